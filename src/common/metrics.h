@@ -10,11 +10,17 @@ typedef enum metric {
     METRIC_BLOCK_COMPILATION = 0,
     METRIC_RSP_STEPS,
     METRIC_AUDIOSTREAM_AVAILABLE,
+    METRIC_AUDIO_LATENCY_US,
+    METRIC_AUDIO_UNDERRUN,
     METRIC_SI_INTERRUPT,
     METRIC_PI_INTERRUPT,
     METRIC_AI_INTERRUPT,
     METRIC_DP_INTERRUPT,
     METRIC_SP_INTERRUPT,
+    METRIC_RSP_HLE_TASK,
+    METRIC_RSP_BLOCK_COMPILATION,
+    METRIC_RSP_UCODE_HIT,
+    METRIC_RSP_UCODE_MISS,
     NUM_METRICS
 } metric_t;
 
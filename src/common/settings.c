@@ -209,6 +209,8 @@ void n64_settings_load_defaults() {
     n64_settings.controller[3].gamepad_enabled = false;
 
     n64_settings.scaling = 0;
+    n64_settings.resampler_quality = RESAMPLER_SINC_BEST;
+    n64_settings.audio_latency_ms = 48;
 }
 
 const char* joybus_to_str(n64_joybus_device_type_t joybus) {
@@ -225,6 +227,23 @@ const char* joybus_to_str(n64_joybus_device_type_t joybus) {
     }
 }
 
+const char* resampler_quality_to_str(n64_resampler_quality_t quality) {
+    switch (quality) {
+        case RESAMPLER_SINC_BEST:    return "SINC_BEST";
+        case RESAMPLER_SINC_MEDIUM:  return "SINC_MEDIUM";
+        case RESAMPLER_SINC_FASTEST: return "SINC_FASTEST";
+        case RESAMPLER_LINEAR:       return "LINEAR";
+    }
+}
+
+n64_resampler_quality_t str_to_resampler_quality(const char* quality) {
+    if (strcmp("SINC_BEST",    quality) == 0) return RESAMPLER_SINC_BEST;
+    if (strcmp("SINC_MEDIUM",  quality) == 0) return RESAMPLER_SINC_MEDIUM;
+    if (strcmp("SINC_FASTEST", quality) == 0) return RESAMPLER_SINC_FASTEST;
+    if (strcmp("LINEAR",       quality) == 0) return RESAMPLER_LINEAR;
+    return RESAMPLER_SINC_BEST;
+}
+
 n64_joybus_device_type_t str_to_joybus(const char* joybus) {
     if (strcmp("NONE",       joybus) == 0) return JOYBUS_NONE;
     if (strcmp("CONTROLLER", joybus) == 0) return JOYBUS_CONTROLLER;
@@ -268,6 +287,14 @@ int n64_settings_write(const char* path) {
     CONFIG_LINE("; Graphics upscaling. Valid values: 0, 2, 4, 8.");
     CONFIG_LINE("upscaling=%d", n64_settings.scaling);
 
+    CONFIG_LINE("[audio]");
+    CONFIG_LINE("; Resampler used to convert game audio to the host's sample rate. Lower quality uses less CPU.");
+    CONFIG_LINE("; Valid values: 'SINC_BEST', 'SINC_MEDIUM', 'SINC_FASTEST', 'LINEAR'");
+    CONFIG_LINE("resampler=%s", resampler_quality_to_str(n64_settings.resampler_quality));
+    CONFIG_LINE("; Target audio latency in milliseconds. Playback speed is nudged by up to 0.5%% to stay close to it.");
+    CONFIG_LINE("; Valid values: %d-%d", AUDIO_LATENCY_MIN_MS, AUDIO_LATENCY_MAX_MS);
+    CONFIG_LINE("latency_ms=%d", n64_settings.audio_latency_ms);
+
     CONFIG_LINE("; Joybus devices/Controller ports. Configure what type of device is plugged in.");
     CONFIG_LINE("; Valid values: 'NONE', 'CONTROLLER', 'DANCEPAD', 'VRU', 'MOUSE', 'KEYBOARD', 'DENSHA'");
     CONFIG_LINE("; WARNING: Not all are implemented yet.");
@@ -430,6 +457,13 @@ int handler(void* user, const char* section, const char* name, const char* value
         if (n64_settings.scaling != 0 && n64_settings.scaling != 2 && n64_settings.scaling != 4 && n64_settings.scaling != 8) {
             n64_settings.scaling = 0;
         }
+    } else if (MATCH("audio", "resampler")) {
+        n64_settings.resampler_quality = str_to_resampler_quality(value);
+    } else if (MATCH("audio", "latency_ms")) {
+        n64_settings.audio_latency_ms = atoi(value);
+        if (n64_settings.audio_latency_ms < AUDIO_LATENCY_MIN_MS || n64_settings.audio_latency_ms > AUDIO_LATENCY_MAX_MS) {
+            n64_settings.audio_latency_ms = 48;
+        }
     }
 
     return 1;
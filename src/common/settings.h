@@ -34,10 +34,23 @@ typedef struct n64_controller_mapping {
     SDL_KeyCode keyboard_z[2];
 } n64_controller_mapping_t;
 
+// The host buffer must hold at least one callback's worth of audio, and has room for twice the maximum.
+#define AUDIO_LATENCY_MIN_MS 24
+#define AUDIO_LATENCY_MAX_MS 80
+
+typedef enum n64_resampler_quality {
+    RESAMPLER_SINC_BEST,
+    RESAMPLER_SINC_MEDIUM,
+    RESAMPLER_SINC_FASTEST,
+    RESAMPLER_LINEAR
+} n64_resampler_quality_t;
+
 typedef struct n64_settings {
     n64_joybus_device_type_t controller_port[4];
     n64_controller_mapping_t controller[4];
     int scaling; // valid values: 0, 2, 4, 8
+    n64_resampler_quality_t resampler_quality;
+    int audio_latency_ms; // Target amount of audio queued for the host
 } n64_settings_t;
 
 extern n64_settings_t n64_settings;
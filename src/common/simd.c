@@ -0,0 +1,59 @@
+#include <string.h>
+#include "simd.h"
+#include "log.h"
+
+simd_level_t simd_level = SIMD_LEVEL_SCALAR;
+// -1 if nothing was requested
+static int requested_level = -1;
+
+static const char* simd_level_names[] = {
+        [SIMD_LEVEL_SCALAR] = "scalar",
+        [SIMD_LEVEL_SSE2]   = "sse2",
+        [SIMD_LEVEL_SSE41]  = "sse4.1",
+        [SIMD_LEVEL_AVX2]   = "avx2",
+};
+
+simd_level_t simd_host_level() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_LEVEL_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1")) {
+        return SIMD_LEVEL_SSE41;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_LEVEL_SSE2;
+    }
+#endif
+    return SIMD_LEVEL_SCALAR;
+}
+
+const char* simd_level_name(simd_level_t level) {
+    return simd_level_names[level];
+}
+
+void simd_request_level(const char* name) {
+    for (int i = SIMD_LEVEL_SCALAR; i <= SIMD_LEVEL_AVX2; i++) {
+        if (strcmp(name, simd_level_names[i]) == 0) {
+            requested_level = i;
+            return;
+        }
+    }
+    logfatal("Unknown SIMD level '%s', expected scalar, sse2, sse4.1 or avx2", name);
+}
+
+void simd_init() {
+    simd_level_t host = simd_host_level();
+    simd_level = host;
+
+    if (requested_level >= 0) {
+        if (requested_level > host) {
+            logwarn("SIMD level %s requested, but this host only supports %s", simd_level_name(requested_level), simd_level_name(host));
+        } else {
+            simd_level = requested_level;
+        }
+    }
+
+    loginfo("Using %s kernels", simd_level_name(simd_level));
+}
@@ -0,0 +1,38 @@
+#ifndef N64_SIMD_H
+#define N64_SIMD_H
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Instruction set tiers the hot kernels are built for. Each tier includes everything below it.
+typedef enum simd_level {
+    SIMD_LEVEL_SCALAR,
+    SIMD_LEVEL_SSE2,
+    SIMD_LEVEL_SSE41,
+    SIMD_LEVEL_AVX2,
+} simd_level_t;
+
+// The tier kernels should use. Only changes in simd_init(), before the kernels are set up.
+extern simd_level_t simd_level;
+
+// Kernels for a higher tier than the build baseline are compiled with these, and only called after checking simd_level.
+// SSE2 is the x86-64 baseline, so its kernels don't need one.
+#define SIMD_TARGET_SSE41 __attribute__((target("ssse3,sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+
+simd_level_t simd_host_level();
+const char* simd_level_name(simd_level_t level);
+// Asks for a specific tier ("scalar", "sse2", "sse4.1" or "avx2") instead of the best one, e.g. for benchmarking.
+// Has to be called before simd_init().
+void simd_request_level(const char* name);
+// Picks the requested tier, or the best one the host supports if none was requested or the host can't run it.
+void simd_init();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //N64_SIMD_H
@@ -162,6 +162,7 @@ COMPILER(mips_cp_c_le_d);
 COMPILER(mips_cp_c_le_s);
 
 dasm_State* block_header();
+dasm_State* rsp_block_header();
 void clear_branch_flag(dasm_State** Dst);
 void advance_pc(dasm_State** Dst);
 void advance_rsp_pc(dasm_State** Dst);
@@ -184,4 +185,10 @@ void flush_rsp_next_pc(dasm_State** Dst, u16 next_pc);
 void fill_valid_host_regs(int* valid_host_regs, int* num_valid_host_regs);
 void load_host_register_from_gpr(dasm_State** Dst, u8 host_reg, int guest_reg);
 void flush_host_register_to_gpr(dasm_State** Dst, int host_reg, int guest_reg);
+void fill_valid_rsp_host_regs(int* valid_host_regs, int* num_valid_host_regs);
+void load_rsp_host_register_from_gpr(dasm_State** Dst, int host_reg, int guest_reg);
+void flush_rsp_host_register_to_gpr(dasm_State** Dst, int host_reg, int guest_reg);
+void fill_valid_rsp_host_vregs(int* valid_host_regs, int* num_valid_host_regs);
+void load_rsp_host_vreg_from_vu_reg(dasm_State** Dst, int host_reg, int guest_reg);
+void flush_rsp_host_vreg_to_vu_reg(dasm_State** Dst, int host_reg, int guest_reg);
 #endif //N64_ASM_EMITTER_H
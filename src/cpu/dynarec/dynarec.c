@@ -219,6 +219,16 @@ void compile_new_block(n64_dynarec_block_t* block, bool* code_mask, u64 virtual_
             case MT_MULTREG:
                 load_reg_1(Dst, &arg_host_registers[0], instr.r.rs);
                 break;
+            case RS_RT_READ:
+            case RS_READ:
+            case RS_READ_LINK:
+            case LINK:
+            case RT_READ:
+            case RT_WRITE:
+            case VECTOR:
+            case VECTOR_LOAD:
+            case VECTOR_STORE:
+                logfatal("RSP instruction format used by a CPU instruction");
         }
         if (ir->exception_possible) {
             set_prev_branch_flag(Dst, prev_instr_category == BRANCH || prev_instr_category == BRANCH_LIKELY);
@@ -34,7 +34,17 @@ typedef enum instruction_format {
     R_TYPE,
     J_TYPE,
     MF_MULTREG,
-    MT_MULTREG
+    MT_MULTREG,
+    // Formats only the RSP uses
+    RS_RT_READ,
+    RS_READ,
+    RS_READ_LINK,
+    LINK,
+    RT_READ,
+    RT_WRITE,
+    VECTOR,
+    VECTOR_LOAD,
+    VECTOR_STORE
 } instruction_format_t;
 
 typedef void(*mipsinstr_compiler_t)(dasm_State**, mips_instruction_t, u32, int*, int, u32*);
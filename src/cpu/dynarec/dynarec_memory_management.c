@@ -16,9 +16,11 @@ void flush_rsp_code_cache() {
     // Just set the pointer back to the beginning, no need to clear the actual data.
     N64RSPDYNAREC->codecache_used = 0;
 
-    // However, the block cache needs to be fully invalidated.
-    for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
-        N64RSPDYNAREC->blockcache[i].run = rsp_missing_block_handler;
+    // However, the block caches of every ucode need to be fully invalidated.
+    for (int u = 0; u < RSP_UCODE_CACHE_SIZE; u++) {
+        for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
+            N64RSPDYNAREC->ucodes[u].blockcache[i].run = rsp_missing_block_handler;
+        }
     }
 }
 
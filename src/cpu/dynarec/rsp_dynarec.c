@@ -1,5 +1,7 @@
 #include <log.h>
+#include <metrics.h>
 #include <rsp.h>
+#include <string.h>
 #include "rsp_dynarec.h"
 #include "asm_emitter.h"
 #include "dynarec_memory_management.h"
@@ -17,14 +19,143 @@ void* rsp_link_and_encode(dasm_State** d) {
 }
 
 #define NEXT(address) ((address + 4) & 0xFFF)
+#define RSP_REG_LR 31
+#define RSP_MAX_HOST_REGS 8
+
+// Guest registers are cached in host registers for the length of a block, and only written back when a block ends,
+// when the register is evicted, or before calling into the interpreter, which reads them from N64RSP.
+typedef struct rsp_register_cache {
+    int valid_host_regs[RSP_MAX_HOST_REGS];
+    int num_valid_host_regs;
+    // Index into valid_host_regs, or -1 when the guest register isn't cached
+    int guest_reg_to_host_reg[32];
+    int host_reg_to_guest_reg[RSP_MAX_HOST_REGS];
+    bool guest_reg_dirty[32];
+    u32 host_reg_last_used[RSP_MAX_HOST_REGS];
+    void (*load)(dasm_State** Dst, int host_reg, int guest_reg);
+    void (*flush)(dasm_State** Dst, int host_reg, int guest_reg);
+} rsp_register_cache_t;
+
+// Scalar registers live in callee-saved GPRs, vector registers in XMM registers.
+static rsp_register_cache_t gprs;
+static rsp_register_cache_t vregs;
+static u32 reg_use_counter;
+
+static void reset_regs(rsp_register_cache_t* cache) {
+    for (int r = 0; r < 32; r++) {
+        cache->guest_reg_to_host_reg[r] = -1;
+        cache->guest_reg_dirty[r] = false;
+    }
+    for (int h = 0; h < cache->num_valid_host_regs; h++) {
+        cache->host_reg_to_guest_reg[h] = -1;
+        cache->host_reg_last_used[h] = 0;
+    }
+}
+
+static void write_back_reg(dasm_State** Dst, rsp_register_cache_t* cache, int guest) {
+    if (cache->guest_reg_dirty[guest]) {
+        cache->flush(Dst, cache->valid_host_regs[cache->guest_reg_to_host_reg[guest]], guest);
+        cache->guest_reg_dirty[guest] = false;
+    }
+}
+
+static void write_back_all(dasm_State** Dst, rsp_register_cache_t* cache) {
+    for (int r = 0; r < 32; r++) {
+        write_back_reg(Dst, cache, r);
+    }
+}
+
+// Only valid for registers that have been written back, or whose value no longer matters
+static void forget_reg(rsp_register_cache_t* cache, int guest) {
+    int host = cache->guest_reg_to_host_reg[guest];
+    if (host >= 0) {
+        cache->host_reg_to_guest_reg[host] = -1;
+        cache->guest_reg_to_host_reg[guest] = -1;
+    }
+}
+
+static void forget_all(rsp_register_cache_t* cache) {
+    for (int r = 0; r < 32; r++) {
+        forget_reg(cache, r);
+    }
+}
+
+static int alloc_reg(dasm_State** Dst, rsp_register_cache_t* cache, int guest, bool load) {
+    int host = cache->guest_reg_to_host_reg[guest];
+    if (host < 0) {
+        // Take a free register, or evict the least recently used one. Registers allocated for the current
+        // instruction are always more recent than anything else, so they're never evicted.
+        host = 0;
+        for (int h = 0; h < cache->num_valid_host_regs; h++) {
+            if (cache->host_reg_to_guest_reg[h] < 0) {
+                host = h;
+                break;
+            }
+            if (cache->host_reg_last_used[h] < cache->host_reg_last_used[host]) {
+                host = h;
+            }
+        }
+
+        int evicted = cache->host_reg_to_guest_reg[host];
+        if (evicted >= 0) {
+            write_back_reg(Dst, cache, evicted);
+            forget_reg(cache, evicted);
+        }
+
+        cache->host_reg_to_guest_reg[host] = guest;
+        cache->guest_reg_to_host_reg[guest] = host;
+        if (load) {
+            cache->load(Dst, cache->valid_host_regs[host], guest);
+        }
+    }
+    cache->host_reg_last_used[host] = ++reg_use_counter;
+    return cache->valid_host_regs[host];
+}
+
+INLINE int read_reg(dasm_State** Dst, int guest) {
+    return alloc_reg(Dst, &gprs, guest, true);
+}
+
+// $zero is never written, compilers skip instructions that target it.
+INLINE int write_reg(dasm_State** Dst, int guest) {
+    if (guest == 0) {
+        return -1;
+    }
+    int host = alloc_reg(Dst, &gprs, guest, false);
+    gprs.guest_reg_dirty[guest] = true;
+    return host;
+}
+
+INLINE int read_vreg(dasm_State** Dst, int guest) {
+    return alloc_reg(Dst, &vregs, guest, true);
+}
+
+INLINE int write_vreg(dasm_State** Dst, int guest) {
+    int host = alloc_reg(Dst, &vregs, guest, false);
+    vregs.guest_reg_dirty[guest] = true;
+    return host;
+}
+
+// For instructions that only replace some of the elements
+INLINE int modify_vreg(dasm_State** Dst, int guest) {
+    int host = alloc_reg(Dst, &vregs, guest, true);
+    vregs.guest_reg_dirty[guest] = true;
+    return host;
+}
 
 void compile_new_rsp_block(rsp_dynarec_block_t* block, u16 address) {
     static dasm_State* d;
     static dasm_State** Dst;
 
-    d = block_header();
+    d = rsp_block_header();
     Dst = &d;
 
+    reset_regs(&gprs);
+    reset_regs(&vregs);
+    reg_use_counter = 0;
+    int arg_host_registers[2] = {0, 0};
+    int dest_host_register = 0;
+
     int block_length = 0;
     int block_extra_cycles = 0;
     bool should_continue_block = true;
@@ -50,7 +181,71 @@ void compile_new_rsp_block(rsp_dynarec_block_t* block, u16 address) {
 
         //advance_rsp_pc(Dst);
 
-        ir->compiler(Dst, instr, address, NULL, 0, &extra_cycles);
+        switch (ir->format) {
+            case CALL_INTERPRETER:
+                write_back_all(Dst, &gprs);
+                // The interpreter works on N64RSP.vu_regs, and the call clobbers every XMM register anyway
+                write_back_all(Dst, &vregs);
+                forget_all(&vregs);
+                break;
+            case FORMAT_NOP:
+                break;
+            case SHIFT_CONST:
+                arg_host_registers[0] = read_reg(Dst, instr.r.rt);
+                dest_host_register = write_reg(Dst, instr.r.rd);
+                break;
+            case I_TYPE:
+                arg_host_registers[0] = read_reg(Dst, instr.i.rs);
+                dest_host_register = write_reg(Dst, instr.i.rt);
+                break;
+            case R_TYPE:
+                arg_host_registers[0] = read_reg(Dst, instr.r.rt);
+                arg_host_registers[1] = read_reg(Dst, instr.r.rs);
+                dest_host_register = write_reg(Dst, instr.r.rd);
+                break;
+            case RS_RT_READ:
+                arg_host_registers[0] = read_reg(Dst, instr.i.rs);
+                arg_host_registers[1] = read_reg(Dst, instr.i.rt);
+                break;
+            case RS_READ:
+                arg_host_registers[0] = read_reg(Dst, instr.i.rs);
+                break;
+            case RS_READ_LINK:
+                arg_host_registers[0] = read_reg(Dst, instr.i.rs);
+                dest_host_register = write_reg(Dst, instr.op == OPC_SPCL ? instr.r.rd : RSP_REG_LR);
+                break;
+            case LINK:
+                dest_host_register = write_reg(Dst, RSP_REG_LR);
+                break;
+            case RT_READ:
+                arg_host_registers[0] = read_reg(Dst, instr.r.rt);
+                break;
+            case RT_WRITE:
+                dest_host_register = write_reg(Dst, instr.r.rt);
+                break;
+            case VECTOR:
+                arg_host_registers[0] = read_vreg(Dst, instr.cp2_vec.vs);
+                arg_host_registers[1] = read_vreg(Dst, instr.cp2_vec.vt);
+                dest_host_register = write_vreg(Dst, instr.cp2_vec.vd);
+                break;
+            case VECTOR_LOAD:
+                arg_host_registers[0] = read_reg(Dst, instr.v.base);
+                arg_host_registers[1] = modify_vreg(Dst, instr.v.vt);
+                break;
+            case VECTOR_STORE:
+                arg_host_registers[0] = read_reg(Dst, instr.v.base);
+                arg_host_registers[1] = read_vreg(Dst, instr.v.vt);
+                break;
+            default:
+                logfatal("Unknown RSP instruction format %d", ir->format);
+        }
+
+        ir->compiler(Dst, instr, address, arg_host_registers, dest_host_register, &extra_cycles);
+
+        if (ir->format == CALL_INTERPRETER) {
+            // The only GPR an interpreted RSP instruction can write is rt (mfc2, cfc2), so drop our copy of it.
+            forget_reg(&gprs, instr.r.rt);
+        }
         block_length++;
         block_extra_cycles += extra_cycles;
 
@@ -98,11 +293,15 @@ void compile_new_rsp_block(rsp_dynarec_block_t* block, u16 address) {
         flush_rsp_next_pc(Dst, NEXT(address) >> 2);
     }
 
+    write_back_all(Dst, &gprs);
+    write_back_all(Dst, &vregs);
     end_rsp_block(Dst, block_length + block_extra_cycles);
     void* compiled = rsp_link_and_encode(Dst);
     dasm_free(Dst);
 
     block->run = compiled;
+    block->length = block_length;
+    mark_metric(METRIC_RSP_BLOCK_COMPILATION);
 }
 
 int rsp_missing_block_handler() {
@@ -118,15 +317,76 @@ rsp_dynarec_t* rsp_dynarec_init(u8* codecache, size_t codecache_size) {
     dynarec->codecache_size = codecache_size;
     dynarec->codecache_used = 0;
 
-    for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
-        dynarec->blockcache[i].run = rsp_missing_block_handler;
+    for (int u = 0; u < RSP_UCODE_CACHE_SIZE; u++) {
+        for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
+            dynarec->ucodes[u].blockcache[i].run = rsp_missing_block_handler;
+        }
     }
+    dynarec->blockcache = dynarec->ucodes[0].blockcache;
+    dynarec->imem_dirty = true;
 
     dynarec->codecache = codecache;
 
+    gprs.num_valid_host_regs = RSP_MAX_HOST_REGS;
+    gprs.load = load_rsp_host_register_from_gpr;
+    gprs.flush = flush_rsp_host_register_to_gpr;
+    fill_valid_rsp_host_regs(gprs.valid_host_regs, &gprs.num_valid_host_regs);
+
+    vregs.num_valid_host_regs = RSP_MAX_HOST_REGS;
+    vregs.load = load_rsp_host_vreg_from_vu_reg;
+    vregs.flush = flush_rsp_host_vreg_to_vu_reg;
+    fill_valid_rsp_host_vregs(vregs.valid_host_regs, &vregs.num_valid_host_regs);
+
     return dynarec;
 }
 
+// FNV-1a, a word at a time. Matches are checked against the whole image, so this only has to be quick.
+static u64 hash_imem(const u8* imem) {
+    u64 hash = 0xCBF29CE484222325;
+    for (int i = 0; i < SP_IMEM_SIZE; i += sizeof(u64)) {
+        u64 word;
+        memcpy(&word, &imem[i], sizeof(u64));
+        hash ^= word;
+        hash *= 0x100000001B3;
+    }
+    return hash ^ (hash >> 32);
+}
+
+void rsp_dynarec_select_ucode() {
+    rsp_dynarec_t* dynarec = N64RSPDYNAREC;
+    dynarec->imem_dirty = false;
+    dynarec->ucode_clock++;
+
+    u64 hash = hash_imem(N64RSP.sp_imem);
+    rsp_dynarec_ucode_t* victim = &dynarec->ucodes[0];
+    for (int i = 0; i < RSP_UCODE_CACHE_SIZE; i++) {
+        rsp_dynarec_ucode_t* ucode = &dynarec->ucodes[i];
+        if (ucode->valid && ucode->hash == hash && memcmp(ucode->imem, N64RSP.sp_imem, SP_IMEM_SIZE) == 0) {
+            ucode->last_used = dynarec->ucode_clock;
+            dynarec->blockcache = ucode->blockcache;
+            mark_metric(METRIC_RSP_UCODE_HIT);
+            return;
+        }
+        if (victim->valid && (!ucode->valid || ucode->last_used < victim->last_used)) {
+            victim = ucode;
+        }
+    }
+
+    // Never seen this image before, or it's been pushed out. Take over the least recently used block cache.
+    victim->valid = true;
+    victim->hash = hash;
+    victim->last_used = dynarec->ucode_clock;
+    memcpy(victim->imem, N64RSP.sp_imem, SP_IMEM_SIZE);
+    for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
+        victim->blockcache[i].run = rsp_missing_block_handler;
+    }
+    dynarec->blockcache = victim->blockcache;
+    mark_metric(METRIC_RSP_UCODE_MISS);
+}
+
 int rsp_dynarec_step() {
+    if (unlikely(N64RSPDYNAREC->imem_dirty)) {
+        rsp_dynarec_select_ucode();
+    }
     return N64RSPDYNAREC->blockcache[N64RSP.pc & 0x3FF].run(&N64RSP);
 }
@@ -12,17 +12,37 @@ typedef struct rsp rsp_t;
 
 typedef struct rsp_dynarec_block {
     int (*run)(rsp_t* cpu);
+    // Instructions in the block, it always runs all of them
+    int length;
 } rsp_dynarec_block_t;
 
+// IMEM images we keep compiled blocks for. Games swap the audio and graphics microcode (and their overlays) in and out
+// of IMEM several times a frame, so going back to an image we've seen before reuses its blocks instead of compiling them again.
+#define RSP_UCODE_CACHE_SIZE 8
+
+typedef struct rsp_dynarec_ucode {
+    bool valid;
+    u64 hash;
+    u64 last_used;
+    u8 imem[SP_IMEM_SIZE];
+    rsp_dynarec_block_t blockcache[RSP_BLOCKCACHE_SIZE];
+} rsp_dynarec_ucode_t;
+
 typedef struct rsp_dynarec {
     u8* codecache;
     u64 codecache_size;
     u64 codecache_used;
 
-    rsp_dynarec_block_t blockcache[RSP_BLOCKCACHE_SIZE];
+    // Blocks compiled from what's in IMEM now, one of the ucodes below
+    rsp_dynarec_block_t* blockcache;
+    // Set when IMEM changes. The block cache to use is picked again before the next block runs.
+    bool imem_dirty;
+    u64 ucode_clock;
+    rsp_dynarec_ucode_t ucodes[RSP_UCODE_CACHE_SIZE];
 } rsp_dynarec_t;
 
 rsp_dynarec_t* rsp_dynarec_init(u8* codecache, size_t codecache_size);
+void rsp_dynarec_select_ucode();
 int rsp_dynarec_step();
 int rsp_missing_block_handler();
 
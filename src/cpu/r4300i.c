@@ -2,6 +2,7 @@
 #include <log.h>
 #include <system/n64system.h>
 #include <mem/n64bus.h>
+#include <system/scheduler.h>
 #include "disassemble.h"
 #include "mips_instructions.h"
 #include "fpu_instructions.h"
@@ -728,14 +729,29 @@ void on_tlb_exception(u64 address) {
     N64CP0.entry_hi.r = (address >> 62) & 0b11;
 }
 
+// $Count is stored shifted left by one, so it advances once per CPU cycle and wraps every 2^33 cycles.
+#define COUNT_WRAP_CYCLES 0x200000000
+
+void r4300i_schedule_compare_interrupt() {
+    u64 cycles = (((u64)N64CP0.compare << 1) - N64CP0.count) & 0x1FFFFFFFF;
+    if (cycles == 0) {
+        cycles = COUNT_WRAP_CYCLES;
+    }
+    scheduler_remove_event(SCHEDULER_COMPARE_INTERRUPT);
+    scheduler_enqueue_relative(cycles, SCHEDULER_COMPARE_INTERRUPT);
+}
+
+void on_compare_interrupt() {
+    N64CPU.cp0.cause.ip7 = true;
+    loginfo("Compare interrupt! count = 0x%09lX compare << 1 = 0x%09lX", N64CP0.count, (u64)N64CP0.compare << 1);
+    r4300i_interrupt_update();
+    // Count will next match compare after wrapping all the way around
+    scheduler_enqueue_relative(COUNT_WRAP_CYCLES, SCHEDULER_COMPARE_INTERRUPT);
+}
+
 void r4300i_step() {
     N64CPU.cp0.count += CYCLES_PER_INSTR;
     N64CPU.cp0.count &= 0x1FFFFFFFF;
-    if (unlikely(N64CPU.cp0.count == (u64)N64CPU.cp0.compare << 1)) {
-        N64CPU.cp0.cause.ip7 = true;
-        loginfo("Compare interrupt! count = 0x%09lX compare << 1 = 0x%09lX", N64CP0.count, (u64)N64CP0.compare << 1);
-        r4300i_interrupt_update();
-    }
 
     /* Commented out for now since the game never actually reads cp0.random
     if (N64CPU.cp0.random <= N64CPU.cp0.wired) {
@@ -610,6 +610,8 @@ void r4300i_step();
 void r4300i_handle_exception(u64 pc, u32 code, int coprocessor_error);
 mipsinstr_handler_t r4300i_instruction_decode(u64 pc, mips_instruction_t instr);
 void r4300i_interrupt_update();
+void r4300i_schedule_compare_interrupt();
+void on_compare_interrupt();
 bool instruction_stable(mips_instruction_t instr);
 
 extern const char* register_names[];
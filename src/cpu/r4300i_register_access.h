@@ -44,6 +44,7 @@ INLINE void set_cp0_register_word(u8 r, u32 value) {
             break;
         case R4300I_CP0_REG_COUNT:
             N64CPU.cp0.count = (u64)value << 1;
+            r4300i_schedule_compare_interrupt();
             break;
         case R4300I_CP0_REG_CAUSE: {
             cp0_cause_t newcause;
@@ -62,6 +63,7 @@ INLINE void set_cp0_register_word(u8 r, u32 value) {
             loginfo("$Compare written with 0x%08X (count is now 0x%08lX)", value, N64CPU.cp0.count);
             N64CPU.cp0.cause.ip7 = false;
             N64CPU.cp0.compare = value;
+            r4300i_schedule_compare_interrupt();
             break;
         case R4300I_CP0_REG_STATUS: {
             N64CPU.cp0.status.raw &= ~CP0_STATUS_WRITE_MASK;
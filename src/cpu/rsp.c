@@ -1,5 +1,6 @@
 #include <metrics.h>
 #include "rsp.h"
+#include "rsp_profiler.h"
 #include "mips_instructions.h"
 #include "rsp_instructions.h"
 #include "rsp_vector_instructions.h"
@@ -20,6 +21,30 @@ void rsp_release_semaphore() {
     N64RSP.semaphore_held = false;
 }
 
+void rsp_dp_reg_write(u32 r, u32 value) {
+    switch (r) {
+        case RSP_CP0_CMD_START:
+            rdp_start_reg_write(value);
+            break;
+        case RSP_CP0_CMD_END:
+            rdp_end_reg_write(value);
+            break;
+        case RSP_CP0_CMD_STATUS:
+            rdp_status_reg_write(value);
+            break;
+        default:
+            logfatal("RSP wrote to DP register $c%d, which isn't forwarded", r);
+    }
+}
+
+void rsp_invalidate_cpu_page(u32 physical_address, u32 unused) {
+    invalidate_dynarec_page(physical_address);
+}
+
+void rsp_sync_softrdp_rdram(u32 address, u32 length) {
+    softrdp_sync_rdram_range(&n64sys.softrdp_state, address, length);
+}
+
 INLINE rspinstr_handler_t rsp_cp0_decode(u32 pc, mips_instruction_t instr) {
     if (instr.last11 == 0) {
         switch (instr.r.rs) {
@@ -47,69 +72,69 @@ INLINE rspinstr_handler_t rsp_cp0_decode(u32 pc, mips_instruction_t instr) {
 INLINE rspinstr_handler_t rsp_cp2_decode(u32 pc, mips_instruction_t instr) {
     if (instr.cp2_vec.is_vec) {
         switch (instr.cp2_vec.funct) {
-            case FUNCT_RSP_VEC_VABS:  return rsp_vec_vabs;
-            case FUNCT_RSP_VEC_VADD:  return rsp_vec_vadd;
-            case FUNCT_RSP_VEC_VADDC: return rsp_vec_vaddc;
-            case FUNCT_RSP_VEC_VAND:  return rsp_vec_vand;
-            case FUNCT_RSP_VEC_VCH:   return rsp_vec_vch;
-            case FUNCT_RSP_VEC_VCL:   return rsp_vec_vcl;
-            case FUNCT_RSP_VEC_VCR:   return rsp_vec_vcr;
-            case FUNCT_RSP_VEC_VEQ:   return rsp_vec_veq;
-            case FUNCT_RSP_VEC_VGE:   return rsp_vec_vge;
-            case FUNCT_RSP_VEC_VLT:   return rsp_vec_vlt;
-            case FUNCT_RSP_VEC_VMACF: return rsp_vec_vmacf;
-            case FUNCT_RSP_VEC_VMACQ: return rsp_vec_vmacq;
-            case FUNCT_RSP_VEC_VMACU: return rsp_vec_vmacu;
-            case FUNCT_RSP_VEC_VMADH: return rsp_vec_vmadh;
-            case FUNCT_RSP_VEC_VMADL: return rsp_vec_vmadl;
-            case FUNCT_RSP_VEC_VMADM: return rsp_vec_vmadm;
-            case FUNCT_RSP_VEC_VMADN: return rsp_vec_vmadn;
-            case FUNCT_RSP_VEC_VMOV:  return rsp_vec_vmov;
-            case FUNCT_RSP_VEC_VMRG:  return rsp_vec_vmrg;
-            case FUNCT_RSP_VEC_VMUDH: return rsp_vec_vmudh;
-            case FUNCT_RSP_VEC_VMUDL: return rsp_vec_vmudl;
-            case FUNCT_RSP_VEC_VMUDM: return rsp_vec_vmudm;
-            case FUNCT_RSP_VEC_VMUDN: return rsp_vec_vmudn;
-            case FUNCT_RSP_VEC_VMULF: return rsp_vec_vmulf;
-            case FUNCT_RSP_VEC_VMULQ: return rsp_vec_vmulq;
-            case FUNCT_RSP_VEC_VMULU: return rsp_vec_vmulu;
-            case FUNCT_RSP_VEC_VNAND: return rsp_vec_vnand;
-            case FUNCT_RSP_VEC_VNE:   return rsp_vec_vne;
-            case FUNCT_RSP_VEC_VNOP:  return rsp_vec_vnop;
-            case FUNCT_RSP_VEC_VNOR:  return rsp_vec_vnor;
-            case FUNCT_RSP_VEC_VNXOR: return rsp_vec_vnxor;
-            case FUNCT_RSP_VEC_VOR :  return rsp_vec_vor;
-            case FUNCT_RSP_VEC_VRCP:  return rsp_vec_vrcp;
-            case FUNCT_RSP_VEC_VRCPH: return rsp_vec_vrcph_vrsqh;
-            case FUNCT_RSP_VEC_VRCPL: return rsp_vec_vrcpl;
-            case FUNCT_RSP_VEC_VRNDN: return rsp_vec_vrndn;
-            case FUNCT_RSP_VEC_VRNDP: return rsp_vec_vrndp;
-            case FUNCT_RSP_VEC_VRSQ:  return rsp_vec_vrsq;
-            case FUNCT_RSP_VEC_VRSQH: return rsp_vec_vrcph_vrsqh;
-            case FUNCT_RSP_VEC_VRSQL: return rsp_vec_vrsql;
-            case FUNCT_RSP_VEC_VSAR:  return rsp_vec_vsar;
-            case FUNCT_RSP_VEC_VSUB:  return rsp_vec_vsub;
-            case FUNCT_RSP_VEC_VSUBC: return rsp_vec_vsubc;
-            case FUNCT_RSP_VEC_VXOR:  return rsp_vec_vxor;
-            case FUNCT_RSP_VEC_VSUT:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VADDB: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VSUBB: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VACCB: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VSUCB: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VSAD:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VSAC:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VSUM:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_0x1E:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_0x1F:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_0x2E:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_0x2F:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VEXTT: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VEXTQ: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VEXTN: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_0x3B:  return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VINST: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VINSQ: return rsp_vec_vzero; // undocumented
-            case FUNCT_RSP_VEC_VINSN: return rsp_vec_vzero; // undocumented
+            case FUNCT_RSP_VEC_VABS:  return RSP_VECTOR_HANDLER(rsp_vec_vabs);
+            case FUNCT_RSP_VEC_VADD:  return RSP_VECTOR_HANDLER(rsp_vec_vadd);
+            case FUNCT_RSP_VEC_VADDC: return RSP_VECTOR_HANDLER(rsp_vec_vaddc);
+            case FUNCT_RSP_VEC_VAND:  return RSP_VECTOR_HANDLER(rsp_vec_vand);
+            case FUNCT_RSP_VEC_VCH:   return RSP_VECTOR_HANDLER(rsp_vec_vch);
+            case FUNCT_RSP_VEC_VCL:   return RSP_VECTOR_HANDLER(rsp_vec_vcl);
+            case FUNCT_RSP_VEC_VCR:   return RSP_VECTOR_HANDLER(rsp_vec_vcr);
+            case FUNCT_RSP_VEC_VEQ:   return RSP_VECTOR_HANDLER(rsp_vec_veq);
+            case FUNCT_RSP_VEC_VGE:   return RSP_VECTOR_HANDLER(rsp_vec_vge);
+            case FUNCT_RSP_VEC_VLT:   return RSP_VECTOR_HANDLER(rsp_vec_vlt);
+            case FUNCT_RSP_VEC_VMACF: return RSP_VECTOR_HANDLER(rsp_vec_vmacf);
+            case FUNCT_RSP_VEC_VMACQ: return RSP_VECTOR_HANDLER(rsp_vec_vmacq);
+            case FUNCT_RSP_VEC_VMACU: return RSP_VECTOR_HANDLER(rsp_vec_vmacu);
+            case FUNCT_RSP_VEC_VMADH: return RSP_VECTOR_HANDLER(rsp_vec_vmadh);
+            case FUNCT_RSP_VEC_VMADL: return RSP_VECTOR_HANDLER(rsp_vec_vmadl);
+            case FUNCT_RSP_VEC_VMADM: return RSP_VECTOR_HANDLER(rsp_vec_vmadm);
+            case FUNCT_RSP_VEC_VMADN: return RSP_VECTOR_HANDLER(rsp_vec_vmadn);
+            case FUNCT_RSP_VEC_VMOV:  return RSP_VECTOR_HANDLER(rsp_vec_vmov);
+            case FUNCT_RSP_VEC_VMRG:  return RSP_VECTOR_HANDLER(rsp_vec_vmrg);
+            case FUNCT_RSP_VEC_VMUDH: return RSP_VECTOR_HANDLER(rsp_vec_vmudh);
+            case FUNCT_RSP_VEC_VMUDL: return RSP_VECTOR_HANDLER(rsp_vec_vmudl);
+            case FUNCT_RSP_VEC_VMUDM: return RSP_VECTOR_HANDLER(rsp_vec_vmudm);
+            case FUNCT_RSP_VEC_VMUDN: return RSP_VECTOR_HANDLER(rsp_vec_vmudn);
+            case FUNCT_RSP_VEC_VMULF: return RSP_VECTOR_HANDLER(rsp_vec_vmulf);
+            case FUNCT_RSP_VEC_VMULQ: return RSP_VECTOR_HANDLER(rsp_vec_vmulq);
+            case FUNCT_RSP_VEC_VMULU: return RSP_VECTOR_HANDLER(rsp_vec_vmulu);
+            case FUNCT_RSP_VEC_VNAND: return RSP_VECTOR_HANDLER(rsp_vec_vnand);
+            case FUNCT_RSP_VEC_VNE:   return RSP_VECTOR_HANDLER(rsp_vec_vne);
+            case FUNCT_RSP_VEC_VNOP:  return RSP_VECTOR_HANDLER(rsp_vec_vnop);
+            case FUNCT_RSP_VEC_VNOR:  return RSP_VECTOR_HANDLER(rsp_vec_vnor);
+            case FUNCT_RSP_VEC_VNXOR: return RSP_VECTOR_HANDLER(rsp_vec_vnxor);
+            case FUNCT_RSP_VEC_VOR :  return RSP_VECTOR_HANDLER(rsp_vec_vor);
+            case FUNCT_RSP_VEC_VRCP:  return RSP_VECTOR_HANDLER(rsp_vec_vrcp);
+            case FUNCT_RSP_VEC_VRCPH: return RSP_VECTOR_HANDLER(rsp_vec_vrcph_vrsqh);
+            case FUNCT_RSP_VEC_VRCPL: return RSP_VECTOR_HANDLER(rsp_vec_vrcpl);
+            case FUNCT_RSP_VEC_VRNDN: return RSP_VECTOR_HANDLER(rsp_vec_vrndn);
+            case FUNCT_RSP_VEC_VRNDP: return RSP_VECTOR_HANDLER(rsp_vec_vrndp);
+            case FUNCT_RSP_VEC_VRSQ:  return RSP_VECTOR_HANDLER(rsp_vec_vrsq);
+            case FUNCT_RSP_VEC_VRSQH: return RSP_VECTOR_HANDLER(rsp_vec_vrcph_vrsqh);
+            case FUNCT_RSP_VEC_VRSQL: return RSP_VECTOR_HANDLER(rsp_vec_vrsql);
+            case FUNCT_RSP_VEC_VSAR:  return RSP_VECTOR_HANDLER(rsp_vec_vsar);
+            case FUNCT_RSP_VEC_VSUB:  return RSP_VECTOR_HANDLER(rsp_vec_vsub);
+            case FUNCT_RSP_VEC_VSUBC: return RSP_VECTOR_HANDLER(rsp_vec_vsubc);
+            case FUNCT_RSP_VEC_VXOR:  return RSP_VECTOR_HANDLER(rsp_vec_vxor);
+            case FUNCT_RSP_VEC_VSUT:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VADDB: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VSUBB: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VACCB: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VSUCB: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VSAD:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VSAC:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VSUM:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_0x1E:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_0x1F:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_0x2E:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_0x2F:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VEXTT: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VEXTQ: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VEXTN: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_0x3B:  return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VINST: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VINSQ: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
+            case FUNCT_RSP_VEC_VINSN: return RSP_VECTOR_HANDLER(rsp_vec_vzero); // undocumented
             case FUNCT_RSP_VEC_VNULL: return rsp_nop; // undocumented
             default: {
                 char buf[50];
@@ -119,10 +144,10 @@ INLINE rspinstr_handler_t rsp_cp2_decode(u32 pc, mips_instruction_t instr) {
         }
     } else {
         switch (instr.cp2_regmove.funct) {
-            case COP_CF: return rsp_cfc2;
-            case COP_CT: return rsp_ctc2;
-            case COP_MF: return rsp_mfc2;
-            case COP_MT: return rsp_mtc2;
+            case COP_CF: return RSP_VECTOR_HANDLER(rsp_cfc2);
+            case COP_CT: return RSP_VECTOR_HANDLER(rsp_ctc2);
+            case COP_MF: return RSP_VECTOR_HANDLER(rsp_mfc2);
+            case COP_MT: return RSP_VECTOR_HANDLER(rsp_mtc2);
             default: {
                 char buf[50];
                 disassemble(pc, instr.raw, buf, 50);
@@ -184,17 +209,17 @@ INLINE rspinstr_handler_t rsp_regimm_decode(u32 pc, mips_instruction_t instr) {
 
 INLINE rspinstr_handler_t rsp_lwc2_decode(u32 pc, mips_instruction_t instr) {
     switch (instr.v.funct) {
-        case LWC2_LBV: return rsp_lwc2_lbv;
-        case LWC2_LDV: return rsp_lwc2_ldv;
-        case LWC2_LFV: return rsp_lwc2_lfv;
-        case LWC2_LHV: return rsp_lwc2_lhv;
-        case LWC2_LLV: return rsp_lwc2_llv;
-        case LWC2_LPV: return rsp_lwc2_lpv;
-        case LWC2_LQV: return rsp_lwc2_lqv;
-        case LWC2_LRV: return rsp_lwc2_lrv;
-        case LWC2_LSV: return rsp_lwc2_lsv;
-        case LWC2_LTV: return rsp_lwc2_ltv;
-        case LWC2_LUV: return rsp_lwc2_luv;
+        case LWC2_LBV: return RSP_VECTOR_HANDLER(rsp_lwc2_lbv);
+        case LWC2_LDV: return RSP_VECTOR_HANDLER(rsp_lwc2_ldv);
+        case LWC2_LFV: return RSP_VECTOR_HANDLER(rsp_lwc2_lfv);
+        case LWC2_LHV: return RSP_VECTOR_HANDLER(rsp_lwc2_lhv);
+        case LWC2_LLV: return RSP_VECTOR_HANDLER(rsp_lwc2_llv);
+        case LWC2_LPV: return RSP_VECTOR_HANDLER(rsp_lwc2_lpv);
+        case LWC2_LQV: return RSP_VECTOR_HANDLER(rsp_lwc2_lqv);
+        case LWC2_LRV: return RSP_VECTOR_HANDLER(rsp_lwc2_lrv);
+        case LWC2_LSV: return RSP_VECTOR_HANDLER(rsp_lwc2_lsv);
+        case LWC2_LTV: return RSP_VECTOR_HANDLER(rsp_lwc2_ltv);
+        case LWC2_LUV: return RSP_VECTOR_HANDLER(rsp_lwc2_luv);
         case SWC2_SWV: return rsp_nop; // Does not exist on the RSP
         default:
             logfatal("other/unknown MIPS RSP LWC2 with funct: 0x%02X", instr.v.funct);
@@ -203,18 +228,18 @@ INLINE rspinstr_handler_t rsp_lwc2_decode(u32 pc, mips_instruction_t instr) {
 
 INLINE rspinstr_handler_t rsp_swc2_decode(u32 pc, mips_instruction_t instr) {
     switch (instr.v.funct) {
-        case LWC2_LBV: return rsp_swc2_sbv;
-        case LWC2_LDV: return rsp_swc2_sdv;
-        case LWC2_LFV: return rsp_swc2_sfv;
-        case LWC2_LHV: return rsp_swc2_shv;
-        case LWC2_LLV: return rsp_swc2_slv;
-        case LWC2_LPV: return rsp_swc2_spv;
-        case LWC2_LQV: return rsp_swc2_sqv;
-        case LWC2_LRV: return rsp_swc2_srv;
-        case LWC2_LSV: return rsp_swc2_ssv;
-        case LWC2_LTV: return rsp_swc2_stv;
-        case LWC2_LUV: return rsp_swc2_suv;
-        case SWC2_SWV: return rsp_swc2_swv;
+        case LWC2_LBV: return RSP_VECTOR_HANDLER(rsp_swc2_sbv);
+        case LWC2_LDV: return RSP_VECTOR_HANDLER(rsp_swc2_sdv);
+        case LWC2_LFV: return RSP_VECTOR_HANDLER(rsp_swc2_sfv);
+        case LWC2_LHV: return RSP_VECTOR_HANDLER(rsp_swc2_shv);
+        case LWC2_LLV: return RSP_VECTOR_HANDLER(rsp_swc2_slv);
+        case LWC2_LPV: return RSP_VECTOR_HANDLER(rsp_swc2_spv);
+        case LWC2_LQV: return RSP_VECTOR_HANDLER(rsp_swc2_sqv);
+        case LWC2_LRV: return RSP_VECTOR_HANDLER(rsp_swc2_srv);
+        case LWC2_LSV: return RSP_VECTOR_HANDLER(rsp_swc2_ssv);
+        case LWC2_LTV: return RSP_VECTOR_HANDLER(rsp_swc2_stv);
+        case LWC2_LUV: return RSP_VECTOR_HANDLER(rsp_swc2_suv);
+        case SWC2_SWV: return RSP_VECTOR_HANDLER(rsp_swc2_swv);
 
         default:
             logfatal("other/unknown MIPS RSP SWC2 with funct: 0x%02X", instr.v.funct);
@@ -347,6 +372,7 @@ void rsp_run() {
     while (N64RSP.steps > 0) {
         N64RSP.steps--;
         run_for++;
+        rsp_profile(N64RSP.pc, 1);
         _rsp_step();
     }
     mark_metric_multiple(METRIC_RSP_STEPS, run_for);
@@ -356,7 +382,9 @@ void rsp_dynarec_run() {
     int run_for = 0;
     // This is set to 0 by the break instruction, and when halted by a write to SP_STATUS_REG
     while (N64RSP.steps > 0) {
+        u16 pc = N64RSP.pc;
         int taken = rsp_dynarec_step();
+        rsp_profile_block(pc, N64RSPDYNAREC->blockcache[pc & 0x3FF].length, taken);
         N64RSP.steps -= taken;
         run_for += taken;
     }
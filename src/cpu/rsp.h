@@ -11,8 +11,16 @@
 #include <cpu/dynarec/dynarec.h>
 #include <mem/mem_util.h>
 
+#include <system/rsp_thread.h>
+#include <cpu/rsp_hle.h>
+
 #include "rsp_types.h"
 #include "rsp_interface.h"
+#include "rsp_profiler.h"
+
+#if defined(N64_USE_SIMD) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 #define RSP_CP0_DMA_CACHE        0
 #define RSP_CP0_DMA_DRAM         1
@@ -130,13 +138,31 @@ INLINE void quick_invalidate_rsp_icache(u32 address) {
 
     N64RSP.icache[index].handler = cache_rsp_instruction;
     N64RSP.icache[index].instruction.raw = word_from_byte_array(N64RSP.sp_imem, address);
-    N64RSPDYNAREC->blockcache[index].run = rsp_missing_block_handler;
+    N64RSPDYNAREC->imem_dirty = true;
+    rsp_profiler_imem_dirty = true;
 }
 
 INLINE void invalidate_rsp_icache(u32 address) {
     quick_invalidate_rsp_icache(address & 0xFFC);
 }
 
+// The RDP and the CPU's code cache belong to the CPU thread, these get there through rsp_thread_call()
+void rsp_dp_reg_write(u32 r, u32 value);
+void rsp_invalidate_cpu_page(u32 physical_address, u32 unused);
+void rsp_sync_softrdp_rdram(u32 address, u32 length);
+
+// Called before a DMA touches RDRAM, in case the software RDP hasn't finished drawing there. A threaded RSP waits for
+// the CPU thread to check, unless the software RDP isn't in use and there's nothing to wait for.
+INLINE void rsp_sync_rdp_rdram(u32 address, u32 length) {
+    if (unlikely(rsp_thread_is_current)) {
+        if (n64sys.video_type == SOFTWARE_VIDEO_TYPE) {
+            rsp_thread_call(rsp_sync_softrdp_rdram, address, length);
+        }
+    } else {
+        softrdp_sync_rdram_range(&n64sys.softrdp_state, address, length);
+    }
+}
+
 INLINE void rsp_dma_read() {
     u32 length = N64RSP.io.dma.length + 1;
 
@@ -153,6 +179,7 @@ INLINE void rsp_dma_read() {
     if (mem_address != mem_addr_reg.address) {
         logwarn("Misaligned MEM RSP DMA READ! (from 0x%08X, aligned to 0x%08X)", mem_addr_reg.address, mem_address);
     }
+    rsp_sync_rdp_rdram(dram_address, (N64RSP.io.dma.count + 1) * (length + N64RSP.io.dma.skip));
 
     for (int i = 0; i < N64RSP.io.dma.count + 1; i++) {
         u8* mem = (mem_addr_reg.imem ? N64RSP.sp_imem : N64RSP.sp_dmem);
@@ -202,6 +229,7 @@ INLINE void rsp_dma_write() {
     if (mem_address != mem_addr.address) {
         logwarn("Misaligned MEM RSP DMA WRITE! 0x%08X", mem_addr.address);
     }
+    rsp_sync_rdp_rdram(dram_address, (N64RSP.io.dma.count + 1) * (length + N64RSP.io.dma.skip));
 
     for (int i = 0; i < N64RSP.io.dma.count + 1; i++) {
         u8* mem = (mem_addr.imem ? N64RSP.sp_imem : N64RSP.sp_dmem);
@@ -210,12 +238,17 @@ INLINE void rsp_dma_write() {
             u16 addr = (mem_address + j) & 0xFFF;
             rdram[j] = mem[addr];
         }
+        if (unlikely(rsp_hle_verifying)) {
+            rsp_hle_rsp_written(dram_address, length);
+        }
 
 
         // Invalidate all pages touched by the DMA
         // This is probably unnecessary, since why would someone be copying code from the RSP to the CPU and then executing it?
         for (int j = 0; j < length; j += BLOCKCACHE_PAGE_SIZE) {
-            invalidate_dynarec_page(dram_address + j);
+            if (unlikely(is_code(dram_address + j))) {
+                rsp_thread_call(rsp_invalidate_cpu_page, dram_address + j, 0);
+            }
         }
 
         int skip = i == N64RSP.io.dma.count ? 0 : N64RSP.io.dma.skip;
@@ -307,15 +340,13 @@ INLINE void set_rsp_cp0_register(u8 r, u32 value) {
             break;
         }
         case RSP_CP0_CMD_START:
-            rdp_start_reg_write(value);
-            break;
         case RSP_CP0_CMD_END:
-            rdp_end_reg_write(value);
+            rsp_thread_call(rsp_dp_reg_write, r, value);
             break;
         case RSP_CP0_CMD_CURRENT:
             logfatal("Write to unknown RSP CP0 register $c%d: RSP_CP0_CMD_CURRENT", r);
         case RSP_CP0_CMD_STATUS:
-            rdp_status_reg_write(value);
+            rsp_thread_call(rsp_dp_reg_write, r, value);
             break;
         case RSP_CP0_CMD_CLOCK:
             logfatal("Write to unknown RSP CP0 register $c%d: RSP_CP0_CMD_CLOCK", r);
@@ -346,6 +377,49 @@ INLINE void set_rsp_accumulator(int e, u64 val) {
     N64RSP.acc.l.elements[e] = val & 0xFFFF;
 }
 
+// pshufb needs SSSE3, which the scalar vector unit is built without
+#if defined(N64_USE_SIMD) && defined(__SSSE3__)
+// Flags live in the vector unit as one all-ones or all-zeroes lane per element, so they can be used directly as blend
+// masks. Only cfc2/ctc2 (and debugging) need them as bits, where element i maps to bit i and lanes are stored reversed.
+INLINE u16 rsp_flag_lanes_to_bits(vecr l, vecr h) {
+    const vecr reverse_halves = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    return _mm_movemask_epi8(_mm_shuffle_epi8(_mm_packs_epi16(l, h), reverse_halves));
+}
+
+INLINE void rsp_flag_bits_to_lanes(u16 value, vecr* l, vecr* h) {
+    const vecr l_bits = _mm_setr_epi16(1 << 7, 1 << 6, 1 << 5, 1 << 4, 1 << 3, 1 << 2, 1 << 1, 1 << 0);
+    const vecr h_bits = _mm_slli_epi16(l_bits, 8);
+    vecr broadcast = _mm_set1_epi16(value);
+    *l = _mm_cmpeq_epi16(_mm_and_si128(broadcast, l_bits), l_bits);
+    if (h) {
+        *h = _mm_cmpeq_epi16(_mm_and_si128(broadcast, h_bits), h_bits);
+    }
+}
+
+INLINE u16 rsp_get_vco() {
+    return rsp_flag_lanes_to_bits(N64RSP.vco.l.single, N64RSP.vco.h.single);
+}
+
+INLINE u16 rsp_get_vcc() {
+    return rsp_flag_lanes_to_bits(N64RSP.vcc.l.single, N64RSP.vcc.h.single);
+}
+
+INLINE u8 rsp_get_vce() {
+    return rsp_flag_lanes_to_bits(N64RSP.vce.single, N64RSP.zero);
+}
+
+INLINE void rsp_set_vcc(u16 vcc) {
+    rsp_flag_bits_to_lanes(vcc, &N64RSP.vcc.l.single, &N64RSP.vcc.h.single);
+}
+
+INLINE void rsp_set_vco(u16 vco) {
+    rsp_flag_bits_to_lanes(vco, &N64RSP.vco.l.single, &N64RSP.vco.h.single);
+}
+
+INLINE void rsp_set_vce(u16 vce) {
+    rsp_flag_bits_to_lanes(vce, &N64RSP.vce.single, NULL);
+}
+#else
 INLINE u16 rsp_get_vco() {
     u16 value = 0;
     for (int i = 0; i < 8; i++) {
@@ -407,6 +481,7 @@ INLINE void rsp_set_vce(u16 vce) {
         vce >>= 1;
     }
 }
+#endif
 
 void rsp_step();
 void rsp_run();
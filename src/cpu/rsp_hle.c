@@ -0,0 +1,304 @@
+#include "rsp_hle.h"
+#include "rsp_hle_audio.h"
+#include "rsp_hle_gfx.h"
+#include "rsp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <metrics.h>
+
+// Microcode we've seen before, keyed by a CRC of its data segment
+#define UCODE_CACHE_SIZE 8
+// Native RDRAM writes remembered per task while verifying, to name the command behind a mismatch
+#define MAX_VERIFY_WRITES 1024
+// Tasks between verification summaries
+#define VERIFY_REPORT_INTERVAL 256
+// RDRAM is compared this much at a time, and only looked at byte by byte where it differs
+#define VERIFY_CHUNK_SIZE 4096
+
+typedef struct hle_ucode {
+    u32 data_address;
+    u32 data_crc;
+    bool audio;
+    rsp_hle_audio_ucode_t audio_ucode;
+    bool gfx;
+    rsp_hle_gfx_ucode_t gfx_ucode;
+} hle_ucode_t;
+
+typedef struct hle_write {
+    u32 address;
+    u32 length;
+    const char* command;
+} hle_write_t;
+
+u8* rsp_hle_rdram = NULL;
+bool rsp_hle_verifying = false;
+const char* rsp_hle_command = NULL;
+
+static hle_ucode_t ucode_cache[UCODE_CACHE_SIZE];
+static int ucode_cache_entries = 0;
+static int ucode_cache_next = 0;
+
+static u8* verify_rdram = NULL;
+// One bit per byte of RDRAM, set for everything either the native task or the RSP wrote
+static u8* verify_written = NULL;
+static hle_write_t verify_writes[MAX_VERIFY_WRITES];
+static int num_verify_writes = 0;
+static u64 verified_tasks = 0;
+static u64 mismatched_tasks = 0;
+
+static const char* rsp_hle_mode_names[] = {
+        [RSP_HLE_OFF]    = "off",
+        [RSP_HLE_ON]     = "on",
+        [RSP_HLE_VERIFY] = "verify",
+};
+
+rsp_hle_mode_t rsp_hle_mode_from_name(const char* name) {
+    for (int i = RSP_HLE_OFF; i <= RSP_HLE_VERIFY; i++) {
+        if (strcmp(name, rsp_hle_mode_names[i]) == 0) {
+            return i;
+        }
+    }
+    logfatal("Unknown HLE mode '%s', expected off, on or verify", name);
+}
+
+static void read_task(rsp_hle_task_t* task) {
+    u32* fields = (u32*)task;
+    for (int i = 0; i < sizeof(rsp_hle_task_t) / sizeof(u32); i++) {
+        fields[i] = word_from_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + i * 4);
+    }
+}
+
+static hle_ucode_t* identify_ucode(const rsp_hle_task_t* task) {
+    u32 data = hle_dram_address(task->ucode_data);
+    u32 size = task->ucode_data_size > SP_DMEM_SIZE ? SP_DMEM_SIZE : task->ucode_data_size;
+    if (data + size > N64_RDRAM_SIZE) {
+        size = N64_RDRAM_SIZE - data;
+    }
+    u32 crc = crc32(0, &n64sys.mem.rdram[data], size);
+
+    for (int i = 0; i < ucode_cache_entries; i++) {
+        if (ucode_cache[i].data_address == data && ucode_cache[i].data_crc == crc) {
+            return &ucode_cache[i];
+        }
+    }
+
+    hle_ucode_t* ucode = &ucode_cache[ucode_cache_next];
+    ucode_cache_next = (ucode_cache_next + 1) % UCODE_CACHE_SIZE;
+    if (ucode_cache_entries < UCODE_CACHE_SIZE) {
+        ucode_cache_entries++;
+    }
+
+    ucode->data_address = data;
+    ucode->data_crc = crc;
+    ucode->audio = task->type == OSTASK_TYPE_AUDIO && rsp_hle_audio_identify(task, &ucode->audio_ucode);
+    if (task->type == OSTASK_TYPE_AUDIO) {
+        if (ucode->audio) {
+            loginfo("Running audio microcode (data CRC %08X) natively", crc);
+        } else {
+            loginfo("Unknown audio microcode (data CRC %08X), leaving it to the RSP", crc);
+        }
+    }
+    ucode->gfx = task->type == OSTASK_TYPE_GFX && rsp_hle_gfx_identify(task, &ucode->gfx_ucode);
+    if (task->type == OSTASK_TYPE_GFX && !ucode->gfx) {
+        loginfo("Unknown graphics microcode (data CRC %08X), leaving it to the RSP", crc);
+    }
+    return ucode;
+}
+
+// What the boot microcode does once a task is done
+static void finish_task() {
+    N64RSP.status.halt = true;
+    N64RSP.steps = 0;
+    N64RSP.status.broke = true;
+    // SP_STATUS_TASKDONE
+    N64RSP.status.signal_2 = true;
+    mark_metric(METRIC_RSP_HLE_TASK);
+
+    if (N64RSP.status.intr_on_break) {
+        interrupt_raise(INTERRUPT_SP);
+    }
+}
+
+void rsp_hle_start_task() {
+    rsp_hle_task_t task;
+    read_task(&task);
+
+    bool audio = task.type == OSTASK_TYPE_AUDIO && n64sys.rsp_hle_audio != RSP_HLE_OFF;
+    bool gfx = task.type == OSTASK_TYPE_GFX && n64sys.rsp_hle_gfx;
+    if (!audio && !gfx) {
+        return;
+    }
+    // Anything not started by the usual boot microcode isn't a task at all
+    if (task.ucode_boot_size > SP_IMEM_SIZE) {
+        return;
+    }
+    // Tasks we run never yield, so anything resuming was started on the RSP and has to finish there
+    if (task.flags & OSTASK_FLAG_YIELDED) {
+        return;
+    }
+
+    rsp_hle_rdram = n64sys.mem.rdram;
+    hle_ucode_t* ucode = identify_ucode(&task);
+    if (gfx) {
+        if (!ucode->gfx) {
+            return;
+        }
+        // A microcode that gets switched mid-task once will be again, so it stays on the RSP from then on
+        if (!rsp_hle_gfx_supported(&task, &ucode->gfx_ucode)) {
+            loginfo("Graphics microcode (data CRC %08X) switches microcode mid-task, leaving it to the RSP", ucode->data_crc);
+            ucode->gfx = false;
+            return;
+        }
+        if (!rsp_hle_gfx_run(&task, &ucode->gfx_ucode)) {
+            logwarn("Graphics microcode (data CRC %08X) switched microcode mid-task, the rest of the frame was dropped. "
+                    "Leaving it to the RSP from now on.", ucode->data_crc);
+            ucode->gfx = false;
+        }
+        finish_task();
+        return;
+    }
+    if (!ucode->audio || !rsp_hle_audio_supported(&task)) {
+        return;
+    }
+
+    if (n64sys.rsp_hle_audio == RSP_HLE_VERIFY) {
+        // Run the task against a copy of RDRAM, then let the RSP run it for real and compare when it breaks
+        if (verify_rdram == NULL) {
+            verify_rdram = malloc(N64_RDRAM_SIZE);
+            if (verify_rdram == NULL) {
+                logfatal("Failed to allocate memory to verify HLE tasks against");
+            }
+            verify_written = malloc(N64_RDRAM_SIZE / 8);
+            if (verify_written == NULL) {
+                logfatal("Failed to allocate memory to verify HLE tasks against");
+            }
+        }
+        memcpy(verify_rdram, n64sys.mem.rdram, N64_RDRAM_SIZE);
+        memset(verify_written, 0, N64_RDRAM_SIZE / 8);
+        num_verify_writes = 0;
+
+        rsp_hle_rdram = verify_rdram;
+        rsp_hle_audio_run(&task, &ucode->audio_ucode);
+        rsp_hle_rdram = n64sys.mem.rdram;
+        rsp_hle_verifying = true;
+        return;
+    }
+
+    rsp_hle_audio_run(&task, &ucode->audio_ucode);
+    finish_task();
+}
+
+static void mark_verify_written(u32 address, u32 length) {
+    // Whole words, since bytes are swapped around within them
+    u32 end = address + length;
+    for (address &= ~3; address < end; address += 4) {
+        verify_written[hle_dram_address(address) >> 3] |= 0xF << (address & 4);
+    }
+}
+
+static bool verify_was_written(u32 index) {
+    return (verify_written[index >> 3] >> (index & 7)) & 1;
+}
+
+void rsp_hle_dram_written(u32 address, u32 length) {
+    address = hle_dram_address(address);
+    if (rsp_hle_rdram != n64sys.mem.rdram) {
+        mark_verify_written(address, length);
+        if (num_verify_writes < MAX_VERIFY_WRITES) {
+            verify_writes[num_verify_writes].address = address;
+            verify_writes[num_verify_writes].length = length;
+            verify_writes[num_verify_writes].command = rsp_hle_command;
+            num_verify_writes++;
+        }
+        return;
+    }
+
+    // Same as an RSP DMA, see rsp_dma_write()
+    for (u32 offset = 0; offset < length; offset += BLOCKCACHE_PAGE_SIZE) {
+        if (unlikely(is_code(address + offset))) {
+            rsp_invalidate_cpu_page(address + offset, 0);
+        }
+    }
+}
+
+void rsp_hle_rsp_written(u32 address, u32 length) {
+    mark_verify_written(hle_dram_address(address), length);
+}
+
+// The last native write that covered a byte, for naming the command that got it wrong
+static const hle_write_t* find_verify_write(u32 address) {
+    for (int i = num_verify_writes - 1; i >= 0; i--) {
+        const hle_write_t* write = &verify_writes[i];
+        if (hle_dram_address(address - write->address) < write->length) {
+            return write;
+        }
+    }
+    return NULL;
+}
+
+void hle_dram_load(u8* buffer, u16 buffer_address, u32 dram_address, u32 length) {
+    buffer_address &= 0xFFF;
+    dram_address = hle_dram_address(dram_address);
+    if (((buffer_address | dram_address) & 3) == 0 && buffer_address + length <= SP_DMEM_SIZE && dram_address + length <= N64_RDRAM_SIZE) {
+        memcpy(&buffer[buffer_address], &rsp_hle_rdram[dram_address], length);
+    } else {
+        for (u32 i = 0; i < length; i++) {
+            buffer[BYTE_ADDRESS((buffer_address + i) & 0xFFF)] = hle_dram_read_u8(dram_address + i);
+        }
+    }
+}
+
+void hle_dram_save(u32 dram_address, const u8* buffer, u16 buffer_address, u32 length) {
+    buffer_address &= 0xFFF;
+    dram_address = hle_dram_address(dram_address);
+    if (((buffer_address | dram_address) & 3) == 0 && buffer_address + length <= SP_DMEM_SIZE && dram_address + length <= N64_RDRAM_SIZE) {
+        memcpy(&rsp_hle_rdram[dram_address], &buffer[buffer_address], length);
+    } else {
+        for (u32 i = 0; i < length; i++) {
+            rsp_hle_rdram[BYTE_ADDRESS(hle_dram_address(dram_address + i))] = buffer[BYTE_ADDRESS((buffer_address + i) & 0xFFF)];
+        }
+    }
+    rsp_hle_dram_written(dram_address, length);
+}
+
+void rsp_hle_verify_task() {
+    rsp_hle_verifying = false;
+
+    // Compare all of RDRAM. Bytes neither side wrote can still differ, since the CPU kept running while the RSP did
+    // the task, so only the ones the native task or the RSP wrote count.
+    int mismatches = 0;
+    for (u32 chunk = 0; chunk < N64_RDRAM_SIZE; chunk += VERIFY_CHUNK_SIZE) {
+        if (memcmp(&verify_rdram[chunk], &n64sys.mem.rdram[chunk], VERIFY_CHUNK_SIZE) == 0) {
+            continue;
+        }
+        for (u32 index = chunk; index < chunk + VERIFY_CHUNK_SIZE; index++) {
+            if (verify_rdram[index] == n64sys.mem.rdram[index] || !verify_was_written(index)) {
+                continue;
+            }
+            if (mismatches++ < 8) {
+                u32 address = BYTE_ADDRESS(index);
+                const hle_write_t* write = find_verify_write(address);
+                if (write == NULL && num_verify_writes == MAX_VERIFY_WRITES) {
+                    logwarn("HLE audio: 0x%08X is 0x%02X natively, the RSP wrote 0x%02X",
+                            address, verify_rdram[index], n64sys.mem.rdram[index]);
+                } else if (write == NULL) {
+                    logwarn("HLE audio: nothing wrote 0x%08X natively, the RSP wrote 0x%02X",
+                            address, n64sys.mem.rdram[index]);
+                } else {
+                    logwarn("HLE audio: %s wrote 0x%02X to 0x%08X, the RSP wrote 0x%02X",
+                            write->command ? write->command : "?", verify_rdram[index], address, n64sys.mem.rdram[index]);
+                }
+            }
+        }
+    }
+
+    verified_tasks++;
+    if (mismatches > 0) {
+        mismatched_tasks++;
+    }
+    if (verified_tasks % VERIFY_REPORT_INTERVAL == 0) {
+        loginfo("HLE audio: %lu of %lu tasks matched the RSP", verified_tasks - mismatched_tasks, verified_tasks);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef N64_RSP_HLE_H
+#define N64_RSP_HLE_H
+
+#include <stdbool.h>
+#include <util.h>
+#include <system/n64system.h>
+#include <mem/mem_util.h>
+
+// High level emulation of RSP tasks. When the CPU starts the RSP on a task we recognize, the task runs natively on the
+// CPU thread and the RSP goes straight back to halted, as if it had run the whole thing instantly.
+// Anything else, or anything a task needs that isn't implemented, is left to the RSP.
+
+// The OSTask structure libultra leaves at the end of DMEM for the boot microcode
+#define OSTASK_ADDRESS 0xFC0
+
+#define OSTASK_TYPE_GFX   1
+#define OSTASK_TYPE_AUDIO 2
+
+// Set when the task is being resumed after yielding part way through
+#define OSTASK_FLAG_YIELDED 0x0001
+
+typedef struct rsp_hle_task {
+    u32 type;
+    u32 flags;
+    u32 ucode_boot;
+    u32 ucode_boot_size;
+    u32 ucode;
+    u32 ucode_size;
+    u32 ucode_data;
+    u32 ucode_data_size;
+    u32 dram_stack;
+    u32 dram_stack_size;
+    u32 output_buff;
+    u32 output_buff_size;
+    u32 data_ptr;
+    u32 data_size;
+    u32 yield_data_ptr;
+    u32 yield_data_size;
+} rsp_hle_task_t;
+
+// Where tasks read and write RDRAM. Normally the real thing, a copy of it while verifying.
+extern u8* rsp_hle_rdram;
+// Set while the RSP runs a task that was already run natively, so the results can be compared when it breaks
+extern bool rsp_hle_verifying;
+// The command being run, for reporting mismatches
+extern const char* rsp_hle_command;
+
+rsp_hle_mode_t rsp_hle_mode_from_name(const char* name);
+// Called when the CPU takes the RSP out of halt
+void rsp_hle_start_task();
+// Called when the RSP breaks while verifying
+void rsp_hle_verify_task();
+// Records an RDRAM write by the running task
+void rsp_hle_dram_written(u32 address, u32 length);
+// Records an RDRAM write by the RSP while verifying
+void rsp_hle_rsp_written(u32 address, u32 length);
+
+INLINE u32 hle_dram_address(u32 address) {
+    return address & (N64_RDRAM_SIZE - 1);
+}
+
+INLINE u8 hle_dram_read_u8(u32 address) {
+    return rsp_hle_rdram[BYTE_ADDRESS(hle_dram_address(address))];
+}
+
+INLINE u16 hle_dram_read_u16(u32 address) {
+    return half_from_byte_array(rsp_hle_rdram, HALF_ADDRESS(hle_dram_address(address)));
+}
+
+INLINE u32 hle_dram_read_u32(u32 address) {
+    return word_from_byte_array(rsp_hle_rdram, WORD_ADDRESS(hle_dram_address(address)));
+}
+
+INLINE void hle_dram_write_u16(u32 address, u16 value) {
+    half_to_byte_array(rsp_hle_rdram, HALF_ADDRESS(hle_dram_address(address)), value);
+    rsp_hle_dram_written(address, 2);
+}
+
+INLINE void hle_dram_write_u32(u32 address, u32 value) {
+    word_to_byte_array(rsp_hle_rdram, WORD_ADDRESS(hle_dram_address(address)), value);
+    rsp_hle_dram_written(address, 4);
+}
+
+// Block copies between RDRAM and a 4KiB DMEM sized buffer. Both sides are kept in the same byte order, so as long as
+// everything is 8 byte aligned, the way the RSP's DMA engine requires, the bytes copy straight across.
+void hle_dram_load(u8* buffer, u16 buffer_address, u32 dram_address, u32 length);
+void hle_dram_save(u32 dram_address, const u8* buffer, u16 buffer_address, u32 length);
+
+#endif //N64_RSP_HLE_H
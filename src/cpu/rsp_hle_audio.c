@@ -0,0 +1,598 @@
+#include "rsp_hle_audio.h"
+
+#include <string.h>
+#include <log.h>
+#ifdef N64_USE_SIMD
+#include <emmintrin.h>
+#endif
+
+// The standard audio ABI, used by most libultra games. Commands work on buffers in DMEM, which we keep in a private
+// buffer laid out the same way, so blocks copy straight across to and from RDRAM.
+
+#define ABI_DMEM_BASE 0x5C0
+#define ABI_SEGMENTS 16
+
+#define A_INIT 0x01
+#define A_LOOP 0x02
+#define A_LEFT 0x02
+#define A_VOL  0x04
+#define A_AUX  0x08
+
+#define ALIGN(x, n) (((x) + ((n) - 1)) & ~((n) - 1))
+
+// ucode_data fingerprint of the standard ABI
+#define ABI_SIGNATURE_OFFSET_0 0x00
+#define ABI_SIGNATURE_0        0x00000001
+#define ABI_SIGNATURE_OFFSET_1 0x30
+#define ABI_SIGNATURE_1        0xF0000F00
+#define ABI_SIGNATURE_OFFSET_2 0x28
+#define ABI_SIGNATURE_2        0x1E24138C
+
+// First phase of the resample filter, used to find the whole table in the data segment
+static const s16 resample_lut_start[4] = { 0x0C39, 0x66AD, 0x0D46, (s16)0xFFDF };
+
+typedef struct audio_ramp {
+    s64 value;
+    s64 step;
+    s64 target;
+} audio_ramp_t;
+
+typedef enum audio_command {
+    ACMD_SPNOOP,
+    ACMD_ADPCM,
+    ACMD_CLEARBUFF,
+    ACMD_ENVMIXER,
+    ACMD_LOADBUFF,
+    ACMD_RESAMPLE,
+    ACMD_SAVEBUFF,
+    ACMD_SEGMENT,
+    ACMD_SETBUFF,
+    ACMD_SETVOL,
+    ACMD_DMEMMOVE,
+    ACMD_LOADADPCM,
+    ACMD_MIXER,
+    ACMD_INTERLEAVE,
+    ACMD_POLEF,
+    ACMD_SETLOOP,
+    NUM_ACMDS
+} audio_command_t;
+
+static const char* audio_command_names[NUM_ACMDS] = {
+        "SPNOOP", "ADPCM", "CLEARBUFF", "ENVMIXER",
+        "LOADBUFF", "RESAMPLE", "SAVEBUFF", "SEGMENT",
+        "SETBUFF", "SETVOL", "DMEMMOVE", "LOADADPCM",
+        "MIXER", "INTERLEAVE", "POLEF", "SETLOOP"
+};
+
+static struct {
+    u8 buffer[SP_DMEM_SIZE] __attribute__((aligned(16)));
+    const s16* resample_lut;
+    u32 segments[ABI_SEGMENTS];
+
+    // SETBUFF
+    u16 in;
+    u16 out;
+    u16 count;
+    u16 dry_right;
+    u16 wet_left;
+    u16 wet_right;
+
+    // SETVOL
+    s16 dry;
+    s16 wet;
+    s16 vol[2];
+    s16 target[2];
+    s32 rate[2];
+
+    // SETLOOP
+    u32 loop;
+    // LOADADPCM
+    s16 table[16 * 8];
+} audio;
+
+INLINE s16 clamp_s16(s64 x) {
+    if (x > 0x7FFF) {
+        return 0x7FFF;
+    } else if (x < -0x8000) {
+        return -0x8000;
+    }
+    return x;
+}
+
+INLINE u8 buffer_read_u8(u16 dmem) {
+    return audio.buffer[BYTE_ADDRESS(dmem & 0xFFF)];
+}
+
+INLINE s16 buffer_read_s16(u16 dmem) {
+    return half_from_byte_array(audio.buffer, HALF_ADDRESS(dmem & 0xFFE));
+}
+
+INLINE void buffer_write_u8(u16 dmem, u8 value) {
+    audio.buffer[BYTE_ADDRESS(dmem & 0xFFF)] = value;
+}
+
+INLINE void buffer_write_s16(u16 dmem, s16 value) {
+    half_to_byte_array(audio.buffer, HALF_ADDRESS(dmem & 0xFFE), value);
+}
+
+INLINE u32 segmented_address(u32 so) {
+    u8 segment = (so >> 24) & 0x3F;
+    u32 offset = so & 0xFFFFFF;
+    if (segment >= ABI_SEGMENTS) {
+        logwarn("HLE audio: invalid segment %d", segment);
+        return offset;
+    }
+    return audio.segments[segment] + offset;
+}
+
+// Whether [dmem, dmem + length) can be worked on in place: word aligned, and not wrapping around the end of DMEM.
+// Anything else goes a sample at a time.
+INLINE bool buffer_contiguous(u16 dmem, u32 length) {
+    return (dmem & 3) == 0 && dmem + length <= SP_DMEM_SIZE;
+}
+
+// dst = clamp(dst + ((src * gain + round) >> 15)) for 8 samples, with a gain per sample. ENVMIXER rounds the product,
+// MIXER doesn't.
+INLINE void mix_8(u16 dst, u16 src, const s16* gains, s32 round) {
+#if defined(N64_USE_SIMD) && !defined(N64_BIG_ENDIAN)
+    if (buffer_contiguous(dst, 16) && buffer_contiguous(src, 16)) {
+        // Samples are swapped in pairs in the buffer, the gains have been swapped to match
+        __m128i* dst_vec = (__m128i*)&audio.buffer[dst];
+        __m128i d = _mm_loadu_si128(dst_vec);
+        __m128i s = _mm_loadu_si128((__m128i*)&audio.buffer[src]);
+        __m128i g = _mm_loadu_si128((__m128i*)gains);
+
+        __m128i lo = _mm_mullo_epi16(s, g);
+        __m128i hi = _mm_mulhi_epi16(s, g);
+        __m128i rounding = _mm_set1_epi32(round);
+        __m128i product_lo = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), rounding), 15);
+        __m128i product_hi = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), rounding), 15);
+
+        // Sign extend dst to 32 bits, add, and pack back down with saturation
+        __m128i d_lo = _mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16);
+        __m128i d_hi = _mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16);
+        _mm_storeu_si128(dst_vec, _mm_packs_epi32(_mm_add_epi32(d_lo, product_lo), _mm_add_epi32(d_hi, product_hi)));
+        return;
+    }
+#endif
+    for (int i = 0; i < 8; i++) {
+        s16 sample = buffer_read_s16(src + i * 2);
+        s32 mixed = buffer_read_s16(dst + i * 2) + ((sample * gains[HALF_ADDRESS(i * 2) >> 1] + round) >> 15);
+        buffer_write_s16(dst + i * 2, clamp_s16(mixed));
+    }
+}
+
+static void cmd_spnoop(u32 w1, u32 w2) {}
+
+INLINE s16 adpcm_predict_sample(u8 byte, u8 mask, int lshift, int rshift) {
+    s16 sample = (u16)(byte & mask) << lshift;
+    return sample >> rshift;
+}
+
+// dst[i] = (src[i] << 11 + book1[i] * l1 + book2[i] * l2 + sum(book2[k] * src[i - 1 - k])) >> 11
+INLINE void adpcm_compute_residuals(s16* dst, const s16* src, const s16* book, s16 l1, s16 l2) {
+    const s16* book1 = book;
+    const s16* book2 = book + 8;
+    for (int i = 0; i < 8; i++) {
+        s64 accu = (s64)src[i] << 11;
+        accu += book1[i] * l1 + book2[i] * l2;
+        for (int k = 0; k < i; k++) {
+            accu += book2[k] * src[i - 1 - k];
+        }
+        dst[i] = clamp_s16(accu >> 11);
+    }
+}
+
+static void cmd_adpcm(u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    u32 address = segmented_address(w2);
+    u16 dmemo = audio.out;
+    u16 dmemi = audio.in;
+    u16 count = ALIGN(audio.count, 32);
+
+    s16 last_frame[16];
+    if (flags & A_INIT) {
+        memset(last_frame, 0, sizeof(last_frame));
+    } else {
+        u32 from = (flags & A_LOOP) ? audio.loop : address;
+        for (int i = 0; i < 16; i++) {
+            last_frame[i] = hle_dram_read_u16(from + i * 2);
+        }
+    }
+
+    for (int i = 0; i < 16; i++, dmemo += 2) {
+        buffer_write_s16(dmemo, last_frame[i]);
+    }
+
+    while (count != 0) {
+        // One byte of header, then 16 samples of 4 bits each
+        u8 code = buffer_read_u8(dmemi++);
+        int scale = code >> 4;
+        const s16* book = audio.table + ((code & 0xF) << 4);
+        int rshift = scale < 12 ? 12 - scale : 0;
+
+        s16 frame[16];
+        for (int i = 0; i < 8; i++) {
+            u8 byte = buffer_read_u8(dmemi++);
+            frame[i * 2 + 0] = adpcm_predict_sample(byte, 0xF0, 8, rshift);
+            frame[i * 2 + 1] = adpcm_predict_sample(byte, 0x0F, 12, rshift);
+        }
+
+        adpcm_compute_residuals(last_frame, frame, book, last_frame[14], last_frame[15]);
+        adpcm_compute_residuals(last_frame + 8, frame + 8, book, last_frame[6], last_frame[7]);
+
+        for (int i = 0; i < 16; i++, dmemo += 2) {
+            buffer_write_s16(dmemo, last_frame[i]);
+        }
+        count -= 32;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        hle_dram_write_u16(address + i * 2, last_frame[i]);
+    }
+}
+
+static void cmd_clearbuff(u32 w1, u32 w2) {
+    u16 dmem = w1 + ABI_DMEM_BASE;
+    u16 count = w2 & 0xFFF;
+    if (count == 0) {
+        return;
+    }
+    count = ALIGN(count, 16);
+
+    if (buffer_contiguous(dmem, count)) {
+        memset(&audio.buffer[dmem], 0, count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            buffer_write_u8(dmem + i, 0);
+        }
+    }
+}
+
+INLINE s16 ramp_step(audio_ramp_t* ramp) {
+    ramp->value += ramp->step;
+
+    bool reached = ramp->step <= 0 ? ramp->value <= ramp->target : ramp->value >= ramp->target;
+    if (reached) {
+        ramp->value = ramp->target;
+        ramp->step = 0;
+    }
+
+    return ramp->value >> 16;
+}
+
+// Envelope state saved between tasks, as offsets into the 80 byte save area. This is the layout of the reference HLE,
+// mupen64plus-rsp-hle's alist_envmix_exp(), which copies the area out of its word swapped RDRAM and reads wet and dry
+// as its first and third halfwords, so in RDRAM they sit at 2 and 6. Only the first 40 bytes are used, the rest is
+// left as it was.
+#define ENVMIXER_WET        2
+#define ENVMIXER_DRY        6
+#define ENVMIXER_TARGET_L   8
+#define ENVMIXER_TARGET_R   12
+#define ENVMIXER_RATE_L     16
+#define ENVMIXER_RATE_R     20
+#define ENVMIXER_SEQUENCE_L 24
+#define ENVMIXER_SEQUENCE_R 28
+#define ENVMIXER_VALUE_L    32
+#define ENVMIXER_VALUE_R    36
+#define ENVMIXER_STATE_SIZE 40
+
+static void cmd_envmixer(u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    u32 address = segmented_address(w2);
+    bool aux = flags & A_AUX;
+
+    s16 dry = audio.dry;
+    s16 wet = audio.wet;
+    audio_ramp_t ramps[2];
+    s32 rates[2];
+    s32 sequence[2];
+
+    if (flags & A_INIT) {
+        for (int lr = 0; lr < 2; lr++) {
+            ramps[lr].value = audio.vol[lr] * 0x10000;
+            ramps[lr].target = audio.target[lr] * 0x10000;
+            rates[lr] = audio.rate[lr];
+            sequence[lr] = (s32)((s64)audio.vol[lr] * audio.rate[lr]);
+        }
+    } else {
+        dry = hle_dram_read_u16(address + ENVMIXER_DRY);
+        wet = hle_dram_read_u16(address + ENVMIXER_WET);
+        ramps[0].target = (s32)hle_dram_read_u32(address + ENVMIXER_TARGET_L);
+        ramps[1].target = (s32)hle_dram_read_u32(address + ENVMIXER_TARGET_R);
+        rates[0] = hle_dram_read_u32(address + ENVMIXER_RATE_L);
+        rates[1] = hle_dram_read_u32(address + ENVMIXER_RATE_R);
+        sequence[0] = hle_dram_read_u32(address + ENVMIXER_SEQUENCE_L);
+        sequence[1] = hle_dram_read_u32(address + ENVMIXER_SEQUENCE_R);
+        ramps[0].value = (s32)hle_dram_read_u32(address + ENVMIXER_VALUE_L);
+        ramps[1].value = (s32)hle_dram_read_u32(address + ENVMIXER_VALUE_R);
+    }
+
+    // A ramp only moves while it hasn't reached its target
+    ramps[0].step = ramps[0].target - ramps[0].value;
+    ramps[1].step = ramps[1].target - ramps[1].value;
+
+    u16 dst[4] = { audio.out, audio.dry_right, audio.wet_left, audio.wet_right };
+    int outputs = aux ? 4 : 2;
+    u16 in = audio.in;
+
+    for (int y = 0; y < audio.count; y += 16) {
+        for (int lr = 0; lr < 2; lr++) {
+            if (ramps[lr].step != 0) {
+                sequence[lr] = (s32)(((s64)sequence[lr] * rates[lr]) >> 16);
+                ramps[lr].step = (sequence[lr] - ramps[lr].value) >> 3;
+            }
+        }
+
+        // The envelope moves every sample, so each of the 8 gets its own gains. They're stored in the buffer's
+        // sample order so they line up with the samples.
+        s16 gains[4][8] __attribute__((aligned(16)));
+        for (int x = 0; x < 8; x++) {
+            s16 l_vol = ramp_step(&ramps[0]);
+            s16 r_vol = ramp_step(&ramps[1]);
+            int lane = HALF_ADDRESS(x * 2) >> 1;
+
+            gains[0][lane] = clamp_s16((l_vol * dry + 0x4000) >> 15);
+            gains[1][lane] = clamp_s16((r_vol * dry + 0x4000) >> 15);
+            gains[2][lane] = clamp_s16((l_vol * wet + 0x4000) >> 15);
+            gains[3][lane] = clamp_s16((r_vol * wet + 0x4000) >> 15);
+        }
+
+        for (int i = 0; i < outputs; i++) {
+            mix_8(dst[i] + y, in + y, gains[i], 0x4000);
+        }
+    }
+
+    hle_dram_write_u16(address + ENVMIXER_DRY, dry);
+    hle_dram_write_u16(address + ENVMIXER_WET, wet);
+    hle_dram_write_u32(address + ENVMIXER_TARGET_L, ramps[0].target);
+    hle_dram_write_u32(address + ENVMIXER_TARGET_R, ramps[1].target);
+    hle_dram_write_u32(address + ENVMIXER_RATE_L, rates[0]);
+    hle_dram_write_u32(address + ENVMIXER_RATE_R, rates[1]);
+    hle_dram_write_u32(address + ENVMIXER_SEQUENCE_L, sequence[0]);
+    hle_dram_write_u32(address + ENVMIXER_SEQUENCE_R, sequence[1]);
+    hle_dram_write_u32(address + ENVMIXER_VALUE_L, ramps[0].value);
+    hle_dram_write_u32(address + ENVMIXER_VALUE_R, ramps[1].value);
+}
+
+static void cmd_loadbuff(u32 w1, u32 w2) {
+    u32 address = segmented_address(w2);
+    if (audio.count == 0) {
+        return;
+    }
+    hle_dram_load(audio.buffer, audio.in, address, ALIGN(audio.count, 8));
+}
+
+// Interpolates between input samples with a 4 tap filter, stepping through the input by pitch (16.16 fixed point)
+static void cmd_resample(u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    u32 pitch = (w1 & 0xFFFF) << 1;
+    u32 address = segmented_address(w2);
+
+    // Positions in samples. The 4 samples before the input hold the end of the previous run.
+    u16 ipos = (audio.in >> 1) - 4;
+    u16 opos = audio.out >> 1;
+    int count = ALIGN(audio.count, 16) >> 1;
+    u32 pitch_accu;
+
+    if (flags & A_INIT) {
+        for (int i = 0; i < 4; i++) {
+            buffer_write_s16((ipos + i) << 1, 0);
+        }
+        pitch_accu = 0;
+    } else {
+        for (int i = 0; i < 4; i++) {
+            buffer_write_s16((ipos + i) << 1, hle_dram_read_u16(address + i * 2));
+        }
+        pitch_accu = hle_dram_read_u16(address + 8);
+    }
+
+    while (count != 0) {
+        const s16* lut = audio.resample_lut + ((pitch_accu & 0xFC00) >> 8);
+
+        s64 accu = (s64)buffer_read_s16((ipos + 0) << 1) * lut[0]
+                 + (s64)buffer_read_s16((ipos + 1) << 1) * lut[1]
+                 + (s64)buffer_read_s16((ipos + 2) << 1) * lut[2]
+                 + (s64)buffer_read_s16((ipos + 3) << 1) * lut[3];
+        buffer_write_s16(opos++ << 1, clamp_s16(accu >> 15));
+
+        pitch_accu += pitch;
+        ipos += pitch_accu >> 16;
+        pitch_accu &= 0xFFFF;
+        count--;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        hle_dram_write_u16(address + i * 2, buffer_read_s16((ipos + i) << 1));
+    }
+    hle_dram_write_u16(address + 8, pitch_accu);
+}
+
+static void cmd_savebuff(u32 w1, u32 w2) {
+    u32 address = segmented_address(w2);
+    if (audio.count == 0) {
+        return;
+    }
+    hle_dram_save(address, audio.buffer, audio.out, ALIGN(audio.count, 8));
+}
+
+static void cmd_segment(u32 w1, u32 w2) {
+    u8 segment = (w2 >> 24) & 0x3F;
+    if (segment >= ABI_SEGMENTS) {
+        logwarn("HLE audio: invalid segment %d", segment);
+        return;
+    }
+    audio.segments[segment] = w2 & 0xFFFFFF;
+}
+
+static void cmd_setbuff(u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    if (flags & A_AUX) {
+        audio.dry_right = w1 + ABI_DMEM_BASE;
+        audio.wet_left = (w2 >> 16) + ABI_DMEM_BASE;
+        audio.wet_right = w2 + ABI_DMEM_BASE;
+    } else {
+        audio.in = w1 + ABI_DMEM_BASE;
+        audio.out = (w2 >> 16) + ABI_DMEM_BASE;
+        audio.count = w2;
+    }
+}
+
+static void cmd_setvol(u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    if (flags & A_AUX) {
+        audio.dry = w1;
+        audio.wet = w2;
+    } else {
+        int lr = (flags & A_LEFT) ? 0 : 1;
+        if (flags & A_VOL) {
+            audio.vol[lr] = w1;
+        } else {
+            audio.target[lr] = w1;
+            audio.rate[lr] = w2;
+        }
+    }
+}
+
+static void cmd_dmemmove(u32 w1, u32 w2) {
+    u16 dmemi = w1 + ABI_DMEM_BASE;
+    u16 dmemo = (w2 >> 16) + ABI_DMEM_BASE;
+    u16 count = w2;
+    if (count == 0) {
+        return;
+    }
+    count = ALIGN(count, 16);
+
+    // The RSP copies forwards, which only matches memmove when the copy doesn't run into its own output
+    if (buffer_contiguous(dmemi, count) && buffer_contiguous(dmemo, count) && (dmemo <= dmemi || dmemo >= dmemi + count)) {
+        memmove(&audio.buffer[dmemo], &audio.buffer[dmemi], count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            buffer_write_u8(dmemo + i, buffer_read_u8(dmemi + i));
+        }
+    }
+}
+
+static void cmd_loadadpcm(u32 w1, u32 w2) {
+    u16 count = ALIGN(w1 & 0xFFFF, 8) >> 1;
+    u32 address = segmented_address(w2);
+    if (count > sizeof(audio.table) / sizeof(s16)) {
+        count = sizeof(audio.table) / sizeof(s16);
+    }
+    for (int i = 0; i < count; i++) {
+        audio.table[i] = hle_dram_read_u16(address + i * 2);
+    }
+}
+
+static void cmd_mixer(u32 w1, u32 w2) {
+    s16 gain = w1;
+    u16 dmemi = (w2 >> 16) + ABI_DMEM_BASE;
+    u16 dmemo = w2 + ABI_DMEM_BASE;
+    if (audio.count == 0) {
+        return;
+    }
+
+    s16 gains[8] __attribute__((aligned(16)));
+    for (int i = 0; i < 8; i++) {
+        gains[i] = gain;
+    }
+    int count = ALIGN(audio.count, 32);
+    for (int i = 0; i < count; i += 16) {
+        mix_8(dmemo + i, dmemi + i, gains, 0);
+    }
+}
+
+static void cmd_interleave(u32 w1, u32 w2) {
+    u16 left = (w2 >> 16) + ABI_DMEM_BASE;
+    u16 right = w2 + ABI_DMEM_BASE;
+    if (audio.count == 0) {
+        return;
+    }
+
+    int count = ALIGN(audio.count, 16) >> 1;
+    u16 out = audio.out;
+    for (int i = 0; i < count; i++) {
+        s16 l = buffer_read_s16(left + i * 2);
+        s16 r = buffer_read_s16(right + i * 2);
+        buffer_write_s16(out + i * 4 + 0, l);
+        buffer_write_s16(out + i * 4 + 2, r);
+    }
+}
+
+static void cmd_setloop(u32 w1, u32 w2) {
+    audio.loop = segmented_address(w2);
+}
+
+typedef void (*audio_command_handler_t)(u32 w1, u32 w2);
+
+static const audio_command_handler_t audio_command_handlers[NUM_ACMDS] = {
+        [ACMD_SPNOOP]     = cmd_spnoop,
+        [ACMD_ADPCM]      = cmd_adpcm,
+        [ACMD_CLEARBUFF]  = cmd_clearbuff,
+        [ACMD_ENVMIXER]   = cmd_envmixer,
+        [ACMD_LOADBUFF]   = cmd_loadbuff,
+        [ACMD_RESAMPLE]   = cmd_resample,
+        [ACMD_SAVEBUFF]   = cmd_savebuff,
+        [ACMD_SEGMENT]    = cmd_segment,
+        [ACMD_SETBUFF]    = cmd_setbuff,
+        [ACMD_SETVOL]     = cmd_setvol,
+        [ACMD_DMEMMOVE]   = cmd_dmemmove,
+        [ACMD_LOADADPCM]  = cmd_loadadpcm,
+        [ACMD_MIXER]      = cmd_mixer,
+        [ACMD_INTERLEAVE] = cmd_interleave,
+        // POLEF is left to the RSP
+        [ACMD_POLEF]      = NULL,
+        [ACMD_SETLOOP]    = cmd_setloop,
+};
+
+bool rsp_hle_audio_identify(const rsp_hle_task_t* task, rsp_hle_audio_ucode_t* ucode) {
+    u32 data = task->ucode_data;
+    if (hle_dram_read_u32(data + ABI_SIGNATURE_OFFSET_0) != ABI_SIGNATURE_0
+        || hle_dram_read_u32(data + ABI_SIGNATURE_OFFSET_1) != ABI_SIGNATURE_1
+        || hle_dram_read_u32(data + ABI_SIGNATURE_OFFSET_2) != ABI_SIGNATURE_2) {
+        return false;
+    }
+
+    // The resample filter lives somewhere in the data segment
+    u32 size = task->ucode_data_size > SP_DMEM_SIZE ? SP_DMEM_SIZE : task->ucode_data_size;
+    u32 table_size = sizeof(ucode->resample_lut);
+    for (u32 offset = 0; offset + table_size <= size; offset += 2) {
+        bool found = true;
+        for (int i = 0; i < 4 && found; i++) {
+            found = (s16)hle_dram_read_u16(data + offset + i * 2) == resample_lut_start[i];
+        }
+        if (found) {
+            for (int i = 0; i < 64 * 4; i++) {
+                ucode->resample_lut[i] = hle_dram_read_u16(data + offset + i * 2);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool rsp_hle_audio_supported(const rsp_hle_task_t* task) {
+    for (u32 i = 0; i + 8 <= task->data_size; i += 8) {
+        u32 command = (hle_dram_read_u32(task->data_ptr + i) >> 24) & 0x7F;
+        if (command >= NUM_ACMDS || audio_command_handlers[command] == NULL) {
+            logdebug("HLE audio: leaving a task with command 0x%02X to the RSP", command);
+            return false;
+        }
+    }
+    return true;
+}
+
+void rsp_hle_audio_run(const rsp_hle_task_t* task, const rsp_hle_audio_ucode_t* ucode) {
+    audio.resample_lut = ucode->resample_lut;
+    memset(audio.segments, 0, sizeof(audio.segments));
+
+    for (u32 i = 0; i + 8 <= task->data_size; i += 8) {
+        u32 w1 = hle_dram_read_u32(task->data_ptr + i);
+        u32 w2 = hle_dram_read_u32(task->data_ptr + i + 4);
+        u32 command = (w1 >> 24) & 0x7F;
+        // Checked by rsp_hle_audio_supported
+        rsp_hle_command = audio_command_names[command];
+        audio_command_handlers[command](w1, w2);
+    }
+    rsp_hle_command = NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef N64_RSP_HLE_AUDIO_H
+#define N64_RSP_HLE_AUDIO_H
+
+#include "rsp_hle.h"
+
+// What we need out of a recognized audio microcode's data segment
+typedef struct rsp_hle_audio_ucode {
+    // 64 phases of a 4 tap interpolation filter, used by RESAMPLE
+    s16 resample_lut[64 * 4];
+} rsp_hle_audio_ucode_t;
+
+// Checks the microcode's data segment for the standard audio ABI, and pulls out the tables the commands need
+bool rsp_hle_audio_identify(const rsp_hle_task_t* task, rsp_hle_audio_ucode_t* ucode);
+// Whether every command in the task's list is implemented
+bool rsp_hle_audio_supported(const rsp_hle_task_t* task);
+void rsp_hle_audio_run(const rsp_hle_task_t* task, const rsp_hle_audio_ucode_t* ucode);
+
+#endif //N64_RSP_HLE_AUDIO_H
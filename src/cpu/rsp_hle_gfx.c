@@ -0,0 +1,1356 @@
+#include "rsp_hle_gfx.h"
+
+#include <math.h>
+#include <string.h>
+#include <log.h>
+#include <rdp/rdp.h>
+#ifdef N64_USE_SIMD
+#include <xmmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The F3D family of graphics microcode. The display list is walked the way the microcode walks it: vertices are
+// transformed, lit and projected as they're loaded into the vertex cache, and triangles drawn from the cache are clipped,
+// culled and turned into RDP triangle commands. Everything meant for the RDP directly passes through untouched, apart
+// from segmented addresses being resolved. The math is done in floating point rather than the microcode's fixed point
+// and reciprocal tables, so triangle setup is an approximation: edges and gradients come out close to the microcode's,
+// not bit for bit. tests/test_hle_gfx_lle.c measures how close against the real microcode.
+
+// Enough for the 64 entry caches of the .Rej variants, and F3DEX2's 7 bit indices
+#define GFX_MAX_VERTICES 128
+#define GFX_MATRIX_STACK_SIZE 32
+#define GFX_DL_STACK_SIZE 18
+#define GFX_MAX_LIGHTS 8
+// Words of RDP commands collected before handing them to the RDP
+#define GFX_RDP_BUFFER_WORDS 0x4000
+// Give up on display lists that don't end
+#define GFX_MAX_COMMANDS 4000000
+
+// Triangles are clipped against the near plane, and against a guard band this many times the size of the viewport.
+// Whatever's left outside the viewport is scissored by the RDP.
+#define GFX_GUARD_BAND 4.0f
+
+#define CLIP_NEAR   (1 << 0)
+#define CLIP_RIGHT  (1 << 1)
+#define CLIP_LEFT   (1 << 2)
+#define CLIP_TOP    (1 << 3)
+#define CLIP_BOTTOM (1 << 4)
+#define NUM_CLIP_PLANES 5
+#define MAX_CLIPPED_VERTICES (3 + NUM_CLIP_PLANES)
+
+// othermode_h
+#define G_TP_PERSP (1 << 19)
+
+// Display list commands shared by every GBI
+#define G_MW_MATRIX    0x00
+#define G_MW_NUMLIGHT  0x02
+#define G_MW_CLIP      0x04
+#define G_MW_SEGMENT   0x06
+#define G_MW_FOG       0x08
+#define G_MW_LIGHTCOL  0x0A
+#define G_MW_PERSPNORM 0x0E
+
+#define RDP_TRIANGLE       0x08
+#define RDP_TRIANGLE_Z     0x01
+#define RDP_TRIANGLE_TEX   0x02
+#define RDP_TRIANGLE_SHADE 0x04
+
+#define RDP_TEXRECT        0xE4
+#define RDP_TEXRECT_FLIP   0xE5
+#define RDP_SET_OTHER_MODE 0xEF
+#define RDP_SET_TEX_IMAGE  0xFD
+#define RDP_SET_Z_IMAGE    0xFE
+#define RDP_SET_COLOR_IMAGE 0xFF
+
+typedef struct gfx_matrix {
+    float m[4][4] __attribute__((aligned(16)));
+} gfx_matrix_t;
+
+typedef struct gfx_vertex {
+    // Clip space
+    float x, y, z, w;
+    // Screen space, in pixels. z is in the RDP's 0-0x7FFF range
+    float sx, sy, sz, inv_w;
+    // 0-255
+    float r, g, b, a;
+    // s10.5 texels, scaled by G_TEXTURE
+    float s, t;
+    // Planes the vertex is outside of, for clipping
+    u8 clip;
+    // Frustum planes the vertex is outside of, for G_CULLDL
+    u8 frustum;
+} gfx_vertex_t;
+
+typedef struct gfx_light {
+    float color[3];
+    // As given, then in the space of the current modelview matrix, which is where vertex normals are
+    float dir[3];
+    float model_dir[3];
+} gfx_light_t;
+
+// Where each GBI keeps its geometry mode bits
+typedef struct gfx_geometry_bits {
+    u32 zbuffer;
+    u32 shade;
+    u32 shading_smooth;
+    u32 cull_front;
+    u32 cull_back;
+    u32 fog;
+    u32 lighting;
+    u32 texture_gen;
+    u32 texture_gen_linear;
+} gfx_geometry_bits_t;
+
+static const gfx_geometry_bits_t gbi1_geometry_bits = {
+        .zbuffer = 0x1, .shade = 0x4, .shading_smooth = 0x200, .cull_front = 0x1000, .cull_back = 0x2000,
+        .fog = 0x10000, .lighting = 0x20000, .texture_gen = 0x40000, .texture_gen_linear = 0x80000
+};
+
+static const gfx_geometry_bits_t gbi2_geometry_bits = {
+        .zbuffer = 0x1, .shade = 0x4, .shading_smooth = 0x200000, .cull_front = 0x200, .cull_back = 0x400,
+        .fog = 0x10000, .lighting = 0x20000, .texture_gen = 0x40000, .texture_gen_linear = 0x80000
+};
+
+static struct {
+    rsp_hle_gfx_gbi_t gbi;
+    const gfx_geometry_bits_t* bits;
+
+    u32 segments[16];
+    u32 pc;
+    u32 dl_stack[GFX_DL_STACK_SIZE];
+    int dl_depth;
+    bool ended;
+    // Hit G_LOAD_UCODE, which ends the task early
+    bool switched_ucode;
+
+    gfx_matrix_t modelview[GFX_MATRIX_STACK_SIZE];
+    int modelview_depth;
+    gfx_matrix_t projection;
+    // modelview * projection, unless forced by G_MV_MATRIX
+    gfx_matrix_t mvp;
+    bool mvp_dirty;
+    bool lights_dirty;
+
+    gfx_vertex_t vertices[GFX_MAX_VERTICES];
+
+    // In pixels for x and y, in the microcode's 0-0x3FF range for z
+    float viewport_scale[3];
+    float viewport_trans[3];
+
+    u32 geometry_mode;
+    u32 othermode_h;
+    u32 othermode_l;
+
+    struct {
+        float scale_s;
+        float scale_t;
+        int level;
+        int tile;
+        bool on;
+    } texture;
+
+    int num_lights;
+    // The ambient light follows the directional ones
+    gfx_light_t lights[GFX_MAX_LIGHTS + 1];
+    gfx_light_t lookat[2];
+
+    float fog_multiplier;
+    float fog_offset;
+
+    u32 rdphalf_1;
+
+    u32 rdp_words[GFX_RDP_BUFFER_WORDS];
+    int num_rdp_words;
+} gfx;
+
+static bool warned_opcodes[256];
+
+static void warn_unsupported(u8 opcode, const char* what) {
+    if (!warned_opcodes[opcode]) {
+        warned_opcodes[opcode] = true;
+        logwarn("HLE gfx: %s (opcode 0x%02X) isn't supported, skipping it", what, opcode);
+    }
+}
+
+static u32 segmented(u32 address) {
+    return (gfx.segments[(address >> 24) & 0xF] + (address & 0xFFFFFF)) & 0xFFFFFF;
+}
+
+// ---- Matrices. Row vectors, as libultra uses them: clip = vertex * modelview * projection
+
+static void matrix_identity(gfx_matrix_t* m) {
+    memset(m, 0, sizeof(gfx_matrix_t));
+    for (int i = 0; i < 4; i++) {
+        m->m[i][i] = 1.0f;
+    }
+}
+
+// out = a * b. out may be a or b.
+static void matrix_multiply(gfx_matrix_t* out, const gfx_matrix_t* a, const gfx_matrix_t* b) {
+    gfx_matrix_t result;
+#ifdef N64_USE_SIMD
+    __m128 b0 = _mm_load_ps(b->m[0]);
+    __m128 b1 = _mm_load_ps(b->m[1]);
+    __m128 b2 = _mm_load_ps(b->m[2]);
+    __m128 b3 = _mm_load_ps(b->m[3]);
+    for (int i = 0; i < 4; i++) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a->m[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][3]), b3));
+        _mm_store_ps(result.m[i], row);
+    }
+#else
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result.m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j] + a->m[i][3] * b->m[3][j];
+        }
+    }
+#endif
+    *out = result;
+}
+
+// out = (x, y, z, 1) * m
+static void matrix_transform(float* out, const gfx_matrix_t* m, float x, float y, float z) {
+#ifdef N64_USE_SIMD
+    __m128 v = _mm_load_ps(m->m[3]);
+    v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(x), _mm_load_ps(m->m[0])));
+    v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(y), _mm_load_ps(m->m[1])));
+    v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(z), _mm_load_ps(m->m[2])));
+    _mm_storeu_ps(out, v);
+#else
+    for (int i = 0; i < 4; i++) {
+        out[i] = x * m->m[0][i] + y * m->m[1][i] + z * m->m[2][i] + m->m[3][i];
+    }
+#endif
+}
+
+// s15.16, with the integer halves of all 16 elements followed by the fractional halves
+static void load_matrix(gfx_matrix_t* m, u32 address) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            u32 element = (i * 4 + j) * 2;
+            u16 integer = hle_dram_read_u16(address + element);
+            u16 fraction = hle_dram_read_u16(address + 32 + element);
+            m->m[i][j] = (float)(s32)(((u32)integer << 16) | fraction) / 65536.0f;
+        }
+    }
+}
+
+static void normalize(float* v) {
+    float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (length > 0.0f) {
+        v[0] /= length;
+        v[1] /= length;
+        v[2] /= length;
+    }
+}
+
+static void update_mvp() {
+    if (gfx.mvp_dirty) {
+        matrix_multiply(&gfx.mvp, &gfx.modelview[gfx.modelview_depth], &gfx.projection);
+        gfx.mvp_dirty = false;
+    }
+}
+
+// Light directions are given in eye space. Taking them back through the modelview matrix once per matrix is cheaper
+// than taking every normal forward.
+static void to_model_space(gfx_light_t* light) {
+    const gfx_matrix_t* mv = &gfx.modelview[gfx.modelview_depth];
+    for (int i = 0; i < 3; i++) {
+        light->model_dir[i] = mv->m[i][0] * light->dir[0] + mv->m[i][1] * light->dir[1] + mv->m[i][2] * light->dir[2];
+    }
+    normalize(light->model_dir);
+}
+
+static void update_lights() {
+    if (gfx.lights_dirty) {
+        for (int i = 0; i < gfx.num_lights; i++) {
+            to_model_space(&gfx.lights[i]);
+        }
+        to_model_space(&gfx.lookat[0]);
+        to_model_space(&gfx.lookat[1]);
+        gfx.lights_dirty = false;
+    }
+}
+
+static void gfx_matrix(u32 address, bool projection, bool load, bool push) {
+    gfx_matrix_t m;
+    load_matrix(&m, segmented(address));
+
+    if (projection) {
+        if (load) {
+            gfx.projection = m;
+        } else {
+            matrix_multiply(&gfx.projection, &m, &gfx.projection);
+        }
+    } else {
+        if (push && gfx.modelview_depth < GFX_MATRIX_STACK_SIZE - 1) {
+            gfx.modelview[gfx.modelview_depth + 1] = gfx.modelview[gfx.modelview_depth];
+            gfx.modelview_depth++;
+        }
+        gfx_matrix_t* top = &gfx.modelview[gfx.modelview_depth];
+        if (load) {
+            *top = m;
+        } else {
+            matrix_multiply(top, &m, top);
+        }
+        gfx.lights_dirty = true;
+    }
+    gfx.mvp_dirty = true;
+}
+
+static void gfx_pop_matrix(int count) {
+    while (count-- > 0 && gfx.modelview_depth > 0) {
+        gfx.modelview_depth--;
+    }
+    gfx.mvp_dirty = true;
+    gfx.lights_dirty = true;
+}
+
+// gSPForceMatrix replaces the combined matrix until the next G_MTX
+static void gfx_force_matrix(u32 address) {
+    load_matrix(&gfx.mvp, segmented(address));
+    gfx.mvp_dirty = false;
+}
+
+// ---- Vertices
+
+static void project(gfx_vertex_t* v) {
+    float inv_w = v->w != 0.0f ? 1.0f / v->w : 1.0f;
+    v->inv_w = inv_w;
+    v->sx = gfx.viewport_trans[0] + v->x * inv_w * gfx.viewport_scale[0];
+    v->sy = gfx.viewport_trans[1] - v->y * inv_w * gfx.viewport_scale[1];
+    float z = (gfx.viewport_trans[2] + v->z * inv_w * gfx.viewport_scale[2]) * 32.0f;
+    v->sz = z < 0.0f ? 0.0f : (z > 0x7FFF ? 0x7FFF : z);
+}
+
+static u8 clip_codes(const gfx_vertex_t* v) {
+    float guard = v->w * GFX_GUARD_BAND;
+    u8 codes = 0;
+    codes |= v->z < -v->w ? CLIP_NEAR : 0;
+    codes |= v->x > guard ? CLIP_RIGHT : 0;
+    codes |= v->x < -guard ? CLIP_LEFT : 0;
+    codes |= v->y > guard ? CLIP_TOP : 0;
+    codes |= v->y < -guard ? CLIP_BOTTOM : 0;
+    return codes;
+}
+
+static u8 frustum_codes(const gfx_vertex_t* v) {
+    u8 codes = 0;
+    codes |= v->x < -v->w ? 0x01 : 0;
+    codes |= v->x > v->w ? 0x02 : 0;
+    codes |= v->y < -v->w ? 0x04 : 0;
+    codes |= v->y > v->w ? 0x08 : 0;
+    codes |= v->z < -v->w ? 0x10 : 0;
+    codes |= v->z > v->w ? 0x20 : 0;
+    return codes;
+}
+
+static float clamp_color(float c) {
+    return c < 0.0f ? 0.0f : (c > 255.0f ? 255.0f : c);
+}
+
+static void light_vertex(gfx_vertex_t* v, const float* normal) {
+    const gfx_light_t* ambient = &gfx.lights[gfx.num_lights];
+    float color[3] = { ambient->color[0], ambient->color[1], ambient->color[2] };
+    for (int i = 0; i < gfx.num_lights; i++) {
+        const gfx_light_t* light = &gfx.lights[i];
+        float intensity = normal[0] * light->model_dir[0] + normal[1] * light->model_dir[1] + normal[2] * light->model_dir[2];
+        if (intensity > 0.0f) {
+            color[0] += intensity * light->color[0];
+            color[1] += intensity * light->color[1];
+            color[2] += intensity * light->color[2];
+        }
+    }
+    v->r = clamp_color(color[0]);
+    v->g = clamp_color(color[1]);
+    v->b = clamp_color(color[2]);
+}
+
+// Environment mapping: texture coordinates from where the normal points relative to the lookat vectors
+static float texture_gen(const float* normal, const gfx_light_t* lookat) {
+    float d = normal[0] * lookat->model_dir[0] + normal[1] * lookat->model_dir[1] + normal[2] * lookat->model_dir[2];
+    d = d < -1.0f ? -1.0f : (d > 1.0f ? 1.0f : d);
+    float position;
+    if (gfx.geometry_mode & gfx.bits->texture_gen_linear) {
+        position = acosf(-d) / (float)M_PI;
+    } else {
+        position = (d + 1.0f) * 0.5f;
+    }
+    return position * 0x8000;
+}
+
+// 16 bytes each: x, y, z, flag, s, t, then either a color or a normal and alpha
+static void gfx_load_vertices(u32 address, int first, int count) {
+    address = segmented(address);
+    update_mvp();
+    update_lights();
+
+    const u32 geometry = gfx.geometry_mode;
+    for (int i = 0; i < count; i++) {
+        u32 src = address + i * 16;
+        gfx_vertex_t* v = &gfx.vertices[(first + i) & (GFX_MAX_VERTICES - 1)];
+
+        float position[4];
+        matrix_transform(position, &gfx.mvp,
+                         (s16)hle_dram_read_u16(src + 0),
+                         (s16)hle_dram_read_u16(src + 2),
+                         (s16)hle_dram_read_u16(src + 4));
+        v->x = position[0];
+        v->y = position[1];
+        v->z = position[2];
+        v->w = position[3];
+        project(v);
+        v->clip = clip_codes(v);
+        v->frustum = frustum_codes(v);
+
+        s16 s = hle_dram_read_u16(src + 8);
+        s16 t = hle_dram_read_u16(src + 10);
+        u8 c[4] = {
+                hle_dram_read_u8(src + 12), hle_dram_read_u8(src + 13),
+                hle_dram_read_u8(src + 14), hle_dram_read_u8(src + 15)
+        };
+        v->a = c[3];
+
+        if (geometry & (gfx.bits->lighting | gfx.bits->texture_gen)) {
+            float normal[3] = { (s8)c[0], (s8)c[1], (s8)c[2] };
+            normalize(normal);
+            if (geometry & gfx.bits->lighting) {
+                light_vertex(v, normal);
+            } else {
+                v->r = c[0];
+                v->g = c[1];
+                v->b = c[2];
+            }
+            if (geometry & gfx.bits->texture_gen) {
+                v->s = texture_gen(normal, &gfx.lookat[0]) * gfx.texture.scale_s;
+                v->t = texture_gen(normal, &gfx.lookat[1]) * gfx.texture.scale_t;
+            } else {
+                v->s = s * gfx.texture.scale_s;
+                v->t = t * gfx.texture.scale_t;
+            }
+        } else {
+            v->r = c[0];
+            v->g = c[1];
+            v->b = c[2];
+            v->s = s * gfx.texture.scale_s;
+            v->t = t * gfx.texture.scale_t;
+        }
+
+        if (geometry & gfx.bits->fog) {
+            v->a = clamp_color(v->z * v->inv_w * gfx.fog_multiplier + gfx.fog_offset);
+        }
+    }
+}
+
+// G_MWO_POINT_*
+static void gfx_modify_vertex(int index, u32 where, u32 value) {
+    gfx_vertex_t* v = &gfx.vertices[index & (GFX_MAX_VERTICES - 1)];
+    switch (where) {
+        case 0x10: // RGBA
+            v->r = value >> 24;
+            v->g = (value >> 16) & 0xFF;
+            v->b = (value >> 8) & 0xFF;
+            v->a = value & 0xFF;
+            break;
+        case 0x14: // ST
+            v->s = (s16)(value >> 16) * gfx.texture.scale_s;
+            v->t = (s16)value * gfx.texture.scale_t;
+            break;
+        case 0x18: // XYSCREEN, s13.2
+            v->sx = (s16)(value >> 16) / 4.0f;
+            v->sy = (s16)value / 4.0f;
+            break;
+        case 0x1C: // ZSCREEN
+            v->sz = (float)((value >> 16) & 0x7FFF);
+            break;
+        default:
+            logwarn("HLE gfx: unknown vertex field 0x%02X modified", where);
+    }
+}
+
+// ---- RDP output
+
+static void flush_rdp() {
+    if (gfx.num_rdp_words > 0) {
+        rdp_process_commands(gfx.rdp_words, gfx.num_rdp_words);
+        gfx.num_rdp_words = 0;
+    }
+}
+
+static u32* reserve_rdp(int words) {
+    if (gfx.num_rdp_words + words > GFX_RDP_BUFFER_WORDS) {
+        flush_rdp();
+    }
+    u32* out = &gfx.rdp_words[gfx.num_rdp_words];
+    gfx.num_rdp_words += words;
+    return out;
+}
+
+static void emit_rdp(u32 w0, u32 w1) {
+    u32* out = reserve_rdp(2);
+    out[0] = w0;
+    out[1] = w1;
+}
+
+static void gfx_rdp_command(u32 w0, u32 w1) {
+    u8 opcode = w0 >> 24;
+    switch (opcode) {
+        case RDP_SET_TEX_IMAGE:
+        case RDP_SET_Z_IMAGE:
+        case RDP_SET_COLOR_IMAGE:
+            w1 = segmented(w1);
+            break;
+        case RDP_SET_OTHER_MODE:
+            gfx.othermode_h = w0 & 0xFFFFFF;
+            gfx.othermode_l = w1;
+            break;
+    }
+    emit_rdp(w0, w1);
+}
+
+// The other half of a texture rectangle comes in the next two display list commands
+static void gfx_texture_rectangle(u32 w0, u32 w1) {
+    u32* out = reserve_rdp(4);
+    out[0] = w0;
+    out[1] = w1;
+    out[2] = hle_dram_read_u32(gfx.pc + 4);
+    out[3] = hle_dram_read_u32(gfx.pc + 12);
+    gfx.pc += 16;
+}
+
+static void gfx_set_othermode(bool high, int shift, int length, u32 data) {
+    u32 mask = (length >= 32 ? 0xFFFFFFFF : ((1u << length) - 1)) << shift;
+    if (high) {
+        gfx.othermode_h = ((gfx.othermode_h & ~mask) | (data & mask)) & 0xFFFFFF;
+    } else {
+        gfx.othermode_l = (gfx.othermode_l & ~mask) | (data & mask);
+    }
+    emit_rdp(((u32)RDP_SET_OTHER_MODE << 24) | gfx.othermode_h, gfx.othermode_l);
+}
+
+// ---- Triangles
+
+static s32 to_s15_16(float f) {
+    float scaled = f * 65536.0f;
+    if (scaled >= 2147483647.0f) {
+        return 0x7FFFFFFF;
+    } else if (scaled <= -2147483648.0f) {
+        return (s32)0x80000000;
+    }
+    return (s32)scaled;
+}
+
+typedef struct triangle_edges {
+    float hx, hy;
+    float mx, my;
+    // Slope of the major edge, per scanline
+    float ish;
+    // -1 / the triangle's cross product, to turn attribute deltas into gradients
+    float attr_factor;
+    // From the top vertex up to the scanline the RDP starts on
+    float fy;
+} triangle_edges_t;
+
+// An attribute's value at the top of the triangle and its gradients, s15.16
+typedef struct attribute_setup {
+    s32 start;
+    s32 dx;
+    s32 de;
+    s32 dy;
+} attribute_setup_t;
+
+static attribute_setup_t setup_attribute(const triangle_edges_t* e, float a1, float a2, float a3) {
+    float ma = a2 - a1;
+    float ha = a3 - a1;
+    float nx = e->hy * ma - e->my * ha;
+    float ny = e->mx * ha - e->hx * ma;
+    float dx = nx * e->attr_factor;
+    float dy = ny * e->attr_factor;
+    float de = dy + dx * e->ish;
+
+    attribute_setup_t setup = {
+            .start = to_s15_16(a1 + e->fy * de),
+            .dx = to_s15_16(dx),
+            .de = to_s15_16(de),
+            .dy = to_s15_16(dy)
+    };
+    return setup;
+}
+
+INLINE u32 pack_high(s32 a, s32 b) {
+    return ((u32)a & 0xFFFF0000) | ((u32)b >> 16);
+}
+
+INLINE u32 pack_low(s32 a, s32 b) {
+    return ((u32)a << 16) | ((u32)b & 0xFFFF);
+}
+
+// Shade and texture coefficients share a layout: four attributes, integer halves then fractional halves
+static void write_attributes(u32* out, const attribute_setup_t* a) {
+    out[0] = pack_high(a[0].start, a[1].start);
+    out[1] = pack_high(a[2].start, a[3].start);
+    out[2] = pack_high(a[0].dx, a[1].dx);
+    out[3] = pack_high(a[2].dx, a[3].dx);
+    out[4] = pack_low(a[0].start, a[1].start);
+    out[5] = pack_low(a[2].start, a[3].start);
+    out[6] = pack_low(a[0].dx, a[1].dx);
+    out[7] = pack_low(a[2].dx, a[3].dx);
+    out[8] = pack_high(a[0].de, a[1].de);
+    out[9] = pack_high(a[2].de, a[3].de);
+    out[10] = pack_high(a[0].dy, a[1].dy);
+    out[11] = pack_high(a[2].dy, a[3].dy);
+    out[12] = pack_low(a[0].de, a[1].de);
+    out[13] = pack_low(a[2].de, a[3].de);
+    out[14] = pack_low(a[0].dy, a[1].dy);
+    out[15] = pack_low(a[2].dy, a[3].dy);
+}
+
+static void setup_triangle(const gfx_vertex_t* v1, const gfx_vertex_t* v2, const gfx_vertex_t* v3) {
+    const gfx_vertex_t* swap;
+#define SORT(a, b) if ((a)->sy > (b)->sy) { swap = a; a = b; b = swap; }
+    SORT(v1, v2)
+    SORT(v2, v3)
+    SORT(v1, v2)
+#undef SORT
+
+    // Y is s11.2
+    float y1 = floorf(v1->sy * 4.0f) / 4.0f;
+    float y2 = floorf(v2->sy * 4.0f) / 4.0f;
+    float y3 = floorf(v3->sy * 4.0f) / 4.0f;
+    if (y1 == y3) {
+        return;
+    }
+
+    triangle_edges_t e;
+    e.hx = v3->sx - v1->sx;
+    e.hy = y3 - y1;
+    e.mx = v2->sx - v1->sx;
+    e.my = y2 - y1;
+    float lx = v3->sx - v2->sx;
+    float ly = y3 - y2;
+    float nz = e.hx * e.my - e.hy * e.mx;
+    e.attr_factor = nz != 0.0f ? -1.0f / nz : 0.0f;
+    e.ish = e.hx / e.hy;
+    e.fy = floorf(y1) - y1;
+    float ism = e.my != 0.0f ? e.mx / e.my : 0.0f;
+    float isl = ly != 0.0f ? lx / ly : 0.0f;
+
+    bool shade = gfx.geometry_mode & gfx.bits->shade;
+    bool texture = gfx.texture.on;
+    bool zbuffer = gfx.geometry_mode & gfx.bits->zbuffer;
+    u32 command = RDP_TRIANGLE | (shade ? RDP_TRIANGLE_SHADE : 0) | (texture ? RDP_TRIANGLE_TEX : 0) | (zbuffer ? RDP_TRIANGLE_Z : 0);
+    int length = 8 + (shade ? 16 : 0) + (texture ? 16 : 0) + (zbuffer ? 4 : 0);
+
+    u32* out = reserve_rdp(length);
+    bool left_major = nz < 0.0f;
+    out[0] = (command << 24) | (left_major << 23) | ((gfx.texture.level & 7) << 19) | ((gfx.texture.tile & 7) << 16)
+            | ((s32)(y3 * 4.0f) & 0x3FFF);
+    out[1] = (((s32)(y2 * 4.0f) & 0x3FFF) << 16) | ((s32)(y1 * 4.0f) & 0x3FFF);
+    out[2] = to_s15_16(v2->sx);
+    out[3] = to_s15_16(isl);
+    out[4] = to_s15_16(v1->sx + e.fy * e.ish);
+    out[5] = to_s15_16(e.ish);
+    out[6] = to_s15_16(v1->sx + e.fy * ism);
+    out[7] = to_s15_16(ism);
+    out += 8;
+
+    if (shade) {
+        attribute_setup_t color[4] = {
+                setup_attribute(&e, v1->r, v2->r, v3->r),
+                setup_attribute(&e, v1->g, v2->g, v3->g),
+                setup_attribute(&e, v1->b, v2->b, v3->b),
+                setup_attribute(&e, v1->a, v2->a, v3->a)
+        };
+        write_attributes(out, color);
+        out += 16;
+    }
+
+    if (texture) {
+        // Perspective correct texturing interpolates s/w, t/w and 1/w, normalized so the nearest vertex has the most precision
+        float w1 = 1.0f, w2 = 1.0f, w3 = 1.0f;
+        if (gfx.othermode_h & G_TP_PERSP) {
+            float max_w = fmaxf(v1->inv_w, fmaxf(v2->inv_w, v3->inv_w));
+            w1 = v1->inv_w / max_w;
+            w2 = v2->inv_w / max_w;
+            w3 = v3->inv_w / max_w;
+        }
+        attribute_setup_t coordinates[4] = {
+                setup_attribute(&e, v1->s * w1, v2->s * w2, v3->s * w3),
+                setup_attribute(&e, v1->t * w1, v2->t * w2, v3->t * w3),
+                setup_attribute(&e, w1 * 0x7FFF, w2 * 0x7FFF, w3 * 0x7FFF),
+                { 0, 0, 0, 0 }
+        };
+        write_attributes(out, coordinates);
+        out += 16;
+    }
+
+    if (zbuffer) {
+        attribute_setup_t z = setup_attribute(&e, v1->sz, v2->sz, v3->sz);
+        out[0] = z.start;
+        out[1] = z.dx;
+        out[2] = z.de;
+        out[3] = z.dy;
+    }
+}
+
+// Culls by winding and fans the (convex) polygon out into triangles
+static void draw_polygon(const gfx_vertex_t* p, int count) {
+    float area = 0.0f;
+    for (int i = 0; i < count; i++) {
+        const gfx_vertex_t* a = &p[i];
+        const gfx_vertex_t* b = &p[(i + 1) % count];
+        area += a->sx * b->sy - b->sx * a->sy;
+    }
+    // Screen space has y pointing down, so front faces (counterclockwise) wind negative
+    if (area == 0.0f) {
+        return;
+    }
+    if ((area > 0.0f && (gfx.geometry_mode & gfx.bits->cull_back)) || (area < 0.0f && (gfx.geometry_mode & gfx.bits->cull_front))) {
+        return;
+    }
+
+    for (int i = 1; i < count - 1; i++) {
+        setup_triangle(&p[0], &p[i], &p[i + 1]);
+    }
+}
+
+static float clip_distance(const gfx_vertex_t* v, int plane) {
+    switch (plane) {
+        case 0: return v->z + v->w;
+        case 1: return GFX_GUARD_BAND * v->w - v->x;
+        case 2: return GFX_GUARD_BAND * v->w + v->x;
+        case 3: return GFX_GUARD_BAND * v->w - v->y;
+        default: return GFX_GUARD_BAND * v->w + v->y;
+    }
+}
+
+static gfx_vertex_t clip_lerp(const gfx_vertex_t* a, const gfx_vertex_t* b, float t) {
+    gfx_vertex_t v;
+#define LERP(field) v.field = a->field + (b->field - a->field) * t
+    LERP(x); LERP(y); LERP(z); LERP(w);
+    LERP(r); LERP(g); LERP(b); LERP(a);
+    LERP(s); LERP(t);
+#undef LERP
+    project(&v);
+    v.clip = 0;
+    v.frustum = 0;
+    return v;
+}
+
+static void draw_triangle(int i1, int i2, int i3, int flat) {
+    gfx_vertex_t v[3] = {
+            gfx.vertices[i1 & (GFX_MAX_VERTICES - 1)],
+            gfx.vertices[i2 & (GFX_MAX_VERTICES - 1)],
+            gfx.vertices[i3 & (GFX_MAX_VERTICES - 1)]
+    };
+    if (v[0].clip & v[1].clip & v[2].clip) {
+        return;
+    }
+
+    if (!(gfx.geometry_mode & gfx.bits->shading_smooth)) {
+        const gfx_vertex_t* source = &v[flat];
+        for (int i = 0; i < 3; i++) {
+            v[i].r = source->r;
+            v[i].g = source->g;
+            v[i].b = source->b;
+            v[i].a = source->a;
+        }
+    }
+
+    u8 clip = v[0].clip | v[1].clip | v[2].clip;
+    if (clip == 0) {
+        draw_polygon(v, 3);
+        return;
+    }
+
+    // Sutherland-Hodgman, only against the planes something is actually outside of
+    gfx_vertex_t buffers[2][MAX_CLIPPED_VERTICES];
+    gfx_vertex_t* in = v;
+    int count = 3;
+    int next_buffer = 0;
+    for (int plane = 0; plane < NUM_CLIP_PLANES && count >= 3; plane++) {
+        if (!(clip & (1 << plane))) {
+            continue;
+        }
+        gfx_vertex_t* out = buffers[next_buffer];
+        next_buffer ^= 1;
+        int out_count = 0;
+        for (int i = 0; i < count; i++) {
+            const gfx_vertex_t* current = &in[i];
+            const gfx_vertex_t* next = &in[(i + 1) % count];
+            float d_current = clip_distance(current, plane);
+            float d_next = clip_distance(next, plane);
+            if (d_current >= 0.0f) {
+                out[out_count++] = *current;
+            }
+            if ((d_current >= 0.0f) != (d_next >= 0.0f)) {
+                out[out_count++] = clip_lerp(current, next, d_current / (d_current - d_next));
+            }
+        }
+        in = out;
+        count = out_count;
+    }
+
+    if (count >= 3) {
+        draw_polygon(in, count);
+    }
+}
+
+// ---- Display list flow
+
+static void gfx_display_list(u32 address, bool push) {
+    if (push) {
+        if (gfx.dl_depth == GFX_DL_STACK_SIZE) {
+            logwarn("HLE gfx: display list stack overflow, ending the task");
+            gfx.ended = true;
+            return;
+        }
+        gfx.dl_stack[gfx.dl_depth++] = gfx.pc;
+    }
+    gfx.pc = segmented(address);
+}
+
+static void gfx_end_display_list() {
+    if (gfx.dl_depth == 0) {
+        gfx.ended = true;
+    } else {
+        gfx.pc = gfx.dl_stack[--gfx.dl_depth];
+    }
+}
+
+// Skips the rest of the display list if the vertices are all off the same side of the screen
+static void gfx_cull_display_list(int first, int last) {
+    u8 outside = 0xFF;
+    for (int i = first; i <= last && outside != 0; i++) {
+        outside &= gfx.vertices[i & (GFX_MAX_VERTICES - 1)].frustum;
+    }
+    if (outside != 0) {
+        gfx_end_display_list();
+    }
+}
+
+// Branches to the address in RDPHALF_1 if the vertex is in front of the given depth
+static void gfx_branch_z(int index, u32 z) {
+    const gfx_vertex_t* v = &gfx.vertices[index & (GFX_MAX_VERTICES - 1)];
+    float depth = v->z * v->inv_w * gfx.viewport_scale[2] + gfx.viewport_trans[2];
+    if (depth > 0x3FF || depth <= (float)(s32)z) {
+        gfx_display_list(gfx.rdphalf_1, false);
+    }
+}
+
+static void gfx_set_texture(u32 w0, u32 w1, bool on) {
+    gfx.texture.scale_s = (w1 >> 16) / 65536.0f;
+    gfx.texture.scale_t = (w1 & 0xFFFF) / 65536.0f;
+    gfx.texture.level = (w0 >> 11) & 7;
+    gfx.texture.tile = (w0 >> 8) & 7;
+    gfx.texture.on = on;
+}
+
+static void load_light(gfx_light_t* light, u32 address) {
+    for (int i = 0; i < 3; i++) {
+        light->color[i] = hle_dram_read_u8(address + i);
+        light->dir[i] = (s8)hle_dram_read_u8(address + 8 + i);
+    }
+    normalize(light->dir);
+    gfx.lights_dirty = true;
+}
+
+// vscale then vtrans, s13.2 for x and y
+static void load_viewport(u32 address) {
+    for (int i = 0; i < 3; i++) {
+        float scale = (s16)hle_dram_read_u16(address + i * 2);
+        float trans = (s16)hle_dram_read_u16(address + 8 + i * 2);
+        gfx.viewport_scale[i] = i < 2 ? scale / 4.0f : scale;
+        gfx.viewport_trans[i] = i < 2 ? trans / 4.0f : trans;
+    }
+}
+
+static void gfx_move_word(int index, u32 offset, u32 value, int light_stride) {
+    switch (index) {
+        case G_MW_NUMLIGHT: {
+            int lights = gfx.gbi == GFX_GBI_F3DEX2 ? value / 24 : (int)((value - 0x80000000) >> 5) - 1;
+            gfx.num_lights = lights < 0 ? 0 : (lights > GFX_MAX_LIGHTS ? GFX_MAX_LIGHTS : lights);
+            gfx.lights_dirty = true;
+            break;
+        }
+        case G_MW_SEGMENT:
+            gfx.segments[(offset >> 2) & 0xF] = value & 0xFFFFFF;
+            break;
+        case G_MW_FOG:
+            gfx.fog_multiplier = (s16)(value >> 16);
+            gfx.fog_offset = (s16)value;
+            break;
+        case G_MW_LIGHTCOL:
+            // Each light has its color twice, only the first copy is used for lighting
+            if (offset % light_stride == 0 && offset / light_stride <= GFX_MAX_LIGHTS) {
+                gfx_light_t* light = &gfx.lights[offset / light_stride];
+                light->color[0] = value >> 24;
+                light->color[1] = (value >> 16) & 0xFF;
+                light->color[2] = (value >> 8) & 0xFF;
+            }
+            break;
+        case G_MW_CLIP:
+        case G_MW_PERSPNORM:
+            // Clip ratios and the perspective normalization only matter to the microcode's fixed point math
+            break;
+        case G_MW_MATRIX:
+            warn_unsupported(index, "G_MW_MATRIX");
+            break;
+        default:
+            logwarn("HLE gfx: unknown G_MOVEWORD index 0x%02X", index);
+    }
+}
+
+// ---- F3D and F3DEX
+
+// F3D indexes vertices by their offset in its 40 byte per vertex buffer, F3DEX by index * 2
+INLINE int gbi1_vertex(u32 byte) {
+    return gfx.gbi == GFX_GBI_F3D ? (byte & 0xFF) / 10 : (byte & 0xFF) / 2;
+}
+
+static void gbi1_move_mem(u32 w0, u32 w1) {
+    int index = (w0 >> 16) & 0xFF;
+    u32 address = segmented(w1);
+    switch (index) {
+        case 0x80:
+            load_viewport(address);
+            break;
+        case 0x82:
+            load_light(&gfx.lookat[1], address);
+            break;
+        case 0x84:
+            load_light(&gfx.lookat[0], address);
+            break;
+        case 0x86: case 0x88: case 0x8A: case 0x8C: case 0x8E: case 0x90: case 0x92: case 0x94:
+            load_light(&gfx.lights[(index - 0x86) / 2], address);
+            break;
+        case 0x96:
+            // G_MV_TXTATT, only used by the sprite microcode
+            break;
+        case 0x9E:
+            gfx_force_matrix(w1);
+            break;
+        default:
+            logwarn("HLE gfx: unknown G_MOVEMEM index 0x%02X", index);
+    }
+}
+
+static void gbi1_command(u32 w0, u32 w1) {
+    u8 opcode = w0 >> 24;
+    switch (opcode) {
+        case 0x00: // G_SPNOOP
+        case 0xC0: // G_NOOP
+            break;
+        case 0x01: { // G_MTX
+            u8 params = (w0 >> 16) & 0xFF;
+            gfx_matrix(w1, params & 0x01, params & 0x02, params & 0x04);
+            break;
+        }
+        case 0x03: // G_MOVEMEM
+            gbi1_move_mem(w0, w1);
+            break;
+        case 0x04: // G_VTX
+            if (gfx.gbi == GFX_GBI_F3D) {
+                gfx_load_vertices(w1, (w0 >> 16) & 0xF, ((w0 >> 20) & 0xF) + 1);
+            } else {
+                gfx_load_vertices(w1, ((w0 >> 16) & 0xFF) / 2, (w0 >> 10) & 0x3F);
+            }
+            break;
+        case 0x06: // G_DL
+            gfx_display_list(w1, ((w0 >> 16) & 0xFF) == 0);
+            break;
+        case 0xAF: // G_LOAD_UCODE
+            // rsp_hle_gfx_supported() looks for this first, but gives up on display lists it can't follow to the end
+            gfx.switched_ucode = true;
+            gfx.ended = true;
+            break;
+        case 0xB0: // G_BRANCH_Z
+            if (gfx.gbi == GFX_GBI_F3D) {
+                warn_unsupported(opcode, "F3D opcode 0xB0");
+            } else {
+                gfx_branch_z((w0 & 0xFFF) / 2, w1);
+            }
+            break;
+        case 0xB1: // G_TRI2
+            if (gfx.gbi == GFX_GBI_F3D) {
+                warn_unsupported(opcode, "F3D opcode 0xB1");
+            } else {
+                draw_triangle(gbi1_vertex(w0 >> 16), gbi1_vertex(w0 >> 8), gbi1_vertex(w0), 0);
+                draw_triangle(gbi1_vertex(w1 >> 16), gbi1_vertex(w1 >> 8), gbi1_vertex(w1), 0);
+            }
+            break;
+        case 0xB2: // G_RDPHALF_CONT, G_MODIFYVTX in F3DEX
+            if (gfx.gbi != GFX_GBI_F3D) {
+                gfx_modify_vertex((w0 & 0xFFFF) / 2, (w0 >> 16) & 0xFF, w1);
+            }
+            break;
+        case 0xB3: // G_RDPHALF_2
+            break;
+        case 0xB4: // G_RDPHALF_1
+            gfx.rdphalf_1 = w1;
+            break;
+        case 0xB5: // G_LINE3D, which F3DEX uses for quadrangles
+            if (gfx.gbi == GFX_GBI_F3D) {
+                warn_unsupported(opcode, "G_LINE3D");
+            } else {
+                int v0 = gbi1_vertex(w1 >> 24), v1 = gbi1_vertex(w1 >> 16), v2 = gbi1_vertex(w1 >> 8), v3 = gbi1_vertex(w1);
+                draw_triangle(v0, v1, v2, 0);
+                draw_triangle(v0, v2, v3, 0);
+            }
+            break;
+        case 0xB6: // G_CLEARGEOMETRYMODE
+            gfx.geometry_mode &= ~w1;
+            break;
+        case 0xB7: // G_SETGEOMETRYMODE
+            gfx.geometry_mode |= w1;
+            break;
+        case 0xB8: // G_ENDDL
+            gfx_end_display_list();
+            break;
+        case 0xB9: // G_SETOTHERMODE_L
+            gfx_set_othermode(false, (w0 >> 8) & 0xFF, w0 & 0xFF, w1);
+            break;
+        case 0xBA: // G_SETOTHERMODE_H
+            gfx_set_othermode(true, (w0 >> 8) & 0xFF, w0 & 0xFF, w1);
+            break;
+        case 0xBB: // G_TEXTURE
+            gfx_set_texture(w0, w1, w0 & 0xFF);
+            break;
+        case 0xBC: // G_MOVEWORD
+            gfx_move_word(w0 & 0xFF, (w0 >> 8) & 0xFFFF, w1, 0x20);
+            break;
+        case 0xBD: // G_POPMTX, only the modelview matrix has a stack
+            if ((w1 & 1) == 0) {
+                gfx_pop_matrix(1);
+            }
+            break;
+        case 0xBE: // G_CULLDL
+            if (gfx.gbi == GFX_GBI_F3D) {
+                gfx_cull_display_list((w0 & 0xFFFFFF) / 40, w1 / 40);
+            } else {
+                gfx_cull_display_list((w0 & 0xFFFF) / 2, (w1 & 0xFFFF) / 2);
+            }
+            break;
+        case 0xBF: { // G_TRI1
+            if (gfx.gbi == GFX_GBI_F3D) {
+                // The flag picks the vertex whose color is used for flat shading
+                int flat = (w1 >> 24) & 0xFF;
+                draw_triangle(gbi1_vertex(w1 >> 16), gbi1_vertex(w1 >> 8), gbi1_vertex(w1), flat < 3 ? flat : 0);
+            } else {
+                draw_triangle(gbi1_vertex(w1 >> 16), gbi1_vertex(w1 >> 8), gbi1_vertex(w1), 0);
+            }
+            break;
+        }
+        case RDP_TEXRECT:
+        case RDP_TEXRECT_FLIP:
+            gfx_texture_rectangle(w0, w1);
+            break;
+        default:
+            if (opcode >= 0xE6) {
+                gfx_rdp_command(w0, w1);
+            } else {
+                warn_unsupported(opcode, "Unknown command");
+            }
+    }
+}
+
+// ---- F3DEX2
+
+static void gbi2_move_mem(u32 w0, u32 w1) {
+    int index = w0 & 0xFF;
+    u32 offset = ((w0 >> 8) & 0xFF) * 8;
+    u32 address = segmented(w1);
+    switch (index) {
+        case 8: // G_MV_VIEWPORT
+            load_viewport(address);
+            break;
+        case 10: // G_MV_LIGHT, lookat x and y then the lights, 24 bytes apart
+            if (offset == 0) {
+                load_light(&gfx.lookat[0], address);
+            } else if (offset == 24) {
+                load_light(&gfx.lookat[1], address);
+            } else if (offset / 24 - 2 <= GFX_MAX_LIGHTS) {
+                load_light(&gfx.lights[offset / 24 - 2], address);
+            }
+            break;
+        case 14: // G_MV_MATRIX
+            gfx_force_matrix(w1);
+            break;
+        case 2:  // G_MV_MMTX
+        case 6:  // G_MV_PMTX
+        case 12: // G_MV_POINT
+            warn_unsupported(0xDC, "G_MOVEMEM to matrices or points");
+            break;
+        default:
+            logwarn("HLE gfx: unknown G_MOVEMEM index %d", index);
+    }
+}
+
+static void gbi2_command(u32 w0, u32 w1) {
+    u8 opcode = w0 >> 24;
+    switch (opcode) {
+        case 0x00: // G_NOOP
+        case 0xE0: // G_SPNOOP
+        case 0xD3: case 0xD4: case 0xD5: // G_SPECIAL_*
+        case 0xD6: // G_DMA_IO
+        case 0xF1: // G_RDPHALF_2
+            break;
+        case 0x01: { // G_VTX
+            int count = (w0 >> 12) & 0xFF;
+            gfx_load_vertices(w1, ((w0 >> 1) & 0x7F) - count, count);
+            break;
+        }
+        case 0x02: // G_MODIFYVTX
+            gfx_modify_vertex((w0 & 0xFFFF) / 2, (w0 >> 16) & 0xFF, w1);
+            break;
+        case 0x03: // G_CULLDL
+            gfx_cull_display_list((w0 & 0xFFFF) / 2, (w1 & 0xFFFF) / 2);
+            break;
+        case 0x04: // G_BRANCH_Z
+            gfx_branch_z((w0 & 0xFFF) / 2, w1);
+            break;
+        case 0x05: // G_TRI1
+            draw_triangle(((w0 >> 16) & 0xFF) / 2, ((w0 >> 8) & 0xFF) / 2, (w0 & 0xFF) / 2, 0);
+            break;
+        case 0x06: // G_TRI2
+        case 0x07: // G_QUAD
+            draw_triangle(((w0 >> 16) & 0xFF) / 2, ((w0 >> 8) & 0xFF) / 2, (w0 & 0xFF) / 2, 0);
+            draw_triangle(((w1 >> 16) & 0xFF) / 2, ((w1 >> 8) & 0xFF) / 2, (w1 & 0xFF) / 2, 0);
+            break;
+        case 0xD7: // G_TEXTURE
+            gfx_set_texture(w0, w1, (w0 >> 1) & 0x7F);
+            break;
+        case 0xD8: // G_POPMTX
+            gfx_pop_matrix(w1 / 64);
+            break;
+        case 0xD9: // G_GEOMETRYMODE, bits to keep then bits to set
+            gfx.geometry_mode = (gfx.geometry_mode & (w0 & 0xFFFFFF)) | w1;
+            break;
+        case 0xDA: { // G_MTX, with the push bit inverted
+            u8 params = (w0 & 0xFF) ^ 0x01;
+            gfx_matrix(w1, params & 0x04, params & 0x02, params & 0x01);
+            break;
+        }
+        case 0xDB: // G_MOVEWORD
+            gfx_move_word((w0 >> 16) & 0xFF, w0 & 0xFFFF, w1, 0x18);
+            break;
+        case 0xDC: // G_MOVEMEM
+            gbi2_move_mem(w0, w1);
+            break;
+        case 0xDD: // G_LOAD_UCODE
+            // rsp_hle_gfx_supported() looks for this first, but gives up on display lists it can't follow to the end
+            gfx.switched_ucode = true;
+            gfx.ended = true;
+            break;
+        case 0xDE: // G_DL
+            gfx_display_list(w1, ((w0 >> 16) & 0xFF) == 0);
+            break;
+        case 0xDF: // G_ENDDL
+            gfx_end_display_list();
+            break;
+        case 0xE1: // G_RDPHALF_1
+            gfx.rdphalf_1 = w1;
+            break;
+        case 0xE2: { // G_SETOTHERMODE_L
+            int length = (w0 & 0xFF) + 1;
+            gfx_set_othermode(false, 32 - ((w0 >> 8) & 0xFF) - length, length, w1);
+            break;
+        }
+        case 0xE3: { // G_SETOTHERMODE_H
+            int length = (w0 & 0xFF) + 1;
+            gfx_set_othermode(true, 32 - ((w0 >> 8) & 0xFF) - length, length, w1);
+            break;
+        }
+        case RDP_TEXRECT:
+        case RDP_TEXRECT_FLIP:
+            gfx_texture_rectangle(w0, w1);
+            break;
+        default:
+            if (opcode >= 0xE6) {
+                gfx_rdp_command(w0, w1);
+            } else {
+                warn_unsupported(opcode, "Unknown command");
+            }
+    }
+}
+
+// ---- Tasks
+
+static const char* find_string(const char* data, u32 size, const char* needle) {
+    u32 length = strlen(needle);
+    for (u32 i = 0; i + length <= size; i++) {
+        if (memcmp(&data[i], needle, length) == 0) {
+            return &data[i];
+        }
+    }
+    return NULL;
+}
+
+bool rsp_hle_gfx_identify(const rsp_hle_task_t* task, rsp_hle_gfx_ucode_t* ucode) {
+    char data[SP_DMEM_SIZE];
+    u32 size = task->ucode_data_size > SP_DMEM_SIZE ? SP_DMEM_SIZE : task->ucode_data_size;
+    for (u32 i = 0; i < size; i++) {
+        data[i] = hle_dram_read_u8(task->ucode_data + i);
+    }
+
+    // e.g. "RSP Gfx ucode F3DEX       fifo 2.08  Yoshitaka Yasumoto 1999 Nintendo."
+    const char* version = find_string(data, size, "RSP Gfx ucode ");
+    if (version != NULL) {
+        const char* name = version + 14;
+        u32 remaining = size - (name - data);
+        u32 length = 0;
+        while (length < remaining && name[length] != '\0' && name[length] != '\n') {
+            length++;
+        }
+        // S2DEX and L3DEX draw sprites and lines rather than triangles
+        if (length < 3 || strncmp(name, "F3D", 3) != 0) {
+            logwarn("Graphics microcode \"%.*s\" isn't supported, leaving it to the RSP", length, name);
+            return false;
+        }
+        const char* fifo = find_string(name, length, "fifo ");
+        if (fifo == NULL) {
+            fifo = find_string(name, length, "xbus ");
+        }
+        if (fifo == NULL || fifo + 5 >= name + length) {
+            logwarn("Graphics microcode \"%.*s\" isn't supported, leaving it to the RSP", length, name);
+            return false;
+        }
+        switch (fifo[5]) {
+            case '0':
+            case '1':
+                ucode->gbi = GFX_GBI_F3DEX;
+                break;
+            case '2':
+                ucode->gbi = GFX_GBI_F3DEX2;
+                break;
+            default:
+                logwarn("Graphics microcode \"%.*s\" isn't supported, leaving it to the RSP", length, name);
+                return false;
+        }
+        loginfo("Running graphics microcode \"%.*s\" natively", length, name);
+        return true;
+    }
+
+    if (find_string(data, size, "RSP SW Version: 2.0") != NULL) {
+        ucode->gbi = GFX_GBI_F3D;
+        loginfo("Running graphics microcode F3D natively");
+        return true;
+    }
+    return false;
+}
+
+// The state a task starts with, before the display list sets anything up
+static void reset_state(const rsp_hle_gfx_ucode_t* ucode) {
+    gfx.gbi = ucode->gbi;
+    gfx.bits = ucode->gbi == GFX_GBI_F3DEX2 ? &gbi2_geometry_bits : &gbi1_geometry_bits;
+    memset(gfx.segments, 0, sizeof(gfx.segments));
+    gfx.dl_depth = 0;
+    gfx.ended = false;
+    gfx.switched_ucode = false;
+
+    gfx.modelview_depth = 0;
+    matrix_identity(&gfx.modelview[0]);
+    matrix_identity(&gfx.projection);
+    gfx.mvp_dirty = true;
+    gfx.lights_dirty = true;
+
+    gfx.geometry_mode = 0;
+    gfx.othermode_h = 0;
+    gfx.othermode_l = 0;
+    gfx.texture.on = false;
+    gfx.texture.scale_s = 1.0f;
+    gfx.texture.scale_t = 1.0f;
+    gfx.texture.level = 0;
+    gfx.texture.tile = 0;
+
+    gfx.num_lights = 1;
+    memset(gfx.lights, 0, sizeof(gfx.lights));
+    memset(gfx.lookat, 0, sizeof(gfx.lookat));
+    gfx.lookat[0].dir[0] = 1.0f;
+    gfx.lookat[1].dir[1] = 1.0f;
+    gfx.fog_multiplier = 0.0f;
+    gfx.fog_offset = 0.0f;
+    gfx.rdphalf_1 = 0;
+    gfx.num_rdp_words = 0;
+}
+
+// Follows the display lists the way rsp_hle_gfx_run() would, minding nothing but where they go. Branches that depend
+// on the geometry are followed both ways, so anything the task could run is seen.
+bool rsp_hle_gfx_supported(const rsp_hle_task_t* task, const rsp_hle_gfx_ucode_t* ucode) {
+    bool gbi2 = ucode->gbi == GFX_GBI_F3DEX2;
+    u32 segments[16];
+    memset(segments, 0, sizeof(segments));
+    u32 stack[GFX_DL_STACK_SIZE * 2];
+    int depth = 0;
+    u32 rdphalf_1 = 0;
+
+    u32 pc = hle_dram_address(task->data_ptr);
+    for (int commands = 0; commands < GFX_MAX_COMMANDS; commands++) {
+        u32 w0 = hle_dram_read_u32(pc);
+        u32 w1 = hle_dram_read_u32(pc + 4);
+        pc += 8;
+
+        u8 opcode = w0 >> 24;
+        int index = gbi2 ? (w0 >> 16) & 0xFF : w0 & 0xFF;
+        u32 offset = gbi2 ? w0 & 0xFFFF : (w0 >> 8) & 0xFFFF;
+        u32 target = (segments[(w1 >> 24) & 0xF] + (w1 & 0xFFFFFF)) & 0xFFFFFF;
+        bool branch_z = gbi2 ? opcode == 0x04 : opcode == 0xB0 && ucode->gbi != GFX_GBI_F3D;
+
+        if (opcode == (gbi2 ? 0xDD : 0xAF)) { // G_LOAD_UCODE
+            return false;
+        } else if (opcode == (gbi2 ? 0xDE : 0x06)) { // G_DL
+            if (((w0 >> 16) & 0xFF) == 0) {
+                if (depth == sizeof(stack) / sizeof(stack[0])) {
+                    return true;
+                }
+                stack[depth++] = pc;
+            }
+            pc = target;
+        } else if (opcode == (gbi2 ? 0xDF : 0xB8)) { // G_ENDDL
+            if (depth == 0) {
+                return true;
+            }
+            pc = stack[--depth];
+        } else if (opcode == (gbi2 ? 0xDB : 0xBC) && index == G_MW_SEGMENT) { // G_MOVEWORD
+            segments[(offset >> 2) & 0xF] = w1 & 0xFFFFFF;
+        } else if (opcode == (gbi2 ? 0xE1 : 0xB4)) { // G_RDPHALF_1
+            rdphalf_1 = w1;
+        } else if (branch_z) {
+            // Taken like a call, so both the branch and what follows it get looked at
+            if (depth == sizeof(stack) / sizeof(stack[0])) {
+                return true;
+            }
+            stack[depth++] = pc;
+            pc = (segments[(rdphalf_1 >> 24) & 0xF] + (rdphalf_1 & 0xFFFFFF)) & 0xFFFFFF;
+        } else if (opcode == RDP_TEXRECT || opcode == RDP_TEXRECT_FLIP) {
+            pc += 16;
+        }
+    }
+    // Runs on too long to tell. rsp_hle_gfx_run() gives up on it the same way.
+    return true;
+}
+
+bool rsp_hle_gfx_run(const rsp_hle_task_t* task, const rsp_hle_gfx_ucode_t* ucode) {
+    reset_state(ucode);
+    void (*command)(u32 w0, u32 w1) = ucode->gbi == GFX_GBI_F3DEX2 ? gbi2_command : gbi1_command;
+
+    gfx.pc = hle_dram_address(task->data_ptr);
+    int commands = 0;
+    while (!gfx.ended) {
+        if (++commands > GFX_MAX_COMMANDS) {
+            logwarn("HLE gfx: display list at 0x%08X ran for more than %d commands, ending the task", task->data_ptr, GFX_MAX_COMMANDS);
+            break;
+        }
+        u32 w0 = hle_dram_read_u32(gfx.pc);
+        u32 w1 = hle_dram_read_u32(gfx.pc + 4);
+        gfx.pc += 8;
+        command(w0, w1);
+    }
+    flush_rdp();
+    return !gfx.switched_ucode;
+}
@@ -0,0 +1,27 @@
+#ifndef N64_RSP_HLE_GFX_H
+#define N64_RSP_HLE_GFX_H
+
+#include "rsp_hle.h"
+
+// The display list formats we understand. F3D is the original Fast3D, F3DEX extends it with a bigger vertex cache
+// and packed triangle commands, and F3DEX2 renumbers everything. Variants of each (LX, LP, NoN, Rej) share its format.
+typedef enum rsp_hle_gfx_gbi {
+    GFX_GBI_F3D,
+    GFX_GBI_F3DEX,
+    GFX_GBI_F3DEX2
+} rsp_hle_gfx_gbi_t;
+
+typedef struct rsp_hle_gfx_ucode {
+    rsp_hle_gfx_gbi_t gbi;
+} rsp_hle_gfx_ucode_t;
+
+// Checks the version string in the microcode's data segment
+bool rsp_hle_gfx_identify(const rsp_hle_task_t* task, rsp_hle_gfx_ucode_t* ucode);
+// Whether the task stays on this microcode. Display lists that switch to another one with G_LOAD_UCODE are left to the RSP.
+bool rsp_hle_gfx_supported(const rsp_hle_task_t* task, const rsp_hle_gfx_ucode_t* ucode);
+// Walks the task's display list, transforming, lighting and clipping the geometry, and hands the RDP the commands the
+// microcode would have written to its output buffer. Returns false if it switched microcode after all, which drops the
+// rest of the task.
+bool rsp_hle_gfx_run(const rsp_hle_task_t* task, const rsp_hle_gfx_ucode_t* ucode);
+
+#endif //N64_RSP_HLE_GFX_H
@@ -1,6 +1,7 @@
 #include "rsp_instructions.h"
 #include <log.h>
 #include <n64_rsp_bus.h>
+#include "rsp_hle.h"
 
 #define RSP_REG_LR 31
 
@@ -104,12 +105,8 @@ RSP_INSTR(rsp_spc_slt) {
     s32 op1 = get_rsp_register(instruction.r.rs);
     s32 op2 = get_rsp_register(instruction.r.rt);
 
-    // RS - RT
-    s32 result = op1 - op2;
-    // if RS is LESS than RT
-    // aka, if result is negative
-
-    if (result < 0) {
+    // Compare directly, RS - RT can overflow
+    if (op1 < op2) {
         set_rsp_register(instruction.r.rd, 1);
     } else {
         set_rsp_register(instruction.r.rd, 0);
@@ -145,6 +142,11 @@ RSP_INSTR(rsp_spc_break) {
     N64RSP.steps = 0;
     N64RSP.status.broke = true;
 
+    // Compare before the CPU hears about it
+    if (unlikely(rsp_hle_verifying)) {
+        rsp_hle_verify_task();
+    }
+
     if (N64RSP.status.intr_on_break) {
         interrupt_raise(INTERRUPT_SP);
     }
@@ -1,5 +1,7 @@
 #include "rsp_interface.h"
 #include "rsp.h"
+#include "rsp_hle.h"
+#include "rsp_profiler.h"
 
 typedef union sp_status_write {
     u32 raw;
@@ -46,6 +48,7 @@ INLINE void set_rsp_pc(u16 pc) {
 void rsp_status_reg_write(u32 value) {
     sp_status_write_t write;
     write.raw = value;
+    bool was_halted = N64RSP.status.halt;
 
     CLEAR_SET(N64RSP.status.halt,          write.clear_halt,          write.set_halt);
     if (N64RSP.status.halt) {
@@ -69,6 +72,14 @@ void rsp_status_reg_write(u32 value) {
     CLEAR_SET(N64RSP.status.signal_5,      write.clear_signal_5,      write.set_signal_5);
     CLEAR_SET(N64RSP.status.signal_6,      write.clear_signal_6,      write.set_signal_6);
     CLEAR_SET(N64RSP.status.signal_7,      write.clear_signal_7,      write.set_signal_7);
+
+    if (was_halted && !N64RSP.status.halt) {
+        rsp_hle_start_task();
+        // Tasks run natively never reach the RSP
+        if (unlikely(rsp_profiler_enabled) && !N64RSP.status.halt) {
+            rsp_profiler_task_started();
+        }
+    }
 }
 
 u32 read_word_spreg(u32 address) {
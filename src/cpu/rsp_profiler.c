@@ -0,0 +1,343 @@
+#include "rsp_profiler.h"
+#include "rsp.h"
+#include "rsp_hle.h"
+#include "disassemble.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+
+// Distinct IMEM images and task microcode we keep separate counts for, anything past that is lumped together
+#define MAX_PROFILED_IMAGES 32
+#define MAX_PROFILED_TASKS 32
+// Hottest words listed at the top of the report
+#define REPORT_HOT_SPOTS 32
+
+typedef struct profiled_image {
+    u32 crc;
+    u64 cycles;
+    u64 counts[SP_IMEM_SIZE / 4];
+    u8 imem[SP_IMEM_SIZE];
+} profiled_image_t;
+
+// Tasks are told apart by their type and a CRC of the microcode they asked the boot microcode to load
+typedef struct profiled_task {
+    u32 type;
+    u32 ucode_crc;
+    u64 tasks;
+    u64 cycles;
+} profiled_task_t;
+
+bool rsp_profiler_enabled = false;
+bool rsp_profiler_imem_dirty = true;
+
+static const char* report_path = NULL;
+
+static profiled_image_t* images = NULL;
+static int num_images = 0;
+static profiled_image_t* current_image = NULL;
+
+static profiled_task_t tasks[MAX_PROFILED_TASKS + 1];
+static int num_tasks = 0;
+// Where cycles go before the first task, and when the RSP is started without an OSTask in DMEM
+static profiled_task_t* current_task = &tasks[MAX_PROFILED_TASKS];
+
+void rsp_profiler_start(const char* path) {
+    // One more than the limit, the last one collects every image past it
+    images = calloc(MAX_PROFILED_IMAGES + 1, sizeof(profiled_image_t));
+    if (images == NULL) {
+        logfatal("Failed to allocate memory for the RSP profiler");
+    }
+    report_path = path;
+    rsp_profiler_imem_dirty = true;
+    rsp_profiler_enabled = true;
+}
+
+static void select_image() {
+    rsp_profiler_imem_dirty = false;
+    u32 crc = crc32(0, N64RSP.sp_imem, SP_IMEM_SIZE);
+    for (int i = 0; i < num_images; i++) {
+        if (images[i].crc == crc) {
+            current_image = &images[i];
+            return;
+        }
+    }
+
+    if (num_images == MAX_PROFILED_IMAGES) {
+        current_image = &images[MAX_PROFILED_IMAGES];
+        return;
+    }
+    current_image = &images[num_images++];
+    current_image->crc = crc;
+    memcpy(current_image->imem, N64RSP.sp_imem, SP_IMEM_SIZE);
+}
+
+void rsp_profiler_count(u16 pc, int cycles) {
+    if (unlikely(rsp_profiler_imem_dirty)) {
+        select_image();
+    }
+    current_image->counts[pc & 0x3FF] += cycles;
+    current_image->cycles += cycles;
+    current_task->cycles += cycles;
+}
+
+void rsp_profiler_count_block(u16 pc, int length, int cycles) {
+    if (unlikely(rsp_profiler_imem_dirty)) {
+        select_image();
+    }
+    // Blocks run straight through, so each instruction ran once and the first one takes anything extra
+    current_image->counts[pc & 0x3FF] += cycles - length + 1;
+    for (int i = 1; i < length; i++) {
+        current_image->counts[(pc + i) & 0x3FF]++;
+    }
+    current_image->cycles += cycles;
+    current_task->cycles += cycles;
+}
+
+void rsp_profiler_task_started() {
+    u32 type = word_from_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + offsetof(rsp_hle_task_t, type));
+    u32 ucode = word_from_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + offsetof(rsp_hle_task_t, ucode));
+    u32 ucode_size = word_from_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + offsetof(rsp_hle_task_t, ucode_size));
+    u32 boot_size = word_from_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + offsetof(rsp_hle_task_t, ucode_boot_size));
+
+    // Same test as rsp_hle_start_task(), anything else isn't a task at all
+    if (boot_size > SP_IMEM_SIZE) {
+        current_task = &tasks[MAX_PROFILED_TASKS];
+        current_task->tasks++;
+        return;
+    }
+
+    ucode = hle_dram_address(ucode);
+    ucode_size = ucode_size > SP_IMEM_SIZE ? SP_IMEM_SIZE : ucode_size;
+    if (ucode + ucode_size > N64_RDRAM_SIZE) {
+        ucode_size = N64_RDRAM_SIZE - ucode;
+    }
+    u32 crc = crc32(0, &n64sys.mem.rdram[ucode], ucode_size);
+
+    current_task = NULL;
+    for (int i = 0; i < num_tasks; i++) {
+        if (tasks[i].type == type && tasks[i].ucode_crc == crc) {
+            current_task = &tasks[i];
+            break;
+        }
+    }
+    if (current_task == NULL) {
+        if (num_tasks == MAX_PROFILED_TASKS) {
+            current_task = &tasks[MAX_PROFILED_TASKS];
+        } else {
+            current_task = &tasks[num_tasks++];
+            current_task->type = type;
+            current_task->ucode_crc = crc;
+        }
+    }
+    current_task->tasks++;
+}
+
+static const char* vector_op_names[64] = {
+        [FUNCT_RSP_VEC_VMULF] = "vmulf", [FUNCT_RSP_VEC_VMULU] = "vmulu", [FUNCT_RSP_VEC_VRNDP] = "vrndp",
+        [FUNCT_RSP_VEC_VMULQ] = "vmulq", [FUNCT_RSP_VEC_VMUDL] = "vmudl", [FUNCT_RSP_VEC_VMUDM] = "vmudm",
+        [FUNCT_RSP_VEC_VMUDN] = "vmudn", [FUNCT_RSP_VEC_VMUDH] = "vmudh", [FUNCT_RSP_VEC_VMACF] = "vmacf",
+        [FUNCT_RSP_VEC_VMACU] = "vmacu", [FUNCT_RSP_VEC_VRNDN] = "vrndn", [FUNCT_RSP_VEC_VMACQ] = "vmacq",
+        [FUNCT_RSP_VEC_VMADL] = "vmadl", [FUNCT_RSP_VEC_VMADM] = "vmadm", [FUNCT_RSP_VEC_VMADN] = "vmadn",
+        [FUNCT_RSP_VEC_VMADH] = "vmadh", [FUNCT_RSP_VEC_VADD]  = "vadd",  [FUNCT_RSP_VEC_VSUB]  = "vsub",
+        [FUNCT_RSP_VEC_VABS]  = "vabs",  [FUNCT_RSP_VEC_VADDC] = "vaddc", [FUNCT_RSP_VEC_VSUBC] = "vsubc",
+        [FUNCT_RSP_VEC_VSAR]  = "vsar",  [FUNCT_RSP_VEC_VLT]   = "vlt",   [FUNCT_RSP_VEC_VEQ]   = "veq",
+        [FUNCT_RSP_VEC_VNE]   = "vne",   [FUNCT_RSP_VEC_VGE]   = "vge",   [FUNCT_RSP_VEC_VCL]   = "vcl",
+        [FUNCT_RSP_VEC_VCH]   = "vch",   [FUNCT_RSP_VEC_VCR]   = "vcr",   [FUNCT_RSP_VEC_VMRG]  = "vmrg",
+        [FUNCT_RSP_VEC_VAND]  = "vand",  [FUNCT_RSP_VEC_VNAND] = "vnand", [FUNCT_RSP_VEC_VOR]   = "vor",
+        [FUNCT_RSP_VEC_VNOR]  = "vnor",  [FUNCT_RSP_VEC_VXOR]  = "vxor",  [FUNCT_RSP_VEC_VNXOR] = "vnxor",
+        [FUNCT_RSP_VEC_VRCP]  = "vrcp",  [FUNCT_RSP_VEC_VRCPL] = "vrcpl", [FUNCT_RSP_VEC_VRCPH] = "vrcph",
+        [FUNCT_RSP_VEC_VMOV]  = "vmov",  [FUNCT_RSP_VEC_VRSQ]  = "vrsq",  [FUNCT_RSP_VEC_VRSQL] = "vrsql",
+        [FUNCT_RSP_VEC_VRSQH] = "vrsqh", [FUNCT_RSP_VEC_VNOP]  = "vnop",
+};
+
+// Indexed by the rd field, the same for loads and stores apart from swv
+static const char* vector_memory_names[16] = {
+        [LWC2_LBV] = "bv", [LWC2_LSV] = "sv", [LWC2_LLV] = "lv", [LWC2_LDV] = "dv",
+        [LWC2_LQV] = "qv", [LWC2_LRV] = "rv", [LWC2_LPV] = "pv", [LWC2_LUV] = "uv",
+        [LWC2_LHV] = "hv", [LWC2_LFV] = "fv", [SWC2_SWV] = "wv", [LWC2_LTV] = "tv",
+};
+
+static const int vector_memory_scale[16] = {
+        [LWC2_LBV] = 1,  [LWC2_LSV] = 2,  [LWC2_LLV] = 4,  [LWC2_LDV] = 8,
+        [LWC2_LQV] = 16, [LWC2_LRV] = 16, [LWC2_LPV] = 8,  [LWC2_LUV] = 8,
+        [LWC2_LHV] = 16, [LWC2_LFV] = 16, [SWC2_SWV] = 16, [LWC2_LTV] = 16,
+};
+
+// The disassembler only knows the CPU's instruction set, the RSP's COP2 and vector loads and stores are decoded here
+static void disassemble_rsp(u16 address, u32 raw, char* buf, int buflen) {
+    int opcode = raw >> 26;
+    int rs = (raw >> 21) & 0x1F;
+    int rt = (raw >> 16) & 0x1F;
+    int rd = (raw >> 11) & 0x1F;
+    int sa = (raw >> 6) & 0x1F;
+
+    if (opcode == OPC_CP2 && (raw & (1 << 25))) {
+        const char* name = vector_op_names[raw & 0x3F];
+        snprintf(buf, buflen, "%s $v%d, $v%d, $v%d[%d]", name ? name : "vnull", sa, rd, rt, rs & 0xF);
+    } else if (opcode == OPC_CP2) {
+        static const char* move_names[8] = {[0] = "mfc2", [2] = "cfc2", [4] = "mtc2", [6] = "ctc2"};
+        const char* name = rs < 8 ? move_names[rs] : NULL;
+        if (name == NULL) {
+            snprintf(buf, buflen, "cop2 0x%08X", raw);
+        } else if (rs == 2 || rs == 6) {
+            snprintf(buf, buflen, "%s $%d, $vc%d", name, rt, rd);
+        } else {
+            snprintf(buf, buflen, "%s $%d, $v%d[%d]", name, rt, rd, (raw >> 7) & 0xF);
+        }
+    } else if (opcode == RSP_OPC_LWC2 || opcode == RSP_OPC_SWC2) {
+        const char* name = rd < 16 ? vector_memory_names[rd] : NULL;
+        if (name == NULL) {
+            snprintf(buf, buflen, "%s 0x%08X", opcode == RSP_OPC_LWC2 ? "lwc2" : "swc2", raw);
+        } else {
+            // 7 bit signed offset, in units of the access size
+            int offset = ((int)(raw << 25) >> 25) * vector_memory_scale[rd];
+            snprintf(buf, buflen, "%c%s $v%d[%d], %d($%d)", opcode == RSP_OPC_LWC2 ? 'l' : 's', name, rt, (raw >> 7) & 0xF, offset, rs);
+        }
+    } else {
+        disassemble(address, raw, buf, buflen);
+    }
+}
+
+static int compare_images(const void* a, const void* b) {
+    const profiled_image_t* x = *(const profiled_image_t**)a;
+    const profiled_image_t* y = *(const profiled_image_t**)b;
+    return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
+
+static int compare_tasks(const void* a, const void* b) {
+    const profiled_task_t* x = a;
+    const profiled_task_t* y = b;
+    return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
+
+static const char* task_type_name(u32 type) {
+    switch (type) {
+        case OSTASK_TYPE_GFX: return "gfx";
+        case OSTASK_TYPE_AUDIO: return "audio";
+        default: return "other";
+    }
+}
+
+static double percent(u64 part, u64 total) {
+    return total == 0 ? 0.0 : 100.0 * (double)part / (double)total;
+}
+
+static void write_instruction(FILE* out, profiled_image_t* image, int index, u64 total) {
+    char disassembly[100];
+    u32 raw = word_from_byte_array(image->imem, index * 4);
+    disassemble_rsp(index * 4, raw, disassembly, sizeof(disassembly));
+    fprintf(out, "  %08X  %03X  %12lu  %6.2f%%  %08X  %s\n",
+            image->crc, index * 4, image->counts[index], percent(image->counts[index], total), raw, disassembly);
+}
+
+void rsp_profiler_write_report() {
+    if (!rsp_profiler_enabled) {
+        return;
+    }
+    FILE* out = fopen(report_path, "w");
+    if (out == NULL) {
+        logwarn("Failed to open %s to write the RSP profile to", report_path);
+        return;
+    }
+
+    u64 total = 0;
+    u64 total_tasks = 0;
+    for (int i = 0; i <= MAX_PROFILED_TASKS; i++) {
+        total += tasks[i].cycles;
+        total_tasks += tasks[i].tasks;
+    }
+    fprintf(out, "RSP profile: %lu cycles over %lu tasks\n", total, total_tasks);
+
+    fprintf(out, "\nTasks by microcode:\n");
+    fprintf(out, "  type   ucode CRC  %10s  %14s  %7s  %12s\n", "tasks", "cycles", "share", "cycles/task");
+    profiled_task_t sorted_tasks[MAX_PROFILED_TASKS + 1];
+    memcpy(sorted_tasks, tasks, sizeof(tasks));
+    qsort(sorted_tasks, MAX_PROFILED_TASKS + 1, sizeof(profiled_task_t), compare_tasks);
+    for (int i = 0; i <= MAX_PROFILED_TASKS; i++) {
+        const profiled_task_t* task = &sorted_tasks[i];
+        if (task->cycles == 0 && task->tasks == 0) {
+            continue;
+        }
+        // The catch-all entry is the one with no type
+        if (task->type == 0) {
+            fprintf(out, "  %-5s  %9s", "-", "-");
+        } else {
+            fprintf(out, "  %-5s  %08X ", task_type_name(task->type), task->ucode_crc);
+        }
+        fprintf(out, "  %10lu  %14lu  %6.2f%%  %12lu\n", task->tasks, task->cycles, percent(task->cycles, total),
+                task->tasks == 0 ? 0 : task->cycles / task->tasks);
+    }
+
+    profiled_image_t* sorted_images[MAX_PROFILED_IMAGES + 1];
+    int num_sorted = 0;
+    for (int i = 0; i <= MAX_PROFILED_IMAGES; i++) {
+        if (images[i].cycles > 0) {
+            sorted_images[num_sorted++] = &images[i];
+        }
+    }
+    qsort(sorted_images, num_sorted, sizeof(profiled_image_t*), compare_images);
+
+    fprintf(out, "\nIMEM images:\n");
+    for (int i = 0; i < num_sorted; i++) {
+        const profiled_image_t* image = sorted_images[i];
+        if (image == &images[MAX_PROFILED_IMAGES]) {
+            fprintf(out, "  (the rest)  %14lu  %6.2f%%\n", image->cycles, percent(image->cycles, total));
+        } else {
+            fprintf(out, "  %08X    %14lu  %6.2f%%\n", image->crc, image->cycles, percent(image->cycles, total));
+        }
+    }
+
+    // Repeatedly pick the hottest word not yet listed, there are few enough of these for that not to matter
+    fprintf(out, "\nHot spots:\n");
+    fprintf(out, "  IMEM CRC  addr  %12s  %7s  raw       instruction\n", "cycles", "share");
+    u64 listed_below = UINT64_MAX;
+    int listed = 0;
+    while (listed < REPORT_HOT_SPOTS) {
+        u64 best = 0;
+        for (int i = 0; i < num_sorted; i++) {
+            if (sorted_images[i] == &images[MAX_PROFILED_IMAGES]) {
+                continue;
+            }
+            for (int index = 0; index < SP_IMEM_SIZE / 4; index++) {
+                u64 count = sorted_images[i]->counts[index];
+                if (count > best && count < listed_below) {
+                    best = count;
+                }
+            }
+        }
+        if (best == 0) {
+            break;
+        }
+        for (int i = 0; i < num_sorted && listed < REPORT_HOT_SPOTS; i++) {
+            if (sorted_images[i] == &images[MAX_PROFILED_IMAGES]) {
+                continue;
+            }
+            for (int index = 0; index < SP_IMEM_SIZE / 4 && listed < REPORT_HOT_SPOTS; index++) {
+                if (sorted_images[i]->counts[index] == best) {
+                    write_instruction(out, sorted_images[i], index, total);
+                    listed++;
+                }
+            }
+        }
+        listed_below = best;
+    }
+
+    for (int i = 0; i < num_sorted; i++) {
+        profiled_image_t* image = sorted_images[i];
+        if (image == &images[MAX_PROFILED_IMAGES]) {
+            continue;
+        }
+        fprintf(out, "\nIMEM %08X, %lu cycles:\n", image->crc, image->cycles);
+        for (int index = 0; index < SP_IMEM_SIZE / 4; index++) {
+            if (image->counts[index] > 0) {
+                write_instruction(out, image, index, image->cycles);
+            }
+        }
+    }
+
+    fclose(out);
+    loginfo("Wrote the RSP profile to %s", report_path);
+}
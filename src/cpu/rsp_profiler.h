@@ -0,0 +1,37 @@
+#ifndef N64_RSP_PROFILER_H
+#define N64_RSP_PROFILER_H
+
+#include <stdbool.h>
+#include <util.h>
+
+// Counts where the RSP spends its time, per microcode. Microcode is told apart by a CRC of the whole of IMEM, so an
+// overlay swapped in part way through a task shows up as its own entry.
+// The interpreter counts every instruction. The dynarec counts whole blocks, and every instruction in a block is counted
+// once each time it runs. Cycles a block takes beyond one per instruction are counted on its first instruction.
+
+extern bool rsp_profiler_enabled;
+// Set when IMEM changes, so the next count works out which microcode it belongs to
+extern bool rsp_profiler_imem_dirty;
+
+// Starts profiling, the report goes to path when rsp_profiler_write_report() is called
+void rsp_profiler_start(const char* path);
+void rsp_profiler_write_report();
+// Called when the CPU takes the RSP out of halt
+void rsp_profiler_task_started();
+void rsp_profiler_count(u16 pc, int cycles);
+void rsp_profiler_count_block(u16 pc, int length, int cycles);
+
+// pc is in words, the way the RSP keeps it
+INLINE void rsp_profile(u16 pc, int cycles) {
+    if (unlikely(rsp_profiler_enabled)) {
+        rsp_profiler_count(pc, cycles);
+    }
+}
+
+INLINE void rsp_profile_block(u16 pc, int length, int cycles) {
+    if (unlikely(rsp_profiler_enabled)) {
+        rsp_profiler_count_block(pc, length, cycles);
+    }
+}
+
+#endif //N64_RSP_PROFILER_H
@@ -7,14 +7,15 @@
 #include <emmintrin.h>
 #endif
 #include <util.h>
+
+#define SP_DMEM_SIZE 0x1000
+#define SP_IMEM_SIZE 0x1000
+
 #include <cpu/dynarec/rsp_dynarec.h>
 #include "mips_instruction_decode.h"
 
 #define vecr __m128i
 
-#define SP_DMEM_SIZE 0x1000
-#define SP_IMEM_SIZE 0x1000
-
 typedef union vu_reg {
     // Used by instructions
     u8 bytes[16];
@@ -1,11 +1,16 @@
 #include "rsp_vector_instructions.h"
 
-#ifdef N64_USE_SIMD
+// rsp_vector_instructions_scalar.c builds this file a second time without the SIMD kernels
+#if defined(N64_USE_SIMD) && !defined(N64_RSP_SCALAR_KERNELS)
+#define RSP_SIMD_KERNELS
+#endif
+
+#ifdef RSP_SIMD_KERNELS
 #include <emmintrin.h>
 #endif
 
 #include <log.h>
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
 #include <immintrin.h>
 #include <n64_rsp_bus.h>
 
@@ -38,7 +43,7 @@ INLINE bool is_sign_extension(s16 high, s16 low) {
     return false;
 }
 
-#ifndef N64_USE_SIMD
+#ifndef RSP_SIMD_KERNELS
 INLINE vu_reg_t broadcast(vu_reg_t* vt, int lane0, int lane1, int lane2, int lane3, int lane4, int lane5, int lane6, int lane7) {
     vu_reg_t vte;
     vte.elements[VU_ELEM_INDEX(0)] = vt->elements[VU_ELEM_INDEX(lane0)];
@@ -59,42 +64,42 @@ INLINE vu_reg_t get_vte(vu_reg_t* vt, u8 e) {
         case 0 ... 1:
             return *vt;
         case 2:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vt->single, 0b11110101), 0b11110101);
 #else
             vte = broadcast(vt, 0, 0, 2, 2, 4, 4, 6, 6);
 #endif
             break;
         case 3:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vt->single, 0b10100000), 0b10100000);
 #else
             vte = broadcast(vt, 1, 1, 3, 3, 5, 5, 7, 7);
 #endif
             break;
         case 4:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vt->single, 0b11111111), 0b11111111);
 #else
             vte = broadcast(vt, 0, 0, 0, 0, 4, 4, 4, 4);
 #endif
             break;
         case 5:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vt->single, 0b10101010), 0b10101010);
 #else
             vte = broadcast(vt, 1, 1, 1, 1, 5, 5, 5, 5);
 #endif
             break;
         case 6:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vt->single, 0b01010101), 0b01010101);
 #else
             vte = broadcast(vt, 2, 2, 2, 2, 6, 6, 6, 6);
 #endif
             break;
         case 7:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vt->single, 0b00000000), 0b00000000);
 #else
             vte = broadcast(vt, 3, 3, 3, 3, 7, 7, 7, 7);
@@ -102,7 +107,7 @@ INLINE vu_reg_t get_vte(vu_reg_t* vt, u8 e) {
             break;
         case 8 ... 15: {
             int index = VU_ELEM_INDEX(e - 8);
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vte.single = _mm_set1_epi16(vt->elements[index]);
 #else
             for (int i = 0; i < 8; i++) {
@@ -119,10 +124,83 @@ INLINE vu_reg_t get_vte(vu_reg_t* vt, u8 e) {
     return vte;
 }
 
+#ifdef RSP_SIMD_KERNELS
+INLINE vecr select_lanes(vecr mask, vecr if_set, vecr if_clear) {
+    return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+}
+
+// Shared tail of veq/vne/vlt/vge: vcc.l picks between vs and vte, then the other flags are cleared.
+INLINE void finish_compare(vu_reg_t* vs, vu_reg_t* vd, vu_reg_t* vte) {
+    N64RSP.acc.l.single = select_lanes(N64RSP.vcc.l.single, vs->single, vte->single);
+    vd->single = N64RSP.acc.l.single;
+    N64RSP.vcc.h.single = N64RSP.zero;
+    N64RSP.vco.h.single = N64RSP.zero;
+    N64RSP.vco.l.single = N64RSP.zero;
+}
+
+// Adds a 48 bit value, split into 16 bit low/mid/high lanes like the accumulator itself, to the accumulator. A wrapped
+// add carried out exactly where it differs from the unsigned saturating add, which keeps the carries exact.
+INLINE void accumulate(vecr lo, vecr mid, vecr hi) {
+    vecr all_ones = _mm_cmpeq_epi16(lo, lo);
+    vecr carry_lo = _mm_adds_epu16(N64RSP.acc.l.single, lo);
+    N64RSP.acc.l.single = _mm_add_epi16(N64RSP.acc.l.single, lo);
+    carry_lo = _mm_xor_si128(_mm_cmpeq_epi16(carry_lo, N64RSP.acc.l.single), all_ones);
+
+    vecr carry_mid = _mm_adds_epu16(N64RSP.acc.m.single, mid);
+    N64RSP.acc.m.single = _mm_add_epi16(N64RSP.acc.m.single, mid);
+    carry_mid = _mm_xor_si128(_mm_cmpeq_epi16(carry_mid, N64RSP.acc.m.single), all_ones);
+    // The carry from the low lanes is -1 where set. Adding it carries out only if mid wrapped around to zero.
+    N64RSP.acc.m.single = _mm_sub_epi16(N64RSP.acc.m.single, carry_lo);
+    carry_mid = _mm_or_si128(carry_mid, _mm_and_si128(carry_lo, _mm_cmpeq_epi16(N64RSP.acc.m.single, N64RSP.zero)));
+
+    N64RSP.acc.h.single = _mm_sub_epi16(_mm_add_epi16(N64RSP.acc.h.single, hi), carry_mid);
+}
+
+// Bits 47..16 of the accumulator clamped to a signed 16 bit value
+INLINE vecr acc_clamp_signed() {
+    vecr lo = _mm_unpacklo_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
+    vecr hi = _mm_unpackhi_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// Bits 47..16 of the accumulator: 0 if negative, 0xFFFF if above 0x7FFF, otherwise unchanged
+INLINE vecr acc_clamp_unsigned() {
+    vecr lo = _mm_unpacklo_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
+    vecr hi = _mm_unpackhi_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
+    vecr clamped = _mm_packus_epi32(lo, hi);
+    return _mm_or_si128(clamped, _mm_srai_epi16(clamped, 15));
+}
+
+// The low lanes of the accumulator if the high and mid lanes are just their sign extension, otherwise 0 if the
+// accumulator is negative and 0xFFFF if it's positive.
+INLINE vecr acc_clamp_low() {
+    vecr sign = _mm_srai_epi16(N64RSP.acc.h.single, 15);
+    vecr sign_extension = _mm_and_si128(_mm_cmpeq_epi16(sign, N64RSP.acc.h.single),
+                                        _mm_cmpeq_epi16(sign, _mm_srai_epi16(N64RSP.acc.m.single, 15)));
+    return _mm_blendv_epi8(_mm_cmpeq_epi16(sign, N64RSP.zero), N64RSP.acc.l.single, sign_extension);
+}
+
+// The product of a signed and an unsigned operand. pmulhuw treats both as unsigned, so the unsigned operand is taken
+// back off the high half where the signed one is negative.
+INLINE vecr mulhi_mixed(vecr s, vecr u) {
+    return _mm_sub_epi16(_mm_mulhi_epu16(s, u), _mm_and_si128(u, _mm_srai_epi16(s, 15)));
+}
 
+// vs * vte * 2 as a sign extended 48 bit value, for the fractional multiplies
+INLINE void mul_fraction(vu_reg_t* vs, vu_reg_t* vte, vecr* lo, vecr* mid, vecr* hi) {
+    vecr prod_lo = _mm_mullo_epi16(vs->single, vte->single);
+    vecr prod_hi = _mm_mulhi_epi16(vs->single, vte->single);
+    *lo  = _mm_slli_epi16(prod_lo, 1);
+    *mid = _mm_or_si128(_mm_slli_epi16(prod_hi, 1), _mm_srli_epi16(prod_lo, 15));
+    *hi  = _mm_srai_epi16(prod_hi, 15);
+}
+#endif
+
+#ifndef N64_RSP_SCALAR_KERNELS
 vu_reg_t ext_get_vte(vu_reg_t* vt, u8 e) {
     return get_vte(vt, e);
 }
+#endif
 
 
 #define SHIFT_AMOUNT_LBV_SBV 0
@@ -146,7 +224,7 @@ INLINE int sign_extend_7bit_offset(u8 offset, int shift_amount) {
     return uofs << shift_amount;
 }
 
-u32 rcp(s32 sinput) {
+static u32 rcp(s32 sinput) {
     // One's complement absolute value, xor with the sign bit to invert all bits if the sign bit is set
     s32 mask = sinput >> 31;
     s32 input = sinput ^ mask;
@@ -169,7 +247,7 @@ u32 rcp(s32 sinput) {
     return result;
 }
 
-u32 rsq(u32 input) {
+static u32 rsq(u32 input) {
     if (input == 0) {
         return 0x7FFFFFFF;
     } else if (input == 0xFFFF8000) {
@@ -289,9 +367,10 @@ RSP_VECTOR_INSTR(rsp_lwc2_lqv) {
     logdebug("rsp_lwc2_lqv");
     int e = instruction.v.element;
     u32 address = get_rsp_register(instruction.v.base) + sign_extend_7bit_offset(instruction.v.offset, SHIFT_AMOUNT_LQV_SQV);
-    u32 end_address = ((address & ~15) + 15);
+    // Stops at the end of the 16 byte line. Counting bytes rather than comparing addresses can't overflow.
+    int length = 16 - (address & 15);
 
-    for (int i = 0; address + i <= end_address && i + e < 16; i++) {
+    for (int i = 0; i < length && i + e < 16; i++) {
         N64RSP.vu_regs[instruction.v.vt].bytes[VU_BYTE_INDEX(i + e)] = n64_rsp_read_byte(address + i);
     }
 }
@@ -494,9 +573,9 @@ RSP_VECTOR_INSTR(rsp_swc2_sqv) {
     logdebug("rsp_swc2_sqv");
     int e = instruction.v.element;
     u32 address = get_rsp_register(instruction.v.base) + sign_extend_7bit_offset(instruction.v.offset, SHIFT_AMOUNT_LQV_SQV);
-    u32 end_address = ((address & ~15) + 15);
+    int length = 16 - (address & 15);
 
-    for (int i = 0; address + i <= end_address; i++) {
+    for (int i = 0; i < length; i++) {
         n64_rsp_write_byte(address + i, N64RSP.vu_regs[instruction.v.vt].bytes[VU_BYTE_INDEX((i + e) & 15)]);
     }
 }
@@ -605,24 +684,16 @@ RSP_VECTOR_INSTR(rsp_ctc2) {
     u16 value = get_rsp_register(instruction.r.rt) & 0xFFFF;
     switch (instruction.r.rd & 3) {
         case 0: { // VCO
-            for (int i = 0; i < 8; i++) {
-                N64RSP.vco.h.elements[VU_ELEM_INDEX(i)] = FLAGREG_BOOL(((value >> (i + 8)) & 1) == 1);
-                N64RSP.vco.l.elements[VU_ELEM_INDEX(i)] = FLAGREG_BOOL(((value >> i) & 1) == 1);
-            }
+            rsp_set_vco(value);
             break;
         }
         case 1: { // VCC
-            for (int i = 0; i < 8; i++) {
-                N64RSP.vcc.h.elements[VU_ELEM_INDEX(i)] = FLAGREG_BOOL(((value >> (i + 8)) & 1) == 1);
-                N64RSP.vcc.l.elements[VU_ELEM_INDEX(i)] = FLAGREG_BOOL(((value >> i) & 1) == 1);
-            }
+            rsp_set_vcc(value);
             break;
         }
         case 2:
         case 3: { // VCE
-            for (int i = 0; i < 8; i++) {
-                N64RSP.vce.elements[VU_ELEM_INDEX(i)] = FLAGREG_BOOL(((value >> i) & 1) == 1);
-            }
+            rsp_set_vce(value & 0xFF);
             break;
         }
     }
@@ -653,7 +724,7 @@ RSP_VECTOR_INSTR(rsp_vec_vabs) {
     defvd;
     defvte;
 
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     // check if each element is zero
     __m128i vs_is_zero = _mm_cmpeq_epi16(vs->single, N64RSP.zero);
 
@@ -700,6 +771,16 @@ RSP_VECTOR_INSTR(rsp_vec_vadd) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    // The carry lanes are -1 when set, so subtracting them adds the carry in.
+    vecr carry = N64RSP.vco.l.single;
+    N64RSP.acc.l.single = _mm_sub_epi16(_mm_add_epi16(vs->single, vte.single), carry);
+    // Adding the carry to the smaller operand first can only saturate if both are 0x7FFF, where the result saturates anyway.
+    vecr minimum = _mm_subs_epi16(_mm_min_epi16(vs->single, vte.single), carry);
+    vd->single = _mm_adds_epi16(minimum, _mm_max_epi16(vs->single, vte.single));
+    N64RSP.vco.l.single = N64RSP.zero;
+    N64RSP.vco.h.single = N64RSP.zero;
+#else
     for (int i = 0; i < 8; i++) {
         s16 vs_element = vs->signed_elements[i];
         s16 vte_element = vte.signed_elements[i];
@@ -709,6 +790,7 @@ RSP_VECTOR_INSTR(rsp_vec_vadd) {
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vaddc) {
@@ -717,6 +799,14 @@ RSP_VECTOR_INSTR(rsp_vec_vaddc) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    vecr result = _mm_add_epi16(vs->single, vte.single);
+    // The unsigned sum carried out if saturating didn't give the same answer as wrapping
+    N64RSP.vco.l.single = _mm_xor_si128(_mm_cmpeq_epi16(result, _mm_adds_epu16(vs->single, vte.single)), _mm_cmpeq_epi16(result, result));
+    N64RSP.vco.h.single = N64RSP.zero;
+    N64RSP.acc.l.single = result;
+    vd->single = result;
+#else
     for (int i = 0; i < 8; i++) {
         u16 vs_element = vs->elements[i];
         u16 vte_element = vte.elements[i];
@@ -726,6 +816,7 @@ RSP_VECTOR_INSTR(rsp_vec_vaddc) {
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL((result >> 16) & 1);
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vand) {
@@ -856,6 +947,10 @@ RSP_VECTOR_INSTR(rsp_vec_veq) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    N64RSP.vcc.l.single = _mm_andnot_si128(N64RSP.vco.h.single, _mm_cmpeq_epi16(vs->single, vte.single));
+    finish_compare(vs, vd, &vte);
+#else
     for (int i = 0; i < 8; i++) {
         N64RSP.vcc.l.elements[i] = FLAGREG_BOOL((N64RSP.vco.h.elements[i] == 0) && (vs->elements[i] == vte.elements[i]));
         N64RSP.acc.l.elements[i] = N64RSP.vcc.l.elements[i] != 0 ? vs->elements[i] : vte.elements[i];
@@ -865,6 +960,7 @@ RSP_VECTOR_INSTR(rsp_vec_veq) {
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vge) {
@@ -873,6 +969,12 @@ RSP_VECTOR_INSTR(rsp_vec_vge) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    vecr eql = _mm_cmpeq_epi16(vs->single, vte.single);
+    vecr neg = _mm_andnot_si128(_mm_and_si128(N64RSP.vco.l.single, N64RSP.vco.h.single), eql);
+    N64RSP.vcc.l.single = _mm_or_si128(neg, _mm_cmpgt_epi16(vs->single, vte.single));
+    finish_compare(vs, vd, &vte);
+#else
     for (int i = 0; i < 8; i++) {
         bool eql = vs->signed_elements[i] == vte.signed_elements[i];
         bool neg = !(N64RSP.vco.l.elements[i] != 0 && N64RSP.vco.h.elements[i] != 0) && eql;
@@ -885,6 +987,7 @@ RSP_VECTOR_INSTR(rsp_vec_vge) {
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
 
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vlt) {
@@ -893,6 +996,12 @@ RSP_VECTOR_INSTR(rsp_vec_vlt) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    vecr eql = _mm_cmpeq_epi16(vs->single, vte.single);
+    vecr neg = _mm_and_si128(_mm_and_si128(N64RSP.vco.l.single, N64RSP.vco.h.single), eql);
+    N64RSP.vcc.l.single = _mm_or_si128(neg, _mm_cmplt_epi16(vs->single, vte.single));
+    finish_compare(vs, vd, &vte);
+#else
     for (int i = 0; i < 8; i++) {
         bool eql = vs->elements[i] == vte.elements[i];
         bool neg = N64RSP.vco.h.elements[i] != 0 && N64RSP.vco.l.elements[i] != 0 && eql;
@@ -903,6 +1012,7 @@ RSP_VECTOR_INSTR(rsp_vec_vlt) {
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmacf) {
@@ -910,6 +1020,12 @@ RSP_VECTOR_INSTR(rsp_vec_vmacf) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    vecr lo, mid, hi;
+    mul_fraction(vs, &vte, &lo, &mid, &hi);
+    accumulate(lo, mid, hi);
+    vd->single = acc_clamp_signed();
+#else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
@@ -925,6 +1041,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmacf) {
 
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmacq) {
@@ -949,6 +1066,12 @@ RSP_VECTOR_INSTR(rsp_vec_vmacu) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    vecr lo, mid, hi;
+    mul_fraction(vs, &vte, &lo, &mid, &hi);
+    accumulate(lo, mid, hi);
+    vd->single = acc_clamp_unsigned();
+#else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
@@ -964,6 +1087,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmacu) {
 
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmadh) {
@@ -971,25 +1095,16 @@ RSP_VECTOR_INSTR(rsp_vec_vmadh) {
     defvs;
     defvd;
     defvte;
-#ifdef N64_USE_SIMD
-    vecr lo, hi, omask;
-    lo                 = _mm_mullo_epi16(vs->single, vte.single);
-    hi                 = _mm_mulhi_epi16(vs->single, vte.single);
-    omask              = _mm_adds_epu16(N64RSP.acc.m.single, lo);
-    N64RSP.acc.m.single  = _mm_add_epi16(N64RSP.acc.m.single, lo);
-    omask              = _mm_cmpeq_epi16(N64RSP.acc.m.single, omask);
-    omask              = _mm_cmpeq_epi16(omask, N64RSP.zero);
-    hi                 = _mm_sub_epi16(hi, omask);
-    N64RSP.acc.h.single  = _mm_add_epi16(N64RSP.acc.h.single, hi);
-    lo                 = _mm_unpacklo_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
-    hi                 = _mm_unpackhi_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
-    vd->single         = _mm_packs_epi32(lo, hi);
+#ifdef RSP_SIMD_KERNELS
+    // The product goes in bits 47..16, so it can't carry out of the low lanes
+    accumulate(N64RSP.zero, _mm_mullo_epi16(vs->single, vte.single), _mm_mulhi_epi16(vs->single, vte.single));
+    vd->single = acc_clamp_signed();
 #else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
         s32 prod = multiplicand1 * multiplicand2;
-        word uprod = prod;
+        u32 uprod = prod;
 
         u64 acc_delta = (u64)uprod << 16;
         s64 acc = get_rsp_accumulator(e) + acc_delta;
@@ -1008,6 +1123,10 @@ RSP_VECTOR_INSTR(rsp_vec_vmadl) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    accumulate(_mm_mulhi_epu16(vs->single, vte.single), N64RSP.zero, N64RSP.zero);
+    vd->single = acc_clamp_low();
+#else
     for (int e = 0; e < 8; e++) {
         u64 multiplicand1 = vte.elements[e];
         u64 multiplicand2 = vs->elements[e];
@@ -1028,6 +1147,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmadl) {
 
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmadm) {
@@ -1035,28 +1155,10 @@ RSP_VECTOR_INSTR(rsp_vec_vmadm) {
     defvs;
     defvd;
     defvte;
-#ifdef N64_USE_SIMD
-    vecr lo, hi, sign, vta, omask;
-    lo                 = _mm_mullo_epi16(vs->single, vte.single);
-    hi                 = _mm_mulhi_epu16(vs->single, vte.single);
-    sign               = _mm_srai_epi16(vs->single, 15);
-    vta                = _mm_and_si128(vte.single, sign);
-    hi                 = _mm_sub_epi16(hi, vta);
-    omask              = _mm_adds_epu16(N64RSP.acc.l.single, lo);
-    N64RSP.acc.l.single  = _mm_add_epi16(N64RSP.acc.l.single, lo);
-    omask              = _mm_cmpeq_epi16(N64RSP.acc.l.single, omask);
-    omask              = _mm_cmpeq_epi16(omask, N64RSP.zero);
-    hi                 = _mm_sub_epi16(hi, omask);
-    omask              = _mm_adds_epu16(N64RSP.acc.m.single, hi);
-    N64RSP.acc.m.single  = _mm_add_epi16(N64RSP.acc.m.single, hi);
-    omask              = _mm_cmpeq_epi16(N64RSP.acc.m.single, omask);
-    omask              = _mm_cmpeq_epi16(omask, N64RSP.zero);
-    hi                 = _mm_srai_epi16(hi, 15);
-    N64RSP.acc.h.single  = _mm_add_epi16(N64RSP.acc.h.single, hi);
-    N64RSP.acc.h.single  = _mm_sub_epi16(N64RSP.acc.h.single, omask);
-    lo                 = _mm_unpacklo_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
-    hi                 = _mm_unpackhi_epi16(N64RSP.acc.m.single, N64RSP.acc.h.single);
-    vd->single         = _mm_packs_epi32(lo, hi);
+#ifdef RSP_SIMD_KERNELS
+    vecr mid = mulhi_mixed(vs->single, vte.single);
+    accumulate(_mm_mullo_epi16(vs->single, vte.single), mid, _mm_srai_epi16(mid, 15));
+    vd->single = acc_clamp_signed();
 #else
     for (int e = 0; e < 8; e++) {
         u16 multiplicand1 = vte.elements[e];
@@ -1081,32 +1183,10 @@ RSP_VECTOR_INSTR(rsp_vec_vmadn) {
     defvs;
     defvd;
     defvte;
-#ifdef N64_USE_SIMD
-    vecr lo, hi, sign, vsa, omask, nhi, nmd, shi, smd, cmask, cval;
-    lo                 = _mm_mullo_epi16(vs->single, vte.single);
-    hi                 = _mm_mulhi_epu16(vs->single, vte.single);
-    sign               = _mm_srai_epi16(vte.single, 15);
-    vsa                = _mm_and_si128(vs->single, sign);
-    hi                 = _mm_sub_epi16(hi, vsa);
-    omask              = _mm_adds_epu16(N64RSP.acc.l.single, lo);
-    N64RSP.acc.l.single  = _mm_add_epi16(N64RSP.acc.l.single, lo);
-    omask              = _mm_cmpeq_epi16(N64RSP.acc.l.single, omask);
-    omask              = _mm_cmpeq_epi16(omask, N64RSP.zero);
-    hi                 = _mm_sub_epi16(hi, omask);
-    omask              = _mm_adds_epu16(N64RSP.acc.m.single, hi);
-    N64RSP.acc.m.single  = _mm_add_epi16(N64RSP.acc.m.single, hi);
-    omask              = _mm_cmpeq_epi16(N64RSP.acc.m.single, omask);
-    omask              = _mm_cmpeq_epi16(omask, N64RSP.zero);
-    hi                 = _mm_srai_epi16(hi, 15);
-    N64RSP.acc.h.single  = _mm_add_epi16(N64RSP.acc.h.single, hi);
-    N64RSP.acc.h.single  = _mm_sub_epi16(N64RSP.acc.h.single, omask);
-    nhi                = _mm_srai_epi16(N64RSP.acc.h.single, 15);
-    nmd                = _mm_srai_epi16(N64RSP.acc.m.single, 15);
-    shi                = _mm_cmpeq_epi16(nhi, N64RSP.acc.h.single);
-    smd                = _mm_cmpeq_epi16(nhi, nmd);
-    cmask              = _mm_and_si128(smd, shi);
-    cval               = _mm_cmpeq_epi16(nhi, N64RSP.zero);
-    vd->single         = _mm_blendv_epi8(cval, N64RSP.acc.l.single, cmask);
+#ifdef RSP_SIMD_KERNELS
+    vecr mid = mulhi_mixed(vte.single, vs->single);
+    accumulate(_mm_mullo_epi16(vs->single, vte.single), mid, _mm_srai_epi16(mid, 15));
+    vd->single = acc_clamp_low();
 #else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
@@ -1160,7 +1240,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmov) {
     u8 de = instruction.cp2_vec.vs & 7;
 
     u16 vte_elem = vte.elements[VU_ELEM_INDEX(se)];
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     vd->elements[VU_ELEM_INDEX(de)] = vte_elem;
     N64RSP.acc.l = vte;
 #else
@@ -1177,6 +1257,12 @@ RSP_VECTOR_INSTR(rsp_vec_vmrg) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    N64RSP.acc.l.single = select_lanes(N64RSP.vcc.l.single, vs->single, vte.single);
+    vd->single = N64RSP.acc.l.single;
+    N64RSP.vco.l.single = N64RSP.zero;
+    N64RSP.vco.h.single = N64RSP.zero;
+#else
     for (int i = 0; i < 8; i++) {
         N64RSP.acc.l.elements[i] = N64RSP.vcc.l.elements[i] != 0 ? vs->elements[i] : vte.elements[i];
         vd->elements[i] = N64RSP.acc.l.elements[i];
@@ -1184,6 +1270,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmrg) {
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmudh) {
@@ -1191,6 +1278,12 @@ RSP_VECTOR_INSTR(rsp_vec_vmudh) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    N64RSP.acc.l.single = N64RSP.zero;
+    N64RSP.acc.m.single = _mm_mullo_epi16(vs->single, vte.single);
+    N64RSP.acc.h.single = _mm_mulhi_epi16(vs->single, vte.single);
+    vd->single = acc_clamp_signed();
+#else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
@@ -1205,6 +1298,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmudh) {
 
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmudl) {
@@ -1212,6 +1306,13 @@ RSP_VECTOR_INSTR(rsp_vec_vmudl) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    // The product shifted down can't reach the mid lanes, so it's always its own sign extension
+    N64RSP.acc.l.single = _mm_mulhi_epu16(vs->single, vte.single);
+    N64RSP.acc.m.single = N64RSP.zero;
+    N64RSP.acc.h.single = N64RSP.zero;
+    vd->single = N64RSP.acc.l.single;
+#else
     for (int e = 0; e < 8; e++) {
         u64 multiplicand1 = vte.elements[e];
         u64 multiplicand2 = vs->elements[e];
@@ -1231,6 +1332,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmudl) {
 
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmudm) {
@@ -1238,6 +1340,13 @@ RSP_VECTOR_INSTR(rsp_vec_vmudm) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    // A 32 bit product never needs clamping, so the result is just its high half
+    N64RSP.acc.l.single = _mm_mullo_epi16(vs->single, vte.single);
+    N64RSP.acc.m.single = mulhi_mixed(vs->single, vte.single);
+    N64RSP.acc.h.single = _mm_srai_epi16(N64RSP.acc.m.single, 15);
+    vd->single = N64RSP.acc.m.single;
+#else
     for (int e = 0; e < 8; e++) {
         u16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
@@ -1250,6 +1359,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmudm) {
         set_rsp_accumulator(e, acc);
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmudn) {
@@ -1257,6 +1367,13 @@ RSP_VECTOR_INSTR(rsp_vec_vmudn) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    // A 32 bit product is always the sign extension of its low half, so the result is just that
+    N64RSP.acc.l.single = _mm_mullo_epi16(vs->single, vte.single);
+    N64RSP.acc.m.single = mulhi_mixed(vte.single, vs->single);
+    N64RSP.acc.h.single = _mm_srai_epi16(N64RSP.acc.m.single, 15);
+    vd->single = N64RSP.acc.l.single;
+#else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         u16 multiplicand2 = vs->elements[e];
@@ -1277,6 +1394,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmudn) {
 
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmulf) {
@@ -1284,6 +1402,16 @@ RSP_VECTOR_INSTR(rsp_vec_vmulf) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    vecr lo, mid, hi;
+    mul_fraction(vs, &vte, &lo, &mid, &hi);
+    N64RSP.acc.l.single = lo;
+    N64RSP.acc.m.single = mid;
+    N64RSP.acc.h.single = hi;
+    // Round by adding 0x8000
+    accumulate(_mm_set1_epi16(0x8000), N64RSP.zero, N64RSP.zero);
+    vd->single = acc_clamp_signed();
+#else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
@@ -1297,6 +1425,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmulf) {
         s16 result = clamp_signed(acc >> 16);
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vmulq) {
@@ -1323,6 +1452,16 @@ RSP_VECTOR_INSTR(rsp_vec_vmulu) {
     defvs;
     defvd;
     defvte;
+#ifdef RSP_SIMD_KERNELS
+    vecr lo, mid, hi;
+    mul_fraction(vs, &vte, &lo, &mid, &hi);
+    N64RSP.acc.l.single = lo;
+    N64RSP.acc.m.single = mid;
+    N64RSP.acc.h.single = hi;
+    // Round by adding 0x8000
+    accumulate(_mm_set1_epi16(0x8000), N64RSP.zero, N64RSP.zero);
+    vd->single = acc_clamp_unsigned();
+#else
     for (int e = 0; e < 8; e++) {
         s16 multiplicand1 = vte.elements[e];
         s16 multiplicand2 = vs->elements[e];
@@ -1336,6 +1475,7 @@ RSP_VECTOR_INSTR(rsp_vec_vmulu) {
         set_rsp_accumulator(e, acc);
         vd->elements[e] = result;
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vnand) {
@@ -1356,6 +1496,11 @@ RSP_VECTOR_INSTR(rsp_vec_vne) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    vecr eql = _mm_cmpeq_epi16(vs->single, vte.single);
+    N64RSP.vcc.l.single = _mm_or_si128(N64RSP.vco.h.single, _mm_xor_si128(eql, _mm_cmpeq_epi16(eql, eql)));
+    finish_compare(vs, vd, &vte);
+#else
     for (int i = 0; i < 8; i++) {
         N64RSP.vcc.l.elements[i] = FLAGREG_BOOL((N64RSP.vco.h.elements[i] != 0) || (vs->elements[i] != vte.elements[i]));
         N64RSP.acc.l.elements[i] = N64RSP.vcc.l.elements[i] != 0 ? vs->elements[i] : vte.elements[i];
@@ -1365,6 +1510,7 @@ RSP_VECTOR_INSTR(rsp_vec_vne) {
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vnop) {}
@@ -1418,7 +1564,7 @@ RSP_VECTOR_INSTR(rsp_vec_vrcp) {
     vd->elements[VU_ELEM_INDEX(de)] = result & 0xFFFF;
     N64RSP.divout = (result >> 16) & 0xFFFF;
     N64RSP.divin_loaded = false;
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     N64RSP.acc.l.single = vte.single;
 #else
     for (int i = 0; i < 8; i++) {
@@ -1444,7 +1590,7 @@ RSP_VECTOR_INSTR(rsp_vec_vrcpl) {
     N64RSP.divout = (result >> 16) & 0xFFFF;
     N64RSP.divin = 0;
     N64RSP.divin_loaded = false;
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     N64RSP.acc.l.single = vte.single;
 #else
     for (int i = 0; i < 8; i++) {
@@ -1537,7 +1683,7 @@ RSP_VECTOR_INSTR(rsp_vec_vrsq) {
     N64RSP.divout = (result >> 16) & 0xFFFF;
     N64RSP.divin_loaded = false;
 
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     N64RSP.acc.l.single = vte.single;
 #else
     for (int i = 0; i < 8; i++) {
@@ -1554,7 +1700,7 @@ RSP_VECTOR_INSTR(rsp_vec_vrcph_vrsqh) {
     u8 e  = instruction.cp2_vec.e & 7;
     u8 de = instruction.cp2_vec.vs & 7;
 
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     N64RSP.acc.l.single = vte.single;
 #else
     for (int i = 0; i < 8; i++) {
@@ -1583,7 +1729,7 @@ RSP_VECTOR_INSTR(rsp_vec_vrsql) {
     N64RSP.divout = (result >> 16) & 0xFFFF;
     N64RSP.divin_loaded = false;
 
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
     N64RSP.acc.l.single = vte.single;
 #else
     for (int i = 0; i < 8; i++) {
@@ -1598,7 +1744,7 @@ RSP_VECTOR_INSTR(rsp_vec_vsar) {
     defvd;
     switch (instruction.cp2_vec.e) {
         case 0x8:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vd->single = N64RSP.acc.h.single;
 #else
             for (int i = 0; i < 8; i++) {
@@ -1607,7 +1753,7 @@ RSP_VECTOR_INSTR(rsp_vec_vsar) {
 #endif
             break;
         case 0x9:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vd->single = N64RSP.acc.m.single;
 #else
             for (int i = 0; i < 8; i++) {
@@ -1616,7 +1762,7 @@ RSP_VECTOR_INSTR(rsp_vec_vsar) {
 #endif
             break;
         case 0xA:
-#ifdef N64_USE_SIMD
+#ifdef RSP_SIMD_KERNELS
             vd->single = N64RSP.acc.l.single;
 #else
             for (int i = 0; i < 8; i++) {
@@ -1638,6 +1784,18 @@ RSP_VECTOR_INSTR(rsp_vec_vsub) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    // The carry lanes are -1 when set, so subtracting them from vte folds the borrow in.
+    vecr carry = N64RSP.vco.l.single;
+    vecr unsat_vte = _mm_sub_epi16(vte.single, carry);
+    vecr sat_vte = _mm_subs_epi16(vte.single, carry);
+    N64RSP.acc.l.single = _mm_sub_epi16(vs->single, unsat_vte);
+    // Only vte = 0x7FFF with a borrow saturates, in which case the missing 1 is subtracted afterwards.
+    vecr overflow = _mm_cmpgt_epi16(sat_vte, unsat_vte);
+    vd->single = _mm_adds_epi16(_mm_subs_epi16(vs->single, sat_vte), overflow);
+    N64RSP.vco.l.single = N64RSP.zero;
+    N64RSP.vco.h.single = N64RSP.zero;
+#else
     for (int i = 0; i < 8; i++) {
         s32 result = vs->signed_elements[i] - vte.signed_elements[i] - (N64RSP.vco.l.elements[i] != 0);
         N64RSP.acc.l.signed_elements[i] = result;
@@ -1645,6 +1803,7 @@ RSP_VECTOR_INSTR(rsp_vec_vsub) {
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(0);
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(0);
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vsubc) {
@@ -1653,6 +1812,15 @@ RSP_VECTOR_INSTR(rsp_vec_vsubc) {
     defvd;
     defvte;
 
+#ifdef RSP_SIMD_KERNELS
+    vecr result = _mm_sub_epi16(vs->single, vte.single);
+    vecr all_ones = _mm_cmpeq_epi16(result, result);
+    // Borrow when vs < vte unsigned, i.e. when vte - vs doesn't saturate to zero
+    N64RSP.vco.l.single = _mm_xor_si128(_mm_cmpeq_epi16(_mm_subs_epu16(vte.single, vs->single), N64RSP.zero), all_ones);
+    N64RSP.vco.h.single = _mm_xor_si128(_mm_cmpeq_epi16(result, N64RSP.zero), all_ones);
+    vd->single = result;
+    N64RSP.acc.l.single = result;
+#else
     for (int i = 0; i < 8; i++) {
         u32 result = vs->elements[i] - vte.elements[i];
         u16 hresult = result & 0xFFFF;
@@ -1663,6 +1831,7 @@ RSP_VECTOR_INSTR(rsp_vec_vsubc) {
         N64RSP.vco.l.elements[i] = FLAGREG_BOOL(carry);
         N64RSP.vco.h.elements[i] = FLAGREG_BOOL(result != 0); // not hresult, but I bet that'd also work
     }
+#endif
 }
 
 RSP_VECTOR_INSTR(rsp_vec_vxor) {
@@ -0,0 +1,3 @@
+// The vector unit without SIMD kernels, for hosts that don't have SSE4.1. Every handler gets a _scalar suffix.
+#define N64_RSP_SCALAR_KERNELS
+#include "rsp_vector_instructions.c"
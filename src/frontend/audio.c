@@ -1,10 +1,17 @@
 #include "audio.h"
 #include "render.h"
 #include <SDL_audio.h>
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
 #include <metrics.h>
+#include <settings.h>
 #include <samplerate.h>
 #include <fifo.h>
 #include <rdp/parallel_rdp_wrapper.h>
+#include <simd.h>
+#ifdef N64_USE_SIMD
+#include <immintrin.h>
+#endif
 
 static_assert(sizeof(float) == 4, "float must be 32 bits");
 #define S16_TO_F32(x) ((float)(x) / (float)32768)
@@ -13,9 +20,7 @@ static_assert(sizeof(float) == 4, "float must be 32 bits");
 #define HOST_SAMPLE_FORMAT AUDIO_F32SYS
 #define HOST_SAMPLE_SIZE sizeof(float)
 //#define HOST_BUFFER_SIZE ((HOST_SAMPLE_RATE) / 2)
-#define HOST_BUFFER_SIZE 32768
-
-#define GUEST_SAMPLE_SIZE sizeof(float)
+#define HOST_BUFFER_SIZE 65536
 
 // Variable, controlled by the game
 unsigned guest_sample_rate = HOST_SAMPLE_RATE;
@@ -23,43 +28,226 @@ unsigned guest_sample_rate = HOST_SAMPLE_RATE;
 // output_sample_rate / input_sample_rate
 double resample_ratio = 1;
 
+// Dynamic rate control: the ratio actually used is resample_ratio nudged by up to this much, depending on how far
+// the amount of queued audio is from the target latency. Small enough that the pitch change isn't audible.
+#define MAX_RATE_ADJUSTMENT 0.005
+// Frames the rate control aims to keep queued, and the point where the audio thread stops and waits for the callback.
+int target_queued_frames;
+int max_queued_frames;
+
 
 #define FRAMES_PER_REQUEST 1024
 #define AUDIO_CHANNELS 2
 #define GUEST_BUFFER_SIZE ((FRAMES_PER_REQUEST) * (AUDIO_CHANNELS))
 
+// Raw guest samples, in the AI's one-word-per-frame format, waiting for the audio thread
+#define GUEST_RING_FRAMES 2048
+#define GUEST_FRAME_SIZE sizeof(u32)
+
 SDL_AudioSpec audio_spec;
 SDL_AudioSpec request;
 SDL_AudioDeviceID audio_dev;
 
+// Owned by the audio thread
 float guest_sample_buffer[GUEST_BUFFER_SIZE];
+u32 guest_frame_buffer[FRAMES_PER_REQUEST];
 
 // Much larger than needed
 #define TEMP_RESAMPLED_BUFFER_SIZE HOST_SAMPLE_RATE
 #define TEMP_RESAMPLED_BUFFER_FRAMES (HOST_SAMPLE_RATE / AUDIO_CHANNELS)
 float temp_resampled_buffer[TEMP_RESAMPLED_BUFFER_SIZE];
-unsigned idx_guest_sample_buffer = 0;
+
+// Emulation thread -> audio thread
+struct fifo* guest_sample_ring;
+// Audio thread -> SDL audio callback
 struct fifo* host_sample_buffer;
 
 SRC_STATE* resampler;
 
+SDL_Thread* audio_thread;
+// Guards resample_ratio, and is held while waiting on or signalling any of the conditions below.
+SDL_mutex* audio_mutex;
+// Signalled when guest samples are pushed
+SDL_cond* guest_samples_pushed;
+// Signalled when the audio thread takes samples out of the guest ring
+SDL_cond* guest_ring_space;
+// Signalled when the audio callback takes samples out of the host buffer
+SDL_cond* host_buffer_space;
+
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define HOST_FRAME_SIZE (AUDIO_CHANNELS * HOST_SAMPLE_SIZE)
+
+INLINE void signal_condition(SDL_cond* cond) {
+    SDL_LockMutex(audio_mutex);
+    SDL_CondSignal(cond);
+    SDL_UnlockMutex(audio_mutex);
+}
+
 void audio_callback(void* userdata, Uint8* stream, int length) {
     int avail = fifo_read_available(host_sample_buffer);
     set_metric(METRIC_AUDIOSTREAM_AVAILABLE, avail);
 
     int to_read = MIN(length, avail);
     fifo_read(host_sample_buffer, stream, to_read);
+    signal_condition(host_buffer_space);
 
     if (avail < length) {
+        mark_metric(METRIC_AUDIO_UNDERRUN);
         memset(stream + avail, 0, length - avail);
     }
 }
 
+// Audio that has been produced by the game but not yet handed to the host, in host frames
+INLINE double queued_host_frames(double ratio) {
+    double host_frames = fifo_read_available(host_sample_buffer) / HOST_FRAME_SIZE;
+    double guest_frames = fifo_read_available(guest_sample_ring) / GUEST_FRAME_SIZE;
+    return host_frames + guest_frames * ratio;
+}
+
+// Speeds playback up slightly when too much audio is queued and slows it down when too little is,
+// so the queue settles at the target latency instead of draining or filling up.
+INLINE double rate_controlled_ratio(double ratio) {
+    double queued = queued_host_frames(ratio);
+    set_metric(METRIC_AUDIO_LATENCY_US, (uint64_t)(queued * 1000000 / HOST_SAMPLE_RATE));
+
+    double error = (queued - target_queued_frames) / target_queued_frames;
+    error = MAX(-1.0, MIN(1.0, error));
+    return ratio * (1.0 - MAX_RATE_ADJUSTMENT * error);
+}
+
+int resampler_converter_type(n64_resampler_quality_t quality) {
+    switch (quality) {
+        case RESAMPLER_SINC_BEST:    return SRC_SINC_BEST_QUALITY;
+        case RESAMPLER_SINC_MEDIUM:  return SRC_SINC_MEDIUM_QUALITY;
+        case RESAMPLER_SINC_FASTEST: return SRC_SINC_FASTEST;
+        case RESAMPLER_LINEAR:       return SRC_LINEAR;
+    }
+    logfatal("Unknown resampler quality %d", quality);
+}
+
+// Converts frames in the AI DMA format (one word per frame, left channel in the upper half) to interleaved floats.
+// The SIMD versions only handle whole vectors and leave the tail to this one.
+static void convert_sample_words_scalar(float* out, const u32* samples, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i * 2] = S16_TO_F32((s16)(samples[i] >> 16));
+        out[i * 2 + 1] = S16_TO_F32((s16)samples[i]);
+    }
+}
+
+#ifdef N64_USE_SIMD
+static void convert_sample_words_sse(float* out, const u32* samples, int count) {
+    int i = 0;
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 4 <= count; i += 4) {
+        __m128i words = _mm_loadu_si128((const __m128i*)&samples[i]);
+        __m128i left = _mm_srai_epi32(words, 16);
+        __m128i right = _mm_srai_epi32(_mm_slli_epi32(words, 16), 16);
+        __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi32(left, right)), scale);
+        __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi32(left, right)), scale);
+        _mm_storeu_ps(&out[i * 2], lo);
+        _mm_storeu_ps(&out[i * 2 + 4], hi);
+    }
+    convert_sample_words_scalar(&out[i * 2], &samples[i], count - i);
+}
+
+SIMD_TARGET_AVX2 static void convert_sample_words_avx2(float* out, const u32* samples, int count) {
+    int i = 0;
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m256i words = _mm256_loadu_si256((const __m256i*)&samples[i]);
+        __m256i left = _mm256_srai_epi32(words, 16);
+        __m256i right = _mm256_srai_epi32(_mm256_slli_epi32(words, 16), 16);
+        // The unpacks work within each 128 bit half: lo holds frames 0-1 and 4-5, hi holds frames 2-3 and 6-7
+        __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpacklo_epi32(left, right)), scale);
+        __m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpackhi_epi32(left, right)), scale);
+        _mm256_storeu_ps(&out[i * 2], _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(&out[i * 2 + 8], _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    convert_sample_words_scalar(&out[i * 2], &samples[i], count - i);
+}
+#endif
+
+static void (*convert_sample_words)(float* out, const u32* samples, int count) = convert_sample_words_scalar;
+
+// Resamples a batch of guest frames and queues them for the audio callback. Runs on the audio thread.
+void resample_guest_buffer(int frames, double ratio) {
+    SRC_DATA resampler_data = { 0 };
+    resampler_data.data_in = guest_sample_buffer;
+    resampler_data.input_frames = frames;
+    resampler_data.data_out = temp_resampled_buffer;
+    resampler_data.output_frames = TEMP_RESAMPLED_BUFFER_FRAMES;
+    resampler_data.src_ratio = ratio;
+    resampler_data.end_of_input = false;
+
+    int error = src_process(resampler, &resampler_data);
+    if (error != 0) {
+        logalways("Error resampling! %s", src_strerror(error));
+        return;
+    }
+    loginfo("Input frames: %ld Input frames used: %ld Output frames: %ld", resampler_data.input_frames, resampler_data.input_frames_used, resampler_data.output_frames_gen);
+
+    long buf_size = resampler_data.output_frames_gen * AUDIO_CHANNELS * HOST_SAMPLE_SIZE;
+    // Bytes remaining to be written to the FIFO
+    long bytes_remaining = buf_size;
+    long buf_idx = 0;
+    while (bytes_remaining > 0) {
+        long chunk_size = MIN(FRAMES_PER_REQUEST * HOST_FRAME_SIZE, bytes_remaining);
+        // Only this thread writes to the host buffer, so it can only drain while we wait.
+        long max_queued_bytes = max_queued_frames * HOST_FRAME_SIZE;
+        if (fifo_read_available(host_sample_buffer) + chunk_size > max_queued_bytes) {
+            SDL_LockMutex(audio_mutex);
+            while (fifo_read_available(host_sample_buffer) + chunk_size > max_queued_bytes) {
+                SDL_CondWait(host_buffer_space, audio_mutex);
+            }
+            SDL_UnlockMutex(audio_mutex);
+        }
+        fifo_write(host_sample_buffer, ((u8*)temp_resampled_buffer) + buf_idx, chunk_size);
+        buf_idx += chunk_size;
+        bytes_remaining -= chunk_size;
+    }
+}
+
+int audio_thread_main(void* userdata) {
+    while (true) {
+        SDL_LockMutex(audio_mutex);
+        while (fifo_read_available(guest_sample_ring) == 0) {
+            SDL_CondWait(guest_samples_pushed, audio_mutex);
+        }
+        // Samples already in the ring when the game changes its rate get the new ratio. That's a few milliseconds at most.
+        double ratio = resample_ratio;
+        SDL_UnlockMutex(audio_mutex);
+
+        int frames = MIN(fifo_read_available(guest_sample_ring) / GUEST_FRAME_SIZE, FRAMES_PER_REQUEST);
+        fifo_read(guest_sample_ring, guest_frame_buffer, frames * GUEST_FRAME_SIZE);
+        signal_condition(guest_ring_space);
+
+        convert_sample_words(guest_sample_buffer, guest_frame_buffer, frames);
+        resample_guest_buffer(frames, rate_controlled_ratio(ratio));
+    }
+    return 0;
+}
+
 void audio_init() {
+#ifdef N64_USE_SIMD
+    if (simd_level >= SIMD_LEVEL_AVX2) {
+        convert_sample_words = convert_sample_words_avx2;
+    } else if (simd_level >= SIMD_LEVEL_SSE2) {
+        convert_sample_words = convert_sample_words_sse;
+    }
+#endif
     memset(temp_resampled_buffer, 0, TEMP_RESAMPLED_BUFFER_SIZE * HOST_SAMPLE_SIZE);
     host_sample_buffer = fifo_create(HOST_BUFFER_SIZE);
+    target_queued_frames = n64_settings.audio_latency_ms * HOST_SAMPLE_RATE / 1000;
+    max_queued_frames = MIN(target_queued_frames * 2, (HOST_BUFFER_SIZE / HOST_FRAME_SIZE) - 1);
+    guest_sample_ring = fifo_create(GUEST_RING_FRAMES * GUEST_FRAME_SIZE);
+    audio_mutex = SDL_CreateMutex();
+    guest_samples_pushed = SDL_CreateCond();
+    guest_ring_space = SDL_CreateCond();
+    host_buffer_space = SDL_CreateCond();
+    if (!audio_mutex || !guest_samples_pushed || !guest_ring_space || !host_buffer_space) {
+        logfatal("Failed to create audio synchronization primitives: %s", SDL_GetError());
+    }
     adjust_audio_sample_rate(HOST_SAMPLE_RATE);
     memset(&request, 0, sizeof(request));
 
@@ -81,69 +269,64 @@ void audio_init() {
     SDL_PauseAudioDevice(audio_dev, false);
 
     int src_error = 0;
-    resampler = src_new(SRC_SINC_BEST_QUALITY, AUDIO_CHANNELS, &src_error);
+    resampler = src_new(resampler_converter_type(n64_settings.resampler_quality), AUDIO_CHANNELS, &src_error);
     if (resampler == NULL) {
         logfatal("Failed to initialize libsamplerate! Error: %d", src_error);
     }
+
+    audio_thread = SDL_CreateThread(audio_thread_main, "audio", NULL);
+    if (audio_thread == NULL) {
+        logfatal("Failed to start the audio thread: %s", SDL_GetError());
+    }
+    SDL_DetachThread(audio_thread);
 }
 
-void flush_guest_buffer() {
-    if (idx_guest_sample_buffer == 0) {
-        return;
+void adjust_audio_sample_rate(int sample_rate) {
+    guest_sample_rate = sample_rate;
+    double ratio = ((double)HOST_SAMPLE_RATE) / ((double)guest_sample_rate);
+    if (audio_mutex != NULL) {
+        SDL_LockMutex(audio_mutex);
+        resample_ratio = ratio;
+        SDL_UnlockMutex(audio_mutex);
+    } else {
+        resample_ratio = ratio;
     }
+    logalways("Adjusting guest sample rate. Host rate: %d Guest rate: %d Ratio: %f", HOST_SAMPLE_RATE, guest_sample_rate, resample_ratio);
+}
 
-    SRC_DATA resampler_data = { 0 };
-    resampler_data.data_in = guest_sample_buffer;
-    resampler_data.input_frames = idx_guest_sample_buffer / AUDIO_CHANNELS;
-    resampler_data.data_out = temp_resampled_buffer;
-    resampler_data.output_frames = TEMP_RESAMPLED_BUFFER_FRAMES;
-    resampler_data.src_ratio = resample_ratio;
-    resampler_data.end_of_input = false;
+// Hands frames to the audio thread. If it has fallen behind, either wait for it (sync to audio) or drop the frames.
+void audio_push_samples(const u32* samples, int count) {
+    // No frontend, nowhere to send the samples
+    if (audio_thread == NULL) {
+        return;
+    }
 
-    int error = src_process(resampler, &resampler_data);
-    if (error != 0) {
-        logalways("Error resampling! %s", src_strerror(error));
-    } else {
-        loginfo("Input frames: %ld Input frames used: %ld Output frames: %ld", resampler_data.input_frames, resampler_data.input_frames_used, resampler_data.output_frames_gen);
-
-        long buf_size = resampler_data.output_frames_gen * AUDIO_CHANNELS * HOST_SAMPLE_SIZE;
-        // Bytes remaining to be written to the FIFO
-        long bytes_remaining = buf_size;
-        long buf_idx = 0;
-        while (bytes_remaining > 0) {
-            long chunk_size = MIN(FRAMES_PER_REQUEST * AUDIO_CHANNELS * HOST_SAMPLE_SIZE, bytes_remaining);
-            int fifo_write_avail = fifo_write_remaining(host_sample_buffer);
-            bool full = fifo_write_avail < chunk_size;
-            bool sync_to_audio_enabled = !is_framerate_unlocked();
-            if (sync_to_audio_enabled && full) {
-                continue;
+    while (count > 0) {
+        int frames = MIN(count, FRAMES_PER_REQUEST);
+        int bytes = frames * GUEST_FRAME_SIZE;
+        // Only this thread writes to the ring, so space can only grow while we wait.
+        if (fifo_write_remaining(guest_sample_ring) < bytes) {
+            if (is_framerate_unlocked()) {
+                return;
             }
-            if (!full) {
-                fifo_write(host_sample_buffer, ((u8*)temp_resampled_buffer) + buf_idx, chunk_size);
+            SDL_LockMutex(audio_mutex);
+            while (fifo_write_remaining(guest_sample_ring) < bytes) {
+                SDL_CondWait(guest_ring_space, audio_mutex);
             }
-            buf_idx += chunk_size;
-            bytes_remaining -= chunk_size;
+            SDL_UnlockMutex(audio_mutex);
         }
+        fifo_write(guest_sample_ring, samples, bytes);
+        signal_condition(guest_samples_pushed);
+        samples += frames;
+        count -= frames;
     }
-
-    idx_guest_sample_buffer = 0;
 }
 
-void adjust_audio_sample_rate(int sample_rate) {
-    // Flush first so all samples already pushed are resampled at the old rate
-    flush_guest_buffer();
-
-    guest_sample_rate = sample_rate;
-    resample_ratio = ((double)HOST_SAMPLE_RATE) / ((double)guest_sample_rate);
-    logalways("Adjusting guest sample rate. Host rate: %d Guest rate: %d Ratio: %f", HOST_SAMPLE_RATE, guest_sample_rate, resample_ratio);
-}
-
-void audio_push_sample(s16 left, s16 right) {
-    if (idx_guest_sample_buffer + 2 > GUEST_BUFFER_SIZE) {
-        // resample and push to host buffer
-        flush_guest_buffer();
+void audio_push_silence(int count) {
+    static const u32 silence[FRAMES_PER_REQUEST] = { 0 };
+    while (count > 0) {
+        int frames = MIN(count, FRAMES_PER_REQUEST);
+        audio_push_samples(silence, frames);
+        count -= frames;
     }
-
-    guest_sample_buffer[idx_guest_sample_buffer++] = S16_TO_F32(left);
-    guest_sample_buffer[idx_guest_sample_buffer++] = S16_TO_F32(right);
 }
@@ -2,13 +2,18 @@
 #include <cflags.h>
 #include <log.h>
 #include <system/n64system.h>
+#include <system/rsp_thread.h>
+#include <cpu/rsp_hle.h>
+#include <cpu/rsp_profiler.h>
 #include <mem/pif.h>
 #include <rdp/rdp.h>
 #include <rdp/parallel_rdp_wrapper.h>
 #include <frontend/tas_movie.h>
 #include <signal.h>
+#include <SDL_timer.h>
 #include <imgui/imgui_ui.h>
 #include <settings.h>
+#include <simd.h>
 #include "frontend.h"
 
 void usage(cflags_t* flags) {
@@ -48,6 +53,30 @@ int main(int argc, char** argv) {
     bool software_mode = false;
     cflags_add_bool(flags, 's', "software-mode", &software_mode, "Use software mode RDP (UNFINISHED!)");
 
+    int rdp_threads = 0;
+    cflags_add_int(flags, '\0', "rdp-threads", &rdp_threads, "Draw on this many host threads in software mode, each taking its own bands of scanlines, behind the emulation (default: 0, draw on the emulation thread)");
+
+    bool headless = false;
+    cflags_add_bool(flags, 'H', "headless", &headless, "Run without video or audio output, for benchmarking. Requires a ROM. With -s, still draws with the software RDP.");
+
+    int frame_limit = 0;
+    cflags_add_int(flags, 'f', "frames", &frame_limit, "Quit after this many frames and report host time per frame");
+
+    const char* rsp_thread = NULL;
+    cflags_add_string(flags, '\0', "rsp-thread", &rsp_thread, "Run the RSP on its own thread: strict syncs at every SP/DMEM access, relaxed only at SP_STATUS reads (default: off)");
+
+    const char* hle_audio = NULL;
+    cflags_add_string(flags, '\0', "hle-audio", &hle_audio, "Run audio tasks natively instead of on the RSP: on, or verify to run both and compare (default: off)");
+
+    bool hle_gfx = false;
+    cflags_add_bool(flags, '\0', "hle-gfx", &hle_gfx, "Run F3D, F3DEX and F3DEX2 graphics tasks natively instead of on the RSP");
+
+    const char* rsp_profile = NULL;
+    cflags_add_string(flags, '\0', "rsp-profile", &rsp_profile, "Count where the RSP spends its time and write a report of the hottest microcode and instructions to this file on exit");
+
+    const char* simd = NULL;
+    cflags_add_string(flags, '\0', "simd", &simd, "Force a SIMD level for the hot kernels: scalar, sse2, sse4.1 or avx2 (default: best the CPU supports)");
+
     bool debug = false;
 #ifdef N64_DEBUG_MODE
 #ifndef N64_WIN
@@ -82,13 +111,26 @@ int main(int argc, char** argv) {
         interpreter = true;
     }
 #endif
-    if (software_mode) {
+    if (simd != NULL) {
+        simd_request_level(simd);
+    }
+    if (headless) {
+        if (flags->argc < 1) {
+            logfatal("Headless mode needs a ROM to run");
+        }
+        init_n64system(flags->argv[0], false, debug, software_mode ? SOFTWARE_VIDEO_TYPE : UNKNOWN_VIDEO_TYPE, interpreter);
+        if (software_mode) {
+            softrdp_init(&n64sys.softrdp_state, (u8 *) &n64sys.mem.rdram);
+            softrdp_start_workers(&n64sys.softrdp_state, rdp_threads);
+        }
+    } else if (software_mode) {
         const char* rom_path = NULL;
         if (flags->argc >= 1) {
             rom_path = flags->argv[0];
         }
         init_n64system(rom_path, true, debug, SOFTWARE_VIDEO_TYPE, interpreter);
         softrdp_init(&n64sys.softrdp_state, (u8 *) &n64sys.mem.rdram);
+        softrdp_start_workers(&n64sys.softrdp_state, rdp_threads);
     } else {
         const char* rom_path = NULL;
         if (flags->argc >= 1) {
@@ -123,6 +165,29 @@ int main(int argc, char** argv) {
     while (n64sys.mem.rom.rom == NULL && !n64_should_quit()) {
         prdp_update_screen_no_game();
     }
+    n64sys.frame_limit = frame_limit > 0 ? frame_limit : 0;
+    if (rsp_thread != NULL) {
+        n64sys.rsp_thread_mode = rsp_thread_mode_from_name(rsp_thread);
+    }
+    if (hle_audio != NULL) {
+        n64sys.rsp_hle_audio = rsp_hle_mode_from_name(hle_audio);
+    }
+    n64sys.rsp_hle_gfx = hle_gfx;
+    if (rsp_profile != NULL) {
+        rsp_profiler_start(rsp_profile);
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
     n64_system_loop();
+    if (frame_limit > 0) {
+        double elapsed = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+        logalways("Ran %lu frames in %.3f seconds: %.3f ms per frame, %.1f fps", n64sys.frames, elapsed, elapsed * 1000 / n64sys.frames, n64sys.frames / elapsed);
+        rsp_thread_report(n64sys.frames);
+        if (n64sys.video_type == SOFTWARE_VIDEO_TYPE) {
+            softrdp_report_overlap(&n64sys.softrdp_state);
+            softrdp_report_texture_cache(&n64sys.softrdp_state);
+            softrdp_report_commands(&n64sys.softrdp_state, n64sys.frames);
+        }
+    }
+    rsp_profiler_write_report();
     n64_system_cleanup();
 }
\ No newline at end of file
@@ -9,6 +9,10 @@
 #include <volk.h>
 #include <rdp/parallel_rdp_wrapper.h>
 #include <settings.h>
+#include <simd.h>
+#ifdef N64_USE_SIMD
+#include <immintrin.h>
+#endif
 
 // prior to 2.0.10, this was anonymous enum
 #if SDL_COMPILEDVERSION <  SDL_VERSIONNUM(2, 0, 10)
@@ -82,6 +86,13 @@ void render_init(n64_video_type_t video_type) {
             break;
     }
     n64_video_type = video_type;
+#ifdef N64_USE_SIMD
+    if (simd_level >= SIMD_LEVEL_AVX2) {
+        swap_pixel_pairs = swap_pixel_pairs_avx2;
+    } else if (simd_level >= SIMD_LEVEL_SSE2) {
+        swap_pixel_pairs = swap_pixel_pairs_sse;
+    }
+#endif
     audio_init();
     gamepad_init();
 
@@ -141,16 +152,46 @@ INLINE void pre_scanout(SDL_PixelFormatEnum pixel_format) {
 
 }
 
+// RDRAM keeps each word in host order, so the two 16 bit pixels in every word come out swapped. Undoes that for a
+// whole frame at once, since the rows are contiguous in both buffers.
+static void swap_pixel_pairs_scalar(u8* dst, const u8* src, int words) {
+    for (int i = 0; i < words; i++) {
+        u32 word;
+        memcpy(&word, &src[i * 4], sizeof(u32));
+        word = (word << 16) | (word >> 16);
+        memcpy(&dst[i * 4], &word, sizeof(u32));
+    }
+}
+
+#ifdef N64_USE_SIMD
+static void swap_pixel_pairs_sse(u8* dst, const u8* src, int words) {
+    int i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)&src[i * 4]);
+        pixels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, 0xB1), 0xB1);
+        _mm_storeu_si128((__m128i*)&dst[i * 4], pixels);
+    }
+    swap_pixel_pairs_scalar(&dst[i * 4], &src[i * 4], words - i);
+}
+
+SIMD_TARGET_AVX2 static void swap_pixel_pairs_avx2(u8* dst, const u8* src, int words) {
+    int i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)&src[i * 4]);
+        pixels = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, 0xB1), 0xB1);
+        _mm256_storeu_si256((__m256i*)&dst[i * 4], pixels);
+    }
+    swap_pixel_pairs_scalar(&dst[i * 4], &src[i * 4], words - i);
+}
+#endif
+
+static void (*swap_pixel_pairs)(u8* dst, const u8* src, int words) = swap_pixel_pairs_scalar;
+
 static void vi_scanout_16bit() {
     pre_scanout(SDL_PIXELFORMAT_RGBA5551);
     const int rdram_offset = n64sys.vi.vi_origin & (N64_RDRAM_SIZE - 1);
-    for (int y = 0; y < vi_height; y++) {
-        int yofs = (y * vi_width * 2);
-        for (int x = 0; x < vi_width; x += 2) {
-            memcpy(&pixel_buffer[yofs + x * 2 + 2], &n64sys.mem.rdram[rdram_offset + yofs + x * 2 + 0], sizeof(u16));
-            memcpy(&pixel_buffer[yofs + x * 2 + 0], &n64sys.mem.rdram[rdram_offset + yofs + x * 2 + 2], sizeof(u16));
-        }
-    }
+    const int words = (vi_width * vi_height * 2 + 3) / 4;
+    swap_pixel_pairs(pixel_buffer, &n64sys.mem.rdram[rdram_offset], words);
     SDL_UpdateTexture(texture, NULL, &pixel_buffer, vi_width * 2);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
 }
@@ -164,6 +205,7 @@ static void vi_scanout_32bit() {
 
 void render_screen_software() {
     n64_poll_input();
+    softrdp_flush(&n64sys.softrdp_state);
 
     switch (n64sys.vi.status.type) {
         case VI_TYPE_BLANK:
@@ -187,6 +187,9 @@ void render_metrics_window() {
         ImPlot::EndPlot();
     }
 
+    ImGui::Text("RSP block compilations this frame: %ld, microcode cache hits: %ld, misses: %ld",
+                get_metric(METRIC_RSP_BLOCK_COMPILATION), get_metric(METRIC_RSP_UCODE_HIT), get_metric(METRIC_RSP_UCODE_MISS));
+
     ImPlot::SetNextPlotLimitsY(0, n64sys.dynarec->codecache_size, ImGuiCond_Always, 0);
     ImPlot::SetNextPlotLimitsX(0, METRICS_HISTORY_ITEMS, ImGuiCond_Always);
     if (ImPlot::BeginPlot("Codecache bytes used")) {
@@ -195,6 +198,7 @@ void render_metrics_window() {
     }
 
     ImGui::Text("Audio stream bytes available: %ld", get_metric(METRIC_AUDIOSTREAM_AVAILABLE));
+    ImGui::Text("Audio latency: %.1f ms, underruns this frame: %ld", get_metric(METRIC_AUDIO_LATENCY_US) / 1000.0, get_metric(METRIC_AUDIO_UNDERRUN));
     ImPlot::SetNextPlotLimitsY(0, audiostream_bytes_available.max(), ImGuiCond_Always, 0);
     ImPlot::SetNextPlotLimitsX(0, METRICS_HISTORY_ITEMS, ImGuiCond_Always);
     if (ImPlot::BeginPlot("Audio Stream Bytes Available")) {
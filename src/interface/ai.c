@@ -2,13 +2,24 @@
 #include <mem/addresses.h>
 #include <frontend/audio.h>
 #include <mem/mem_util.h>
+#include <system/scheduler.h>
 
 INLINE int MAX(int x, int y) {
     if (x > y) return x;
     return y;
 }
 
+INLINE u64 MIN(u64 x, u64 y) {
+    if (x < y) return x;
+    return y;
+}
+
+void ai_catch_up();
+void ai_schedule();
+
 void write_word_aireg(u32 address, u32 value) {
+    // Registers must see the state as of this cycle, and any change may move the next deadline.
+    ai_catch_up();
     switch (address) {
         case ADDR_AI_DRAM_ADDR_REG:
             if (n64sys.ai.dma_count < 2) {
@@ -45,9 +56,11 @@ void write_word_aireg(u32 address, u32 value) {
         default:
             logfatal("Writing word 0x%08X to address 0x%08X in unsupported region: REGION_AI_REGS", value, address);
     }
+    ai_schedule();
 }
 
 u32 read_word_aireg(u32 address) {
+    ai_catch_up();
     switch (address) {
         case ADDR_AI_DRAM_ADDR_REG:
             logfatal("Read from unknown AI register: AI_DRAM_ADDR_REG");
@@ -74,38 +87,71 @@ u32 read_word_aireg(u32 address) {
     }
 }
 
-void sample() {
-    if (n64sys.ai.dma_count == 0) {
-        audio_push_sample(0, 0);
-        return;
-    }
+// Generate this many samples per scheduler event when no DMA boundary comes sooner
+#define AI_BATCH_SAMPLES 256
+
+// Plays back `count` samples, starting at the AI's current position, in as few bulk conversions as possible.
+// Register state, including the address carry quirk, ends up exactly as if each sample were played one at a time.
+void ai_generate_samples(u64 count) {
+    while (count > 0) {
+        if (n64sys.ai.dma_count == 0) {
+            audio_push_silence(count);
+            return;
+        }
 
-    u32 address_hi = ((n64sys.ai.dma_address[0] >> 13) + n64sys.ai.dma_address_carry) & 0x7ff;
-    n64sys.ai.dma_address[0] = (address_hi << 13) | n64sys.ai.dma_address[0] & 0x1fff;
-    u32 data = RDRAM_WORD(n64sys.ai.dma_address[0]);
+        u32 address_hi = ((n64sys.ai.dma_address[0] >> 13) + n64sys.ai.dma_address_carry) & 0x7ff;
+        u32 address = (address_hi << 13) | (n64sys.ai.dma_address[0] & 0x1fff);
 
-    s16 left  = data >> 16;
-    s16 right = data >> 0;
-    audio_push_sample(left, right);
+        // Stop at the end of the DMA, and don't run off the end of RDRAM since the span is read in one go.
+        u64 chunk = count;
+        chunk = MIN(chunk, n64sys.ai.dma_length[0] >> 2);
+        chunk = MIN(chunk, (N64_RDRAM_SIZE - (address & (N64_RDRAM_SIZE - 1))) >> 2);
+        audio_push_samples(&RDRAM_WORD(address), chunk);
 
-    u32 address_lo = (n64sys.ai.dma_address[0] + 4) & 0x1fff;
-    n64sys.ai.dma_address[0] = (n64sys.ai.dma_address[0] & ~0x1fff) | address_lo;
-    n64sys.ai.dma_address_carry = (address_lo == 0);
-    n64sys.ai.dma_length[0] -= 4;
+        u32 last_address = (address + (chunk - 1) * 4) & 0xFFFFFF;
+        u32 address_lo = (last_address + 4) & 0x1fff;
+        n64sys.ai.dma_address[0] = (last_address & ~0x1fff) | address_lo;
+        n64sys.ai.dma_address_carry = (address_lo == 0);
+        n64sys.ai.dma_length[0] -= chunk * 4;
+        count -= chunk;
 
-    if(!n64sys.ai.dma_length[0]) {
-        interrupt_raise(INTERRUPT_AI);
-        if(--n64sys.ai.dma_count > 0) { // If we have another DMA pending, start on that one.
-            n64sys.ai.dma_address[0] = n64sys.ai.dma_address[1];
-            n64sys.ai.dma_length[0]  = n64sys.ai.dma_length[1];
+        if (!n64sys.ai.dma_length[0]) {
+            interrupt_raise(INTERRUPT_AI);
+            if (--n64sys.ai.dma_count > 0) { // If we have another DMA pending, start on that one.
+                n64sys.ai.dma_address[0] = n64sys.ai.dma_address[1];
+                n64sys.ai.dma_length[0]  = n64sys.ai.dma_length[1];
+            }
         }
     }
 }
 
-void ai_step(int cycles) {
-    n64sys.ai.cycles += cycles;
-    while (n64sys.ai.cycles > n64sys.ai.dac.period) {
-        sample();
-        n64sys.ai.cycles -= n64sys.ai.dac.period;
+// Plays every sample that has come due by now
+void ai_catch_up() {
+    u64 now = scheduler_ticks;
+    if (now < n64sys.ai.next_sample) {
+        return;
     }
-}
\ No newline at end of file
+    u64 count = (now - n64sys.ai.next_sample) / n64sys.ai.dac.period + 1;
+    n64sys.ai.next_sample += count * n64sys.ai.dac.period;
+    ai_generate_samples(count);
+}
+
+// Wake up at the last sample of the current DMA, so the interrupt is raised on time, or after a full batch.
+void ai_schedule() {
+    u64 samples = AI_BATCH_SAMPLES;
+    if (n64sys.ai.dma_count > 0) {
+        samples = MIN(samples, n64sys.ai.dma_length[0] >> 2);
+    }
+    scheduler_remove_event(SCHEDULER_AI_SAMPLE);
+    scheduler_enqueue_absolute(n64sys.ai.next_sample + (samples - 1) * n64sys.ai.dac.period, SCHEDULER_AI_SAMPLE);
+}
+
+void ai_schedule_first_sample() {
+    n64sys.ai.next_sample = scheduler_ticks + n64sys.ai.dac.period;
+    ai_schedule();
+}
+
+void on_ai_sample() {
+    ai_catch_up();
+    ai_schedule();
+}
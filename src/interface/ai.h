@@ -5,6 +5,7 @@
 
 void write_word_aireg(u32 address, u32 value);
 u32 read_word_aireg(u32 address);
-void ai_step(int cycles);
+void ai_schedule_first_sample();
+void on_ai_sample();
 
 #endif //N64_AI_H
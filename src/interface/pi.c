@@ -130,6 +130,7 @@ void write_word_pireg(u32 address, u32 value) {
 
 
             logdebug("DMA requested at PC 0x%016lX from 0x%08X to 0x%08X (DRAM to CART), with a length of %d", N64CPU.pc, dram_addr, cart_addr, length);
+            softrdp_sync_rdram_range(&n64sys.softrdp_state, dram_addr, length);
 
             // TODO: takes 9 cycles per byte to run in reality
             for (int i = 0; i < length; i++) {
@@ -162,6 +163,7 @@ void write_word_pireg(u32 address, u32 value) {
             }
 
             logdebug("DMA requested at PC 0x%016lX from 0x%08X to 0x%08X (CART to DRAM), with a length of %d", N64CPU.pc, cart_addr, dram_addr, length);
+            softrdp_sync_rdram_range(&n64sys.softrdp_state, dram_addr, length);
 
             if (is_flash(n64sys.mem.save_type) && cart_addr >= 0x08000000 && cart_addr < 0x08010000) {
                 // Special case for Flash DMAs
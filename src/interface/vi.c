@@ -1,5 +1,6 @@
 #include "vi.h"
 #include <rdp/rdp.h>
+#include <system/scheduler.h>
 
 #define ADDR_VI_STATUS_REG    0x04400000
 #define ADDR_VI_ORIGIN_REG    0x04400004
@@ -130,3 +131,32 @@ void check_vi_interrupt() {
         logdebug("Checking for VI interrupt: %d == %d? nah", n64sys.vi.v_current & 0x3FE, n64sys.vi.vi_v_intr);
     }
 }
+
+
+void vi_schedule_first_halfline() {
+    n64sys.vi.halfline = 0;
+    n64sys.vi.field = 0;
+    scheduler_enqueue_relative(0, SCHEDULER_VI_HALFLINE);
+}
+
+// Runs at the start of every halfline. Returns true once every field of the frame has been displayed.
+bool on_vi_halfline() {
+    bool frame_complete = false;
+    if (n64sys.vi.halfline >= n64sys.vi.num_halflines) {
+        check_vi_interrupt();
+        rdp_update_screen();
+
+        n64sys.vi.halfline = 0;
+        if (++n64sys.vi.field >= n64sys.vi.num_fields) {
+            n64sys.vi.field = 0;
+            frame_complete = true;
+        }
+    }
+
+    n64sys.vi.v_current = (n64sys.vi.halfline << 1) + n64sys.vi.field;
+    check_vi_interrupt();
+
+    n64sys.vi.halfline++;
+    scheduler_enqueue_relative(n64sys.vi.cycles_per_halfline, SCHEDULER_VI_HALFLINE);
+    return frame_complete;
+}
@@ -6,5 +6,7 @@
 void write_word_vireg(u32 address, u32 value);
 u32 read_word_vireg(u32 address);
 void check_vi_interrupt();
+bool on_vi_halfline();
+void vi_schedule_first_halfline();
 
 #endif //N64_VI_H
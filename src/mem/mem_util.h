@@ -166,4 +166,38 @@ INLINE void half_to_byte_array(u8* arr, u32 index, u16 value) {
     memcpy(arr + index, &value, sizeof(u16));
 }
 
+// https://rosettacode.org/wiki/CRC-32#C
+INLINE u32 crc32(u32 crc, const u8 *buf, size_t len)
+{
+    static u32 table[256];
+    static int have_table = 0;
+    u32 rem;
+    u8 octet;
+    int i, j;
+    const u8 *p, *q;
+
+    if (have_table == 0) {
+        for (i = 0; i < 256; i++) {
+            rem = i;
+            for (j = 0; j < 8; j++) {
+                if (rem & 1) {
+                    rem >>= 1;
+                    rem ^= 0xedb88320;
+                } else
+                    rem >>= 1;
+            }
+            table[i] = rem;
+        }
+        have_table = 1;
+    }
+
+    crc = ~crc;
+    q = buf + len;
+    for (p = buf; p < q; p++) {
+        octet = *p;  /* Cast to unsigned octet. */
+        crc = (crc >> 8) ^ table[(crc & 0xff) ^ octet];
+    }
+    return ~crc;
+}
+
 #endif //N64_MEM_UTIL_H
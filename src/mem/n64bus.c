@@ -8,6 +8,7 @@
 #include <rsp.h>
 #include <interface/si.h>
 #include <interface/pi.h>
+#include <system/rsp_thread.h>
 
 #include "addresses.h"
 #include "pif.h"
@@ -290,6 +291,7 @@ void n64_write_physical_dword(u32 address, u64 value) {
     invalidate_dynarec_page(address);
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             dword_to_byte_array((u8*) &n64sys.mem.rdram, DWORD_ADDRESS(address) - SREGION_RDRAM, value);
             break;
         case REGION_RDRAM_REGS:
@@ -298,6 +300,7 @@ void n64_write_physical_dword(u32 address, u64 value) {
         case REGION_RDRAM_UNUSED:
             return;
         case REGION_SP_MEM: {
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             value >>= 32; // TODO: this is probably wrong, it probably depends on the address.
             if (address & 0x1000) {
                 word_to_byte_array((u8*) &N64RSP.sp_imem, DWORD_ADDRESS(address & 0xFFF), value);
@@ -362,12 +365,14 @@ u64 n64_read_physical_dword(u32 address) {
     }
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             return dword_from_byte_array((u8*) &n64sys.mem.rdram, DWORD_ADDRESS(address) - SREGION_RDRAM);
         case REGION_RDRAM_UNUSED:
             return read_unused(DWORD_ADDRESS(address));
         case REGION_RDRAM_REGS:
             logfatal("Reading dword from address 0x%08X in unsupported region: REGION_RDRAM_REGS", address);
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             if (address & 0x1000) {
                 return dword_from_byte_array((u8*) &N64RSP.sp_imem, DWORD_ADDRESS(address & 0xFFF));
             } else {
@@ -419,6 +424,7 @@ void n64_write_physical_word(u32 address, u32 value) {
     invalidate_dynarec_page(WORD_ADDRESS(address));
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             word_to_byte_array((u8*) &n64sys.mem.rdram, WORD_ADDRESS(address) - SREGION_RDRAM, value);
             break;
         case REGION_RDRAM_REGS:
@@ -427,6 +433,7 @@ void n64_write_physical_word(u32 address, u32 value) {
         case REGION_RDRAM_UNUSED:
             return;
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             if (address & 0x1000) {
                 word_to_byte_array((u8*) &N64RSP.sp_imem, WORD_ADDRESS(address & 0xFFF), value);
                 invalidate_rsp_icache(WORD_ADDRESS(address));
@@ -435,9 +442,12 @@ void n64_write_physical_word(u32 address, u32 value) {
             }
             break;
         case REGION_SP_REGS:
+            rsp_thread_sync(RSP_SYNC_CONTROL);
             write_word_spreg(address, value);
             break;
         case REGION_DP_COMMAND_REGS:
+            // The RDP can read commands straight out of DMEM
+            rsp_thread_sync(RSP_SYNC_CONTROL);
             write_word_dpcreg(address, value);
             break;
         case REGION_DP_SPAN_REGS:
@@ -491,18 +501,21 @@ u32 n64_read_physical_word(u32 address) {
     }
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             return word_from_byte_array((u8*) &n64sys.mem.rdram, WORD_ADDRESS(address) - SREGION_RDRAM);
         case REGION_RDRAM_UNUSED:
             return read_unused(address);
         case REGION_RDRAM_REGS:
             return read_word_rdramreg(address);
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             if (address & 0x1000) {
                 return word_from_byte_array((u8*) &N64RSP.sp_imem, WORD_ADDRESS(address & 0xFFF));
             } else {
                 return word_from_byte_array((u8*) &N64RSP.sp_dmem, WORD_ADDRESS(address & 0xFFF));
             }
         case REGION_SP_REGS:
+            rsp_thread_sync(address == ADDR_SP_STATUS_REG ? RSP_SYNC_STATUS : RSP_SYNC_CONTROL);
             return read_word_spreg(address);
         case REGION_DP_COMMAND_REGS:
             return read_word_dpcreg(address);
@@ -572,6 +585,7 @@ void n64_write_physical_half(u32 address, u32 value) {
     invalidate_dynarec_page(HALF_ADDRESS(address));
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             half_to_byte_array((u8*) &n64sys.mem.rdram, HALF_ADDRESS(address) - SREGION_RDRAM, value);
             break;
         case REGION_RDRAM_REGS:
@@ -580,6 +594,7 @@ void n64_write_physical_half(u32 address, u32 value) {
         case REGION_RDRAM_UNUSED:
             return;
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             value = bus_edge_case_half_pif_spmem(address, value);
             address &= ~3;
             if (address & 0x1000) {
@@ -647,12 +662,14 @@ u16 n64_read_physical_half(u32 address) {
     }
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             return half_from_byte_array((u8*) &n64sys.mem.rdram, HALF_ADDRESS(address) - SREGION_RDRAM);
         case REGION_RDRAM_UNUSED:
             return read_unused(address);
         case REGION_RDRAM_REGS:
             logfatal("Reading u16 from address 0x%08X in unsupported region: REGION_RDRAM_REGS", address);
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             if (address & 0x1000) {
                 return half_from_byte_array((u8*) &N64RSP.sp_imem, HALF_ADDRESS(address & 0xFFF));
             } else {
@@ -700,11 +717,13 @@ void n64_write_physical_byte(u32 address, u32 value) {
     invalidate_dynarec_page(BYTE_ADDRESS(address));
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             n64sys.mem.rdram[BYTE_ADDRESS(address)] = value;
             break;
         case REGION_RDRAM_REGS:
             logfatal("Writing byte 0x%02X to address 0x%08X in unsupported region: REGION_RDRAM_REGS", value & 0xFF, address);
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             value = value << (8 * (3 - (address & 3)));
             address = (address & 0xFFF) & ~3;
             if (address & 0x1000) {
@@ -761,10 +780,12 @@ void n64_write_physical_byte(u32 address, u32 value) {
 u8 n64_read_physical_byte(u32 address) {
     switch (address) {
         case REGION_RDRAM:
+            softrdp_sync_rdram(&n64sys.softrdp_state, address);
             return n64sys.mem.rdram[BYTE_ADDRESS(address)];
         case REGION_RDRAM_REGS:
             logfatal("Reading byte from address 0x%08X in unsupported region: REGION_RDRAM_REGS", address);
         case REGION_SP_MEM:
+            rsp_thread_sync(address & 0x1000 ? RSP_SYNC_CONTROL : RSP_SYNC_DMEM);
             if (address & 0x1000) {
                 return N64RSP.sp_imem[BYTE_ADDRESS(address) - SREGION_SP_IMEM];
             } else {
@@ -255,7 +255,7 @@ void prdp_update_screen_no_game() {
     update_screen(static_cast<Util::IntrusivePtr<Image>>(nullptr));
 }
 
-void prdp_enqueue_command(int command_length, u32* buffer) {
+void prdp_enqueue_command(int command_length, const u32* buffer) {
     command_processor->enqueue_command(command_length, buffer);
 }
 
@@ -17,16 +17,21 @@
 #include <frontend/render.h>
 #include <rsp.h>
 #include <frontend/frontend.h>
+#include <system/scheduler.h>
+#include <timing.h>
+#ifdef N64_USE_SIMD
+#include <emmintrin.h>
+#endif
 
 static void* plugin_handle = NULL;
 static u32 rdram_size_word = N64_RDRAM_SIZE; // GFX_INFO needs this to be sent as a uint32
 
-#define RDP_COMMAND_BUFFER_SIZE 0xFFFFF
-u32 rdp_command_buffer[RDP_COMMAND_BUFFER_SIZE];
-
-#define FROM_RDRAM(address) word_from_byte_array(n64sys.mem.rdram, WORD_ADDRESS(address))
-#define FROM_DMEM(address) word_from_byte_array(N64RSP.sp_dmem, (address) & 0xFFF)
+// The longest command, a shaded, textured and Z-buffered triangle
+#define RDP_MAX_COMMAND_WORDS 44
 
+// The start of a command cut off at the end of the last list, waiting for the rest of its words
+static u32 partial_command[RDP_MAX_COMMAND_WORDS];
+static int partial_command_words = 0;
 
 static const int command_lengths[64] = {
         2, 2, 2, 2, 2, 2, 2, 2, 8, 12, 24, 28, 24, 28, 40, 44,
@@ -37,6 +42,8 @@ static const int command_lengths[64] = {
 
 #define RDP_COMMAND_FULL_SYNC 0x29
 
+static rdp_command_observer_t command_observer = NULL;
+
 
 void rdp_rendering_callback(int redrawn) {
     n64_poll_input();
@@ -102,6 +109,8 @@ u32 read_word_dpcreg(u32 address) {
         case ADDR_DPC_CURRENT_REG:
             return n64sys.dpc.current;
         case ADDR_DPC_STATUS_REG:
+            // Games poll this to wait for the RDP, so the drawing up to the last sync_full has to have landed
+            rdp_wait_for_full_sync();
             return n64sys.dpc.status.raw;
         case ADDR_DPC_CLOCK_REG:
             return n64sys.dpc.clock;
@@ -116,38 +125,130 @@ u32 read_word_dpcreg(u32 address) {
     }
 }
 
-INLINE void rdp_enqueue_command(int command_length, u32* buffer) {
+// The software RDP takes each pair of words as a u64 with the first word on top
+INLINE void swap_command_words(u64* out, const u32* words, int command_length) {
+    int i = 0;
+#ifdef N64_USE_SIMD
+    for (; i + 4 <= command_length; i += 4) {
+        __m128i pairs = _mm_loadu_si128((const __m128i*)&words[i]);
+        _mm_storeu_si128((__m128i*)&out[i >> 1], _mm_shuffle_epi32(pairs, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+#endif
+    for (; i < command_length; i += 2) {
+        out[i >> 1] = (u64)words[i] << 32 | words[i + 1];
+    }
+}
+
+INLINE void rdp_enqueue_command(int command_length, const u32* buffer) {
     switch (n64sys.video_type) {
         case UNKNOWN_VIDEO_TYPE:
-            logfatal("RDP enqueue command with video type UNKNOWN_VIDEO_TYPE");
+            break; // Headless, commands are parsed but not rendered
         case VULKAN_VIDEO_TYPE:
         case QT_VULKAN_VIDEO_TYPE:
             prdp_enqueue_command(command_length, buffer); break;
-        case SOFTWARE_VIDEO_TYPE:
-            softrdp_enqueue_command(&n64sys.softrdp_state, command_length, (uint64_t *) buffer); break;
+        case SOFTWARE_VIDEO_TYPE: {
+            u64 swapped[RDP_MAX_COMMAND_WORDS / 2];
+            swap_command_words(swapped, buffer, command_length);
+            softrdp_enqueue_command(&n64sys.softrdp_state, command_length, swapped);
+            break;
+        }
+    }
+}
+
+// Everything the software RDP's workers have to finish before the last sync_full counts as done
+static u64 full_sync_fence = 0;
+
+void rdp_wait_for_full_sync() {
+    if (n64sys.video_type == SOFTWARE_VIDEO_TYPE) {
+        softrdp_wait(&n64sys.softrdp_state, full_sync_fence);
     }
 }
 
 INLINE void rdp_on_full_sync() {
     switch (n64sys.video_type) {
         case UNKNOWN_VIDEO_TYPE:
-            logfatal("RDP on full sync with video type UNKNOWN_VIDEO_TYPE");
+            break;
         case VULKAN_VIDEO_TYPE:
         case QT_VULKAN_VIDEO_TYPE:
             prdp_on_full_sync(); break;
         case SOFTWARE_VIDEO_TYPE:
-            full_sync_softrdp();
+            // The software RDP's workers keep drawing, the DP interrupt waits for them instead
+            full_sync_fence = softrdp_fence(&n64sys.softrdp_state);
             break;
     }
     n64sys.dpc.status.pipe_busy = false;
     n64sys.dpc.status.start_gclk = false;
     n64sys.dpc.status.cbuf_ready = false;
-    interrupt_raise(INTERRUPT_DP);
+    scheduler_enqueue_relative(DP_INTERRUPT_DELAY, SCHEDULER_DP_INTERRUPT);
 }
 
-void process_rdp_list() {
-    static int last_run_unprocessed_words = 0;
+INLINE void rdp_process_command(u8 command, int command_length, const u32* buffer) {
+    // Don't need to process commands under 8
+    if (command >= 8) {
+        if (unlikely(command_observer != NULL)) {
+            command_observer(command_length, buffer);
+        }
+        rdp_enqueue_command(command_length, buffer);
+    }
+
+    if (command == RDP_COMMAND_FULL_SYNC) {
+        rdp_on_full_sync();
+    }
+}
+
+void rdp_set_command_observer(rdp_command_observer_t observer) {
+    command_observer = observer;
+}
+
+void rdp_process_commands(const u32* commands, int length_words) {
+    int index = 0;
+    while (index < length_words) {
+        u8 command = (commands[index] >> 24) & 0x3F;
+        int command_length = command_lengths[command];
+        if (index + command_length > length_words) {
+            logfatal("Got a partial RDP command 0x%02X at the end of a list of %d words", command, length_words);
+        }
+        rdp_process_command(command, command_length, &commands[index]);
+        index += command_length;
+    }
+}
+
+// Runs the commands in a piece of a display list, straight from where it sits in RDRAM or DMEM. Only a command cut off
+// at the end is copied, to be finished by the next piece.
+static void process_rdp_words(const u32* words, int length_words) {
+    int index = 0;
+
+    if (partial_command_words > 0) {
+        u8 command = (partial_command[0] >> 24) & 0x3F;
+        int command_length = command_lengths[command];
+        int needed = command_length - partial_command_words;
+        int available = needed < length_words ? needed : length_words;
+        memcpy(&partial_command[partial_command_words], words, available * sizeof(u32));
+        partial_command_words += available;
+        if (partial_command_words < command_length) {
+            return;
+        }
+        partial_command_words = 0;
+        rdp_process_command(command, command_length, partial_command);
+        index = available;
+    }
+
+    while (index < length_words) {
+        u8 command = (words[index] >> 24) & 0x3F;
+        int command_length = command_lengths[command];
 
+        if (index + command_length > length_words) {
+            partial_command_words = length_words - index;
+            memcpy(partial_command, &words[index], partial_command_words * sizeof(u32));
+            return;
+        }
+
+        rdp_process_command(command, command_length, &words[index]);
+        index += command_length;
+    }
+}
+
+void process_rdp_list() {
     n64_dpc_t* dpc = &n64sys.dpc;
 
     // tell the game to not touch RDP stuff while we work
@@ -165,75 +266,25 @@ void process_rdp_list() {
         return;
     }
 
-    if (display_list_length + (last_run_unprocessed_words * 4) > RDP_COMMAND_BUFFER_SIZE) {
-        logfatal("Got a command of display_list_length %d / 0x%X (with %d unprocessed words from last run) - this overflows our buffer of size %d / 0x%X!",
-                 display_list_length, display_list_length, last_run_unprocessed_words, RDP_COMMAND_BUFFER_SIZE, RDP_COMMAND_BUFFER_SIZE);
-    }
-
-    // read the commands into a buffer, 32 bits at a time.
-    // we need to read the whole thing into a buffer before sending each command to the RDP
-    // because commands have variable lengths
+    // Both RDRAM and DMEM hold each word in host order, so the commands can be read where they are
     if (dpc->status.xbus_dmem_dma) {
-        for (int i = 0; i < display_list_length; i += 4) {
-            u32 command_word = FROM_DMEM(current + i);
-            rdp_command_buffer[last_run_unprocessed_words + (i >> 2)] = command_word;
+        // Lists in DMEM wrap around its end
+        u32 address = current & 0xFFF;
+        while (display_list_length > 0) {
+            int length = SP_DMEM_SIZE - address;
+            if (length > display_list_length) {
+                length = display_list_length;
+            }
+            process_rdp_words((const u32*)&N64RSP.sp_dmem[address], length >> 2);
+            display_list_length -= length;
+            address = 0;
         }
     } else {
-        if (end > 0x7FFFFFF || current > 0x7FFFFFF) {
+        if (end > N64_RDRAM_SIZE) {
             logwarn("Not running RDP commands, wanted to read past end of RDRAM!");
             return;
         }
-        for (int i = 0; i < display_list_length; i += 4) {
-            u32 command_word = FROM_RDRAM(current + i);
-            rdp_command_buffer[last_run_unprocessed_words + (i >> 2)] = command_word;
-        }
-    }
-
-    int length_words = (display_list_length >> 2) + last_run_unprocessed_words;
-    int buf_index = 0;
-
-    bool processed_all = true;
-
-    while (buf_index < length_words) {
-        u8 command = (rdp_command_buffer[buf_index] >> 24) & 0x3F;
-
-        int command_length = command_lengths[command];
-
-        // Check we actually have enough bytes left in the display list for this command, and save the remainder of the display list for the next run, if not.
-        if ((buf_index + command_length) * 4 > display_list_length + (last_run_unprocessed_words * 4)) {
-            // Copy remaining bytes back to the beginning of the display list, and save them for next run.
-            last_run_unprocessed_words = length_words - buf_index;
-
-            // Safe to allocate this on the stack because we'll only have a partial command left, and that _has_ to be pretty small.
-            u32 temp[last_run_unprocessed_words];
-            for (int i = 0; i < last_run_unprocessed_words; i++) {
-                temp[i] = rdp_command_buffer[buf_index + i];
-            }
-
-            for (int i = 0; i < last_run_unprocessed_words; i++) {
-                rdp_command_buffer[i] = temp[i];
-            }
-
-            processed_all = false;
-
-            break;
-        }
-
-
-        // Don't need to process commands under 8
-        if (command >= 8) {
-            rdp_enqueue_command(command_length, &rdp_command_buffer[buf_index]);
-        }
-
-        if (command == RDP_COMMAND_FULL_SYNC) {
-            rdp_on_full_sync();
-        }
-
-        buf_index += command_length;
-    }
-
-    if (processed_all) {
-        last_run_unprocessed_words = 0;
+        process_rdp_words((const u32*)&n64sys.mem.rdram[WORD_ADDRESS(current)], display_list_length >> 2);
     }
 
     dpc->current = end;
@@ -254,6 +305,7 @@ void rdp_run_command() {
             case VULKAN_VIDEO_TYPE:
             case QT_VULKAN_VIDEO_TYPE:
             case SOFTWARE_VIDEO_TYPE:
+            case UNKNOWN_VIDEO_TYPE:
                 process_rdp_list();
                 break;
             default:
@@ -271,8 +323,14 @@ void rdp_update_screen() {
             prdp_update_screen();
             break;
         case SOFTWARE_VIDEO_TYPE:
-            n64_render_screen();
+            if (n64sys.frontend) {
+                n64_render_screen();
+            } else {
+                softrdp_flush(&n64sys.softrdp_state);
+            }
             break;
+        case UNKNOWN_VIDEO_TYPE:
+            break; // No frontend, nothing to display
         default:
             logfatal("Unknown video type");
     }
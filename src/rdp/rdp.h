@@ -14,6 +14,13 @@ void rdp_update_screen();
 void rdp_status_reg_write(u32 value);
 void rdp_start_reg_write(u32 value);
 void rdp_end_reg_write(u32 value);
+// Runs complete commands that didn't come through the DPC registers, e.g. from a graphics task run natively
+void rdp_process_commands(const u32* commands, int length_words);
+// Waits for the software RDP to finish drawing everything before the last sync_full
+void rdp_wait_for_full_sync();
+// Gets every command on its way to be rendered, e.g. to compare what two ways of running a task sent. NULL to stop.
+typedef void (*rdp_command_observer_t)(int length_words, const u32* words);
+void rdp_set_command_observer(rdp_command_observer_t observer);
 
 #ifdef __cplusplus
 }
@@ -1,8 +1,21 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <log.h>
 #include <cstring>
 #include <util.h>
 #include <mem/mem_util.h>
+#include <mem/n64mem.h>
+#include <simd.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+#include <SDL_timer.h>
+#ifdef N64_USE_SIMD
+#include <immintrin.h>
+#endif
 #include "softrdp.h"
 
 #ifndef INLINE
@@ -135,24 +148,6 @@ typedef struct edge_coefficients {
 
 static_assert(sizeof(edge_coefficients_t) == 4 * sizeof(u64), "Edge coefficients must be 4 u64s");
 
-typedef struct z_coefficients {
-    // Inverse depth
-    int16_t z;
-    uint16_t z_f;
-
-    // Change in Z per change in X coordinate
-    int16_t dzdx;
-    uint16_t dzdx_f;
-
-    // Change in Z along major edge
-    int16_t dzde;
-    uint16_t dzde_f;
-
-    // Change in Z per change in Y coordinate
-    int16_t dzdy;
-    uint16_t dzdy_f;
-} z_coefficients_t;
-
 template<int int_part, int frac_part>
 union fixed_point_16 {
     u16 uraw:(int_part + frac_part);
@@ -246,16 +241,76 @@ static_assert(sizeof(load_block_t) == sizeof(u64));
 
 static_assert(sizeof(texture_rectangle_t) == 2 * sizeof(u64), "Texture rectangle command must be 2 u64s");
 
-typedef struct span {
-    int start;
-    int end;
-} span_t;
+// Per-pixel attributes a primitive can interpolate, in the order their coefficients come in the command
+enum {
+    ATTR_R, ATTR_G, ATTR_B, ATTR_A,
+    ATTR_S, ATTR_T, ATTR_W,
+    ATTR_Z,
+    ATTR_COUNT
+};
+
+// Spans are shaded this many pixels at a time, so the interpolated attributes stay in L1
+#define SPAN_CHUNK 64
+
+typedef struct pipeline pipeline_t;
+
+// Everything needed to draw a triangle or rectangle, worked out once when the command is parsed. All x values and
+// attributes are s15.16.
+typedef struct primitive {
+    // First scanline, where the second minor edge takes over, and one past the last scanline
+    int y_start;
+    int y_mid;
+    int y_end;
 
-typedef struct spans {
-    int start_y;
-    int num_spans;
-    span_t spans[1024];
-} spans_t;
+    // 0 = left major 1 = right major
+    bool right_major;
+
+    int32_t xh, dxhdy;
+    int32_t xm, dxmdy;
+    int32_t xl, dxldy;
+
+    bool shade;
+    bool texture;
+    bool zbuffer;
+    int tile;
+
+    // Values where the major edge crosses y_start, and their change per pixel and per scanline along the major edge
+    int32_t attr[ATTR_COUNT];
+    int32_t dadx[ATTR_COUNT];
+    int32_t dade[ATTR_COUNT];
+    // Z's change per scanline, which only goes into dz
+    int32_t dzdy;
+
+    // Whether its pixels are tested against the Z buffer, or update it. dz is the log of how much depth a pixel covers,
+    // taken as a power of two.
+    bool depth;
+    uint8_t dz;
+
+    // How its pixels are shaded, for the modes set when it was drawn
+    const pipeline_t* pipeline;
+} primitive_t;
+
+// Attributes of one chunk of a span, one entry per pixel
+typedef struct span_buffer {
+    uint32_t shade[SPAN_CHUNK];
+    int32_t s[SPAN_CHUNK];
+    int32_t t[SPAN_CHUNK];
+    int32_t w[SPAN_CHUNK];
+    int32_t z[SPAN_CHUNK];
+    // Nonzero for the pixels that passed the depth test, cleared by shading for the ones it then didn't draw
+    uint8_t draw[SPAN_CHUNK];
+    // What the Z buffer gets for each pixel that's drawn, when depth is updated
+    uint16_t depth[SPAN_CHUNK];
+} span_buffer_t;
+
+// Inputs to the color combiner and blender for one pixel
+typedef struct pixel_inputs {
+    color_32bpp_t combined;
+    color_32bpp_t texel0;
+    color_32bpp_t texel1;
+    color_32bpp_t shade;
+    uint8_t noise;
+} pixel_inputs_t;
 
 constexpr bool get_bit(uint64_t cmd, int bit) {
     return (cmd >> bit) & 1;
@@ -269,7 +324,7 @@ constexpr uint64_t get_bits(uint64_t cmd, int hi, int lo) {
     return (cmd >> lo) & get_mask(hi - lo);
 }
 
-INLINE int get_bytes_per_pixel(softrdp_state_t* rdp) {
+INLINE int get_bytes_per_pixel(const softrdp_state_t* rdp) {
     switch (rdp->color_image.size) {
         case 2: return 2;
         case 3: return 4;
@@ -278,90 +333,221 @@ INLINE int get_bytes_per_pixel(softrdp_state_t* rdp) {
     }
 }
 
-INLINE void get_zbuffer_coefficients(const uint64_t* buffer, z_coefficients_t* coefficients) {
-    coefficients->z   = get_bits(buffer[0], 63, 48);
-    coefficients->z_f = get_bits(buffer[0], 47, 32);
-
-    coefficients->dzdx   = get_bits(buffer[0], 31, 16);
-    coefficients->dzdx_f = get_bits(buffer[0], 15, 0);
-
-    coefficients->dzde   = get_bits(buffer[1], 63, 48);
-    coefficients->dzde_f = get_bits(buffer[1], 47, 32);
+INLINE int32_t s15_16(uint64_t integer, uint64_t frac) {
+    return (int32_t)((uint32_t)integer << 16 | (uint32_t)frac);
+}
 
-    coefficients->dzdy   = get_bits(buffer[1], 31, 16);
-    coefficients->dzdy_f = get_bits(buffer[1], 15, 0);
+// Y coordinates are s11.2 in 14 bits
+INLINE int get_scanline(uint64_t y) {
+    return (int16_t)(y << 2) >> 4;
+}
 
+// Shade and texture coefficients share a layout: four attributes at a time, integer and fractional halves in separate words
+INLINE void get_attribute_coefficients(const uint64_t* buffer, primitive_t* prim, int first, int count) {
+    for (int i = 0; i < count; i++) {
+        int lo = 48 - i * 16;
+        int hi = lo + 15;
+        prim->attr[first + i] = s15_16(get_bits(buffer[0], hi, lo), get_bits(buffer[2], hi, lo));
+        prim->dadx[first + i] = s15_16(get_bits(buffer[1], hi, lo), get_bits(buffer[3], hi, lo));
+        prim->dade[first + i] = s15_16(get_bits(buffer[4], hi, lo), get_bits(buffer[6], hi, lo));
+        // The change per scanline, buffer[5] and buffer[7], only matters to the RDP's subpixel walk
+    }
+}
 
-    logalways("Z coefficients: z: %d.%d, dzdx: %d.%d, dzde: %d.%d, dzdy: %d.%d",
-              coefficients->z, coefficients->z_f,
-              coefficients->dzdx, coefficients->dzdx_f,
-              coefficients->dzde, coefficients->dzde_f,
-              coefficients->dzdy, coefficients->dzdy_f);
+INLINE void get_zbuffer_coefficients(const uint64_t* buffer, primitive_t* prim) {
+    prim->attr[ATTR_Z] = (int32_t)get_bits(buffer[0], 63, 32);
+    prim->dadx[ATTR_Z] = (int32_t)get_bits(buffer[0], 31, 0);
+    prim->dade[ATTR_Z] = (int32_t)get_bits(buffer[1], 63, 32);
+    prim->dzdy = (int32_t)get_bits(buffer[1], 31, 0);
 }
 
-INLINE void triangle_edgewalker(softrdp_state_t* rdp, const edge_coefficients_t* ec, spans_t* spans) {
-    uint32_t xstart;
-    uint32_t xend;
+// Parses any triangle command. Coefficients follow the edges in a fixed order: shade, then texture, then Z.
+INLINE void get_triangle(const uint64_t* buffer, primitive_t* prim, bool shade, bool texture, bool zbuffer) {
+    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
 
-    int32_t dxstart;
-    int32_t dxend;
+    prim->y_start = get_scanline(ec->yh);
+    prim->y_mid   = get_scanline(ec->ym);
+    prim->y_end   = get_scanline(ec->yl);
+    prim->right_major = ec->right_major;
+
+    prim->xh = s15_16(ec->xh, ec->xh_f);
+    prim->xm = s15_16(ec->xm, ec->xm_f);
+    prim->xl = s15_16(ec->xl, ec->xl_f);
+    prim->dxhdy = s15_16(ec->dxhdy, ec->dxhdy_f);
+    prim->dxmdy = s15_16(ec->dxmdy, ec->dxmdy_f);
+    prim->dxldy = s15_16(ec->dxldy, ec->dxldy_f);
+
+    prim->shade = shade;
+    prim->texture = texture;
+    prim->zbuffer = zbuffer;
+    prim->tile = ec->tile;
+
+    int index = 4;
+    if (shade) {
+        get_attribute_coefficients(&buffer[index], prim, ATTR_R, 4);
+        index += 8;
+    }
+    if (texture) {
+        get_attribute_coefficients(&buffer[index], prim, ATTR_S, 3);
+        index += 8;
+    }
+    if (zbuffer) {
+        get_zbuffer_coefficients(&buffer[index], prim);
+    }
+}
 
-    if (ec->right_major) {
-        xstart = ec->xm << 16 | ec->xm_f;
-        xend = ec->xh << 16 | ec->xh_f;
+// A rectangle is a primitive whose edges don't move: the right edge is the major one, and the minor edges are both the left
+INLINE void get_rectangle(primitive_t* prim, int xh, int yh, int xl, int yl) {
+    memset(prim, 0, sizeof(primitive_t));
+    prim->y_start = yh;
+    prim->y_mid = yl;
+    prim->y_end = yl;
+    prim->right_major = true;
+    prim->xh = xl << 16;
+    prim->xm = xh << 16;
+    prim->xl = xh << 16;
+}
 
-        dxstart = ec->dxmdy << 16 | ec->dxmdy_f;
-        dxend = ec->dxhdy << 16 | ec->dxhdy_f;
-    } else {
-        xstart = ec->xh << 16 | ec->xh_f;
-        xend = ec->xm << 16 | ec->xm_f;
+INLINE uint32_t add_wrapping(int32_t a, int32_t b) {
+    return (uint32_t)a + (uint32_t)b;
+}
 
-        dxstart = ec->dxhdy << 16 | ec->dxhdy_f;
-        dxend = ec->dxmdy << 16 | ec->dxmdy_f;
+static void interpolate_span_scalar(const primitive_t* prim, const int32_t* start, int n, span_buffer_t* span) {
+    if (prim->shade) {
+        for (int i = 0; i < n; i++) {
+            color_32bpp_t shade;
+            uint8_t* channels[4] = { &shade.r, &shade.g, &shade.b, &shade.a };
+            for (int c = 0; c < 4; c++) {
+                int32_t value = (int32_t)add_wrapping(start[ATTR_R + c], prim->dadx[ATTR_R + c] * i) >> 16;
+                *channels[c] = value < 0 ? 0 : (value > 0xFF ? 0xFF : value);
+            }
+            span->shade[i] = shade.raw;
+        }
+    }
+    if (prim->texture) {
+        for (int i = 0; i < n; i++) {
+            span->s[i] = (int32_t)add_wrapping(start[ATTR_S], prim->dadx[ATTR_S] * i);
+            span->t[i] = (int32_t)add_wrapping(start[ATTR_T], prim->dadx[ATTR_T] * i);
+            span->w[i] = (int32_t)add_wrapping(start[ATTR_W], prim->dadx[ATTR_W] * i);
+        }
+    }
+    if (prim->zbuffer) {
+        for (int i = 0; i < n; i++) {
+            span->z[i] = (int32_t)add_wrapping(start[ATTR_Z], prim->dadx[ATTR_Z] * i);
+        }
     }
+}
 
-    int bytes_per_pixel = get_bytes_per_pixel(rdp);
+#ifdef N64_USE_SIMD
+// The value of an attribute at four consecutive pixels
+INLINE __m128i ramp_sse(int32_t start, int32_t step) {
+    return _mm_set_epi32((int)add_wrapping(start, step * 3), (int)add_wrapping(start, step * 2), (int)add_wrapping(start, step), start);
+}
 
-    int yh = ec->yh / 4;
-    int ym = ec->ym / 4;
-    int yl = ec->yl / 4;
+INLINE void interpolate_attribute_sse(int32_t start, int32_t step, int n, int32_t* out) {
+    __m128i value = ramp_sse(start, step);
+    const __m128i increment = _mm_set1_epi32(step * 4);
+    for (int i = 0; i < n; i += 4) {
+        _mm_storeu_si128((__m128i*)&out[i], value);
+        value = _mm_add_epi32(value, increment);
+    }
+}
 
-    logalways("Edgewalking triangle yh %d ym %d yl %d", yh, ym, yl);
+// Clamps four s15.16 values per channel to 0-255 with saturating packs, then interleaves them into color_32bpp_t order
+INLINE __m128i pack_shade_sse(__m128i r, __m128i g, __m128i b, __m128i a) {
+    __m128i ab = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+    __m128i gr = _mm_packs_epi32(_mm_srai_epi32(g, 16), _mm_srai_epi32(r, 16));
+    __m128i channels = _mm_packus_epi16(ab, gr); // a0-a3 b0-b3 g0-g3 r0-r3
+    __m128i ab_pairs = _mm_unpacklo_epi8(channels, _mm_srli_si128(channels, 4));
+    __m128i gr_pairs = _mm_unpacklo_epi8(_mm_srli_si128(channels, 8), _mm_srli_si128(channels, 12));
+    return _mm_unpacklo_epi16(ab_pairs, gr_pairs);
+}
 
-    spans->start_y = yh;
+// Buffers are SPAN_CHUNK long, so running past n to the end of the vector is harmless
+static void interpolate_span_sse(const primitive_t* prim, const int32_t* start, int n, span_buffer_t* span) {
+    if (prim->shade) {
+        __m128i r = ramp_sse(start[ATTR_R], prim->dadx[ATTR_R]);
+        __m128i g = ramp_sse(start[ATTR_G], prim->dadx[ATTR_G]);
+        __m128i b = ramp_sse(start[ATTR_B], prim->dadx[ATTR_B]);
+        __m128i a = ramp_sse(start[ATTR_A], prim->dadx[ATTR_A]);
+        const __m128i dr = _mm_set1_epi32(prim->dadx[ATTR_R] * 4);
+        const __m128i dg = _mm_set1_epi32(prim->dadx[ATTR_G] * 4);
+        const __m128i db = _mm_set1_epi32(prim->dadx[ATTR_B] * 4);
+        const __m128i da = _mm_set1_epi32(prim->dadx[ATTR_A] * 4);
+        for (int i = 0; i < n; i += 4) {
+            _mm_storeu_si128((__m128i*)&span->shade[i], pack_shade_sse(r, g, b, a));
+            r = _mm_add_epi32(r, dr);
+            g = _mm_add_epi32(g, dg);
+            b = _mm_add_epi32(b, db);
+            a = _mm_add_epi32(a, da);
+        }
+    }
+    if (prim->texture) {
+        interpolate_attribute_sse(start[ATTR_S], prim->dadx[ATTR_S], n, span->s);
+        interpolate_attribute_sse(start[ATTR_T], prim->dadx[ATTR_T], n, span->t);
+        interpolate_attribute_sse(start[ATTR_W], prim->dadx[ATTR_W], n, span->w);
+    }
+    if (prim->zbuffer) {
+        interpolate_attribute_sse(start[ATTR_Z], prim->dadx[ATTR_Z], n, span->z);
+    }
+}
 
-    int span_index = 0;
+SIMD_TARGET_AVX2 INLINE __m256i ramp_avx2(int32_t start, int32_t step) {
+    return _mm256_set_epi32((int)add_wrapping(start, step * 7), (int)add_wrapping(start, step * 6),
+                            (int)add_wrapping(start, step * 5), (int)add_wrapping(start, step * 4),
+                            (int)add_wrapping(start, step * 3), (int)add_wrapping(start, step * 2),
+                            (int)add_wrapping(start, step), start);
+}
 
-    for (int y = yh; y < ym; y += 1) {
-        span_t* s = &spans->spans[span_index++];
+SIMD_TARGET_AVX2 INLINE void interpolate_attribute_avx2(int32_t start, int32_t step, int n, int32_t* out) {
+    __m256i value = ramp_avx2(start, step);
+    const __m256i increment = _mm256_set1_epi32(step * 8);
+    for (int i = 0; i < n; i += 8) {
+        _mm256_storeu_si256((__m256i*)&out[i], value);
+        value = _mm256_add_epi32(value, increment);
+    }
+}
 
-        s->start = ((ec->right_major ? xend : xstart) >> 16);
-        s->end = ((ec->right_major ? xstart : xend) >> 16);
+// Same as pack_shade_sse(), every step stays within a 128 bit lane so each lane holds four pixels in order
+SIMD_TARGET_AVX2 INLINE __m256i pack_shade_avx2(__m256i r, __m256i g, __m256i b, __m256i a) {
+    __m256i ab = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+    __m256i gr = _mm256_packs_epi32(_mm256_srai_epi32(g, 16), _mm256_srai_epi32(r, 16));
+    __m256i channels = _mm256_packus_epi16(ab, gr);
+    __m256i ab_pairs = _mm256_unpacklo_epi8(channels, _mm256_srli_si256(channels, 4));
+    __m256i gr_pairs = _mm256_unpacklo_epi8(_mm256_srli_si256(channels, 8), _mm256_srli_si256(channels, 12));
+    return _mm256_unpacklo_epi16(ab_pairs, gr_pairs);
+}
 
-        xstart += dxstart;
-        xend += dxend;
+SIMD_TARGET_AVX2 static void interpolate_span_avx2(const primitive_t* prim, const int32_t* start, int n, span_buffer_t* span) {
+    if (prim->shade) {
+        __m256i r = ramp_avx2(start[ATTR_R], prim->dadx[ATTR_R]);
+        __m256i g = ramp_avx2(start[ATTR_G], prim->dadx[ATTR_G]);
+        __m256i b = ramp_avx2(start[ATTR_B], prim->dadx[ATTR_B]);
+        __m256i a = ramp_avx2(start[ATTR_A], prim->dadx[ATTR_A]);
+        const __m256i dr = _mm256_set1_epi32(prim->dadx[ATTR_R] * 8);
+        const __m256i dg = _mm256_set1_epi32(prim->dadx[ATTR_G] * 8);
+        const __m256i db = _mm256_set1_epi32(prim->dadx[ATTR_B] * 8);
+        const __m256i da = _mm256_set1_epi32(prim->dadx[ATTR_A] * 8);
+        for (int i = 0; i < n; i += 8) {
+            _mm256_storeu_si256((__m256i*)&span->shade[i], pack_shade_avx2(r, g, b, a));
+            r = _mm256_add_epi32(r, dr);
+            g = _mm256_add_epi32(g, dg);
+            b = _mm256_add_epi32(b, db);
+            a = _mm256_add_epi32(a, da);
+        }
     }
-
-    if (ec->right_major) {
-        xstart = ec->xl << 16 | ec->xl_f;
-        dxstart = ec->dxldy << 16 | ec->dxldy_f;
-    } else {
-        xend = ec->xl << 16 | ec->xl_f;
-        dxend = ec->dxldy << 16 | ec->dxldy_f;
+    if (prim->texture) {
+        interpolate_attribute_avx2(start[ATTR_S], prim->dadx[ATTR_S], n, span->s);
+        interpolate_attribute_avx2(start[ATTR_T], prim->dadx[ATTR_T], n, span->t);
+        interpolate_attribute_avx2(start[ATTR_W], prim->dadx[ATTR_W], n, span->w);
     }
-
-    for (int y = ym; y < yl; y += 1) {
-        span_t* s = &spans->spans[span_index++];
-
-        s->start = ((ec->right_major ? xend : xstart) >> 16);
-        s->end = ((ec->right_major ? xstart : xend) >> 16);
-
-        xstart += dxstart;
-        xend += dxend;
+    if (prim->zbuffer) {
+        interpolate_attribute_avx2(start[ATTR_Z], prim->dadx[ATTR_Z], n, span->z);
     }
-
-    spans->num_spans = span_index;
 }
+#endif
+
+static void (*interpolate_span)(const primitive_t* prim, const int32_t* start, int n, span_buffer_t* span) = interpolate_span_scalar;
 
 INLINE blender_source_t from_1a(int value) {
     switch (value) {
@@ -376,7 +562,7 @@ INLINE blender_source_t from_1a(int value) {
 INLINE blender_source_t from_1b(int value) {
     switch(value) {
         case 0: return BLENDER_PIXEL_ALPHA;
-        case 1: return BLENDER_PRIMITIVE_ALPHA;
+        case 1: return BLENDER_FOG_ALPHA;
         case 2: return BLENDER_SHADE_ALPHA;
         case 3: return BLENDER_ZERO;
         default: logfatal("Unknown 1b blender source: %d", value);
@@ -403,24 +589,174 @@ INLINE blender_source_t from_2b(int value) {
     }
 }
 
-uint8_t get_blender_alpha(softrdp_state_t* rdp, blender_source_t source) {
+INLINE combiner_source_t from_rgb_sub_a(int value) {
+    switch (value) {
+        case 0: return COMBINER_COMBINED;
+        case 1: return COMBINER_TEXEL0;
+        case 2: return COMBINER_TEXEL1;
+        case 3: return COMBINER_PRIMITIVE;
+        case 4: return COMBINER_SHADE;
+        case 5: return COMBINER_ENVIRONMENT;
+        case 6: return COMBINER_ONE;
+        case 7: return COMBINER_NOISE;
+        default: return COMBINER_ZERO;
+    }
+}
+
+INLINE combiner_source_t from_rgb_sub_b(int value) {
+    switch (value) {
+        case 0: return COMBINER_COMBINED;
+        case 1: return COMBINER_TEXEL0;
+        case 2: return COMBINER_TEXEL1;
+        case 3: return COMBINER_PRIMITIVE;
+        case 4: return COMBINER_SHADE;
+        case 5: return COMBINER_ENVIRONMENT;
+        case 6: return COMBINER_KEY_CENTER;
+        case 7: return COMBINER_CONVERT_K4;
+        default: return COMBINER_ZERO;
+    }
+}
+
+INLINE combiner_source_t from_rgb_mul(int value) {
+    switch (value) {
+        case 0:  return COMBINER_COMBINED;
+        case 1:  return COMBINER_TEXEL0;
+        case 2:  return COMBINER_TEXEL1;
+        case 3:  return COMBINER_PRIMITIVE;
+        case 4:  return COMBINER_SHADE;
+        case 5:  return COMBINER_ENVIRONMENT;
+        case 6:  return COMBINER_KEY_SCALE;
+        case 7:  return COMBINER_COMBINED_ALPHA;
+        case 8:  return COMBINER_TEXEL0_ALPHA;
+        case 9:  return COMBINER_TEXEL1_ALPHA;
+        case 10: return COMBINER_PRIMITIVE_ALPHA;
+        case 11: return COMBINER_SHADE_ALPHA;
+        case 12: return COMBINER_ENVIRONMENT_ALPHA;
+        case 13: return COMBINER_LOD_FRACTION;
+        case 14: return COMBINER_PRIM_LOD_FRACTION;
+        case 15: return COMBINER_CONVERT_K5;
+        default: return COMBINER_ZERO;
+    }
+}
+
+INLINE combiner_source_t from_rgb_add(int value) {
+    switch (value) {
+        case 0: return COMBINER_COMBINED;
+        case 1: return COMBINER_TEXEL0;
+        case 2: return COMBINER_TEXEL1;
+        case 3: return COMBINER_PRIMITIVE;
+        case 4: return COMBINER_SHADE;
+        case 5: return COMBINER_ENVIRONMENT;
+        case 6: return COMBINER_ONE;
+        default: return COMBINER_ZERO;
+    }
+}
+
+// Alpha sub_a, sub_b and add all share these
+INLINE combiner_source_t from_alpha_add(int value) {
+    switch (value) {
+        case 0: return COMBINER_COMBINED_ALPHA;
+        case 1: return COMBINER_TEXEL0_ALPHA;
+        case 2: return COMBINER_TEXEL1_ALPHA;
+        case 3: return COMBINER_PRIMITIVE_ALPHA;
+        case 4: return COMBINER_SHADE_ALPHA;
+        case 5: return COMBINER_ENVIRONMENT_ALPHA;
+        case 6: return COMBINER_ONE;
+        default: return COMBINER_ZERO;
+    }
+}
+
+INLINE combiner_source_t from_alpha_mul(int value) {
+    switch (value) {
+        case 0: return COMBINER_LOD_FRACTION;
+        case 1: return COMBINER_TEXEL0_ALPHA;
+        case 2: return COMBINER_TEXEL1_ALPHA;
+        case 3: return COMBINER_PRIMITIVE_ALPHA;
+        case 4: return COMBINER_SHADE_ALPHA;
+        case 5: return COMBINER_ENVIRONMENT_ALPHA;
+        case 6: return COMBINER_PRIM_LOD_FRACTION;
+        default: return COMBINER_ZERO;
+    }
+}
+
+INLINE color_32bpp_t grey(uint8_t value) {
+    color_32bpp_t color;
+    color.r = value;
+    color.g = value;
+    color.b = value;
+    color.a = value;
+    return color;
+}
+
+INLINE uint8_t combiner_alpha(const softrdp_state_t* rdp, const pixel_inputs_t* in, combiner_source_t source) {
     switch (source) {
-        case BLENDER_PIXEL_ALPHA:
-            // TODO
-            return 0xFF;
-        case BLENDER_PRIMITIVE_ALPHA:
-            logfatal("BLENDER_PRIMITIVE_ALPHA");
-        case BLENDER_SHADE_ALPHA:
-            logfatal("BLENDER_SHADE_ALPHA");
-        case BLENDER_ONE_MINUS_ALPHA:
-            // TODO
-            return 0xFF;
-        case BLENDER_MEMORY_ALPHA:
-            logfatal("BLENDER_MEMORY_ALPHA");
-        case BLENDER_ONE:
-            logfatal("BLENDER_ONE");
-        case BLENDER_ZERO:
-            logfatal("BLENDER_ZERO");
+        case COMBINER_COMBINED_ALPHA:    return in->combined.a;
+        case COMBINER_TEXEL0_ALPHA:      return in->texel0.a;
+        case COMBINER_TEXEL1_ALPHA:      return in->texel1.a;
+        case COMBINER_PRIMITIVE_ALPHA:   return rdp->prim_color.a;
+        case COMBINER_SHADE_ALPHA:       return in->shade.a;
+        case COMBINER_ENVIRONMENT_ALPHA: return rdp->env_color.a;
+        case COMBINER_PRIM_LOD_FRACTION: return rdp->prim_lod_frac;
+        case COMBINER_ONE:               return 0xFF;
+        // No mipmapping, so the LOD fraction is always 0
+        case COMBINER_LOD_FRACTION:
+        case COMBINER_ZERO:
+            return 0;
+        default:
+            logfatal("Getting color value from combiner_alpha function!");
+    }
+}
+
+INLINE color_32bpp_t combiner_color(const softrdp_state_t* rdp, const pixel_inputs_t* in, combiner_source_t source) {
+    switch (source) {
+        case COMBINER_COMBINED:    return in->combined;
+        case COMBINER_TEXEL0:      return in->texel0;
+        case COMBINER_TEXEL1:      return in->texel1;
+        case COMBINER_PRIMITIVE:   return rdp->prim_color;
+        case COMBINER_SHADE:       return in->shade;
+        case COMBINER_ENVIRONMENT: return rdp->env_color;
+        case COMBINER_NOISE:       return grey(in->noise);
+        case COMBINER_CONVERT_K4:  return grey(rdp->convert[4]);
+        case COMBINER_CONVERT_K5:  return grey(rdp->convert[5]);
+        // Chroma keying isn't supported
+        case COMBINER_KEY_CENTER:
+        case COMBINER_KEY_SCALE:
+            return grey(0);
+        default:
+            return grey(combiner_alpha(rdp, in, source));
+    }
+}
+
+INLINE uint8_t combine_channel(int a, int b, int c, int d) {
+    int value = (((a - b) * c + 0x80) >> 8) + d;
+    return value < 0 ? 0 : (value > 0xFF ? 0xFF : value);
+}
+
+INLINE color_32bpp_t color_combiner(const softrdp_state_t* rdp, const pixel_inputs_t* in, int cycle) {
+    const combiner_config_t* config = &rdp->combiner_config[cycle];
+    color_32bpp_t a = combiner_color(rdp, in, config->rgb_sub_a);
+    color_32bpp_t b = combiner_color(rdp, in, config->rgb_sub_b);
+    color_32bpp_t c = combiner_color(rdp, in, config->rgb_mul);
+    color_32bpp_t d = combiner_color(rdp, in, config->rgb_add);
+
+    color_32bpp_t result;
+    result.r = combine_channel(a.r, b.r, c.r, d.r);
+    result.g = combine_channel(a.g, b.g, c.g, d.g);
+    result.b = combine_channel(a.b, b.b, c.b, d.b);
+    result.a = combine_channel(combiner_alpha(rdp, in, config->alpha_sub_a), combiner_alpha(rdp, in, config->alpha_sub_b),
+                               combiner_alpha(rdp, in, config->alpha_mul), combiner_alpha(rdp, in, config->alpha_add));
+    return result;
+}
+
+INLINE uint8_t get_blender_alpha(const softrdp_state_t* rdp, blender_source_t source, const pixel_inputs_t* in, uint8_t pixel_alpha, uint8_t memory_alpha, uint8_t alpha_1b) {
+    switch (source) {
+        case BLENDER_PIXEL_ALPHA:     return pixel_alpha;
+        case BLENDER_FOG_ALPHA:       return rdp->fog_color.a;
+        case BLENDER_SHADE_ALPHA:     return in->shade.a;
+        case BLENDER_ONE_MINUS_ALPHA: return 0xFF - alpha_1b;
+        case BLENDER_MEMORY_ALPHA:    return memory_alpha;
+        case BLENDER_ONE:             return 0xFF;
+        case BLENDER_ZERO:            return 0;
 
         case BLENDER_PIXEL_COLOR:
         case BLENDER_MEMORY_COLOR:
@@ -432,21 +768,15 @@ uint8_t get_blender_alpha(softrdp_state_t* rdp, blender_source_t source) {
     }
 }
 
-color_32bpp_t get_blender_color(softrdp_state_t* rdp, blender_source_t source) {
+INLINE color_32bpp_t get_blender_color(const softrdp_state_t* rdp, blender_source_t source, color_32bpp_t pixel, color_32bpp_t memory) {
     switch(source) {
-        case BLENDER_PIXEL_COLOR:
-            // TODO: Output of color combiner
-            return {.raw = 0xFFFFFFFF };
-        case BLENDER_MEMORY_COLOR:
-            logfatal("BLENDER_MEMORY_COLOR");
-            break;
-        case BLENDER_BLEND_COLOR:
-            return rdp->blend_color;
-        case BLENDER_FOG_COLOR:
-            logfatal("BLENDER_FOG_COLOR");
-            break;
+        case BLENDER_PIXEL_COLOR:  return pixel;
+        case BLENDER_MEMORY_COLOR: return memory;
+        case BLENDER_BLEND_COLOR:  return rdp->blend_color;
+        case BLENDER_FOG_COLOR:    return rdp->fog_color;
+
         case BLENDER_PIXEL_ALPHA:
-        case BLENDER_PRIMITIVE_ALPHA:
+        case BLENDER_FOG_ALPHA:
         case BLENDER_SHADE_ALPHA:
         case BLENDER_ONE_MINUS_ALPHA:
         case BLENDER_MEMORY_ALPHA:
@@ -458,14 +788,29 @@ color_32bpp_t get_blender_color(softrdp_state_t* rdp, blender_source_t source) {
     }
 }
 
-color_32bpp_t blender(softrdp_state_t* rdp, int cycle) {
-    color_32bpp_t _1a = get_blender_color(rdp, rdp->other_modes.blender_config[cycle].source_1a);
-    uint8_t _1b       = get_blender_alpha(rdp, rdp->other_modes.blender_config[cycle].source_1b);
-    color_32bpp_t _2a = get_blender_color(rdp, rdp->other_modes.blender_config[cycle].source_2a);
-    uint8_t _2b       = get_blender_alpha(rdp, rdp->other_modes.blender_config[cycle].source_2b);
+INLINE uint8_t blend_channel(int a, int a_factor, int b, int b_factor) {
+    int value = (a * a_factor + b * b_factor + 0x7F) / 0xFF;
+    return value > 0xFF ? 0xFF : value;
+}
 
-    // TODO: (1a * 1b + 2a * 2b) / (1b + 2b)
-    return _1a;
+// (1a * 1b + 2a * 2b). Without force_blend, and without coverage to antialias edges with, the last cycle passes 1a through.
+INLINE color_32bpp_t blender(const softrdp_state_t* rdp, int cycle, bool blend, const pixel_inputs_t* in, color_32bpp_t pixel, color_32bpp_t memory) {
+    const blender_config_t* config = &rdp->other_modes.blender_config[cycle];
+    color_32bpp_t _1a = get_blender_color(rdp, config->source_1a, pixel, memory);
+    if (!blend) {
+        _1a.a = pixel.a;
+        return _1a;
+    }
+    uint8_t _1b       = get_blender_alpha(rdp, config->source_1b, in, pixel.a, memory.a, 0);
+    color_32bpp_t _2a = get_blender_color(rdp, config->source_2a, pixel, memory);
+    uint8_t _2b       = get_blender_alpha(rdp, config->source_2b, in, pixel.a, memory.a, _1b);
+
+    color_32bpp_t result;
+    result.r = blend_channel(_1a.r, _1b, _2a.r, _2b);
+    result.g = blend_channel(_1a.g, _1b, _2a.g, _2b);
+    result.b = blend_channel(_1a.b, _1b, _2a.b, _2b);
+    result.a = pixel.a;
+    return result;
 }
 
 color_16bpp_t convert_32bpp_to_16bpp(color_32bpp_t color) {
@@ -478,153 +823,1455 @@ color_16bpp_t convert_32bpp_to_16bpp(color_32bpp_t color) {
     return converted;
 }
 
-uint32_t convert_32bpp_to_packed_16bpp(color_32bpp_t color) {
-    color_16bpp_t converted = convert_32bpp_to_16bpp(color);
-    return ((uint32_t)converted.raw << 16) | converted.raw;
+INLINE color_32bpp_t convert_16bpp_to_32bpp(uint16_t raw) {
+    color_16bpp_t color;
+    color.raw = raw;
+    color_32bpp_t converted;
+    converted.r = color.r << 3 | color.r >> 2;
+    converted.g = color.g << 3 | color.g >> 2;
+    converted.b = color.b << 3 | color.b >> 2;
+    converted.a = color.a ? 0xFF : 0;
+    return converted;
+}
+
+INLINE uint16_t fill_for_addr(uint32_t color, uint32_t addr) {
+    // Code below is optimized to remove the conditional.
+    // Essentially, the behavior is to use the upper bits of fill_color if we're on an even column,
+    // and the lower bits if we're on an odd column.
+
+    // return rdp->fill_color >> (addr % 4 == 0 ? 16 : 0);
+    return color >> (16 - ((addr % 4) * 8));
+}
+
+INLINE void rdram_write16(softrdp_state_t* rdp, u32 address, u16 value) {
+    memcpy(&rdp->rdram[HALF_ADDRESS(address)], &value, sizeof(u16));
+}
+
+INLINE void rdram_write32(softrdp_state_t* rdp, u32 address, u32 value) {
+    memcpy(&rdp->rdram[WORD_ADDRESS(address)], &value, sizeof(u32));
+}
+
+INLINE u8 rdram_read8(const softrdp_state_t* rdp, u32 address) {
+    return rdp->rdram[BYTE_ADDRESS(address)];
+}
+
+INLINE u16 rdram_read16(const softrdp_state_t* rdp, u32 address) {
+    u16 value;
+    memcpy(&value, &rdp->rdram[HALF_ADDRESS(address)], sizeof(u16));
+    return value;
+}
+
+INLINE u32 rdram_read32(const softrdp_state_t* rdp, u32 address) {
+    u32 value;
+    memcpy(&value, &rdp->rdram[WORD_ADDRESS(address)], sizeof(u32));
+    return value;
+}
+
+INLINE u8 tmem_read8(const softrdp_state_t* rdp, u16 address) {
+    return rdp->tmem[BYTE_ADDRESS(address)];
+}
+
+INLINE u16 tmem_read16(const softrdp_state_t* rdp, u16 address) {
+    u16 value;
+    memcpy(&value, &rdp->tmem[HALF_ADDRESS(address)], sizeof(u16));
+    return value;
+}
+
+INLINE void tmem_write8(softrdp_state_t* rdp, u16 address, u8 value) {
+    rdp->tmem[BYTE_ADDRESS(address)] = value;
+}
+
+INLINE void tmem_write16(softrdp_state_t* rdp, u16 address, u16 value) {
+    memcpy(&rdp->tmem[HALF_ADDRESS(address)], &value, sizeof(u16));
+}
+
+// The color image is drawn into host memory a band of SOFTRDP_BAND_HEIGHT scanlines at a time, with 16 bit pixels in
+// order rather than swapped within each word like RDRAM keeps them. A row is copied in from RDRAM the first time it's
+// drawn to, and only copied back by resolve_framebuffer(), once something could see it.
+typedef struct framebuffer_tile {
+    std::vector<uint8_t> pixels;
+    // The band's rows that were copied in, one bit each
+    uint32_t rows;
+} framebuffer_tile_t;
+
+static_assert(SOFTRDP_BAND_HEIGHT <= 32, "A tile's rows have to fit in its mask");
+
+// Spans can run past the right edge of the color image into the next row, as they would in RDRAM. Room for the widest
+// span keeps that inside the tile, though what runs off the last row is dropped.
+#define FRAMEBUFFER_TILE_SLACK (1024 * 4)
+
+struct softrdp_framebuffer {
+    // Indexed by band
+    std::vector<framebuffer_tile_t> tiles;
+    // The color image the rows were copied from
+    uint32_t dram_addr;
+    uint32_t stride;
+    int bytes_per_pixel;
+    // Whether any tile has rows to copy back
+    bool drawn;
+};
+
+// Swaps the two 16 bit pixels in each word, which turns RDRAM's order into the tiles' and back
+static void swap_pixel_pairs_scalar(uint8_t* dst, const uint8_t* src, int words) {
+    for (int i = 0; i < words; i++) {
+        u32 word;
+        memcpy(&word, &src[i * 4], sizeof(u32));
+        word = (word << 16) | (word >> 16);
+        memcpy(&dst[i * 4], &word, sizeof(u32));
+    }
+}
+
+#ifdef N64_USE_SIMD
+static void swap_pixel_pairs_sse(uint8_t* dst, const uint8_t* src, int words) {
+    int i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)&src[i * 4]);
+        pixels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)&dst[i * 4], pixels);
+    }
+    swap_pixel_pairs_scalar(&dst[i * 4], &src[i * 4], words - i);
+}
+
+SIMD_TARGET_AVX2 static void swap_pixel_pairs_avx2(uint8_t* dst, const uint8_t* src, int words) {
+    int i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)&src[i * 4]);
+        pixels = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm256_storeu_si256((__m256i*)&dst[i * 4], pixels);
+    }
+    swap_pixel_pairs_sse(&dst[i * 4], &src[i * 4], words - i);
+}
+#endif
+
+static void (*swap_pixel_pairs)(uint8_t* dst, const uint8_t* src, int words) = swap_pixel_pairs_scalar;
+
+// Copies a row of the color image from RDRAM into a tile. Whole words in range of RDRAM are copied at once, and
+// anything else a pixel at a time, wrapping around the end of RDRAM like single pixel accesses do.
+static void load_framebuffer_row(const softrdp_state_t* rdp, const softrdp_framebuffer* fb, uint8_t* pixels, uint32_t address) {
+    const uint32_t bytes = fb->stride;
+    uint32_t i = 0;
+    if (fb->bytes_per_pixel == 4) {
+        if ((address & 3) == 0 && address + bytes <= N64_RDRAM_SIZE) {
+            memcpy(pixels, &rdp->rdram[WORD_ADDRESS(address)], bytes);
+            return;
+        }
+        for (; i < bytes; i += 4) {
+            const u32 pixel = rdram_read32(rdp, (address + i) & (N64_RDRAM_SIZE - 1));
+            memcpy(&pixels[i], &pixel, sizeof(u32));
+        }
+        return;
+    }
+    if ((address & 1) == 0 && address + bytes <= N64_RDRAM_SIZE) {
+        if (address & 2) {
+            const u16 pixel = rdram_read16(rdp, address);
+            memcpy(pixels, &pixel, sizeof(u16));
+            i = 2;
+        }
+        const int words = (bytes - i) / 4;
+        swap_pixel_pairs(&pixels[i], &rdp->rdram[address + i], words);
+        i += words * 4;
+    }
+    for (; i < bytes; i += 2) {
+        const u16 pixel = rdram_read16(rdp, (address + i) & (N64_RDRAM_SIZE - 1));
+        memcpy(&pixels[i], &pixel, sizeof(u16));
+    }
+}
+
+// The other way around. Only the row's own bytes are written, since a worker drawing the next band may share a word.
+static void resolve_framebuffer_row(softrdp_state_t* rdp, const softrdp_framebuffer* fb, const uint8_t* pixels, uint32_t address) {
+    const uint32_t bytes = fb->stride;
+    uint32_t i = 0;
+    if (fb->bytes_per_pixel == 4) {
+        if ((address & 3) == 0 && address + bytes <= N64_RDRAM_SIZE) {
+            memcpy(&rdp->rdram[WORD_ADDRESS(address)], pixels, bytes);
+            return;
+        }
+        for (; i < bytes; i += 4) {
+            u32 pixel;
+            memcpy(&pixel, &pixels[i], sizeof(u32));
+            rdram_write32(rdp, (address + i) & (N64_RDRAM_SIZE - 1), pixel);
+        }
+        return;
+    }
+    if ((address & 1) == 0 && address + bytes <= N64_RDRAM_SIZE) {
+        if (address & 2) {
+            u16 pixel;
+            memcpy(&pixel, pixels, sizeof(u16));
+            rdram_write16(rdp, address, pixel);
+            i = 2;
+        }
+        const int words = (bytes - i) / 4;
+        swap_pixel_pairs(&rdp->rdram[address + i], &pixels[i], words);
+        i += words * 4;
+    }
+    for (; i < bytes; i += 2) {
+        u16 pixel;
+        memcpy(&pixel, &pixels[i], sizeof(u16));
+        rdram_write16(rdp, (address + i) & (N64_RDRAM_SIZE - 1), pixel);
+    }
+}
+
+static uint8_t* load_framebuffer_line(softrdp_state_t* rdp, int y) {
+    softrdp_framebuffer* fb = rdp->framebuffer;
+    if (!fb->drawn) {
+        fb->dram_addr = rdp->color_image.dram_addr;
+        fb->bytes_per_pixel = get_bytes_per_pixel(rdp);
+        fb->stride = rdp->color_image.width * fb->bytes_per_pixel;
+        fb->drawn = true;
+    }
+    const size_t band = y / SOFTRDP_BAND_HEIGHT;
+    const int row = y % SOFTRDP_BAND_HEIGHT;
+    if (band >= fb->tiles.size()) {
+        fb->tiles.resize(band + 1);
+    }
+    framebuffer_tile_t* tile = &fb->tiles[band];
+    const size_t size = fb->stride * SOFTRDP_BAND_HEIGHT + FRAMEBUFFER_TILE_SLACK;
+    if (tile->pixels.size() < size) {
+        tile->pixels.resize(size);
+    }
+    uint8_t* line = &tile->pixels[row * fb->stride];
+    load_framebuffer_row(rdp, fb, line, fb->dram_addr + y * fb->stride);
+    tile->rows |= 1u << row;
+    return line;
+}
+
+// Scanline y of the color image, to draw to
+INLINE uint8_t* framebuffer_line(softrdp_state_t* rdp, int y) {
+    softrdp_framebuffer* fb = rdp->framebuffer;
+    const size_t band = y / SOFTRDP_BAND_HEIGHT;
+    const int row = y % SOFTRDP_BAND_HEIGHT;
+    if (likely(band < fb->tiles.size() && (fb->tiles[band].rows & (1u << row)))) {
+        return &fb->tiles[band].pixels[row * fb->stride];
+    }
+    return load_framebuffer_line(rdp, y);
+}
+
+// Copies every row drawn since the last time back to RDRAM
+static void resolve_framebuffer(softrdp_state_t* rdp) {
+    softrdp_framebuffer* fb = rdp->framebuffer;
+    // Never initialized when another RDP is in use
+    if (fb == NULL || !fb->drawn) {
+        return;
+    }
+    for (size_t band = 0; band < fb->tiles.size(); band++) {
+        framebuffer_tile_t* tile = &fb->tiles[band];
+        for (int row = 0; tile->rows != 0; row++) {
+            if (tile->rows & (1u << row)) {
+                const uint32_t y = band * SOFTRDP_BAND_HEIGHT + row;
+                resolve_framebuffer_row(rdp, fb, &tile->pixels[row * fb->stride], fb->dram_addr + y * fb->stride);
+                tile->rows &= ~(1u << row);
+            }
+        }
+    }
+    fb->drawn = false;
+}
+
+INLINE color_32bpp_t read_pixel(const softrdp_state_t* rdp, const uint8_t* pixel) {
+    color_32bpp_t color;
+    if (rdp->color_image.size == TEXEL_SIZE_16) {
+        u16 raw;
+        memcpy(&raw, pixel, sizeof(u16));
+        color = convert_16bpp_to_32bpp(raw);
+    } else {
+        memcpy(&color.raw, pixel, sizeof(u32));
+    }
+    return color;
+}
+
+INLINE void write_pixel(softrdp_state_t* rdp, uint8_t* pixel, color_32bpp_t color) {
+    if (rdp->color_image.size == TEXEL_SIZE_16) {
+        const u16 raw = convert_32bpp_to_16bpp(color).raw;
+        memcpy(pixel, &raw, sizeof(u16));
+    } else {
+        memcpy(pixel, &color.raw, sizeof(u32));
+    }
+}
+
+// Applies a tile's shift, offset, clamp, mirror and mask to an s10.5 texture coordinate, giving a whole texel
+INLINE int wrap_texel_coordinate(int coord, int shift, uint16_t low, uint16_t high, bool clamp, bool mirror, int mask) {
+    if (shift <= 10) {
+        coord >>= shift;
+    } else {
+        coord <<= (16 - shift);
+    }
+    // The tile's bounds are 10.2
+    coord -= low << 3;
+    int texel = coord >> 5;
+
+    if (clamp || mask == 0) {
+        int max = (high - low) >> 2;
+        texel = texel < 0 ? 0 : (texel > max ? max : texel);
+    }
+    if (mask > 0) {
+        if (mirror && ((texel >> mask) & 1)) {
+            texel = ~texel;
+        }
+        texel &= (1 << mask) - 1;
+    }
+    return texel;
+}
+
+INLINE color_32bpp_t palette_lookup(const softrdp_state_t* rdp, int index) {
+    // load_tlut leaves each entry at the start of a 64 bit row in the upper half of TMEM
+    uint16_t entry = tmem_read16(rdp, 0x800 + index * 8);
+    if (rdp->other_modes.tlut_type) {
+        color_32bpp_t color = grey(entry >> 8);
+        color.a = entry & 0xFF;
+        return color;
+    }
+    return convert_16bpp_to_32bpp(entry);
+}
+
+// Decodes the texel at whole texel coordinates s and t, already wrapped, of a tile whose texel size is Size
+template<int Size>
+INLINE color_32bpp_t fetch_texel(const softrdp_state_t* rdp, const softrdp_tile_t* tile, int s, int t) {
+    const u32 tmem_line = tile->tmem_adrs * sizeof(u64) + t * tile->line * sizeof(u64);
+    const u32 tmem_xor = (t & 1) << 2; // Xor the address by 4 for odd lines
+    color_32bpp_t color;
+
+    if constexpr (Size == TEXEL_SIZE_4) {
+        u8 byte = tmem_read8(rdp, ((tmem_line + (s >> 1)) ^ tmem_xor) & 0xFFF);
+        u8 value = s & 1 ? byte & 0xF : byte >> 4;
+        if (rdp->other_modes.en_tlut) {
+            return palette_lookup(rdp, tile->palette << 4 | value);
+        }
+        switch (tile->format) {
+            case PIXEL_FORMAT_IA:
+                color = grey((value >> 1) << 5 | (value >> 1) << 2 | (value >> 2));
+                color.a = value & 1 ? 0xFF : 0;
+                return color;
+            default:
+                return grey(value << 4 | value);
+        }
+    } else if constexpr (Size == TEXEL_SIZE_8) {
+        u8 value = tmem_read8(rdp, ((tmem_line + s) ^ tmem_xor) & 0xFFF);
+        if (rdp->other_modes.en_tlut) {
+            return palette_lookup(rdp, value);
+        }
+        switch (tile->format) {
+            case PIXEL_FORMAT_IA:
+                color = grey((value >> 4) * 0x11);
+                color.a = (value & 0xF) * 0x11;
+                return color;
+            default:
+                return grey(value);
+        }
+    } else if constexpr (Size == TEXEL_SIZE_16) {
+        u16 value = tmem_read16(rdp, ((tmem_line + s * 2) ^ tmem_xor) & 0xFFF);
+        if (rdp->other_modes.en_tlut) {
+            return palette_lookup(rdp, value >> 8);
+        }
+        switch (tile->format) {
+            case PIXEL_FORMAT_IA:
+                color = grey(value >> 8);
+                color.a = value & 0xFF;
+                return color;
+            case PIXEL_FORMAT_RGBA:
+                return convert_16bpp_to_32bpp(value);
+            default:
+                logfatal("Sampling a 16 bit texture of format %d", tile->format);
+        }
+    } else {
+        // RG in the lower half of TMEM, BA in the upper half
+        const u16 tmem_addr_rg = ((tmem_line + s * 2) & 0x7FF) ^ tmem_xor;
+        const u16 rg = tmem_read16(rdp, tmem_addr_rg);
+        const u16 ba = tmem_read16(rdp, tmem_addr_rg | 0x800);
+        color.raw = (u32)rg << 16 | ba;
+        return color;
+    }
+}
+
+// s and t are s10.5, from the texture coordinate interpolants. Point sampled.
+template<int Size>
+INLINE color_32bpp_t sample_tile_sized(const softrdp_state_t* rdp, const softrdp_tile_t* tile, int s, int t) {
+    s = wrap_texel_coordinate(s, tile->shift_s, tile->sl, tile->sh, tile->cs, tile->ms, tile->mask_s);
+    t = wrap_texel_coordinate(t, tile->shift_t, tile->tl, tile->th, tile->ct, tile->mt, tile->mask_t);
+    return fetch_texel<Size>(rdp, tile, s, t);
+}
+
+static color_32bpp_t sample_tile(const softrdp_state_t* rdp, const softrdp_tile_t* tile, int s, int t) {
+    switch (tile->size) {
+        case TEXEL_SIZE_4:  return sample_tile_sized<TEXEL_SIZE_4>(rdp, tile, s, t);
+        case TEXEL_SIZE_8:  return sample_tile_sized<TEXEL_SIZE_8>(rdp, tile, s, t);
+        case TEXEL_SIZE_16: return sample_tile_sized<TEXEL_SIZE_16>(rdp, tile, s, t);
+        case TEXEL_SIZE_32: return sample_tile_sized<TEXEL_SIZE_32>(rdp, tile, s, t);
+        default:
+            logfatal("Unknown texel size: %d", tile->size);
+    }
+}
+
+// A tile decoded to 32 bit colors, so sampling it is a lookup. Covers every texel wrap_texel_coordinate() can give.
+typedef struct decoded_texture {
+    int width;
+    int height;
+    std::vector<color_32bpp_t> texels;
+    // The TMEM it was decoded from, palette included, to check a texture that hashes the same against
+    std::vector<uint8_t> source;
+} decoded_texture_t;
+
+// The TMEM a tile covers, hashed, along with everything else that decides how it decodes. A texture loaded again every
+// frame hashes the same, so it's only decoded the first time. The hash only finds the entry: what it was decoded from is
+// compared too, so a different texture that happens to hash the same is never sampled.
+typedef struct texture_key {
+    uint64_t hash;
+    uint64_t layout;
+
+    bool operator==(const texture_key& other) const {
+        return hash == other.hash && layout == other.layout;
+    }
+} texture_key_t;
+
+struct texture_key_hash {
+    size_t operator()(const texture_key_t& key) const {
+        return key.hash ^ key.layout * 0x9E3779B97F4A7C15ULL;
+    }
+};
+
+// Larger tiles are sampled straight from TMEM
+#define MAX_DECODED_TILE_TEXELS (256 * 256)
+// The cache is emptied once it holds more than this many texels
+#define MAX_DECODED_TEXELS (4 * 1024 * 1024)
+
+// What a tile was decoded to, kept until TMEM or the tile changes
+typedef struct tile_texture {
+    const softrdp_state_t* rdp;
+    uint64_t tmem_generation;
+    softrdp_tile_t tile;
+    bool en_tlut;
+    bool tlut_type;
+    // NULL when the tile can't be decoded ahead of time
+    const decoded_texture_t* texture;
+} tile_texture_t;
+
+// Like the pixel pipelines, each thread keeps its own
+static thread_local std::unordered_map<texture_key_t, decoded_texture_t, texture_key_hash> texture_cache;
+static thread_local size_t texture_cache_texels = 0;
+static thread_local tile_texture_t tile_textures[8];
+// The TMEM the tile being looked up covers, gathered here to be hashed and compared
+static thread_local std::vector<uint8_t> texture_source;
+
+// How many texels wrap_texel_coordinate() can give, or 0 if the tile's bounds are backwards
+INLINE int tile_extent(int mask, uint16_t low, uint16_t high) {
+    if (mask > 0) {
+        return 1 << mask;
+    }
+    return high < low ? 0 : ((high - low) >> 2) + 1;
+}
+
+// Appends TMEM to source. Addresses and lengths are in whole u64s. The address wraps within mask, like the sampler's
+// does.
+INLINE void gather_tmem(std::vector<uint8_t>* source, const softrdp_state_t* rdp, u32 address, u32 length, u32 mask, u32 half) {
+    const size_t start = source->size();
+    source->resize(start + length);
+    for (u32 i = 0; i < length; i += sizeof(u64)) {
+        memcpy(&(*source)[start + i], &rdp->tmem[((address + i) & mask) | half], sizeof(u64));
+    }
+}
+
+INLINE uint64_t hash_tmem(const std::vector<uint8_t>& source) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < source.size(); i += sizeof(u64)) {
+        u64 word;
+        memcpy(&word, &source[i], sizeof(u64));
+        hash = (hash ^ word) * 0x100000001B3ULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+template<int Size>
+static void decode_texture(const softrdp_state_t* rdp, const softrdp_tile_t* tile, decoded_texture_t* texture) {
+    texture->texels.resize(texture->width * texture->height);
+    for (int t = 0; t < texture->height; t++) {
+        for (int s = 0; s < texture->width; s++) {
+            texture->texels[t * texture->width + s] = fetch_texel<Size>(rdp, tile, s, t);
+        }
+    }
+}
+
+static const decoded_texture_t* find_decoded_texture(softrdp_state_t* rdp, const softrdp_tile_t* tile) {
+    const int width = tile_extent(tile->mask_s, tile->sl, tile->sh);
+    const int height = tile_extent(tile->mask_t, tile->tl, tile->th);
+    if (width == 0 || height == 0 || width * height > MAX_DECODED_TILE_TEXELS) {
+        return nullptr;
+    }
+
+    // Every line up to the last, and as much of the last as its texels take up. 32 bit texels are split across both
+    // halves of TMEM, with RG and BA each taking 16 bits in their half.
+    const u32 tmem_base = tile->tmem_adrs * sizeof(u64);
+    const u32 line_bytes = tile->size == TEXEL_SIZE_32 ? width * 2 : ((width << tile->size) + 1) >> 1;
+    u32 length = (height - 1) * tile->line * sizeof(u64) + line_bytes;
+    length = (length + 7) & ~7;
+    std::vector<uint8_t>& source = texture_source;
+    source.clear();
+    if (tile->size == TEXEL_SIZE_32) {
+        length = std::min<u32>(length, 0x800);
+        gather_tmem(&source, rdp, tmem_base, length, 0x7F8, 0);
+        gather_tmem(&source, rdp, tmem_base, length, 0x7F8, 0x800);
+    } else {
+        length = std::min<u32>(length, sizeof(rdp->tmem));
+        gather_tmem(&source, rdp, tmem_base, length, 0xFF8, 0);
+    }
+
+    const bool tlut = rdp->other_modes.en_tlut && tile->size != TEXEL_SIZE_32;
+    if (tlut) {
+        // palette_lookup() reads a u64 per entry from the upper half of TMEM
+        if (tile->size == TEXEL_SIZE_4) {
+            gather_tmem(&source, rdp, 0x800 + tile->palette * 16 * sizeof(u64), 16 * sizeof(u64), 0xFF8, 0);
+        } else {
+            gather_tmem(&source, rdp, 0x800, 256 * sizeof(u64), 0xFF8, 0);
+        }
+    }
+
+    texture_key_t key;
+    key.hash = hash_tmem(source);
+    key.layout = (uint64_t)width << 48 | (uint64_t)height << 32 | (uint64_t)tile->line << 16
+               | tile->format << 8 | tile->size << 6 | tlut << 5 | rdp->other_modes.tlut_type << 4 | (tlut ? tile->palette : 0);
+
+    auto found = texture_cache.find(key);
+    if (found != texture_cache.end()) {
+        if (found->second.source == source) {
+            rdp->texture_cache_hits++;
+            return &found->second;
+        }
+        // Another texture hashed the same. Tiles may still point at the one that's cached, so this one is sampled
+        // from TMEM instead of replacing it.
+        rdp->texture_cache_misses++;
+        return nullptr;
+    }
+    rdp->texture_cache_misses++;
+
+    decoded_texture_t* texture = &texture_cache[key];
+    texture->width = width;
+    texture->height = height;
+    texture->source = source;
+    switch (tile->size) {
+        case TEXEL_SIZE_4:  decode_texture<TEXEL_SIZE_4>(rdp, tile, texture);  break;
+        case TEXEL_SIZE_8:  decode_texture<TEXEL_SIZE_8>(rdp, tile, texture);  break;
+        case TEXEL_SIZE_16: decode_texture<TEXEL_SIZE_16>(rdp, tile, texture); break;
+        case TEXEL_SIZE_32: decode_texture<TEXEL_SIZE_32>(rdp, tile, texture); break;
+        default: logfatal("Unknown texel size: %d", tile->size);
+    }
+    texture_cache_texels += width * height;
+    return texture;
+}
+
+// Empties the cache once it's full. Only called between primitives, since it frees what the tiles point at.
+static void trim_texture_cache() {
+    if (texture_cache_texels <= MAX_DECODED_TEXELS) {
+        return;
+    }
+    texture_cache.clear();
+    texture_cache_texels = 0;
+    for (tile_texture_t& memo : tile_textures) {
+        memo.rdp = nullptr;
+    }
+}
+
+// The decoded form of a tile, or NULL to sample it from TMEM
+static const decoded_texture_t* get_decoded_texture(softrdp_state_t* rdp, int index) {
+    tile_texture_t* memo = &tile_textures[index];
+    const softrdp_tile_t* tile = &rdp->tiles[index];
+    if (memo->rdp == rdp && memo->tmem_generation == rdp->tmem_generation
+        && memo->en_tlut == rdp->other_modes.en_tlut && memo->tlut_type == rdp->other_modes.tlut_type
+        && memcmp(&memo->tile, tile, sizeof(softrdp_tile_t)) == 0) {
+        return memo->texture;
+    }
+    const decoded_texture_t* texture = find_decoded_texture(rdp, tile);
+    memo->rdp = rdp;
+    memo->tmem_generation = rdp->tmem_generation;
+    memo->tile = *tile;
+    memo->en_tlut = rdp->other_modes.en_tlut;
+    memo->tlut_type = rdp->other_modes.tlut_type;
+    memo->texture = texture;
+    return texture;
+}
+
+// s and t are s10.5, like sample_tile()
+INLINE color_32bpp_t sample_decoded(const decoded_texture_t* texture, const softrdp_tile_t* tile, int s, int t) {
+    s = wrap_texel_coordinate(s, tile->shift_s, tile->sl, tile->sh, tile->cs, tile->ms, tile->mask_s);
+    t = wrap_texel_coordinate(t, tile->shift_t, tile->tl, tile->th, tile->ct, tile->mt, tile->mask_t);
+    return texture->texels[t * texture->width + s];
+}
+
+template<int Size>
+INLINE color_32bpp_t sample_texture(const softrdp_state_t* rdp, const decoded_texture_t* texture, const softrdp_tile_t* tile, int s, int t) {
+    if (texture != nullptr) {
+        return sample_decoded(texture, tile, s, t);
+    }
+    return sample_tile_sized<Size>(rdp, tile, s, t);
+}
+
+// Turns the s, t and w interpolants into s10.5 texture coordinates, dividing by w for perspective correction
+INLINE void texture_coordinates(const softrdp_state_t* rdp, int32_t s, int32_t t, int32_t w, int* out_s, int* out_t) {
+    if (rdp->other_modes.persp_tex_en) {
+        // w is normalized so the nearest vertex is 1.0 in s0.15
+        float scale = 32768.0f / (float)(w > 0 ? w : 1);
+        *out_s = (int)((float)s * scale);
+        *out_t = (int)((float)t * scale);
+    } else {
+        *out_s = s >> 16;
+        *out_t = t >> 16;
+    }
+}
+
+INLINE bool alpha_compare(const softrdp_state_t* rdp, uint8_t alpha) {
+    return !rdp->other_modes.alpha_compare_en || alpha >= rdp->blend_color.a;
+}
+
+INLINE uint8_t noise(int x, int y) {
+    uint32_t hash = (uint32_t)x * 0x9E3779B1 ^ (uint32_t)y * 0x85EBCA77;
+    return (hash ^ (hash >> 15)) >> 8;
+}
+
+// Runs the combiner and blender for the pixels of a chunk of a span marked to draw, and writes the results. Handles any
+// modes, deciding where each input comes from per pixel, so it's only used for the modes the specialized pipelines
+// below don't cover.
+static void shade_span_generic(softrdp_state_t* rdp, const primitive_t* prim, int y, int x, int n, span_buffer_t* span) {
+    const int bytes_per_pixel = get_bytes_per_pixel(rdp);
+    uint8_t* pixel = framebuffer_line(rdp, y) + x * bytes_per_pixel;
+    const bool two_cycle = rdp->other_modes.cycle_type == 1;
+    const softrdp_tile_t* tile0 = &rdp->tiles[prim->tile];
+    const softrdp_tile_t* tile1 = &rdp->tiles[(prim->tile + 1) & 7];
+    const decoded_texture_t* texture0 = prim->texture ? get_decoded_texture(rdp, prim->tile) : nullptr;
+    const decoded_texture_t* texture1 = prim->texture && two_cycle ? get_decoded_texture(rdp, (prim->tile + 1) & 7) : nullptr;
+
+    pixel_inputs_t in;
+    in.shade.raw = 0;
+    in.texel0.raw = 0;
+    in.texel1.raw = 0;
+
+    for (int i = 0; i < n; i++, pixel += bytes_per_pixel) {
+        if (!span->draw[i]) {
+            continue;
+        }
+        if (prim->shade) {
+            in.shade.raw = span->shade[i];
+        }
+        if (prim->texture) {
+            int s, t;
+            texture_coordinates(rdp, span->s[i], span->t[i], span->w[i], &s, &t);
+            in.texel0 = texture0 ? sample_decoded(texture0, tile0, s, t) : sample_tile(rdp, tile0, s, t);
+            if (two_cycle) {
+                in.texel1 = texture1 ? sample_decoded(texture1, tile1, s, t) : sample_tile(rdp, tile1, s, t);
+            } else {
+                in.texel1 = in.texel0;
+            }
+        }
+        in.noise = noise(x + i, y);
+        in.combined.raw = 0;
+
+        color_32bpp_t color;
+        if (two_cycle) {
+            in.combined = color_combiner(rdp, &in, 0);
+            color = color_combiner(rdp, &in, 1);
+        } else {
+            // One cycle mode runs the second cycle's combiner
+            color = color_combiner(rdp, &in, 1);
+        }
+        if (!alpha_compare(rdp, color.a)) {
+            span->draw[i] = 0;
+            continue;
+        }
+
+        color_32bpp_t memory;
+        if (rdp->other_modes.image_read_en) {
+            memory = read_pixel(rdp, pixel);
+        } else {
+            memory.raw = 0;
+            memory.a = 0xFF;
+        }
+
+        if (two_cycle) {
+            // The first cycle always blends, and feeds the second as the pixel color
+            color_32bpp_t first = blender(rdp, 0, true, &in, color, memory);
+            color = blender(rdp, 1, rdp->other_modes.force_blend, &in, first, memory);
+        } else {
+            color = blender(rdp, 0, rdp->other_modes.force_blend, &in, color, memory);
+        }
+        write_pixel(rdp, pixel, color);
+    }
+}
+
+typedef void (*shade_span_t)(softrdp_state_t* rdp, const primitive_t* prim, int y, int x, int n, span_buffer_t* span);
+
+// Where the combiner's inputs are kept while shading a span, so each source can be looked up once per pipeline rather
+// than switched on per pixel
+enum {
+    // Change per pixel
+    SLOT_COMBINED, SLOT_TEXEL0, SLOT_TEXEL1, SLOT_SHADE, SLOT_NOISE,
+    // The same alphas in all four channels, for the RGB inputs that take an alpha
+    SLOT_COMBINED_ALPHA, SLOT_TEXEL0_ALPHA, SLOT_TEXEL1_ALPHA, SLOT_SHADE_ALPHA,
+    // Only change with commands
+    SLOT_PRIMITIVE, SLOT_ENVIRONMENT, SLOT_PRIMITIVE_ALPHA, SLOT_ENVIRONMENT_ALPHA, SLOT_PRIM_LOD_FRACTION,
+    SLOT_CONVERT_K4, SLOT_CONVERT_K5, SLOT_ONE, SLOT_ZERO,
+    SLOT_COUNT
+};
+
+// The blender's inputs are looked up the same way. Colors are indexed by blender_source_t, alphas by
+// blender_source_t - BLENDER_PIXEL_ALPHA.
+enum { BLENDER_COLOR_COUNT = BLENDER_FOG_COLOR + 1, BLENDER_ALPHA_COUNT = BLENDER_ZERO - BLENDER_PIXEL_ALPHA + 1 };
+
+// The span function and input slots for one combination of modes
+struct pipeline {
+    shade_span_t shade_span;
+    // sub_a, sub_b, mul and add for each cycle
+    uint8_t combiner_rgb[2][4];
+    uint8_t combiner_alpha[2][4];
+    // 1a, 1b, 2a and 2b for each cycle
+    uint8_t blender[2][4];
+};
+
+// Everything a pipeline is picked by: the other modes and combine words, and what the primitive and tiles look like
+typedef struct pipeline_key {
+    uint64_t other_modes;
+    uint64_t combine;
+    uint32_t format;
+
+    bool operator==(const pipeline_key& other) const {
+        return other_modes == other.other_modes && combine == other.combine && format == other.format;
+    }
+} pipeline_key_t;
+
+struct pipeline_key_hash {
+    size_t operator()(const pipeline_key_t& key) const {
+        uint64_t hash = key.other_modes * 0x9E3779B97F4A7C15ULL ^ key.combine * 0xC2B2AE3D27D4EB4FULL ^ key.format;
+        return hash ^ (hash >> 29);
+    }
+};
+
+// Pipelines picked so far. Each thread keeps its own, so the workers never share one.
+#define MAX_CACHED_PIPELINES 4096
+static thread_local std::unordered_map<pipeline_key_t, pipeline_t, pipeline_key_hash> pipeline_cache;
+static thread_local pipeline_key_t last_pipeline_key;
+static thread_local const pipeline_t* last_pipeline = nullptr;
+
+INLINE uint8_t combiner_rgb_slot(combiner_source_t source) {
+    switch (source) {
+        case COMBINER_COMBINED:          return SLOT_COMBINED;
+        case COMBINER_TEXEL0:            return SLOT_TEXEL0;
+        case COMBINER_TEXEL1:            return SLOT_TEXEL1;
+        case COMBINER_PRIMITIVE:         return SLOT_PRIMITIVE;
+        case COMBINER_SHADE:             return SLOT_SHADE;
+        case COMBINER_ENVIRONMENT:       return SLOT_ENVIRONMENT;
+        case COMBINER_NOISE:             return SLOT_NOISE;
+        case COMBINER_CONVERT_K4:        return SLOT_CONVERT_K4;
+        case COMBINER_CONVERT_K5:        return SLOT_CONVERT_K5;
+        case COMBINER_COMBINED_ALPHA:    return SLOT_COMBINED_ALPHA;
+        case COMBINER_TEXEL0_ALPHA:      return SLOT_TEXEL0_ALPHA;
+        case COMBINER_TEXEL1_ALPHA:      return SLOT_TEXEL1_ALPHA;
+        case COMBINER_PRIMITIVE_ALPHA:   return SLOT_PRIMITIVE_ALPHA;
+        case COMBINER_SHADE_ALPHA:       return SLOT_SHADE_ALPHA;
+        case COMBINER_ENVIRONMENT_ALPHA: return SLOT_ENVIRONMENT_ALPHA;
+        case COMBINER_PRIM_LOD_FRACTION: return SLOT_PRIM_LOD_FRACTION;
+        case COMBINER_ONE:               return SLOT_ONE;
+        // Same as combiner_color(): no chroma keying and no mipmapping
+        default:                         return SLOT_ZERO;
+    }
+}
+
+// The alpha channel of the slot returned is the input
+INLINE uint8_t combiner_alpha_slot(combiner_source_t source) {
+    switch (source) {
+        case COMBINER_COMBINED_ALPHA:    return SLOT_COMBINED;
+        case COMBINER_TEXEL0_ALPHA:      return SLOT_TEXEL0;
+        case COMBINER_TEXEL1_ALPHA:      return SLOT_TEXEL1;
+        case COMBINER_PRIMITIVE_ALPHA:   return SLOT_PRIMITIVE;
+        case COMBINER_SHADE_ALPHA:       return SLOT_SHADE;
+        case COMBINER_ENVIRONMENT_ALPHA: return SLOT_ENVIRONMENT;
+        case COMBINER_PRIM_LOD_FRACTION: return SLOT_PRIM_LOD_FRACTION;
+        case COMBINER_ONE:               return SLOT_ONE;
+        default:                         return SLOT_ZERO;
+    }
+}
+
+INLINE void set_constant_slots(const softrdp_state_t* rdp, color_32bpp_t* slots) {
+    slots[SLOT_PRIMITIVE] = rdp->prim_color;
+    slots[SLOT_ENVIRONMENT] = rdp->env_color;
+    slots[SLOT_PRIMITIVE_ALPHA] = grey(rdp->prim_color.a);
+    slots[SLOT_ENVIRONMENT_ALPHA] = grey(rdp->env_color.a);
+    slots[SLOT_PRIM_LOD_FRACTION] = grey(rdp->prim_lod_frac);
+    slots[SLOT_CONVERT_K4] = grey(rdp->convert[4]);
+    slots[SLOT_CONVERT_K5] = grey(rdp->convert[5]);
+    slots[SLOT_ONE] = grey(0xFF);
+    slots[SLOT_ZERO] = grey(0);
+}
+
+INLINE color_32bpp_t combine_slots(const color_32bpp_t* slots, const uint8_t* rgb, const uint8_t* alpha) {
+    const color_32bpp_t a = slots[rgb[0]];
+    const color_32bpp_t b = slots[rgb[1]];
+    const color_32bpp_t c = slots[rgb[2]];
+    const color_32bpp_t d = slots[rgb[3]];
+
+    color_32bpp_t result;
+    result.r = combine_channel(a.r, b.r, c.r, d.r);
+    result.g = combine_channel(a.g, b.g, c.g, d.g);
+    result.b = combine_channel(a.b, b.b, c.b, d.b);
+    result.a = combine_channel(slots[alpha[0]].a, slots[alpha[1]].a, slots[alpha[2]].a, slots[alpha[3]].a);
+    return result;
+}
+
+// The same as blender(), with colors[BLENDER_PIXEL_COLOR] and alphas for the pixel already filled in
+template<bool Blend>
+INLINE color_32bpp_t blend_slots(const uint8_t* config, const color_32bpp_t* colors, uint8_t* alphas) {
+    color_32bpp_t _1a = colors[config[0]];
+    const uint8_t pixel_alpha = colors[BLENDER_PIXEL_COLOR].a;
+    if constexpr (!Blend) {
+        _1a.a = pixel_alpha;
+        return _1a;
+    } else {
+        const uint8_t _1b = alphas[config[1]];
+        alphas[BLENDER_ONE_MINUS_ALPHA - BLENDER_PIXEL_ALPHA] = 0xFF - _1b;
+        const color_32bpp_t _2a = colors[config[2]];
+        const uint8_t _2b = alphas[config[3]];
+
+        color_32bpp_t result;
+        result.r = blend_channel(_1a.r, _1b, _2a.r, _2b);
+        result.g = blend_channel(_1a.g, _1b, _2a.g, _2b);
+        result.b = blend_channel(_1a.b, _1b, _2a.b, _2b);
+        result.a = pixel_alpha;
+        return result;
+    }
+}
+
+// shade_span_generic() for one cycle type, texel size (-1 without a texture), blending, image read and color image size,
+// with the combiner's and blender's inputs picked out by the pipeline's slots
+template<int Cycles, int TexelSize, bool ForceBlend, bool ImageRead, bool Color16>
+static void shade_span_specialized(softrdp_state_t* rdp, const primitive_t* prim, int y, int x, int n, span_buffer_t* span) {
+    const pipeline_t* pipeline = prim->pipeline;
+    const int bytes_per_pixel = Color16 ? 2 : 4;
+    uint8_t* pixel = framebuffer_line(rdp, y) + x * bytes_per_pixel;
+    const softrdp_tile_t* tile0 = &rdp->tiles[prim->tile];
+    const softrdp_tile_t* tile1 = &rdp->tiles[(prim->tile + 1) & 7];
+    const decoded_texture_t* texture0 = TexelSize >= 0 ? get_decoded_texture(rdp, prim->tile) : nullptr;
+    const decoded_texture_t* texture1 = TexelSize >= 0 && Cycles == 2 ? get_decoded_texture(rdp, (prim->tile + 1) & 7) : nullptr;
+    const uint32_t shade_mask = prim->shade ? 0xFFFFFFFF : 0;
+    const uint8_t alpha_threshold = rdp->other_modes.alpha_compare_en ? rdp->blend_color.a : 0;
+
+    color_32bpp_t slots[SLOT_COUNT];
+    set_constant_slots(rdp, slots);
+    slots[SLOT_COMBINED].raw = 0;
+    slots[SLOT_COMBINED_ALPHA].raw = 0;
+    slots[SLOT_TEXEL0].raw = 0;
+    slots[SLOT_TEXEL1].raw = 0;
+    slots[SLOT_TEXEL0_ALPHA].raw = 0;
+    slots[SLOT_TEXEL1_ALPHA].raw = 0;
+
+    color_32bpp_t colors[BLENDER_COLOR_COUNT];
+    uint8_t alphas[BLENDER_ALPHA_COUNT];
+    colors[BLENDER_BLEND_COLOR] = rdp->blend_color;
+    colors[BLENDER_FOG_COLOR] = rdp->fog_color;
+    alphas[BLENDER_FOG_ALPHA - BLENDER_PIXEL_ALPHA] = rdp->fog_color.a;
+    alphas[BLENDER_ONE - BLENDER_PIXEL_ALPHA] = 0xFF;
+    alphas[BLENDER_ZERO - BLENDER_PIXEL_ALPHA] = 0;
+
+    for (int i = 0; i < n; i++, pixel += bytes_per_pixel) {
+        if (!span->draw[i]) {
+            continue;
+        }
+        slots[SLOT_SHADE].raw = span->shade[i] & shade_mask;
+        slots[SLOT_SHADE_ALPHA] = grey(slots[SLOT_SHADE].a);
+        if constexpr (TexelSize >= 0) {
+            int s, t;
+            texture_coordinates(rdp, span->s[i], span->t[i], span->w[i], &s, &t);
+            slots[SLOT_TEXEL0] = sample_texture<TexelSize>(rdp, texture0, tile0, s, t);
+            slots[SLOT_TEXEL1] = Cycles == 2 ? sample_texture<TexelSize>(rdp, texture1, tile1, s, t) : slots[SLOT_TEXEL0];
+            slots[SLOT_TEXEL0_ALPHA] = grey(slots[SLOT_TEXEL0].a);
+            slots[SLOT_TEXEL1_ALPHA] = grey(slots[SLOT_TEXEL1].a);
+        }
+        slots[SLOT_NOISE] = grey(noise(x + i, y));
+
+        if constexpr (Cycles == 2) {
+            slots[SLOT_COMBINED].raw = 0;
+            slots[SLOT_COMBINED_ALPHA].raw = 0;
+            slots[SLOT_COMBINED] = combine_slots(slots, pipeline->combiner_rgb[0], pipeline->combiner_alpha[0]);
+            slots[SLOT_COMBINED_ALPHA] = grey(slots[SLOT_COMBINED].a);
+        }
+        color_32bpp_t color = combine_slots(slots, pipeline->combiner_rgb[1], pipeline->combiner_alpha[1]);
+        if (color.a < alpha_threshold) {
+            span->draw[i] = 0;
+            continue;
+        }
+
+        color_32bpp_t memory;
+        if constexpr (!ImageRead) {
+            memory.raw = 0;
+            memory.a = 0xFF;
+        } else if constexpr (Color16) {
+            u16 raw;
+            memcpy(&raw, pixel, sizeof(u16));
+            memory = convert_16bpp_to_32bpp(raw);
+        } else {
+            memcpy(&memory.raw, pixel, sizeof(u32));
+        }
+        colors[BLENDER_PIXEL_COLOR] = color;
+        colors[BLENDER_MEMORY_COLOR] = memory;
+        alphas[BLENDER_PIXEL_ALPHA - BLENDER_PIXEL_ALPHA] = color.a;
+        alphas[BLENDER_SHADE_ALPHA - BLENDER_PIXEL_ALPHA] = slots[SLOT_SHADE].a;
+        alphas[BLENDER_MEMORY_ALPHA - BLENDER_PIXEL_ALPHA] = memory.a;
+
+        if constexpr (Cycles == 2) {
+            // The first cycle always blends, and feeds the second as the pixel color
+            colors[BLENDER_PIXEL_COLOR] = blend_slots<true>(pipeline->blender[0], colors, alphas);
+            alphas[BLENDER_PIXEL_ALPHA - BLENDER_PIXEL_ALPHA] = colors[BLENDER_PIXEL_COLOR].a;
+            color = blend_slots<ForceBlend>(pipeline->blender[1], colors, alphas);
+        } else {
+            color = blend_slots<ForceBlend>(pipeline->blender[0], colors, alphas);
+        }
+
+        if constexpr (Color16) {
+            const u16 raw = convert_32bpp_to_16bpp(color).raw;
+            memcpy(pixel, &raw, sizeof(u16));
+        } else {
+            memcpy(pixel, &color.raw, sizeof(u32));
+        }
+    }
+}
+
+// Turns the runtime modes into template arguments, one at a time
+template<int Cycles, int TexelSize, bool ForceBlend, bool ImageRead>
+INLINE shade_span_t specialize_color_size(bool color16) {
+    return color16 ? shade_span_specialized<Cycles, TexelSize, ForceBlend, ImageRead, true>
+                   : shade_span_specialized<Cycles, TexelSize, ForceBlend, ImageRead, false>;
+}
+
+template<int Cycles, int TexelSize, bool ForceBlend>
+INLINE shade_span_t specialize_image_read(bool image_read, bool color16) {
+    return image_read ? specialize_color_size<Cycles, TexelSize, ForceBlend, true>(color16)
+                      : specialize_color_size<Cycles, TexelSize, ForceBlend, false>(color16);
+}
+
+template<int Cycles, int TexelSize>
+INLINE shade_span_t specialize_blend(bool force_blend, bool image_read, bool color16) {
+    return force_blend ? specialize_image_read<Cycles, TexelSize, true>(image_read, color16)
+                       : specialize_image_read<Cycles, TexelSize, false>(image_read, color16);
+}
+
+template<int Cycles>
+INLINE shade_span_t specialize_texel_size(int texel_size, bool force_blend, bool image_read, bool color16) {
+    switch (texel_size) {
+        case TEXEL_SIZE_4:  return specialize_blend<Cycles, TEXEL_SIZE_4>(force_blend, image_read, color16);
+        case TEXEL_SIZE_8:  return specialize_blend<Cycles, TEXEL_SIZE_8>(force_blend, image_read, color16);
+        case TEXEL_SIZE_16: return specialize_blend<Cycles, TEXEL_SIZE_16>(force_blend, image_read, color16);
+        case TEXEL_SIZE_32: return specialize_blend<Cycles, TEXEL_SIZE_32>(force_blend, image_read, color16);
+        default:            return specialize_blend<Cycles, -1>(force_blend, image_read, color16);
+    }
+}
+
+static pipeline_t make_pipeline(const softrdp_state_t* rdp, const primitive_t* prim) {
+    pipeline_t pipeline;
+    for (int cycle = 0; cycle < 2; cycle++) {
+        const combiner_config_t* combiner = &rdp->combiner_config[cycle];
+        pipeline.combiner_rgb[cycle][0] = combiner_rgb_slot(combiner->rgb_sub_a);
+        pipeline.combiner_rgb[cycle][1] = combiner_rgb_slot(combiner->rgb_sub_b);
+        pipeline.combiner_rgb[cycle][2] = combiner_rgb_slot(combiner->rgb_mul);
+        pipeline.combiner_rgb[cycle][3] = combiner_rgb_slot(combiner->rgb_add);
+        pipeline.combiner_alpha[cycle][0] = combiner_alpha_slot(combiner->alpha_sub_a);
+        pipeline.combiner_alpha[cycle][1] = combiner_alpha_slot(combiner->alpha_sub_b);
+        pipeline.combiner_alpha[cycle][2] = combiner_alpha_slot(combiner->alpha_mul);
+        pipeline.combiner_alpha[cycle][3] = combiner_alpha_slot(combiner->alpha_add);
+
+        const blender_config_t* blender = &rdp->other_modes.blender_config[cycle];
+        pipeline.blender[cycle][0] = blender->source_1a;
+        pipeline.blender[cycle][1] = blender->source_1b - BLENDER_PIXEL_ALPHA;
+        pipeline.blender[cycle][2] = blender->source_2a;
+        pipeline.blender[cycle][3] = blender->source_2b - BLENDER_PIXEL_ALPHA;
+    }
+
+    const bool two_cycle = rdp->other_modes.cycle_type == 1;
+    const softrdp_tile_t* tile0 = &rdp->tiles[prim->tile];
+    const softrdp_tile_t* tile1 = &rdp->tiles[(prim->tile + 1) & 7];
+    if (prim->texture && two_cycle && tile0->size != tile1->size) {
+        // The texel size is part of the specialization, and these would need one for each tile
+        pipeline.shade_span = shade_span_generic;
+        return pipeline;
+    }
+    const int texel_size = prim->texture ? tile0->size : -1;
+    const bool force_blend = rdp->other_modes.force_blend;
+    const bool image_read = rdp->other_modes.image_read_en;
+    const bool color16 = rdp->color_image.size == TEXEL_SIZE_16;
+    pipeline.shade_span = two_cycle ? specialize_texel_size<2>(texel_size, force_blend, image_read, color16)
+                                    : specialize_texel_size<1>(texel_size, force_blend, image_read, color16);
+    return pipeline;
+}
+
+// Finds the pipeline for the current modes, making it the first time they're seen
+static const pipeline_t* get_pipeline(const softrdp_state_t* rdp, const primitive_t* prim) {
+    const softrdp_tile_t* tile0 = &rdp->tiles[prim->tile];
+    const softrdp_tile_t* tile1 = &rdp->tiles[(prim->tile + 1) & 7];
+    pipeline_key_t key;
+    key.other_modes = rdp->other_modes.raw;
+    key.combine = rdp->combine.raw;
+    key.format = prim->texture << 8 | tile0->size << 4 | tile1->size << 2 | rdp->color_image.size;
+    if (last_pipeline != nullptr && key == last_pipeline_key) {
+        return last_pipeline;
+    }
+
+    auto found = pipeline_cache.find(key);
+    if (found == pipeline_cache.end()) {
+        if (pipeline_cache.size() >= MAX_CACHED_PIPELINES) {
+            pipeline_cache.clear();
+        }
+        found = pipeline_cache.emplace(key, make_pipeline(rdp, prim)).first;
+    }
+    last_pipeline_key = key;
+    last_pipeline = &found->second;
+    return last_pipeline;
+}
+
+// Repeats a 4 byte fill pattern over a span of a tile. A halfword left over at the end gets the pattern's first half.
+// The SIMD versions hand what's left after their whole vectors to this one.
+static void fill_span_scalar(uint8_t* pixels, uint32_t bytes, uint32_t pattern) {
+    uint32_t i = 0;
+    for (; i + 4 <= bytes; i += 4) {
+        memcpy(&pixels[i], &pattern, sizeof(u32));
+    }
+    if (i < bytes) {
+        memcpy(&pixels[i], &pattern, bytes - i);
+    }
+}
+
+#ifdef N64_USE_SIMD
+static void fill_span_sse(uint8_t* pixels, uint32_t bytes, uint32_t pattern) {
+    uint32_t i = 0;
+    const __m128i fill = _mm_set1_epi32((int)pattern);
+    for (; i + 16 <= bytes; i += 16) {
+        _mm_storeu_si128((__m128i*)&pixels[i], fill);
+    }
+    fill_span_scalar(&pixels[i], bytes - i, pattern);
+}
+
+SIMD_TARGET_AVX2 static void fill_span_avx2(uint8_t* pixels, uint32_t bytes, uint32_t pattern) {
+    uint32_t i = 0;
+    const __m256i fill = _mm256_set1_epi32((int)pattern);
+    for (; i + 32 <= bytes; i += 32) {
+        _mm256_storeu_si256((__m256i*)&pixels[i], fill);
+    }
+    fill_span_sse(&pixels[i], bytes - i, pattern);
+}
+#endif
+
+static void (*fill_span)(uint8_t* pixels, uint32_t bytes, uint32_t pattern) = fill_span_scalar;
+
+// The fill color as it lands in the tile from pixel x of scanline y on. 16 bit pixels take the upper or lower half of
+// it by where they'd be in RDRAM, so it's worked out for the first two and repeated from there.
+INLINE uint32_t fill_pattern(const softrdp_state_t* rdp, int y, int x) {
+    if (rdp->color_image.size != TEXEL_SIZE_16) {
+        return rdp->fill_color;
+    }
+    const uint32_t address = rdp->color_image.dram_addr + (y * rdp->color_image.width + x) * 2;
+    const u16 pixels[2] = { fill_for_addr(rdp->fill_color, address), fill_for_addr(rdp->fill_color, address + 2) };
+    uint32_t pattern;
+    memcpy(&pattern, pixels, sizeof(u32));
+    return pattern;
+}
+
+// Copies n 16 bit texels from one line of TMEM, starting at tmem_address, to a tile. tmem_xor is 4 on odd lines, like
+// the sampler's. The texels mustn't run past the end of the lower half of TMEM.
+static void copy_span_scalar(const softrdp_state_t* rdp, u32 tmem_address, u32 tmem_xor, uint8_t* pixels, int n) {
+    for (int i = 0; i < n; i++) {
+        const u16 texel = tmem_read16(rdp, (tmem_address + i * 2) ^ tmem_xor);
+        memcpy(&pixels[i * 2], &texel, sizeof(u16));
+    }
 }
 
-INLINE uint16_t fill_for_addr(softrdp_state_t* rdp, uint32_t addr) {
-    uint32_t color = 0;
-    color_32bpp_t blender_color;
-    switch (rdp->other_modes.cycle_type) {
-        case 0: // 1-cycle mode: run entire pipeline
+#ifdef N64_USE_SIMD
+// TMEM keeps halfwords swapped within each word, and odd lines have their words swapped too. Whole 8 byte groups are
+// put in order in a buffer 8 texels at a time, so the tile doesn't need to line up with them.
+static void copy_span_sse(const softrdp_state_t* rdp, u32 tmem_address, u32 tmem_xor, uint8_t* pixels, int n) {
+    if (n < 8) {
+        copy_span_scalar(rdp, tmem_address, tmem_xor, pixels, n);
+        return;
+    }
+    const u32 start = tmem_address & ~7;
+    const u32 skip = (tmem_address - start) >> 1;
+    alignas(16) u16 line[0x800 / sizeof(u16) + 8];
+    for (u32 i = 0; i < skip + n; i += 8) {
+        __m128i texels = _mm_loadu_si128((const __m128i*)&rdp->tmem[start + i * 2]);
+        if (tmem_xor) {
+            texels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(texels, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+        } else {
+            texels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(texels, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        }
+        _mm_store_si128((__m128i*)&line[i], texels);
+    }
+    memcpy(pixels, &line[skip], n * sizeof(u16));
+}
+#endif
 
-            // color combiner: cycle 1 value
-            // blender: cycle 0 value
+static void (*copy_span)(const softrdp_state_t* rdp, u32 tmem_address, u32 tmem_xor, uint8_t* pixels, int n) = copy_span_scalar;
 
-            blender_color = blender(rdp, 0);
-            if (get_bytes_per_pixel(rdp) == 2) {
-                color = convert_32bpp_to_packed_16bpp(blender_color);
-            } else {
-                color = blender_color.raw;
-            }
-            break;
-        case 1: // 2-cycle mode: runs the pipeline twice
-            logfatal("2-cycle mode");
-            break;
-        case 2: // Copy mode: copies from TMEM to framebuffer
-            logfatal("Copy mode");
-            break;
-        case 3: // Fill mode: just runs the rasterizer
-            color = rdp->fill_color;
-            break;
-        default:
-            logfatal("fill_for_addr(): unknown cycle type %d", rdp->other_modes.cycle_type);
+// The Z buffer keeps 18 bits of depth per pixel in 16 bits of RDRAM: a 3 bit exponent, the number of leading ones,
+// over an 11 bit mantissa, then the top 2 bits of dz. Its other 2 bits live in RDRAM's hidden bits, which aren't kept
+// here, so they read back as 0.
+#define Z_MAX 0x3FFFF
+#define Z_MODE_DECAL 3
+
+// Per exponent, how far the mantissa is shifted up and the depth it starts at
+alignas(32) static const uint32_t z_shift_table[8] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+alignas(32) static const uint32_t z_base_table[8] = { 0, 0x20000, 0x30000, 0x38000, 0x3C000, 0x3E000, 0x3F000, 0x3F800 };
+
+INLINE uint32_t z_decompress(uint16_t memory) {
+    const uint32_t exponent = memory >> 13;
+    return (((memory >> 2) & 0x7FF) << z_shift_table[exponent]) + z_base_table[exponent];
+}
+
+INLINE uint16_t z_compress(uint32_t z, uint8_t dz) {
+    uint32_t exponent = 0;
+    while (exponent < 7 && z >= z_base_table[exponent + 1]) {
+        exponent++;
     }
+    return exponent << 13 | ((z >> z_shift_table[exponent]) & 0x7FF) << 2 | dz >> 2;
+}
 
-    // Code below is optimized to remove the conditional.
-    // Essentially, the behavior is to use the upper bits of fill_color if we're on an even column,
-    // and the lower bits if we're on an odd column.
+// Depth from Z, s15.16, clamped to what the Z buffer holds
+INLINE uint32_t pixel_z(int32_t z) {
+    const int32_t depth = z >> 13;
+    return depth < 0 ? 0 : (depth > Z_MAX ? Z_MAX : depth);
+}
 
-    // return rdp->fill_color >> (addr % 4 == 0 ? 16 : 0);
-    return color >> (16 - ((addr % 4) * 8));
+INLINE uint32_t primitive_depth(const softrdp_state_t* rdp) {
+    return (rdp->primitive_z & 0x7FFF) << 3;
 }
 
-INLINE void rdram_write16(softrdp_state_t* rdp, u32 address, u16 value) {
-    memcpy(&rdp->rdram[HALF_ADDRESS(address)], &value, sizeof(u16));
+// Without coverage every pixel is fully covered, which leaves the opaque, interpenetrating and transparent modes all
+// passing what's in front. Decal passes what's within dz of the Z buffer, whichever of the two is wider.
+INLINE bool depth_compare(uint8_t z_mode, uint32_t z, uint8_t dz, uint16_t memory) {
+    const uint32_t old = z_decompress(memory);
+    if (z_mode == Z_MODE_DECAL) {
+        const int32_t range = std::max(1 << dz, 1 << ((memory & 3) << 2)) << 3;
+        return old != Z_MAX && (int32_t)z - range <= (int32_t)old && (int32_t)z + range >= (int32_t)old;
+    }
+    return old == Z_MAX || z < old;
 }
 
-INLINE void rdram_write32(softrdp_state_t* rdp, u32 address, u32 value) {
-    memcpy(&rdp->rdram[WORD_ADDRESS(address)], &value, sizeof(u32));
+// Marks the pixels of a chunk that pass the depth test in span->draw, against the Z buffer under them in memory, and
+// works out what each would leave there in span->depth
+static void depth_test_scalar(const softrdp_state_t* rdp, const primitive_t* prim, const uint16_t* memory, int n, span_buffer_t* span) {
+    const bool compare = rdp->other_modes.z_compare_en;
+    const bool source_primitive = rdp->other_modes.z_source_sel;
+    const uint32_t primitive_z = primitive_depth(rdp);
+    for (int i = 0; i < n; i++) {
+        const uint32_t z = source_primitive ? primitive_z : pixel_z(span->z[i]);
+        span->draw[i] = !compare || depth_compare(rdp->other_modes.z_mode, z, prim->dz, memory[i]) ? 0xFF : 0;
+        span->depth[i] = z_compress(z, prim->dz);
+    }
 }
 
-INLINE u8 rdram_read8(softrdp_state_t* rdp, u32 address) {
-    return rdp->rdram[BYTE_ADDRESS(address)];
+// Writes the new depth of the pixels that were drawn into memory
+static void depth_update_scalar(const span_buffer_t* span, int n, uint16_t* memory) {
+    for (int i = 0; i < n; i++) {
+        if (span->draw[i]) {
+            memory[i] = span->depth[i];
+        }
+    }
 }
 
-INLINE u16 rdram_read16(softrdp_state_t* rdp, u32 address) {
-    u16 value;
-    memcpy(&value, &rdp->rdram[HALF_ADDRESS(address)], sizeof(u16));
-    return value;
+#ifdef N64_USE_SIMD
+SIMD_TARGET_SSE41 static void depth_update_sse(const span_buffer_t* span, int n, uint16_t* memory) {
+    for (int i = 0; i < n; i += 8) {
+        const __m128i draw = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)&span->draw[i]));
+        const __m128i old = _mm_loadu_si128((const __m128i*)&memory[i]);
+        const __m128i depth = _mm_loadu_si128((const __m128i*)&span->depth[i]);
+        _mm_storeu_si128((__m128i*)&memory[i], _mm_blendv_epi8(old, depth, draw));
+    }
 }
 
-INLINE u32 rdram_read32(softrdp_state_t* rdp, u32 address) {
-    u32 value;
-    memcpy(&value, &rdp->rdram[WORD_ADDRESS(address)], sizeof(u32));
-    return value;
+// Eight pixels at a time, with the exponent tables held in registers and looked up a lane at a time
+SIMD_TARGET_AVX2 static void depth_test_avx2(const softrdp_state_t* rdp, const primitive_t* prim, const uint16_t* memory, int n, span_buffer_t* span) {
+    const __m256i shift_table = _mm256_load_si256((const __m256i*)z_shift_table);
+    const __m256i base_table = _mm256_load_si256((const __m256i*)z_base_table);
+    const __m256i mantissa_mask = _mm256_set1_epi32(0x7FF);
+    const __m256i z_max = _mm256_set1_epi32(Z_MAX);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i dz_pixel = _mm256_set1_epi32(1 << prim->dz);
+    const __m256i dz_bits = _mm256_set1_epi32(prim->dz >> 2);
+    const __m256i primitive_z = _mm256_set1_epi32(primitive_depth(rdp));
+    const bool compare = rdp->other_modes.z_compare_en;
+    const bool decal = rdp->other_modes.z_mode == Z_MODE_DECAL;
+    const bool source_primitive = rdp->other_modes.z_source_sel;
+
+    for (int i = 0; i < n; i += 8) {
+        __m256i z = primitive_z;
+        if (!source_primitive) {
+            z = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)&span->z[i]), 13);
+            z = _mm256_min_epi32(_mm256_max_epi32(z, zero), z_max);
+        }
+
+        __m256i pass = _mm256_cmpeq_epi32(zero, zero);
+        if (compare) {
+            const __m256i stored = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&memory[i]));
+            const __m256i exponent = _mm256_srli_epi32(stored, 13);
+            const __m256i mantissa = _mm256_and_si256(_mm256_srli_epi32(stored, 2), mantissa_mask);
+            const __m256i old = _mm256_add_epi32(_mm256_sllv_epi32(mantissa, _mm256_permutevar8x32_epi32(shift_table, exponent)),
+                                                 _mm256_permutevar8x32_epi32(base_table, exponent));
+            const __m256i at_max = _mm256_cmpeq_epi32(old, z_max);
+            if (decal) {
+                const __m256i dz_memory = _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_slli_epi32(_mm256_and_si256(stored, _mm256_set1_epi32(3)), 2));
+                const __m256i range = _mm256_slli_epi32(_mm256_max_epi32(dz_memory, dz_pixel), 3);
+                const __m256i too_far = _mm256_cmpgt_epi32(_mm256_sub_epi32(z, range), old);
+                const __m256i too_near = _mm256_cmpgt_epi32(old, _mm256_add_epi32(z, range));
+                pass = _mm256_andnot_si256(_mm256_or_si256(at_max, _mm256_or_si256(too_far, too_near)), pass);
+            } else {
+                pass = _mm256_or_si256(at_max, _mm256_cmpgt_epi32(old, z));
+            }
+        }
+
+        // The new exponent counts the bases z has reached
+        __m256i exponent = zero;
+        for (int e = 1; e < 8; e++) {
+            exponent = _mm256_sub_epi32(exponent, _mm256_cmpgt_epi32(z, _mm256_set1_epi32(z_base_table[e] - 1)));
+        }
+        const __m256i mantissa = _mm256_and_si256(_mm256_srlv_epi32(z, _mm256_permutevar8x32_epi32(shift_table, exponent)), mantissa_mask);
+        const __m256i depth = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(exponent, 13), _mm256_slli_epi32(mantissa, 2)), dz_bits);
+
+        const __m128i depth16 = _mm_packus_epi32(_mm256_castsi256_si128(depth), _mm256_extracti128_si256(depth, 1));
+        _mm_storeu_si128((__m128i*)&span->depth[i], depth16);
+        const __m128i pass16 = _mm_packs_epi32(_mm256_castsi256_si128(pass), _mm256_extracti128_si256(pass, 1));
+        _mm_storel_epi64((__m128i*)&span->draw[i], _mm_packs_epi16(pass16, pass16));
+    }
 }
+#endif
 
-INLINE u16 tmem_read16(softrdp_state_t* rdp, u16 address) {
-    u16 value;
-    memcpy(&value, &rdp->tmem[HALF_ADDRESS(address)], sizeof(u16));
-    return value;
+static void (*depth_test)(const softrdp_state_t* rdp, const primitive_t* prim, const uint16_t* memory, int n, span_buffer_t* span) = depth_test_scalar;
+static void (*depth_update)(const span_buffer_t* span, int n, uint16_t* memory) = depth_update_scalar;
+
+// Where the Z buffer holds pixel x of scanline y. It's as wide as the color image.
+INLINE uint32_t depth_address(const softrdp_state_t* rdp, int y, int x) {
+    return rdp->z_image + (y * rdp->color_image.width + x) * 2;
 }
 
-INLINE void tmem_write8(softrdp_state_t* rdp, u16 address, u8 value) {
-    rdp->tmem[BYTE_ADDRESS(address)] = value;
+// Copies the Z buffer under a span of n pixels out of RDRAM, in order. Like the color image, whole words in range of
+// RDRAM go at once and anything else a pixel at a time, wrapping around its end.
+static void load_depth(const softrdp_state_t* rdp, uint32_t address, int n, uint16_t* memory) {
+    int i = 0;
+    if ((address & 1) == 0 && address + n * 2 <= N64_RDRAM_SIZE) {
+        if (address & 2) {
+            memory[0] = rdram_read16(rdp, address);
+            i = 1;
+        }
+        const int words = (n - i) / 2;
+        swap_pixel_pairs((uint8_t*)&memory[i], &rdp->rdram[address + i * 2], words);
+        i += words * 2;
+    }
+    for (; i < n; i++) {
+        memory[i] = rdram_read16(rdp, (address + i * 2) & (N64_RDRAM_SIZE - 1));
+    }
 }
 
-INLINE void tmem_write16(softrdp_state_t* rdp, u16 address, u16 value) {
-    memcpy(&rdp->tmem[HALF_ADDRESS(address)], &value, sizeof(u16));
+// The other way around. Only the span's own pixels are written, since the next scanline may share a word with it and
+// belong to another worker.
+static void store_depth(softrdp_state_t* rdp, uint32_t address, int n, const uint16_t* memory) {
+    int i = 0;
+    if ((address & 1) == 0 && address + n * 2 <= N64_RDRAM_SIZE) {
+        if (address & 2) {
+            rdram_write16(rdp, address, memory[0]);
+            i = 1;
+        }
+        const int words = (n - i) / 2;
+        swap_pixel_pairs(&rdp->rdram[address + i * 2], (const uint8_t*)&memory[i], words);
+        i += words * 2;
+    }
+    for (; i < n; i++) {
+        rdram_write16(rdp, (address + i * 2) & (N64_RDRAM_SIZE - 1), memory[i]);
+    }
 }
 
 void softrdp_init(softrdp_state_t* state, uint8_t* rdramptr) {
     state->rdram = rdramptr;
+    state->band = 0;
+    state->num_bands = 1;
+    state->workers = NULL;
+    state->dirty_start = 0;
+    state->dirty_end = 0;
+    state->depth_dirty_start = 0;
+    state->depth_dirty_end = 0;
+    state->framebuffer = new softrdp_framebuffer();
+    memset(state->last_state_command, 0, sizeof(state->last_state_command));
+    memset(state->last_tile_command, 0, sizeof(state->last_tile_command));
+    state->batch_primitives = 0;
+    state->commands_received = 0;
+    state->commands_dropped = 0;
+    state->batches = 0;
+    // Each tier only replaces the kernels it has, and starting from scalar lets a lower tier be picked again later
+    fill_span = fill_span_scalar;
+    copy_span = copy_span_scalar;
+    swap_pixel_pairs = swap_pixel_pairs_scalar;
+    interpolate_span = interpolate_span_scalar;
+    depth_test = depth_test_scalar;
+    depth_update = depth_update_scalar;
+#ifdef N64_USE_SIMD
+    if (simd_level >= SIMD_LEVEL_SSE2) {
+        fill_span = fill_span_sse;
+        copy_span = copy_span_sse;
+        swap_pixel_pairs = swap_pixel_pairs_sse;
+        interpolate_span = interpolate_span_sse;
+    }
+    if (simd_level >= SIMD_LEVEL_SSE41) {
+        depth_update = depth_update_sse;
+    }
+    if (simd_level >= SIMD_LEVEL_AVX2) {
+        fill_span = fill_span_avx2;
+        swap_pixel_pairs = swap_pixel_pairs_avx2;
+        interpolate_span = interpolate_span_avx2;
+        depth_test = depth_test_avx2;
+    }
+#endif
 }
 
-DEF_RDP_COMMAND(fill_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
+// Draws [x_begin, x_end) of scanline y, with the attributes at x_begin in start
+static void draw_span(softrdp_state_t* rdp, const primitive_t* prim, int y, int x_begin, int x_end, const int32_t* start) {
+    switch (rdp->other_modes.cycle_type) {
+        case 0: // 1-cycle mode: run entire pipeline
+        case 1: // 2-cycle mode: runs the pipeline twice
+            break;
+        case 2: // Copy mode: copies from TMEM to framebuffer
+            logfatal("Copy mode triangle");
+        case 3: { // Fill mode: just runs the rasterizer
+            int bytes_per_pixel = get_bytes_per_pixel(rdp);
+            fill_span(framebuffer_line(rdp, y) + x_begin * bytes_per_pixel, (x_end - x_begin) * bytes_per_pixel, fill_pattern(rdp, y, x_begin));
+            rdp->pixels_drawn += x_end - x_begin;
+            return;
+        }
+    }
 
-    static spans_t spans;
-    triangle_edgewalker(rdp, ec, &spans);
+    int32_t attr[ATTR_COUNT];
+    memcpy(attr, start, sizeof(attr));
+    span_buffer_t span;
+    uint16_t memory[SPAN_CHUNK];
+    for (int x = x_begin; x < x_end; x += SPAN_CHUNK) {
+        int n = x_end - x < SPAN_CHUNK ? x_end - x : SPAN_CHUNK;
+        interpolate_span(prim, attr, n, &span);
+        const uint32_t address = depth_address(rdp, y, x);
+        if (prim->depth) {
+            load_depth(rdp, address, n, memory);
+            depth_test(rdp, prim, memory, n, &span);
+        } else {
+            memset(span.draw, 0xFF, n);
+        }
+        prim->pipeline->shade_span(rdp, prim, y, x, n, &span);
+        if (prim->depth && rdp->other_modes.z_update_en) {
+            depth_update(&span, n, memory);
+            store_depth(rdp, address, n, memory);
+        }
+        for (int i = 0; i < ATTR_COUNT; i++) {
+            attr[i] = (int32_t)add_wrapping(attr[i], prim->dadx[i] * n);
+        }
+    }
+    rdp->pixels_drawn += x_end - x_begin;
+}
 
-    int bytes_per_pixel = get_bytes_per_pixel(rdp);
+// Walks the scanlines of a primitive that fall within the scissor and [y_begin, y_end), handing each span to draw_span
+static void triangle_edgewalker(softrdp_state_t* rdp, const primitive_t* prim, int y_begin, int y_end) {
+    // Scissor coordinates are 10.2, and exclusive at the bottom right
+    int clip_left = rdp->scissor.xh >> 2;
+    int clip_right = rdp->scissor.xl >> 2;
+    int first = std::max({prim->y_start, y_begin, rdp->scissor.yh >> 2});
+    int last = std::min({prim->y_end, y_end, rdp->scissor.yl >> 2});
+
+    for (int y = first; y < last; y++) {
+        int lines = y - prim->y_start;
+        int32_t major = (int32_t)((int64_t)prim->xh + (int64_t)prim->dxhdy * lines);
+        int32_t minor;
+        if (y < prim->y_mid) {
+            minor = (int32_t)((int64_t)prim->xm + (int64_t)prim->dxmdy * lines);
+        } else {
+            minor = (int32_t)((int64_t)prim->xl + (int64_t)prim->dxldy * (y - prim->y_mid));
+        }
 
-    for (int i = 0; i < spans.num_spans; i++) {
-        int y = spans.start_y + i;
-        span_t* s = &spans.spans[i];
+        int left = (prim->right_major ? minor : major) >> 16;
+        int right = (prim->right_major ? major : minor) >> 16;
+        left = std::max(left, clip_left);
+        right = std::min(right, clip_right);
+        if (left >= right) {
+            continue;
+        }
 
-        uint32_t yofs = rdp->color_image.dram_addr + y * rdp->color_image.width * bytes_per_pixel;
+        // Down the major edge to this scanline, then across to the first pixel
+        int32_t start[ATTR_COUNT];
+        int64_t offset = ((int64_t)left << 16) - major;
+        for (int i = 0; i < ATTR_COUNT; i++) {
+            int64_t value = (int64_t)prim->attr[i] + (int64_t)prim->dade[i] * lines + (((int64_t)prim->dadx[i] * offset) >> 16);
+            start[i] = (int32_t)value;
+        }
+        draw_span(rdp, prim, y, left, right, start);
+    }
+}
 
-        int x_start = s->start < s->end ? s->start : s->end;
-        int x_end = s->end > s->start ? s->end : s->start;
+INLINE bool owns_scanline(const softrdp_state_t* rdp, int y) {
+    return rdp->num_bands <= 1 || (y / SOFTRDP_BAND_HEIGHT) % rdp->num_bands == rdp->band;
+}
 
-        for (int x = x_start * bytes_per_pixel; x < x_end * bytes_per_pixel; x += 2) {
-            uint32_t addr = yofs + x;
-            rdram_write16(rdp, addr, fill_for_addr(rdp, addr));
-        }
+// Calls draw(begin, end) for each run of scanlines in [y_begin, y_end) that this thread draws
+template<typename F>
+INLINE void for_each_band(const softrdp_state_t* rdp, int y_begin, int y_end, F draw) {
+    if (rdp->num_bands <= 1) {
+        draw(y_begin, y_end);
+        return;
+    }
+    int band = std::max(y_begin, 0) / SOFTRDP_BAND_HEIGHT;
+    band += (rdp->band - band % rdp->num_bands + rdp->num_bands) % rdp->num_bands;
+    for (; band * SOFTRDP_BAND_HEIGHT < y_end; band += rdp->num_bands) {
+        int begin = std::max(band * SOFTRDP_BAND_HEIGHT, y_begin);
+        int end = std::min((band + 1) * SOFTRDP_BAND_HEIGHT, y_end);
+        draw(begin, end);
     }
 }
 
-DEF_RDP_COMMAND(fill_zbuffer_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
+INLINE void draw_triangle(softrdp_state_t* rdp, const uint64_t* buffer, bool shade, bool texture, bool zbuffer) {
+    primitive_t prim;
+    memset(&prim, 0, sizeof(primitive_t));
+    get_triangle(buffer, &prim, shade, texture, zbuffer);
+    prim.pipeline = get_pipeline(rdp, &prim);
+    // Triangles without Z coefficients can still be tested at the primitive's depth
+    prim.depth = (zbuffer || rdp->other_modes.z_source_sel) && (rdp->other_modes.z_compare_en || rdp->other_modes.z_update_en);
+    if (prim.depth) {
+        if (rdp->other_modes.z_source_sel) {
+            // The primitive's delta Z is encoded as it is, to the power of two at or below it
+            const uint32_t dz = rdp->primitive_delta_z;
+            prim.dz = dz == 0 ? 0 : 31 - __builtin_clz(dz);
+        } else {
+            // The change in Z across a pixel, rounded up to a power of two
+            const uint32_t dz = (uint32_t)((std::abs((int64_t)prim.dadx[ATTR_Z]) + std::abs((int64_t)prim.dzdy)) >> 16);
+            prim.dz = dz >= 0x4000 ? 15 : (dz == 0 ? 0 : 32 - __builtin_clz(dz));
+        }
+    }
+    trim_texture_cache();
+    for_each_band(rdp, prim.y_start, prim.y_end, [&](int begin, int end) {
+        triangle_edgewalker(rdp, &prim, begin, end);
+    });
+}
 
-    static z_coefficients_t zc;
-    get_zbuffer_coefficients(&buffer[4], &zc);
+DEF_RDP_COMMAND(fill_triangle) {
+    draw_triangle(rdp, buffer, false, false, false);
+}
 
-    static spans_t spans;
-    triangle_edgewalker(rdp, ec, &spans);
-    logfatal("fill_zbuffer_triangle unimplemented");
+DEF_RDP_COMMAND(fill_zbuffer_triangle) {
+    draw_triangle(rdp, buffer, false, false, true);
 }
 
 DEF_RDP_COMMAND(texture_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
-    logfatal("texture_triangle unimplemented");
+    draw_triangle(rdp, buffer, false, true, false);
 }
 
 DEF_RDP_COMMAND(texture_zbuffer_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
-    logfatal("texture_zbuffer_triangle unimplemented");
+    draw_triangle(rdp, buffer, false, true, true);
 }
 
 DEF_RDP_COMMAND(shade_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
-    logfatal("shade_triangle unimplemented");
+    draw_triangle(rdp, buffer, true, false, false);
 }
 
 DEF_RDP_COMMAND(shade_zbuffer_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
-    logfatal("shade_zbuffer_triangle unimplemented");
+    draw_triangle(rdp, buffer, true, false, true);
 }
 
 DEF_RDP_COMMAND(shade_texture_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
-    logfatal("shade_texture_triangle unimplemented");
+    draw_triangle(rdp, buffer, true, true, false);
 }
 
 DEF_RDP_COMMAND(shade_texture_zbuffer_triangle) {
-    const auto* ec = reinterpret_cast<const edge_coefficients_t*>(buffer);
-    logfatal("shade_texture_zbuffer_triangle unimplemented");
+    draw_triangle(rdp, buffer, true, true, true);
 }
 
 INLINE fixed_point_16<11, 5> process_st(fixed_point_16<11, 5> val, bool clamp_enable, bool mirror_enable, u16 mask, u16 shift) {
@@ -679,9 +2326,6 @@ DEF_RDP_COMMAND(texture_rectangle) {
 
     int xh = cmd->xh >> 2;
     int yh = cmd->yh >> 2;
-    logalways("Texture rectangle%s (%d, %d) (%d, %d) with tile %d starting at s,t %d.%d, %d.%d.", flip ? " flip" : "", xh, yh, xl, yl, cmd->tile, cmd->s.integer, cmd->s.frac, cmd->t.integer, cmd->t.frac);
-    logalways("dsdx: %s%d.%d", cmd->dsdx.integer < 0 ? "-" : "", cmd->dsdx.integer, cmd->dsdx.frac);
-    logalways("dtdy: %s%d.%d", cmd->dtdy.integer < 0 ? "-" : "", cmd->dtdy.integer, cmd->dtdy.frac);
 
     const auto orig_s = cmd->s;
     const auto orig_t = cmd->t;
@@ -696,16 +2340,40 @@ DEF_RDP_COMMAND(texture_rectangle) {
 
     int bytes_per_pixel = get_bytes_per_pixel(rdp);
 
-
-    u32 bytes_per_screen_line = rdp->color_image.width * bytes_per_pixel;
     u32 bytes_per_tile_line = descriptor->line * sizeof(u64);
 
+    const int width = xl - xh;
+    if (width <= 0) {
+        return;
+    }
+
+    // Copy mode stepping one texel per pixel copies whole lines of TMEM, as long as s doesn't wrap part way along
+    const u16 mask_s_value = (1 << descriptor->mask_s) - 1;
+    const bool copy_lines = !flip && rdp->other_modes.cycle_type == 2 && dsdx.raw == (1 << 10) && descriptor->shift_s == 0 && !descriptor->cs
+                            && orig_s.integer >= 0
+                            && (descriptor->mask_s == 0 ? !descriptor->ms : orig_s.integer + width - 1 <= mask_s_value);
+
     auto s = orig_s;
     auto t = orig_t;
     switch (descriptor->size) {
         case TEXEL_SIZE_16:
             for (int y = yh; y < yl; y++) {
-                u32 screen_line = rdp->color_image.dram_addr + y * bytes_per_screen_line;
+                if (!owns_scanline(rdp, y)) {
+                    t += dtdy;
+                    continue;
+                }
+                uint8_t* line = framebuffer_line(rdp, y);
+                if (copy_lines) {
+                    const auto processed_t = process_st(t, descriptor->ct, descriptor->mt, descriptor->mask_t, descriptor->shift_t);
+                    const u32 tmem_xor = (processed_t.integer & 1) << 2;
+                    const u16 tmem_line = tmem_base + processed_t.integer * bytes_per_tile_line;
+                    const u32 tmem_addr = (tmem_line + orig_s.integer * 2) & 0x7FF;
+                    if (tmem_addr + width * 2 <= 0x800) {
+                        copy_span(rdp, tmem_addr, tmem_xor, line + xh * bytes_per_pixel, width);
+                        t += dtdy;
+                        continue;
+                    }
+                }
                 for (int x = xh; x < xl; x++) {
                     // TODO: for non-flipped rects, this can go in the body of the outer loop, before this inner loop
                     const auto processed_t = process_st(flip ? s : t, descriptor->ct, descriptor->mt, descriptor->mask_t, descriptor->shift_t);
@@ -717,7 +2385,7 @@ DEF_RDP_COMMAND(texture_rectangle) {
                     const auto processed_s = process_st(flip ? t : s, descriptor->cs, descriptor->ms, descriptor->mask_s, descriptor->shift_s);
                     const u16 tmem_addr = ((tmem_line + processed_s.integer * 2) & 0X7FF) ^ tmem_xor;
                     u16 pixel = tmem_read16(rdp, tmem_addr);
-                    rdram_write16(rdp, screen_line + x * bytes_per_pixel, pixel);
+                    memcpy(&line[x * bytes_per_pixel], &pixel, sizeof(u16));
 
                     s += dsdx;
                 }
@@ -727,7 +2395,11 @@ DEF_RDP_COMMAND(texture_rectangle) {
             break;
         case TEXEL_SIZE_32:
             for (int y = yh; y < yl; y++) {
-                u32 screen_line = rdp->color_image.dram_addr + y * bytes_per_screen_line;
+                if (!owns_scanline(rdp, y)) {
+                    t += dtdy;
+                    continue;
+                }
+                uint8_t* line = framebuffer_line(rdp, y);
                 for (int x = xh; x < xl; x++) {
                     // TODO: for non-flipped rects, this can go in the body of the outer loop, before this inner loop
                     const auto processed_t = process_st(flip ? s : t, descriptor->ct, descriptor->mt, descriptor->mask_t, descriptor->shift_t);
@@ -746,7 +2418,7 @@ DEF_RDP_COMMAND(texture_rectangle) {
                     // TODO: implement a write_pixel(x, y, color) function - texels are processed internally as 32bpp always and written out to the framebuffer in the correct format
                     // TODO: real transparency support
                     if ((pixel & 0xFF) > 0) {
-                        rdram_write32(rdp, screen_line + x * bytes_per_pixel, pixel);
+                        memcpy(&line[x * bytes_per_pixel], &pixel, sizeof(u32));
                     }
                     s += dsdx;
                 }
@@ -760,7 +2432,7 @@ DEF_RDP_COMMAND(texture_rectangle) {
 }
 
 DEF_RDP_COMMAND(sync_load) {
-    logfatal("sync_load unimplemented");
+    //logfatal("sync_load unimplemented");
 }
 
 DEF_RDP_COMMAND(sync_pipe) {
@@ -784,7 +2456,11 @@ DEF_RDP_COMMAND(set_key_r) {
 }
 
 DEF_RDP_COMMAND(set_convert) {
-    logfatal("set_convert unimplemented");
+    // k0-k5, 9 bit signed
+    for (int i = 0; i < 6; i++) {
+        int lo = 45 - i * 9;
+        rdp->convert[i] = (int16_t)(get_bits(buffer[0], lo + 8, lo) << 7) >> 7;
+    }
 }
 
 DEF_RDP_COMMAND(set_scissor) {
@@ -804,6 +2480,7 @@ DEF_RDP_COMMAND(set_prim_depth) {
 }
 
 DEF_RDP_COMMAND(set_other_modes) {
+    rdp->other_modes.raw              = buffer[0];
     rdp->other_modes.atomic_prim      = get_bit(buffer[0], 55);
     rdp->other_modes.cycle_type       = get_bits(buffer[0], 53, 52);
     rdp->other_modes.persp_tex_en     = get_bit(buffer[0], 51);
@@ -850,15 +2527,40 @@ DEF_RDP_COMMAND(set_other_modes) {
     rdp->other_modes.alpha_compare_en = get_bit(buffer[0], 0);
 }
 
+INLINE void set_tile_size(softrdp_tile_t* tile, const uint64_t* buffer) {
+    tile->sl = get_bits(buffer[0], 55, 44);
+    tile->tl = get_bits(buffer[0], 43, 32);
+    tile->sh = get_bits(buffer[0], 23, 12);
+    tile->th = get_bits(buffer[0], 11, 0);
+}
+
 DEF_RDP_COMMAND(load_tlut) {
-    logfatal("load_tlut unimplemented");
+    rdp->tmem_generation++;
+    softrdp_tile_t* descriptor = &rdp->tiles[get_bits(buffer[0], 26, 24)];
+    set_tile_size(descriptor, buffer);
+    unimplemented(rdp->texture_image.size != TEXEL_SIZE_16, "load_tlut: texture image size %d != 16bpp", rdp->texture_image.size);
+
+    const int first = descriptor->sl >> 2;
+    const int last = descriptor->sh >> 2;
+    const u32 tmem_base = descriptor->tmem_adrs * sizeof(u64);
+    const u32 dram_base = rdp->texture_image.dram_addr + first * 2;
+
+    // Each entry fills a whole 64 bit row of TMEM, palette_lookup() reads the first copy
+    for (int i = 0; i <= last - first; i++) {
+        u16 entry = rdram_read16(rdp, dram_base + i * 2);
+        u16 tmem_address = (tmem_base + i * sizeof(u64)) & 0xFFF;
+        for (int copy = 0; copy < 4; copy++) {
+            tmem_write16(rdp, tmem_address + copy * 2, entry);
+        }
+    }
 }
 
 DEF_RDP_COMMAND(set_tile_size) {
-    logfatal("set_tile_size unimplemented");
+    set_tile_size(&rdp->tiles[get_bits(buffer[0], 26, 24)], buffer);
 }
 
 DEF_RDP_COMMAND(load_block) {
+    rdp->tmem_generation++;
     const auto* cmd = reinterpret_cast<const load_block_t*>(buffer);
     softrdp_tile_t* descriptor = &rdp->tiles[cmd->tile];
 
@@ -867,6 +2569,12 @@ DEF_RDP_COMMAND(load_block) {
     fixed_point_16<5, 11> t{0};
     t.integer = cmd->tl;
 
+    // The tile ends up covering the block as a single line
+    descriptor->sl = cmd->sl << 2;
+    descriptor->tl = cmd->tl << 2;
+    descriptor->sh = cmd->sh << 2;
+    descriptor->th = cmd->tl << 2;
+
     const u32 tmem_base = descriptor->tmem_adrs * sizeof(u64); // tmem address in descriptor is in multiples of 64 bits
     const u32 dram_base = rdp->texture_image.dram_addr;
     switch (rdp->texture_image.size) {
@@ -894,11 +2602,10 @@ DEF_RDP_COMMAND(load_block) {
         default:
             logfatal("Load block: unknown texel size: %d", rdp->texture_image.size);
     }
-
-    logalways("Load block: dxt: %d, sh: %d, tile: %d, tl: %d, sl: %d\n", cmd->dxt, cmd->sh, cmd->tile, cmd->tl, cmd->sl);
 }
 
 DEF_RDP_COMMAND(load_tile) {
+    rdp->tmem_generation++;
     int tile_index = get_bits(buffer[0], 26, 24);
     softrdp_tile_t* descriptor = &rdp->tiles[tile_index];
 
@@ -906,11 +2613,13 @@ DEF_RDP_COMMAND(load_tile) {
     unimplemented(descriptor->size != rdp->texture_image.size, "load tile: descriptor size %d != texture image size %d", descriptor->size, rdp->texture_image.size);
     //unimplemented(descriptor->format != rdp->texture_image.format, "load tile: descriptor format (%d) != texture image format (%d)", descriptor->format, rdp->texture_image.format);
 
+    set_tile_size(descriptor, buffer);
+
     // Ignore fractional parts for now (TODO)
-    const u16 sl = get_bits(buffer[0], 55, 44) >> 2;
-    const u16 tl = get_bits(buffer[0], 43, 32) >> 2;
-    const u16 sh = get_bits(buffer[0], 23, 12) >> 2;
-    const u16 th = get_bits(buffer[0], 11, 0) >> 2;
+    const u16 sl = descriptor->sl >> 2;
+    const u16 tl = descriptor->tl >> 2;
+    const u16 sh = descriptor->sh >> 2;
+    const u16 th = descriptor->th >> 2;
 
     const int bytes_per_texture_line = get_bytes_per_line(rdp->texture_image.size, rdp->texture_image.width);
     const int bytes_per_tile_line = descriptor->line * sizeof(u64);
@@ -918,9 +2627,6 @@ DEF_RDP_COMMAND(load_tile) {
     const u32 tmem_base = descriptor->tmem_adrs * sizeof(u64); // tmem address in descriptor is in multiples of 64 bits
     const u32 dram_base = rdp->texture_image.dram_addr;
 
-    unimplemented(tmem_base != 0, "load_tile not to start of tmem");
-
-    int bytes_copied = 0;
     switch (rdp->texture_image.size) {
         case TEXEL_SIZE_4:
             logfatal("Load tile: texel size 4bpp");
@@ -954,7 +2660,7 @@ DEF_RDP_COMMAND(load_tile) {
 
                     u16 tmem_texel_address = tile_line + (s * 2);
                     tmem_texel_address ^= tmem_xor; // For odd lines
-                    tmem_texel_address &= 0X7FF; // Mask to lower half of TMEM
+                    tmem_texel_address &= 0XFFF; // Safety
 
                     tmem_write16(rdp, tmem_texel_address, texel);
                 }
@@ -992,8 +2698,6 @@ DEF_RDP_COMMAND(load_tile) {
         default:
             logfatal("Load tile: Unknown texel size: %d", rdp->texture_image.size);
     }
-
-    logalways("rdp_load_tile: copied %d bytes.", bytes_copied);
 }
 
 DEF_RDP_COMMAND(set_tile) {
@@ -1011,21 +2715,6 @@ DEF_RDP_COMMAND(set_tile) {
     rdp->tiles[tile_index].ms        = get_bit(buffer[0], 8);
     rdp->tiles[tile_index].mask_s    = get_bits(buffer[0], 7, 4);
     rdp->tiles[tile_index].shift_s   = get_bits(buffer[0], 3, 0);
-
-    logalways("Set tile");
-    logalways("format:    %d", rdp->tiles[tile_index].format);
-    logalways("size:      %d", rdp->tiles[tile_index].size);
-    logalways("line:      %d", rdp->tiles[tile_index].line);
-    logalways("tmem_adrs: %d", rdp->tiles[tile_index].tmem_adrs);
-    logalways("palette:   %d", rdp->tiles[tile_index].palette);
-    logalways("ct:        %d", rdp->tiles[tile_index].ct);
-    logalways("mt:        %d", rdp->tiles[tile_index].mt);
-    logalways("mask_t:    %d", rdp->tiles[tile_index].mask_t);
-    logalways("shift_t:   %d", rdp->tiles[tile_index].shift_t);
-    logalways("cs:        %d", rdp->tiles[tile_index].cs);
-    logalways("ms:        %d", rdp->tiles[tile_index].ms);
-    logalways("mask_s:    %d", rdp->tiles[tile_index].mask_s);
-    logalways("shift_s:   %d", rdp->tiles[tile_index].shift_s);
 }
 
 DEF_RDP_COMMAND(fill_rectangle) {
@@ -1035,32 +2724,50 @@ DEF_RDP_COMMAND(fill_rectangle) {
 
     int xh = get_bits(buffer[0], 23, 12) >> 2;
     int yh = get_bits(buffer[0], 11, 0) >> 2;
-    logalways("Fill rectangle (%d, %d) (%d, %d) with color %08X", xh, yh, xl, yl, rdp->fill_color);
+
+    if (rdp->other_modes.cycle_type != 3) {
+        // Everything but fill mode runs the rectangle through the pixel pipeline, with the combiner's constant inputs
+        primitive_t prim;
+        get_rectangle(&prim, xh, yh, xl, yl);
+        prim.pipeline = get_pipeline(rdp, &prim);
+        trim_texture_cache();
+        for_each_band(rdp, yh, yl, [&](int begin, int end) {
+            triangle_edgewalker(rdp, &prim, begin, end);
+        });
+        return;
+    }
 
     int bytes_per_pixel = get_bytes_per_pixel(rdp);
 
     int x_start = xh * bytes_per_pixel;
     int x_end = (xl + 1) * bytes_per_pixel;
 
-    int stride = rdp->color_image.width * bytes_per_pixel;
-
-    for (int y = yh; y < yl; y++) {
-        int yofs = y * stride;
-        for (int x = x_start; x < x_end; x += 2) {
-            uint32_t addr = rdp->color_image.dram_addr + yofs + x;
-            rdram_write16(rdp, addr, fill_for_addr(rdp, addr));
+    for_each_band(rdp, yh, yl, [&](int begin, int end) {
+        if (x_end <= x_start) {
+            return;
         }
-    }
+        for (int y = begin; y < end; y++) {
+            fill_span(framebuffer_line(rdp, y) + x_start, x_end - x_start, fill_pattern(rdp, y, xh));
+        }
+        rdp->pixels_drawn += (uint64_t)(end > begin ? end - begin : 0) * (xl + 1 > xh ? xl + 1 - xh : 0);
+    });
 }
 
 DEF_RDP_COMMAND(set_fill_color) {
     rdp->fill_color = get_bits(buffer[0], 31, 0);
-    logalways("Fill color cmd word: %016lX", buffer[0]);
-    logalways("Fill color: 0x%08X", rdp->fill_color);
+}
+
+INLINE color_32bpp_t get_color(uint64_t cmd) {
+    color_32bpp_t color;
+    color.r = get_bits(cmd, 31, 24);
+    color.g = get_bits(cmd, 23, 16);
+    color.b = get_bits(cmd, 15, 8);
+    color.a = get_bits(cmd, 7, 0);
+    return color;
 }
 
 DEF_RDP_COMMAND(set_fog_color) {
-    logfatal("set_fog_color unimplemented");
+    rdp->fog_color = get_color(buffer[0]);
 }
 
 DEF_RDP_COMMAND(set_blend_color) {
@@ -1068,20 +2775,20 @@ DEF_RDP_COMMAND(set_blend_color) {
     rdp->blend_color.g = get_bits(buffer[0], 23, 16);
     rdp->blend_color.b = get_bits(buffer[0], 15, 8);
     rdp->blend_color.a = get_bits(buffer[0], 7, 0);
-
-    logalways("Blend color: #%02X%02X%02X alpha %02X", rdp->blend_color.r, rdp->blend_color.g, rdp->blend_color.b, rdp->blend_color.a);
 }
 
 DEF_RDP_COMMAND(set_prim_color) {
-    logfatal("set_prim_color unimplemented");
+    rdp->prim_min_level = get_bits(buffer[0], 44, 40);
+    rdp->prim_lod_frac  = get_bits(buffer[0], 39, 32);
+    rdp->prim_color     = get_color(buffer[0]);
 }
 
 DEF_RDP_COMMAND(set_env_color) {
-    logfatal("set_env_color unimplemented");
+    rdp->env_color = get_color(buffer[0]);
 }
 
 DEF_RDP_COMMAND(set_combine) {
-    logalways("Set combine: %016lX", buffer[0]);
+    rdp->combine.raw       = get_bits(buffer[0], 55, 0);
     rdp->combine.sub_a_R_0 = get_bits(buffer[0], 55, 52);
     rdp->combine.mul_R_0   = get_bits(buffer[0], 51, 47);
     rdp->combine.sub_a_A_0 = get_bits(buffer[0], 46, 44);
@@ -1098,6 +2805,26 @@ DEF_RDP_COMMAND(set_combine) {
     rdp->combine.add_R_1   = get_bits(buffer[0], 8,   6);
     rdp->combine.sub_b_A_1 = get_bits(buffer[0], 5,   3);
     rdp->combine.add_A_1   = get_bits(buffer[0], 2,   0);
+
+    combiner_config_t* cycle0 = &rdp->combiner_config[0];
+    cycle0->rgb_sub_a   = from_rgb_sub_a(rdp->combine.sub_a_R_0);
+    cycle0->rgb_sub_b   = from_rgb_sub_b(rdp->combine.sub_b_R_0);
+    cycle0->rgb_mul     = from_rgb_mul(rdp->combine.mul_R_0);
+    cycle0->rgb_add     = from_rgb_add(rdp->combine.add_R_0);
+    cycle0->alpha_sub_a = from_alpha_add(rdp->combine.sub_a_A_0);
+    cycle0->alpha_sub_b = from_alpha_add(rdp->combine.sub_b_A_0);
+    cycle0->alpha_mul   = from_alpha_mul(rdp->combine.mul_A_0);
+    cycle0->alpha_add   = from_alpha_add(rdp->combine.add_A_0);
+
+    combiner_config_t* cycle1 = &rdp->combiner_config[1];
+    cycle1->rgb_sub_a   = from_rgb_sub_a(rdp->combine.sub_a_R_1);
+    cycle1->rgb_sub_b   = from_rgb_sub_b(rdp->combine.sub_b_R_1);
+    cycle1->rgb_mul     = from_rgb_mul(rdp->combine.mul_R_1);
+    cycle1->rgb_add     = from_rgb_add(rdp->combine.add_R_1);
+    cycle1->alpha_sub_a = from_alpha_add(rdp->combine.sub_a_A_1);
+    cycle1->alpha_sub_b = from_alpha_add(rdp->combine.sub_b_A_1);
+    cycle1->alpha_mul   = from_alpha_mul(rdp->combine.mul_A_1);
+    cycle1->alpha_add   = from_alpha_add(rdp->combine.add_A_1);
 }
 
 DEF_RDP_COMMAND(set_texture_image) {
@@ -1106,39 +2833,23 @@ DEF_RDP_COMMAND(set_texture_image) {
 
     rdp->texture_image.width     = get_bits(buffer[0], 41, 32) + 1;
     rdp->texture_image.dram_addr = get_bits(buffer[0], 25, 0);
-    logalways("Set texture image:");
-    logalways("format: %d", rdp->texture_image.format);
-    logalways("size: %d", rdp->texture_image.size);
-
-    logalways("width: %d", rdp->texture_image.width);
-    logalways("dram_addr: %08X", rdp->texture_image.dram_addr);
 }
 
 DEF_RDP_COMMAND(set_mask_image) {
     rdp->z_image = get_bits(buffer[0], 25, 0);
-    logalways("Setting Zbuffer image to 0x%08X", rdp->z_image);
 }
 
 DEF_RDP_COMMAND(set_color_image) {
-    logalways("Set color image %016lX:", buffer[0]);
+    // The new image may overlap the old one, or be read from as the Z buffer, so it has to be in RDRAM first
+    resolve_framebuffer(rdp);
     rdp->color_image.format    = get_bits(buffer[0], 55, 53);
     rdp->color_image.size      = get_bits(buffer[0], 52, 51);
     rdp->color_image.width     = get_bits(buffer[0], 41, 32) + 1;
     rdp->color_image.dram_addr = get_bits(buffer[0], 25, 0);
-    logalways("Format: %d", rdp->color_image.format);
-    logalways("Size: %d",   rdp->color_image.size);
-    logalways("Width: %d",  rdp->color_image.width);
-    logalways("DRAM addr: 0x%08X", rdp->color_image.dram_addr);
 }
 
 
-void softrdp_enqueue_command(softrdp_state_t* rdp, int command_length, uint64_t* buffer) {
-    for (int i = 0; i < (command_length >> 1); i++) {
-        uint64_t lo = (buffer[i] >>  0) & 0xFFFFFFFF;
-        uint64_t hi = (buffer[i] >> 32) & 0xFFFFFFFF;
-        buffer[i] = (lo << 32) | hi;
-    }
-
+static void execute_command(softrdp_state_t* rdp, int command_length, const uint64_t* buffer) {
     auto command = static_cast<rdp_command_t>(get_bits(buffer[0], 61, 56));
 
     switch (command) {
@@ -1181,3 +2892,469 @@ void softrdp_enqueue_command(softrdp_state_t* rdp, int command_length, uint64_t*
         default: logfatal("Unknown RDP command: %02X", command);
     }
 }
+
+// Commands waiting for the workers, as a header u64 holding the command's length in words followed by the command.
+// A header of 0 means the rest of the queue is padding and the next command is at the start.
+#define WORK_QUEUE_SIZE 0x10000
+#define WORK_QUEUE_MASK (WORK_QUEUE_SIZE - 1)
+// Primitives in a row that are written to the queue before the workers are told about them
+#define WORK_BATCH_PRIMITIVES 32
+// Empty spins before a waiting thread gives up the rest of its time slice, and before an idle worker goes to sleep
+#define WORKER_SPINS_BEFORE_YIELD 1024
+#define WORKER_SPINS_BEFORE_SLEEP 4096
+
+typedef struct softrdp_worker {
+    softrdp_state_t state;
+    SDL_Thread* thread;
+    struct softrdp_workers* workers;
+    // Queue entries done, in u64s. Only written by the worker.
+    std::atomic<uint64_t> read;
+    // Performance counter ticks spent with work in the queue
+    std::atomic<uint64_t> busy_ticks;
+} softrdp_worker_t;
+
+struct softrdp_workers {
+    int count;
+    softrdp_worker_t* worker;
+    uint64_t* queue;
+    // Queue entries written, in u64s, and handed to the workers. Only written by the thread queueing commands.
+    std::atomic<uint64_t> write;
+    // Queue entries written, including a batch of primitives not handed to the workers yet
+    uint64_t pending;
+    std::atomic<int> sleeping;
+    std::atomic<bool> quit;
+    SDL_mutex* wake_mutex;
+    SDL_cond* wake_cond;
+    // Performance counter ticks the queueing thread spent waiting for the workers, at fences or for room in the queue
+    uint64_t wait_ticks;
+};
+
+INLINE void backoff(int* spins) {
+    if (++(*spins) % WORKER_SPINS_BEFORE_YIELD == 0) {
+        SDL_Delay(0);
+    } else {
+#ifdef N64_USE_SIMD
+        _mm_pause();
+#endif
+    }
+}
+
+static int worker_thread(void* data) {
+    auto* worker = static_cast<softrdp_worker_t*>(data);
+    softrdp_workers* workers = worker->workers;
+    uint64_t read = worker->read.load(std::memory_order_relaxed);
+    int spins = 0;
+    uint64_t busy_since = 0;
+
+    while (true) {
+        if (read == workers->write.load(std::memory_order_acquire)) {
+            if (busy_since != 0) {
+                worker->busy_ticks.fetch_add(SDL_GetPerformanceCounter() - busy_since, std::memory_order_relaxed);
+                busy_since = 0;
+            }
+            if (workers->quit.load()) {
+                return 0;
+            }
+            if (spins < WORKER_SPINS_BEFORE_SLEEP) {
+                backoff(&spins);
+                continue;
+            }
+            // Checked again with sleeping raised, so a command queued in between isn't missed
+            SDL_LockMutex(workers->wake_mutex);
+            workers->sleeping++;
+            while (read == workers->write.load() && !workers->quit.load()) {
+                SDL_CondWait(workers->wake_cond, workers->wake_mutex);
+            }
+            workers->sleeping--;
+            SDL_UnlockMutex(workers->wake_mutex);
+            continue;
+        }
+        spins = 0;
+        if (busy_since == 0) {
+            busy_since = SDL_GetPerformanceCounter();
+        }
+
+        uint64_t position = read & WORK_QUEUE_MASK;
+        int command_length = (int)workers->queue[position];
+        if (command_length == 0) {
+            read += WORK_QUEUE_SIZE - position;
+        } else {
+            execute_command(&worker->state, command_length, &workers->queue[position + 1]);
+            read += 1 + (command_length >> 1);
+        }
+        worker->read.store(read, std::memory_order_release);
+    }
+}
+
+static uint64_t slowest_worker(const softrdp_workers* workers) {
+    uint64_t slowest = UINT64_MAX;
+    for (int i = 0; i < workers->count; i++) {
+        slowest = std::min(slowest, workers->worker[i].read.load(std::memory_order_acquire));
+    }
+    return slowest;
+}
+
+// Hands everything queued so far to the workers
+static void submit_commands(softrdp_workers* workers) {
+    if (workers->write.load(std::memory_order_relaxed) == workers->pending) {
+        return;
+    }
+    workers->write.store(workers->pending);
+
+    if (workers->sleeping.load() > 0) {
+        SDL_LockMutex(workers->wake_mutex);
+        SDL_CondBroadcast(workers->wake_cond);
+        SDL_UnlockMutex(workers->wake_mutex);
+    }
+}
+
+// Writes a command to the queue, and hands it to the workers along with everything before it if submit is set
+static void queue_command(softrdp_workers* workers, int command_length, const uint64_t* buffer, bool submit) {
+    const uint64_t length = 1 + (command_length >> 1);
+    uint64_t write = workers->pending;
+    uint64_t position = write & WORK_QUEUE_MASK;
+    const bool wraps = position + length > WORK_QUEUE_SIZE;
+    const uint64_t needed = length + (wraps ? WORK_QUEUE_SIZE - position : 0);
+
+    if (write + needed - slowest_worker(workers) > WORK_QUEUE_SIZE) {
+        // The workers can only make room by running what they've been handed
+        submit_commands(workers);
+        const uint64_t start = SDL_GetPerformanceCounter();
+        int spins = 0;
+        while (write + needed - slowest_worker(workers) > WORK_QUEUE_SIZE) {
+            backoff(&spins);
+        }
+        workers->wait_ticks += SDL_GetPerformanceCounter() - start;
+    }
+
+    if (wraps) {
+        workers->queue[position] = 0;
+        write += WORK_QUEUE_SIZE - position;
+        position = 0;
+    }
+    workers->queue[position] = command_length;
+    memcpy(&workers->queue[position + 1], buffer, (command_length >> 1) * sizeof(uint64_t));
+    workers->pending = write + length;
+
+    if (submit) {
+        submit_commands(workers);
+    }
+}
+
+uint64_t softrdp_fence(softrdp_state_t* rdp) {
+    if (rdp->workers == NULL) {
+        return 0;
+    }
+    submit_commands(rdp->workers);
+    return rdp->workers->write.load(std::memory_order_relaxed);
+}
+
+void softrdp_wait(softrdp_state_t* rdp, uint64_t fence) {
+    softrdp_workers* workers = rdp->workers;
+    if (workers == NULL || slowest_worker(workers) >= fence) {
+        return;
+    }
+    const uint64_t start = SDL_GetPerformanceCounter();
+    int spins = 0;
+    while (slowest_worker(workers) < fence) {
+        backoff(&spins);
+    }
+    workers->wait_ticks += SDL_GetPerformanceCounter() - start;
+}
+
+void softrdp_flush(softrdp_state_t* rdp) {
+    softrdp_workers* workers = rdp->workers;
+    if (workers == NULL) {
+        resolve_framebuffer(rdp);
+        rdp->dirty_start = 0;
+        rdp->dirty_end = 0;
+        rdp->depth_dirty_start = 0;
+        rdp->depth_dirty_end = 0;
+        return;
+    }
+    softrdp_wait(rdp, softrdp_fence(rdp));
+    for (int i = 0; i < workers->count; i++) {
+        softrdp_state_t* state = &workers->worker[i].state;
+        // The workers are idle until something else is queued, so their tiles can be copied back from here
+        resolve_framebuffer(state);
+        rdp->pixels_drawn += state->pixels_drawn;
+        rdp->texture_cache_hits += state->texture_cache_hits;
+        rdp->texture_cache_misses += state->texture_cache_misses;
+        state->pixels_drawn = 0;
+        state->texture_cache_hits = 0;
+        state->texture_cache_misses = 0;
+    }
+    rdp->dirty_start = 0;
+    rdp->dirty_end = 0;
+    rdp->depth_dirty_start = 0;
+    rdp->depth_dirty_end = 0;
+}
+
+void softrdp_report_overlap(softrdp_state_t* rdp) {
+    softrdp_workers* workers = rdp->workers;
+    if (workers == NULL) {
+        return;
+    }
+    // Every worker runs the whole queue, so their average is how long the drawing took
+    uint64_t busy_ticks = 0;
+    for (int i = 0; i < workers->count; i++) {
+        busy_ticks += workers->worker[i].busy_ticks.load(std::memory_order_relaxed);
+    }
+    const double frequency = (double)SDL_GetPerformanceFrequency();
+    const double busy = (double)busy_ticks / workers->count / frequency;
+    const double wait = (double)workers->wait_ticks / frequency;
+    const double overlapped = busy > 0 ? std::max(0.0, 1.0 - wait / busy) : 0;
+    logalways("Software RDP workers were busy for %.3f seconds and emulation waited on them for %.3f: %.1f%% overlapped",
+              busy, wait, overlapped * 100);
+}
+
+void softrdp_report_texture_cache(softrdp_state_t* rdp) {
+    softrdp_flush(rdp);
+    const uint64_t lookups = rdp->texture_cache_hits + rdp->texture_cache_misses;
+    if (lookups == 0) {
+        return;
+    }
+    logalways("Decoded texture cache: %lu hits, %lu misses, %.1f%% hit rate",
+              rdp->texture_cache_hits, rdp->texture_cache_misses, 100.0 * rdp->texture_cache_hits / lookups);
+}
+
+void softrdp_report_commands(softrdp_state_t* rdp, uint64_t frames) {
+    if (rdp->commands_received == 0) {
+        return;
+    }
+    logalways("Software RDP dropped %lu of %lu commands as redundant, and drew primitives in %lu batches",
+              rdp->commands_dropped, rdp->commands_received, rdp->batches);
+    if (frames > 0) {
+        logalways("%.1f commands dropped and %.1f batches per frame", (double)rdp->commands_dropped / frames, (double)rdp->batches / frames);
+    }
+}
+
+void softrdp_start_workers(softrdp_state_t* rdp, int threads) {
+    softrdp_stop_workers(rdp);
+    if (threads < 1) {
+        return;
+    }
+    // The workers draw into tiles of their own
+    softrdp_flush(rdp);
+
+    auto* workers = new softrdp_workers();
+    workers->count = threads;
+    workers->queue = new uint64_t[WORK_QUEUE_SIZE];
+    workers->write = 0;
+    workers->pending = 0;
+    workers->sleeping = 0;
+    workers->quit = false;
+    workers->wake_mutex = SDL_CreateMutex();
+    workers->wake_cond = SDL_CreateCond();
+    workers->wait_ticks = 0;
+    workers->worker = new softrdp_worker_t[threads];
+
+    for (int i = 0; i < threads; i++) {
+        softrdp_worker_t* worker = &workers->worker[i];
+        // Each worker keeps its own copy of the state and TMEM, and runs every command but only draws its own bands
+        worker->state = *rdp;
+        worker->state.band = i;
+        worker->state.num_bands = threads;
+        worker->state.pixels_drawn = 0;
+        worker->state.texture_cache_hits = 0;
+        worker->state.texture_cache_misses = 0;
+        worker->state.framebuffer = new softrdp_framebuffer();
+        worker->workers = workers;
+        worker->read = 0;
+        worker->busy_ticks = 0;
+        worker->thread = SDL_CreateThread(worker_thread, "softrdp", worker);
+        if (worker->thread == NULL) {
+            logfatal("Failed to start software RDP worker thread %d", i);
+        }
+    }
+    rdp->workers = workers;
+    loginfo("Drawing on %d software RDP worker threads", threads);
+}
+
+void softrdp_stop_workers(softrdp_state_t* rdp) {
+    softrdp_workers* workers = rdp->workers;
+    if (workers == NULL) {
+        return;
+    }
+    softrdp_flush(rdp);
+    // Everything queued has been run, so the workers' TMEM matches what this thread would have loaded
+    memcpy(rdp->tmem, workers->worker[0].state.tmem, sizeof(rdp->tmem));
+    rdp->tmem_generation++;
+
+    SDL_LockMutex(workers->wake_mutex);
+    workers->quit = true;
+    SDL_CondBroadcast(workers->wake_cond);
+    SDL_UnlockMutex(workers->wake_mutex);
+    for (int i = 0; i < workers->count; i++) {
+        SDL_WaitThread(workers->worker[i].thread, NULL);
+        delete workers->worker[i].state.framebuffer;
+    }
+
+    SDL_DestroyCond(workers->wake_cond);
+    SDL_DestroyMutex(workers->wake_mutex);
+    delete[] workers->worker;
+    delete[] workers->queue;
+    delete workers;
+    rdp->workers = NULL;
+}
+
+// The RDRAM a load reads from, roughly: whole lines of the texture image for tiles and TLUTs
+INLINE void get_load_source(const softrdp_state_t* rdp, rdp_command_t command, const uint64_t* buffer, uint32_t* start, uint32_t* end) {
+    const uint32_t stride = get_bytes_per_line(rdp->texture_image.size, rdp->texture_image.width);
+    const uint32_t base = rdp->texture_image.dram_addr;
+    if (command == RDP_COMMAND_LOAD_BLOCK) {
+        const auto* cmd = reinterpret_cast<const load_block_t*>(buffer);
+        // 4 bytes per texel covers every size
+        *start = base + cmd->tl * stride + cmd->sl * 4;
+        *end = base + cmd->tl * stride + (cmd->sh + 1) * 4;
+    } else {
+        *start = base + (get_bits(buffer[0], 43, 32) >> 2) * stride;
+        *end = base + ((get_bits(buffer[0], 11, 0) >> 2) + 1) * stride + (get_bits(buffer[0], 23, 12) >> 2) * 4;
+    }
+}
+
+INLINE void extend_range(uint32_t* range_start, uint32_t* range_end, uint32_t start, uint32_t end) {
+    if (*range_start == *range_end) {
+        *range_start = start;
+        *range_end = end;
+    } else {
+        *range_start = std::min(*range_start, start);
+        *range_end = std::max(*range_end, end);
+    }
+}
+
+// Where the commands that draw can write: the color image down to the bottom of the scissor, or of a rectangle, which
+// isn't clipped to it. Triangles testing or updating depth use the Z buffer over the same rows, which the workers
+// read and write in RDRAM as they go, so it's only out of date behind them.
+INLINE void mark_dirty(softrdp_state_t* rdp, rdp_command_t command, const uint64_t* buffer) {
+    uint32_t rows = rdp->scissor.yl >> 2;
+    if (command == RDP_COMMAND_TEXTURE_RECTANGLE || command == RDP_COMMAND_TEXTURE_RECTANGLE_FLIP || command == RDP_COMMAND_FILL_RECTANGLE) {
+        rows = std::max(rows, (uint32_t)get_bits(buffer[0], 43, 32) >> 2);
+    }
+    const uint32_t start = rdp->color_image.dram_addr;
+    const uint32_t end = start + rdp->color_image.width * get_bytes_per_pixel(rdp) * (rows + 1);
+    extend_range(&rdp->dirty_start, &rdp->dirty_end, start, end);
+
+    const bool triangle = command >= RDP_COMMAND_FILL_TRIANGLE && command <= RDP_COMMAND_SHADE_TEXTURE_ZBUFFER_TRIANGLE;
+    if (rdp->workers != NULL && triangle && (rdp->other_modes.z_compare_en || rdp->other_modes.z_update_en)) {
+        const uint32_t depth_end = rdp->z_image + rdp->color_image.width * 2 * (rows + 1);
+        extend_range(&rdp->depth_dirty_start, &rdp->depth_dirty_end, rdp->z_image, depth_end);
+    }
+}
+
+// Whether a command would change nothing: one setting state to what it already is, or a sync, since each worker runs
+// the commands in order anyway. Remembers the state commands that do change something.
+INLINE bool is_redundant(softrdp_state_t* rdp, rdp_command_t command, const uint64_t* buffer) {
+    const int tile = get_bits(buffer[0], 26, 24);
+    uint64_t* last;
+    switch (command) {
+        case RDP_COMMAND_SYNC_LOAD:
+        case RDP_COMMAND_SYNC_PIPE:
+        case RDP_COMMAND_SYNC_TILE:
+            return true;
+        case RDP_COMMAND_LOAD_TLUT:
+        case RDP_COMMAND_LOAD_BLOCK:
+        case RDP_COMMAND_LOAD_TILE:
+            // The loads set the tile's size as well
+            rdp->last_tile_command[1][tile] = 0;
+            return false;
+        case RDP_COMMAND_SET_TILE:
+            last = &rdp->last_tile_command[0][tile];
+            break;
+        case RDP_COMMAND_SET_TILE_SIZE:
+            last = &rdp->last_tile_command[1][tile];
+            break;
+        case RDP_COMMAND_SET_CONVERT:
+        case RDP_COMMAND_SET_SCISSOR:
+        case RDP_COMMAND_SET_PRIM_DEPTH:
+        case RDP_COMMAND_SET_OTHER_MODES:
+        case RDP_COMMAND_SET_FILL_COLOR:
+        case RDP_COMMAND_SET_FOG_COLOR:
+        case RDP_COMMAND_SET_BLEND_COLOR:
+        case RDP_COMMAND_SET_PRIM_COLOR:
+        case RDP_COMMAND_SET_ENV_COLOR:
+        case RDP_COMMAND_SET_COMBINE:
+        case RDP_COMMAND_SET_TEXTURE_IMAGE:
+        case RDP_COMMAND_SET_MASK_IMAGE:
+        case RDP_COMMAND_SET_COLOR_IMAGE:
+            last = &rdp->last_state_command[command];
+            break;
+        default:
+            return false;
+    }
+    if (*last == buffer[0]) {
+        return true;
+    }
+    *last = buffer[0];
+    return false;
+}
+
+void softrdp_enqueue_command(softrdp_state_t* rdp, int command_length, const uint64_t* buffer) {
+    auto command = static_cast<rdp_command_t>(get_bits(buffer[0], 61, 56));
+    rdp->commands_received++;
+    if (is_redundant(rdp, command, buffer)) {
+        rdp->commands_dropped++;
+        return;
+    }
+
+    // Primitives in a row share all their state, and make up a batch
+    bool primitive = false;
+
+    // Drawing stays in the framebuffer tiles, so this thread keeps track of where it lands, and copies the tiles back
+    // before anything can see RDRAM there
+    switch (command) {
+        case RDP_COMMAND_FILL_TRIANGLE ... RDP_COMMAND_SHADE_TEXTURE_ZBUFFER_TRIANGLE:
+        case RDP_COMMAND_TEXTURE_RECTANGLE:
+        case RDP_COMMAND_TEXTURE_RECTANGLE_FLIP:
+        case RDP_COMMAND_FILL_RECTANGLE:
+            mark_dirty(rdp, command, buffer);
+            primitive = true;
+            break;
+        case RDP_COMMAND_LOAD_TLUT:
+        case RDP_COMMAND_LOAD_BLOCK:
+        case RDP_COMMAND_LOAD_TILE: {
+            // Rendering to a texture and then loading it
+            uint32_t start, end;
+            get_load_source(rdp, command, buffer, &start, &end);
+            if ((start < rdp->dirty_end && end > rdp->dirty_start) || (start < rdp->depth_dirty_end && end > rdp->depth_dirty_start)) {
+                softrdp_flush(rdp);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if (primitive) {
+        if (rdp->batch_primitives++ == 0) {
+            rdp->batches++;
+        }
+    } else {
+        rdp->batch_primitives = 0;
+    }
+
+    if (rdp->workers == NULL) {
+        execute_command(rdp, command_length, buffer);
+        return;
+    }
+
+    // This thread keeps the state up to date, so it knows where drawing lands and where loads come from, but leaves the
+    // drawing and loading to the workers
+    switch (command) {
+        case RDP_COMMAND_FILL_TRIANGLE ... RDP_COMMAND_SHADE_TEXTURE_ZBUFFER_TRIANGLE:
+        case RDP_COMMAND_TEXTURE_RECTANGLE:
+        case RDP_COMMAND_TEXTURE_RECTANGLE_FLIP:
+        case RDP_COMMAND_FILL_RECTANGLE:
+        case RDP_COMMAND_LOAD_TLUT:
+        case RDP_COMMAND_LOAD_BLOCK:
+        case RDP_COMMAND_LOAD_TILE:
+            break;
+        case RDP_COMMAND_SYNC_FULL:
+            // Nothing for the workers to do, the fence taken after this hands them everything queued
+            return;
+        default:
+            execute_command(rdp, command_length, buffer);
+            break;
+    }
+    // A batch is handed over once it's ended by a state change, or once it's big enough to be worth starting on
+    queue_command(rdp->workers, command_length, buffer, !primitive || rdp->batch_primitives % WORK_BATCH_PRIMITIVES == 0);
+}
@@ -21,6 +21,12 @@ typedef struct softrdp_tile {
     bool ms;
     uint8_t mask_s;
     uint8_t shift_s;
+
+    // Set by set_tile_size and the loads, 10.2 fixed point
+    uint16_t sl;
+    uint16_t tl;
+    uint16_t sh;
+    uint16_t th;
 } softrdp_tile_t;
 
 typedef enum blender_source {
@@ -32,7 +38,7 @@ typedef enum blender_source {
 
     // Alphas
     BLENDER_PIXEL_ALPHA,
-    BLENDER_PRIMITIVE_ALPHA,
+    BLENDER_FOG_ALPHA,
     BLENDER_SHADE_ALPHA,
     BLENDER_ONE_MINUS_ALPHA,
     BLENDER_MEMORY_ALPHA,
@@ -47,6 +53,45 @@ typedef struct blender_config {
     blender_source_t source_2b;
 } blender_config_t;
 
+typedef enum combiner_source {
+    // colors
+    COMBINER_COMBINED,
+    COMBINER_TEXEL0,
+    COMBINER_TEXEL1,
+    COMBINER_PRIMITIVE,
+    COMBINER_SHADE,
+    COMBINER_ENVIRONMENT,
+    COMBINER_KEY_CENTER,
+    COMBINER_KEY_SCALE,
+    COMBINER_NOISE,
+    COMBINER_CONVERT_K4,
+    COMBINER_CONVERT_K5,
+
+    // Alphas, used for the color inputs too
+    COMBINER_COMBINED_ALPHA,
+    COMBINER_TEXEL0_ALPHA,
+    COMBINER_TEXEL1_ALPHA,
+    COMBINER_PRIMITIVE_ALPHA,
+    COMBINER_SHADE_ALPHA,
+    COMBINER_ENVIRONMENT_ALPHA,
+    COMBINER_LOD_FRACTION,
+    COMBINER_PRIM_LOD_FRACTION,
+    COMBINER_ONE,
+    COMBINER_ZERO
+} combiner_source_t;
+
+// (sub_a - sub_b) * mul + add, separately for color and alpha
+typedef struct combiner_config {
+    combiner_source_t rgb_sub_a;
+    combiner_source_t rgb_sub_b;
+    combiner_source_t rgb_mul;
+    combiner_source_t rgb_add;
+    combiner_source_t alpha_sub_a;
+    combiner_source_t alpha_sub_b;
+    combiner_source_t alpha_mul;
+    combiner_source_t alpha_add;
+} combiner_config_t;
+
 typedef union color_32bpp {
     uint32_t raw;
     struct {
@@ -91,6 +136,12 @@ typedef struct softrdp_state {
     } color_image;
 
     color_32bpp_t blend_color;
+    color_32bpp_t fog_color;
+    color_32bpp_t prim_color;
+    color_32bpp_t env_color;
+    uint8_t prim_lod_frac;
+    uint8_t prim_min_level;
+    int16_t convert[6];
 
     struct {
         uint8_t format;
@@ -100,6 +151,8 @@ typedef struct softrdp_state {
     } texture_image;
 
     struct {
+        // The whole command word, to look up the pixel pipeline for these modes with
+        uint64_t raw;
         bool atomic_prim;
         uint8_t cycle_type;
         bool persp_tex_en;
@@ -137,6 +190,7 @@ typedef struct softrdp_state {
     } other_modes;
 
     struct {
+        uint64_t raw;
         uint8_t sub_a_R_0;
         uint8_t mul_R_0;
         uint8_t sub_a_A_0;
@@ -155,16 +209,88 @@ typedef struct softrdp_state {
         uint8_t add_A_1;
     } combine;
 
+    combiner_config_t combiner_config[2]; // one config for each cycle
+
     softrdp_tile_t tiles[8];
 
     u8 tmem[0x1000];
+    // Bumped by every load into TMEM, so textures decoded from it know to look again
+    uint64_t tmem_generation;
 
     uint32_t z_image;
+
+    // Pixels drawn by triangles and rectangles, for benchmarking
+    uint64_t pixels_drawn;
+    // Tiles found already decoded, and tiles that had to be decoded
+    uint64_t texture_cache_hits;
+    uint64_t texture_cache_misses;
+
+    // Worker threads split the screen into bands of SOFTRDP_BAND_HEIGHT scanlines, and each draws every num_bands'th
+    // band starting at band. num_bands is 1 when one thread draws everything.
+    int band;
+    int num_bands;
+
+    // NULL unless softrdp_start_workers() was called with at least one thread
+    struct softrdp_workers* workers;
+    // RDRAM that may be drawn to in the framebuffer tiles, or by the workers, but isn't there yet. Empty after a flush.
+    uint32_t dirty_start;
+    uint32_t dirty_end;
+    // The same for the Z buffer the workers test and update in place. Kept apart, since it's rarely anywhere near the
+    // color image and the textures in between would look dirty too.
+    uint32_t depth_dirty_start;
+    uint32_t depth_dirty_end;
+
+    // Where the color image is drawn before it's copied back to RDRAM
+    struct softrdp_framebuffer* framebuffer;
+
+    // The last word of each state setting command that was run, so one setting the same state again can be dropped.
+    // set_tile and set_tile_size are kept for each tile. 0 until the first, since no command word is 0.
+    uint64_t last_state_command[64];
+    uint64_t last_tile_command[2][8];
+    // Primitives since the last command that wasn't one
+    int batch_primitives;
+    uint64_t commands_received;
+    uint64_t commands_dropped;
+    uint64_t batches;
 } softrdp_state_t;
 
+#define SOFTRDP_BAND_HEIGHT 8
+
 void softrdp_init(softrdp_state_t* state, uint8_t* rdramptr);
-#define full_sync_softrdp() do {} while(0)
-void softrdp_enqueue_command(softrdp_state_t* rdp, int command_length, uint64_t* buffer);
+// Draws on this many host threads from now on, behind the calling thread, which only parses commands and hands them
+// out. 0 draws on the calling thread as each command comes in.
+void softrdp_start_workers(softrdp_state_t* state, int threads);
+void softrdp_stop_workers(softrdp_state_t* state);
+// Marks everything queued so far, so it can be waited for later. Always 0 without workers.
+uint64_t softrdp_fence(softrdp_state_t* state);
+void softrdp_wait(softrdp_state_t* state, uint64_t fence);
+// Waits until everything queued so far is drawn, and copies it back to RDRAM
+void softrdp_flush(softrdp_state_t* state);
+// Logs how much of the workers' drawing the calling thread spent waiting for
+void softrdp_report_overlap(softrdp_state_t* state);
+// Logs how often textures were already decoded when they were drawn with
+void softrdp_report_texture_cache(softrdp_state_t* state);
+// Logs how many commands were dropped for changing nothing, and how many batches the primitives came in, per frame too
+// if frames isn't 0
+void softrdp_report_commands(softrdp_state_t* state, uint64_t frames);
+// Each u64 of the command holds two of its words, the first one in the upper half
+void softrdp_enqueue_command(softrdp_state_t* rdp, int command_length, const uint64_t* buffer);
+
+// Called before anything else touches RDRAM, in case what's been drawn there hasn't landed yet
+static inline void softrdp_sync_rdram(softrdp_state_t* state, uint32_t address) {
+    if (__builtin_expect(address - state->dirty_start < state->dirty_end - state->dirty_start
+                      || address - state->depth_dirty_start < state->depth_dirty_end - state->depth_dirty_start, 0)) {
+        softrdp_flush(state);
+    }
+}
+
+// The same for DMAs touching length bytes from address
+static inline void softrdp_sync_rdram_range(softrdp_state_t* state, uint32_t address, uint32_t length) {
+    if (__builtin_expect((address < state->dirty_end && address + length > state->dirty_start)
+                      || (address < state->depth_dirty_end && address + length > state->depth_dirty_start), 0)) {
+        softrdp_flush(state);
+    }
+}
 #endif
 
 #ifdef __cplusplus
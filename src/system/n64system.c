@@ -20,6 +20,8 @@
 #include <mem/backup.h>
 #include <frontend/game_db.h>
 #include <metrics.h>
+#include <simd.h>
+#include "rsp_thread.h"
 #include <frontend/device.h>
 #include <interface/si.h>
 #include <interface/pi.h>
@@ -39,6 +41,8 @@ static u8 codecache[CODECACHE_SIZE] __attribute__((aligned(4096)));
 #define RSP_CODECACHE_SIZE (1 << 25)
 static u8 rsp_codecache[RSP_CODECACHE_SIZE] __attribute__((aligned(4096)));
 
+void handle_scheduler_event(scheduler_event_t* event);
+
 bool n64_should_quit() {
     return should_quit;
 }
@@ -104,9 +108,12 @@ void init_n64system(const char* rom_path, bool enable_frontend, bool enable_debu
     memset(&n64sys, 0x00, sizeof(n64_system_t));
     memset(&N64CPU, 0x00, sizeof(N64CPU));
     memset(&N64RSP, 0x00, sizeof(N64RSP));
+    // Before anything picks its kernels
+    simd_init();
     init_mem(&n64sys.mem);
 
     n64sys.video_type = video_type;
+    n64sys.frontend = enable_frontend;
 
     mprotect_codecache();
     n64sys.dynarec = n64_dynarec_init(codecache, CODECACHE_SIZE);
@@ -123,6 +130,7 @@ void init_n64system(const char* rom_path, bool enable_frontend, bool enable_debu
 #endif
     n64sys.use_interpreter = use_interpreter;
 
+    scheduler_init(handle_scheduler_event);
     reset_n64system();
 
     if (rom_path != NULL) {
@@ -131,6 +139,8 @@ void init_n64system(const char* rom_path, bool enable_frontend, bool enable_debu
 }
 
 void reset_n64system() {
+    // Nothing can still be drawing when RDRAM is cleared
+    softrdp_flush(&n64sys.softrdp_state);
     force_persist_backup();
     if (n64sys.mem.save_data != NULL) {
         free(n64sys.mem.save_data);
@@ -186,6 +196,9 @@ void reset_n64system() {
     invalidate_dynarec_all_pages(n64sys.dynarec);
 
     scheduler_reset();
+    vi_schedule_first_halfline();
+    ai_schedule_first_sample();
+    r4300i_schedule_compare_interrupt();
 }
 
 INLINE int jit_system_step() {
@@ -202,24 +215,23 @@ INLINE int jit_system_step() {
         if(N64CP0.status.ie && !N64CP0.status.exl && !N64CP0.status.erl) {
             N64CPU.prev_branch = N64CPU.branch;
             r4300i_handle_exception(N64CPU.pc, EXCEPTION_INTERRUPT, 0);
+            // The scheduler is advanced by what's returned, and compare events are scheduled against Count
+            N64CP0.count += CYCLES_PER_INSTR;
+            N64CP0.count &= 0x1FFFFFFFF;
             return CYCLES_PER_INSTR;
         }
     }
     static int cpu_steps = 0;
     int taken = n64_dynarec_step();
-    {
-        uint64_t oldcount = N64CP0.count >> 1;
-        uint64_t newcount = (N64CP0.count + (taken * CYCLES_PER_INSTR)) >> 1;
-        if (unlikely(oldcount < N64CP0.compare && newcount >= N64CP0.compare)) {
-            N64CP0.cause.ip7 = true;
-            loginfo("Compare interrupt! oldcount: 0x%08lX newcount: 0x%08lX compare 0x%08X", oldcount, newcount, N64CP0.compare);
-            r4300i_interrupt_update();
-        }
-        N64CP0.count += taken;
-        N64CP0.count &= 0x1FFFFFFFF;
+    N64CP0.count += taken;
+    N64CP0.count &= 0x1FFFFFFFF;
+
+    if (rsp_thread_running) {
+        rsp_thread_advance(taken);
+        return taken;
     }
-    cpu_steps += taken;
 
+    cpu_steps += taken;
     if (!N64RSP.status.halt) {
         // 2 RSP steps per 3 CPU steps
         while (cpu_steps > 2) {
@@ -251,8 +263,13 @@ INLINE int interpreter_system_step() {
     int taken = CYCLES_PER_INSTR;
     r4300i_step();
     static int cpu_steps = 0;
-    cpu_steps += taken;
 
+    if (rsp_thread_running) {
+        rsp_thread_advance(taken);
+        return taken;
+    }
+
+    cpu_steps += taken;
     if (N64RSP.status.halt) {
         cpu_steps = 0;
         N64RSP.steps = 0;
@@ -268,6 +285,9 @@ INLINE int interpreter_system_step() {
     return taken;
 }
 
+// Set by the VI once all fields of a frame have been displayed
+static bool frame_complete = false;
+
 void handle_scheduler_event(scheduler_event_t* event) {
     switch (event->type) {
         case SCHEDULER_SI_DMA_COMPLETE:
@@ -279,8 +299,23 @@ void handle_scheduler_event(scheduler_event_t* event) {
         case SCHEDULER_PI_BUS_WRITE_COMPLETE:
             on_pi_write_complete();
             break;
+        case SCHEDULER_VI_HALFLINE:
+            if (on_vi_halfline()) {
+                frame_complete = true;
+            }
+            break;
+        case SCHEDULER_AI_SAMPLE:
+            on_ai_sample();
+            break;
+        case SCHEDULER_COMPARE_INTERRUPT:
+            on_compare_interrupt();
+            break;
+        case SCHEDULER_DP_INTERRUPT:
+            rdp_wait_for_full_sync();
+            interrupt_raise(INTERRUPT_DP);
+            break;
         default:
-            logfatal("");
+            logfatal("Unknown scheduler event type: %d", event->type);
     }
 }
 
@@ -298,10 +333,7 @@ void n64_system_step(bool dynarec) {
     }
 
 
-    scheduler_event_t event;
-    if (scheduler_tick(taken, &event)) {
-        handle_scheduler_event(&event);
-    }
+    scheduler_tick(taken);
 }
 
 void check_vsync() {
@@ -310,49 +342,50 @@ void check_vsync() {
     }
 }
 
-void jit_system_loop() {
-    int cycles = 0;
+// Runs the CPU, and the RSP alongside it, straight up to the earliest scheduled event, then fires everything that is due.
+// Passing the backend as a constant lets each caller compile to its own tight loop.
+INLINE void run_to_next_event(bool interpreter) {
+    while (!scheduler_event_due()) {
+        scheduler_advance(interpreter ? interpreter_system_step() : jit_system_step());
+    }
+    scheduler_dispatch_due_events();
+#ifndef N64_WIN
+    n64sys.debugger_state.steps = 0;
+#endif
+}
+
+INLINE void run_frame() {
+    frame_complete = false;
+    if (n64sys.use_interpreter) {
+        while (!frame_complete) {
+            run_to_next_event(true);
+        }
+    } else {
+        while (!frame_complete) {
+            run_to_next_event(false);
+        }
+    }
+}
+
+void n64_system_loop() {
+    rsp_thread_start(n64sys.rsp_thread_mode, !n64sys.use_interpreter);
     while (!should_quit) {
         switch (n64sys.action_queued) {
             case N64_ACTION_NONE:
                 break;
 
             case N64_ACTION_RESET:
+                rsp_thread_stop();
                 reset_n64system();
                 n64_load_rom(n64sys.rom_path);
                 pif_rom_execute();
+                rsp_thread_start(n64sys.rsp_thread_mode, !n64sys.use_interpreter);
                 break;
         }
         n64sys.action_queued = N64_ACTION_NONE;
 
-        for (int field = 0; field < n64sys.vi.num_fields; field++) {
-            int this_frame_cycles = 0;
-            for (int line = 0; line < n64sys.vi.num_halflines; line++) {
-                n64sys.vi.v_current = (line << 1) + field;
-                check_vi_interrupt();
-
-                while (cycles <= n64sys.vi.cycles_per_halfline) {
-                    int taken = jit_system_step();
-                    ai_step(taken);
-                    static scheduler_event_t event;
-                    if (scheduler_tick(taken, &event)) {
-                        handle_scheduler_event(&event);
-                    }
-                    cycles += taken;
-                    this_frame_cycles += taken;
-#ifndef N64_WIN
-                    n64sys.debugger_state.steps = 0;
-#endif
-                }
-                cycles -= n64sys.vi.cycles_per_halfline;
-            }
-            check_vi_interrupt();
-            rdp_update_screen();
+        run_frame();
 
-            // Catch up audio if we didn't run the CPU long enough this frame
-            int missed_cycles = CPU_CYCLES_PER_FRAME - this_frame_cycles;
-            ai_step(missed_cycles);
-        }
 #ifdef N64_DEBUG_MODE
 #ifndef N64_WIN
         if (n64sys.debugger_state.enabled) {
@@ -365,66 +398,18 @@ void jit_system_loop() {
 #endif
         persist_backup();
         reset_all_metrics();
-    }
-    force_persist_backup();
-}
-
-void interpreter_system_loop() {
-    int cycles = 0;
-    while (!should_quit) {
-        for (int field = 0; field < n64sys.vi.num_fields; field++) {
-            int this_frame_cycles = 0;
-            for (int line = 0; line < n64sys.vi.num_halflines; line++) {
-                n64sys.vi.v_current = (line << 1) + field;
-                check_vi_interrupt();
-
-                while (cycles <= n64sys.vi.cycles_per_halfline) {
-                    int taken = interpreter_system_step();
-                    ai_step(taken);
-                    static scheduler_event_t event;
-                    if (scheduler_tick(taken, &event)) {
-                        handle_scheduler_event(&event);
-                    }
-                    cycles += taken;
-                    this_frame_cycles += taken;
-#ifndef N64_WIN
-                    n64sys.debugger_state.steps = 0;
-#endif
-                }
-                cycles -= n64sys.vi.cycles_per_halfline;
-            }
-            check_vi_interrupt();
-            rdp_update_screen();
 
-            // Catch up audio if we didn't run the CPU long enough this frame
-            int missed_cycles = CPU_CYCLES_PER_FRAME - this_frame_cycles;
-            ai_step(missed_cycles);
+        n64sys.frames++;
+        if (n64sys.frame_limit != 0 && n64sys.frames >= n64sys.frame_limit) {
+            should_quit = true;
         }
-#ifdef N64_DEBUG_MODE
-#ifndef N64_WIN
-        if (n64sys.debugger_state.enabled) {
-            debugger_tick();
-        }
-#endif
-#endif
-#ifdef LOG_ENABLED
-        update_delayed_log_verbosity();
-#endif
-        persist_backup();
-        reset_all_metrics();
     }
+    rsp_thread_stop();
     force_persist_backup();
 }
 
-void n64_system_loop() {
-    if (n64sys.use_interpreter) {
-        interpreter_system_loop();
-    } else {
-        jit_system_loop();
-    }
-}
-
 void n64_system_cleanup() {
+    softrdp_stop_workers(&n64sys.softrdp_state);
     if (n64sys.dynarec != NULL) {
         free(n64sys.dynarec);
         n64sys.dynarec = NULL;
@@ -451,7 +436,20 @@ void on_interrupt_change() {
     r4300i_interrupt_update();
 }
 
+static void interrupt_raise_on_cpu(u32 interrupt, u32 unused) {
+    interrupt_raise(interrupt);
+}
+
+static void interrupt_lower_on_cpu(u32 interrupt, u32 unused) {
+    interrupt_lower(interrupt);
+}
+
 void interrupt_raise(n64_interrupt_t interrupt) {
+    if (unlikely(rsp_thread_is_current)) {
+        // The RSP thread doesn't get to touch the CPU
+        rsp_thread_call_on_cpu(interrupt_raise_on_cpu, interrupt, 0);
+        return;
+    }
     switch (interrupt) {
         case INTERRUPT_VI:
             loginfo("Raising VI interrupt");
@@ -490,6 +488,10 @@ void interrupt_raise(n64_interrupt_t interrupt) {
 }
 
 void interrupt_lower(n64_interrupt_t interrupt) {
+    if (unlikely(rsp_thread_is_current)) {
+        rsp_thread_call_on_cpu(interrupt_lower_on_cpu, interrupt, 0);
+        return;
+    }
     switch (interrupt) {
         case INTERRUPT_VI:
             n64sys.mi.intr.vi = false;
@@ -134,6 +134,22 @@ typedef enum n64_action {
     N64_ACTION_RESET
 } n64_action_t;
 
+typedef enum rsp_thread_mode {
+    RSP_THREAD_OFF,
+    // Every access catches the RSP up with the CPU first
+    RSP_THREAD_STRICT,
+    // Only SP_STATUS reads catch the RSP up, and DMEM is accessed without stopping it at all
+    RSP_THREAD_RELAXED
+} rsp_thread_mode_t;
+
+typedef enum rsp_hle_mode {
+    RSP_HLE_OFF,
+    // Recognized tasks run natively instead of on the RSP
+    RSP_HLE_ON,
+    // Recognized tasks run both ways, and the HLE output is compared against the RSP's
+    RSP_HLE_VERIFY
+} rsp_hle_mode_t;
+
 typedef struct n64_system {
     n64_mem_t mem;
     n64_video_type_t video_type;
@@ -152,6 +168,8 @@ typedef struct n64_system {
         int num_halflines;
         int num_fields;
         int cycles_per_halfline;
+        int halfline;
+        int field;
         u32 hsync;
         u32 leap;
         axis_start_t hstart;
@@ -170,7 +188,8 @@ typedef struct n64_system {
         u32 dma_length[2];
         u32 dma_address[2];
         bool dma_address_carry;
-        int cycles;
+        // Scheduler time the next sample plays at
+        u64 next_sample;
 
         struct {
             u32 frequency;
@@ -194,10 +213,21 @@ typedef struct n64_system {
 #endif
     n64_dynarec_t *dynarec;
     softrdp_state_t softrdp_state;
+    // Whether there's a window to draw to
+    bool frontend;
     bool use_interpreter;
+    // Whether the RSP gets a host thread of its own, see system/rsp_thread.h
+    rsp_thread_mode_t rsp_thread_mode;
+    // Whether audio tasks run natively, see cpu/rsp_hle.h
+    rsp_hle_mode_t rsp_hle_audio;
+    // Whether graphics tasks are turned into RDP commands natively, see cpu/rsp_hle_gfx.h
+    bool rsp_hle_gfx;
     char rom_path[PATH_MAX];
     n64_action_t action_queued;
     unsigned target_fps;
+    u64 frames;
+    // Quit after this many frames, 0 runs forever
+    u64 frame_limit;
 } n64_system_t;
 
 void init_n64system(const char* rom_path, bool enable_frontend, bool enable_debug, n64_video_type_t video_type, bool use_interpreter);
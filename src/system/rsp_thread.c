@@ -0,0 +1,337 @@
+#include "rsp_thread.h"
+
+#include <string.h>
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+#include <SDL_timer.h>
+#include <log.h>
+#include <cpu/rsp.h>
+#ifdef N64_USE_SIMD
+#include <emmintrin.h>
+#endif
+
+// Most RSP steps run between checks for a pause request
+#define RSP_THREAD_SLICE 256
+// How far the RSP may fall behind the CPU, in RSP steps, before the CPU waits for it. About a scanline.
+#define RSP_THREAD_MAX_LAG 4096
+// Empty spins before a waiting thread gives up the rest of its time slice
+#define RSP_THREAD_SPINS_BEFORE_YIELD 1024
+
+bool rsp_thread_running = false;
+_Thread_local bool rsp_thread_is_current = false;
+_Atomic int rsp_thread_call_pending = 0;
+int rsp_thread_cpu_cycles = 0;
+bool rsp_thread_holding = false;
+
+static rsp_thread_mode_t rsp_thread_mode = RSP_THREAD_OFF;
+static bool rsp_thread_dynarec = false;
+static SDL_Thread* rsp_thread = NULL;
+static SDL_mutex* wake_mutex = NULL;
+static SDL_cond* wake_cond = NULL;
+
+// RSP steps handed over by the CPU. Only written by the CPU thread.
+static _Atomic u64 granted = 0;
+// RSP steps run so far. Only written by the RSP thread.
+static _Atomic u64 consumed = 0;
+// Written by the CPU thread. While a pause is requested, the RSP runs up to here before it parks.
+static _Atomic int pause_requested = 0;
+static _Atomic u64 catch_up_to = 0;
+// Written by the RSP thread
+static _Atomic int parked = 0;
+static _Atomic int idle = 0;
+static _Atomic int quit = 0;
+// Whether the RSP was caught up before being parked, so a later sync in the same step knows if it has to do it again
+static bool holding_caught_up = false;
+
+// What the CPU thread spent keeping the RSP in step, for rsp_thread_report(). Only touched by the CPU thread.
+static u64 syncs[RSP_SYNC_DMEM + 1];
+static u64 pauses[RSP_SYNC_DMEM + 1];
+static u64 catch_ups[RSP_SYNC_DMEM + 1];
+static u64 pause_ticks[RSP_SYNC_DMEM + 1];
+static u64 throttles = 0;
+static u64 throttle_ticks = 0;
+
+static rsp_cpu_call_t pending_call = NULL;
+static u32 pending_a = 0;
+static u32 pending_b = 0;
+
+static const char* rsp_thread_mode_names[] = {
+        [RSP_THREAD_OFF]     = "off",
+        [RSP_THREAD_STRICT]  = "strict",
+        [RSP_THREAD_RELAXED] = "relaxed",
+};
+
+// Spins for a while, then starts giving up the rest of the time slice, in case the other thread shares our core
+INLINE void backoff(int* spins) {
+    if (++(*spins) >= RSP_THREAD_SPINS_BEFORE_YIELD) {
+        *spins = 0;
+        SDL_Delay(0);
+    } else {
+#ifdef N64_USE_SIMD
+        _mm_pause();
+#endif
+    }
+}
+
+rsp_thread_mode_t rsp_thread_mode_from_name(const char* name) {
+    for (int i = RSP_THREAD_OFF; i <= RSP_THREAD_RELAXED; i++) {
+        if (strcmp(name, rsp_thread_mode_names[i]) == 0) {
+            return i;
+        }
+    }
+    logfatal("Unknown RSP thread mode '%s', expected off, strict or relaxed", name);
+}
+
+// Parks until the CPU lets go. A halted RSP has nothing to catch up on, so its clock is brought up to date instead.
+static u64 park(u64 done) {
+    if (N64RSP.status.halt) {
+        done = atomic_load(&granted);
+        atomic_store(&consumed, done);
+    }
+    atomic_store(&parked, 1);
+    int spins = 0;
+    while (atomic_load(&pause_requested) && !atomic_load(&quit)) {
+        backoff(&spins);
+    }
+    atomic_store(&parked, 0);
+    return done;
+}
+
+// Sleeps while halted. Only the CPU can start the RSP again, and it has to pause it to do that.
+static u64 sleep_while_halted() {
+    u64 done = atomic_load(&granted);
+    atomic_store(&consumed, done);
+
+    SDL_LockMutex(wake_mutex);
+    atomic_store(&idle, 1);
+    while (!atomic_load(&pause_requested) && !atomic_load(&quit)) {
+        SDL_CondWait(wake_cond, wake_mutex);
+    }
+    atomic_store(&idle, 0);
+    SDL_UnlockMutex(wake_mutex);
+    return done;
+}
+
+static int rsp_thread_main(void* userdata) {
+    rsp_thread_is_current = true;
+    u64 done = atomic_load(&consumed);
+    int spins = 0;
+
+    while (!atomic_load(&quit)) {
+        if (atomic_load(&pause_requested) && (N64RSP.status.halt || done >= atomic_load(&catch_up_to))) {
+            done = park(done);
+            continue;
+        }
+
+        if (N64RSP.status.halt) {
+            done = sleep_while_halted();
+            continue;
+        }
+
+        s64 available = (s64)(atomic_load(&granted) - done);
+        if (available <= 0) {
+            // Caught up with the CPU
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        int slice = available < RSP_THREAD_SLICE ? (int)available : RSP_THREAD_SLICE;
+        N64RSP.steps = slice;
+        if (rsp_thread_dynarec) {
+            rsp_dynarec_run();
+        } else {
+            rsp_run();
+        }
+        // The dynarec can overshoot, and a break zeroes the steps left
+        done += slice - N64RSP.steps;
+        atomic_store(&consumed, done);
+    }
+    return 0;
+}
+
+INLINE void wake_rsp() {
+    if (atomic_load(&idle)) {
+        SDL_LockMutex(wake_mutex);
+        SDL_CondSignal(wake_cond);
+        SDL_UnlockMutex(wake_mutex);
+    }
+}
+
+static void release() {
+    atomic_store(&pause_requested, 0);
+    // Wait for it to actually leave, so the next pause isn't answered by this park
+    int spins = 0;
+    while (atomic_load(&parked)) {
+        backoff(&spins);
+    }
+    rsp_thread_holding = false;
+}
+
+void rsp_thread_service() {
+    pending_call(pending_a, pending_b);
+    atomic_store(&rsp_thread_call_pending, 0);
+}
+
+void rsp_thread_call_on_cpu(rsp_cpu_call_t call, u32 a, u32 b) {
+    pending_call = call;
+    pending_a = a;
+    pending_b = b;
+    atomic_store(&rsp_thread_call_pending, 1);
+    int spins = 0;
+    while (atomic_load(&rsp_thread_call_pending) && !atomic_load(&quit)) {
+        backoff(&spins);
+    }
+}
+
+void rsp_thread_grant() {
+    if (rsp_thread_holding) {
+        release();
+    }
+
+    // 2 RSP steps per 3 CPU steps
+    u64 now = atomic_load(&granted) + (rsp_thread_cpu_cycles / 3) * 2;
+    rsp_thread_cpu_cycles %= 3;
+    atomic_store(&granted, now);
+
+    // Don't let the RSP fall too far behind, or the CPU will see it finish tasks later than it should
+    int spins = 0;
+    // The dynarec can overshoot, so the RSP may be slightly ahead
+    if ((s64)(now - atomic_load(&consumed)) <= RSP_THREAD_MAX_LAG || atomic_load(&idle)) {
+        return;
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    while ((s64)(now - atomic_load(&consumed)) > RSP_THREAD_MAX_LAG && !atomic_load(&idle)) {
+        if (atomic_load(&rsp_thread_call_pending)) {
+            rsp_thread_service();
+        }
+        backoff(&spins);
+    }
+    throttles++;
+    throttle_ticks += SDL_GetPerformanceCounter() - start;
+}
+
+void rsp_thread_pause(rsp_sync_point_t point) {
+    if (rsp_thread_is_current) {
+        return;
+    }
+    syncs[point]++;
+    if (point == RSP_SYNC_DMEM && rsp_thread_mode == RSP_THREAD_RELAXED) {
+        return;
+    }
+
+    bool catch_up = rsp_thread_mode == RSP_THREAD_STRICT || point == RSP_SYNC_STATUS;
+    if (rsp_thread_holding) {
+        if (holding_caught_up || !catch_up) {
+            return;
+        }
+        // Parked without catching up earlier in this step, let it go so it can
+        release();
+    }
+
+    pauses[point]++;
+    catch_ups[point] += catch_up;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    // Hand over this step's cycles so far, so catching up means catching up to right now
+    u64 target = atomic_load(&granted) + (rsp_thread_cpu_cycles / 3) * 2;
+    rsp_thread_cpu_cycles %= 3;
+    atomic_store(&granted, target);
+
+    atomic_store(&catch_up_to, catch_up ? target : 0);
+    atomic_store(&pause_requested, 1);
+    wake_rsp();
+
+    int spins = 0;
+    while (!atomic_load(&parked)) {
+        // It might be waiting on us to get there
+        if (atomic_load(&rsp_thread_call_pending)) {
+            rsp_thread_service();
+        }
+        backoff(&spins);
+    }
+    rsp_thread_holding = true;
+    holding_caught_up = catch_up;
+    pause_ticks[point] += SDL_GetPerformanceCounter() - start;
+}
+
+void rsp_thread_start(rsp_thread_mode_t mode, bool dynarec) {
+    if (mode == RSP_THREAD_OFF || rsp_thread_running) {
+        return;
+    }
+
+    rsp_thread_mode = mode;
+    rsp_thread_dynarec = dynarec;
+    rsp_thread_cpu_cycles = 0;
+    rsp_thread_holding = false;
+    atomic_store(&granted, 0);
+    atomic_store(&consumed, 0);
+    atomic_store(&pause_requested, 0);
+    atomic_store(&parked, 0);
+    atomic_store(&idle, 0);
+    atomic_store(&quit, 0);
+    atomic_store(&rsp_thread_call_pending, 0);
+    memset(syncs, 0, sizeof(syncs));
+    memset(pauses, 0, sizeof(pauses));
+    memset(catch_ups, 0, sizeof(catch_ups));
+    memset(pause_ticks, 0, sizeof(pause_ticks));
+    throttles = 0;
+    throttle_ticks = 0;
+
+    wake_mutex = SDL_CreateMutex();
+    wake_cond = SDL_CreateCond();
+    if (!wake_mutex || !wake_cond) {
+        logfatal("Failed to create RSP thread synchronization primitives: %s", SDL_GetError());
+    }
+
+    rsp_thread = SDL_CreateThread(rsp_thread_main, "rsp", NULL);
+    if (rsp_thread == NULL) {
+        logfatal("Failed to start the RSP thread: %s", SDL_GetError());
+    }
+    rsp_thread_running = true;
+    loginfo("Running the RSP on its own thread (%s)", rsp_thread_mode_names[mode]);
+}
+
+void rsp_thread_stop() {
+    if (!rsp_thread_running) {
+        return;
+    }
+
+    atomic_store(&quit, 1);
+    atomic_store(&pause_requested, 0);
+    SDL_LockMutex(wake_mutex);
+    SDL_CondSignal(wake_cond);
+    SDL_UnlockMutex(wake_mutex);
+    // It might be stuck waiting on a call that will never be answered
+    if (atomic_load(&rsp_thread_call_pending)) {
+        rsp_thread_service();
+    }
+    SDL_WaitThread(rsp_thread, NULL);
+
+    rsp_thread = NULL;
+    rsp_thread_running = false;
+    rsp_thread_holding = false;
+    SDL_DestroyCond(wake_cond);
+    SDL_DestroyMutex(wake_mutex);
+    wake_cond = NULL;
+    wake_mutex = NULL;
+}
+
+void rsp_thread_report(u64 frames) {
+    if (rsp_thread_mode == RSP_THREAD_OFF || frames == 0) {
+        return;
+    }
+    static const char* point_names[] = {
+            [RSP_SYNC_STATUS]  = "SP_STATUS",
+            [RSP_SYNC_CONTROL] = "control",
+            [RSP_SYNC_DMEM]    = "DMEM",
+    };
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    logalways("RSP thread (%s), per frame:", rsp_thread_mode_names[rsp_thread_mode]);
+    for (int i = RSP_SYNC_STATUS; i <= RSP_SYNC_DMEM; i++) {
+        logalways("%-9s %10.1f syncs, %10.1f pauses (%.1f catching up), %.3f ms waiting", point_names[i],
+                  (double)syncs[i] / frames, (double)pauses[i] / frames, (double)catch_ups[i] / frames,
+                  pause_ticks[i] * ms_per_tick / frames);
+    }
+    logalways("Waited for the RSP to keep up %.1f times, %.3f ms", (double)throttles / frames, throttle_ticks * ms_per_tick / frames);
+}
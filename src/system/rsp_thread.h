@@ -0,0 +1,81 @@
+#ifndef N64_RSP_THREAD_H
+#define N64_RSP_THREAD_H
+
+#ifdef N64_WIN
+#define atomic_load(ptr) (*(ptr))
+#define atomic_store(ptr, val) (*(ptr) = val)
+#else
+#include <stdatomic.h>
+#endif
+#include <util.h>
+#include <stdbool.h>
+#include <system/n64system.h>
+
+// Runs the RSP on its own host thread, alongside the CPU. The CPU hands the RSP time in the usual 2:3 ratio, and the RSP
+// runs behind it until the CPU touches something the RSP can see. At those points the CPU parks the RSP, usually after
+// letting it catch up, and the RSP stays parked until the CPU finishes its current block.
+// Anything the RSP does to the rest of the system (interrupts, the RDP, the CPU's code cache) is handed to the CPU thread.
+
+typedef enum rsp_sync_point {
+    // SP_STATUS reads, which is how games wait for tasks
+    RSP_SYNC_STATUS,
+    // The other SP registers, IMEM and the DP registers
+    RSP_SYNC_CONTROL,
+    // DMEM accessed by the CPU
+    RSP_SYNC_DMEM
+} rsp_sync_point_t;
+
+// Something the RSP thread needs done on the CPU thread
+typedef void (*rsp_cpu_call_t)(u32 a, u32 b);
+
+// Only changes with the RSP thread stopped
+extern bool rsp_thread_running;
+extern _Thread_local bool rsp_thread_is_current;
+
+extern _Atomic int rsp_thread_call_pending;
+// CPU cycles not yet handed to the RSP
+extern int rsp_thread_cpu_cycles;
+// Set while the CPU keeps the RSP parked for the rest of its current step
+extern bool rsp_thread_holding;
+
+// CPU cycles to collect before handing them to the RSP
+#define RSP_THREAD_GRANT_CYCLES 96
+
+rsp_thread_mode_t rsp_thread_mode_from_name(const char* name);
+void rsp_thread_start(rsp_thread_mode_t mode, bool dynarec);
+void rsp_thread_stop();
+void rsp_thread_pause(rsp_sync_point_t point);
+void rsp_thread_grant();
+void rsp_thread_service();
+void rsp_thread_call_on_cpu(rsp_cpu_call_t call, u32 a, u32 b);
+// Logs how often the CPU synced with the RSP thread in the last run, and how long it spent waiting on it, per frame
+void rsp_thread_report(u64 frames);
+
+// Called by the CPU before it touches anything the RSP can see.
+INLINE void rsp_thread_sync(rsp_sync_point_t point) {
+    if (unlikely(rsp_thread_running)) {
+        rsp_thread_pause(point);
+    }
+}
+
+// Called by the CPU after every step. Passes time on to the RSP, lets it go if it was parked, and does whatever it asked for.
+INLINE void rsp_thread_advance(int cpu_cycles) {
+    rsp_thread_cpu_cycles += cpu_cycles;
+    if (rsp_thread_cpu_cycles >= RSP_THREAD_GRANT_CYCLES || rsp_thread_holding) {
+        rsp_thread_grant();
+    }
+    if (unlikely(atomic_load(&rsp_thread_call_pending))) {
+        rsp_thread_service();
+    }
+}
+
+// Runs a call on the CPU thread, waiting for it if we're on the RSP thread.
+INLINE void rsp_thread_call(rsp_cpu_call_t call, u32 a, u32 b) {
+    if (unlikely(rsp_thread_is_current)) {
+        rsp_thread_call_on_cpu(call, a, b);
+    } else {
+        call(a, b);
+    }
+}
+
+#endif //N64_RSP_THREAD_H
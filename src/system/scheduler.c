@@ -2,75 +2,118 @@
 #include <log.h>
 #include "scheduler.h"
 
-#define NUM_EVENT_NODES 10
+#define INITIAL_HEAP_CAPACITY 16
 
 u64 scheduler_ticks = 0;
+u64 scheduler_next_event = UINT64_MAX;
 
 typedef struct scheduler_event_node {
     scheduler_event_t event;
-    struct scheduler_event_node* next;
+    // Insertion order, so events due at the same time fire first-in first-out
+    u64 order;
 } scheduler_event_node_t;
 
-scheduler_event_node_t event_nodes[NUM_EVENT_NODES];
-int free_event_nodes_stack_ptr = 0;
-scheduler_event_node_t* free_event_nodes[NUM_EVENT_NODES];
+// Binary min-heap ordered by (time, order). Grows as needed, so there's no limit on pending events.
+static scheduler_event_node_t* scheduler_heap = NULL;
+static int scheduler_heap_size = 0;
+static int scheduler_heap_capacity = 0;
+static u64 scheduler_order = 0;
 
-scheduler_event_node_t* scheduler_list = NULL;
+static scheduler_event_handler_t scheduler_handler = NULL;
 
-// pops a pointer off of the free event nodes stack
-scheduler_event_node_t* alloc_event_node() {
-    return free_event_nodes[--free_event_nodes_stack_ptr];
+INLINE bool node_before(const scheduler_event_node_t* a, const scheduler_event_node_t* b) {
+    return a->event.time < b->event.time || (a->event.time == b->event.time && a->order < b->order);
 }
 
-// pushes this pointer onto the free event nodes stack
-void free_event_node(scheduler_event_node_t* node) {
-    free_event_nodes[free_event_nodes_stack_ptr++] = node;
+INLINE void swap_nodes(int a, int b) {
+    scheduler_event_node_t temp = scheduler_heap[a];
+    scheduler_heap[a] = scheduler_heap[b];
+    scheduler_heap[b] = temp;
 }
 
-void scheduler_reset() {
-    scheduler_ticks = 0;
-    free_event_nodes_stack_ptr = 0;
-
-    for (int i = 0; i < NUM_EVENT_NODES; i++) {
-        free_event_node(&event_nodes[i]);
+static void sift_up(int index) {
+    while (index > 0) {
+        int parent = (index - 1) >> 1;
+        if (!node_before(&scheduler_heap[index], &scheduler_heap[parent])) {
+            break;
+        }
+        swap_nodes(index, parent);
+        index = parent;
     }
 }
 
-bool scheduler_tick(u64 ticks, scheduler_event_t* event) {
-    scheduler_ticks += ticks;
+static void sift_down(int index) {
+    while (true) {
+        int left = (index << 1) + 1;
+        int right = left + 1;
+        int smallest = index;
 
-    bool event_occurred = (scheduler_list != NULL) && scheduler_list->event.time < scheduler_ticks;
+        if (left < scheduler_heap_size && node_before(&scheduler_heap[left], &scheduler_heap[smallest])) {
+            smallest = left;
+        }
+        if (right < scheduler_heap_size && node_before(&scheduler_heap[right], &scheduler_heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        swap_nodes(index, smallest);
+        index = smallest;
+    }
+}
+
+INLINE void update_next_event() {
+    scheduler_next_event = scheduler_heap_size > 0 ? scheduler_heap[0].event.time : UINT64_MAX;
+}
 
-    if (event_occurred) {
-        *event = scheduler_list->event;
-        free_event_node(scheduler_list);
-        scheduler_list = scheduler_list->next;
+static void remove_node(int index) {
+    scheduler_heap_size--;
+    if (index != scheduler_heap_size) {
+        scheduler_heap[index] = scheduler_heap[scheduler_heap_size];
+        sift_up(index);
+        sift_down(index);
     }
+    update_next_event();
+}
 
-    return event_occurred;
+void scheduler_init(scheduler_event_handler_t handler) {
+    scheduler_handler = handler;
+    scheduler_reset();
+}
+
+void scheduler_reset() {
+    scheduler_ticks = 0;
+    scheduler_heap_size = 0;
+    scheduler_order = 0;
+    update_next_event();
+}
+
+void scheduler_dispatch_due_events() {
+    while (scheduler_heap_size > 0 && scheduler_heap[0].event.time <= scheduler_ticks) {
+        scheduler_event_t event = scheduler_heap[0].event;
+        remove_node(0);
+        // The handler is free to enqueue more events, including ones that are already due.
+        scheduler_handler(&event);
+    }
 }
 
 void scheduler_enqueue_absolute(u64 at_ticks, scheduler_event_type_t event_type) {
-    scheduler_event_node_t* ins = alloc_event_node();
-    ins->next = NULL;
-    ins->event.type = event_type;
-    ins->event.time = at_ticks;
-
-    // special case when list is empty
-    if (scheduler_list == NULL) {
-        scheduler_list = ins;
-    } else {
-        // Find the first node with a rank smaller than the node we're inserting
-        // that either has a null next node OR a next node with a larger rank than the one we're inserting.
-
-        scheduler_event_node_t* n = scheduler_list;
-        while (n->next != NULL && n->next->event.time < at_ticks) {
-            n = n->next;
+    if (unlikely(scheduler_heap_size == scheduler_heap_capacity)) {
+        int new_capacity = scheduler_heap_capacity == 0 ? INITIAL_HEAP_CAPACITY : scheduler_heap_capacity * 2;
+        scheduler_event_node_t* new_heap = realloc(scheduler_heap, new_capacity * sizeof(scheduler_event_node_t));
+        if (new_heap == NULL) {
+            logfatal("Failed to grow the scheduler to %d events", new_capacity);
         }
-        scheduler_event_node_t* old_next = n->next;
-        n->next = ins;
-        ins->next = old_next;
+        scheduler_heap = new_heap;
+        scheduler_heap_capacity = new_capacity;
     }
+
+    int index = scheduler_heap_size++;
+    scheduler_heap[index].event.time = at_ticks;
+    scheduler_heap[index].event.type = event_type;
+    scheduler_heap[index].order = scheduler_order++;
+    sift_up(index);
+    update_next_event();
 }
 
 void scheduler_enqueue_relative(u64 in_ticks, scheduler_event_type_t event_type) {
@@ -78,20 +121,19 @@ void scheduler_enqueue_relative(u64 in_ticks, scheduler_event_type_t event_type)
 }
 
 u64 scheduler_remove_event(scheduler_event_type_t event_type) {
-    scheduler_event_node_t* node = scheduler_list;
-    scheduler_event_node_t** prev_next = &scheduler_list;
-
-    while (node != NULL) {
-        if (node->event.type == event_type) {
-            u64 in_cycles = node->event.time - scheduler_ticks;
-            free_event_node(node);
-
-            *prev_next = node->next;
-            return in_cycles;
+    // Remove the earliest pending event of this type, if there is one
+    int found = -1;
+    for (int i = 0; i < scheduler_heap_size; i++) {
+        if (scheduler_heap[i].event.type == event_type && (found < 0 || node_before(&scheduler_heap[i], &scheduler_heap[found]))) {
+            found = i;
         }
+    }
 
-        prev_next = &node->next;
-        node = node->next;
+    if (found < 0) {
+        return 0;
     }
-    return 0;
-}
\ No newline at end of file
+
+    u64 time = scheduler_heap[found].event.time;
+    remove_node(found);
+    return time > scheduler_ticks ? time - scheduler_ticks : 0;
+}
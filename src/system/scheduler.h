@@ -7,7 +7,11 @@
 typedef enum scheduler_event_type {
     SCHEDULER_SI_DMA_COMPLETE,
     SCHEDULER_PI_DMA_COMPLETE,
-    SCHEDULER_PI_BUS_WRITE_COMPLETE
+    SCHEDULER_PI_BUS_WRITE_COMPLETE,
+    SCHEDULER_VI_HALFLINE,
+    SCHEDULER_AI_SAMPLE,
+    SCHEDULER_COMPARE_INTERRUPT,
+    SCHEDULER_DP_INTERRUPT
 } scheduler_event_type_t;
 
 typedef struct scheduler_event {
@@ -15,11 +19,42 @@ typedef struct scheduler_event {
     scheduler_event_type_t type;
 } scheduler_event_t;
 
+typedef void(*scheduler_event_handler_t)(scheduler_event_t* event);
 
+extern u64 scheduler_ticks;
+// Time of the earliest pending event, or UINT64_MAX if nothing is scheduled.
+extern u64 scheduler_next_event;
+
+void scheduler_init(scheduler_event_handler_t handler);
 void scheduler_reset();
-bool scheduler_tick(u64 cycles, scheduler_event_t* event);
+void scheduler_dispatch_due_events();
 u64 scheduler_remove_event(scheduler_event_type_t event_type);
 void scheduler_enqueue_absolute(u64 at_cycles, scheduler_event_type_t event_type);
 void scheduler_enqueue_relative(u64 in_cycles, scheduler_event_type_t event_type);
 
+INLINE u64 scheduler_next_event_time() {
+    return scheduler_next_event;
+}
+
+INLINE u64 scheduler_cycles_until_next_event() {
+    return scheduler_next_event - scheduler_ticks;
+}
+
+INLINE bool scheduler_event_due() {
+    return scheduler_ticks >= scheduler_next_event;
+}
+
+// Advances time without firing anything. Callers running up to scheduler_next_event_time() dispatch once they get there.
+INLINE void scheduler_advance(u64 ticks) {
+    scheduler_ticks += ticks;
+}
+
+// Advances time, then runs the handler for every event that has come due, in order.
+INLINE void scheduler_tick(u64 ticks) {
+    scheduler_advance(ticks);
+    if (unlikely(scheduler_event_due())) {
+        scheduler_dispatch_due_events();
+    }
+}
+
 #endif //N64_SCHEDULER_H
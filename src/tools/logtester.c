@@ -3,8 +3,7 @@
 #include <rdp/rdp.h>
 #include <cpu/rsp.h>
 #include <rdp/parallel_rdp_wrapper.h>
-#include <interface/ai.h>
-#include <interface/vi.h>
+#include <system/scheduler.h>
 #include "log.h"
 #include "system/n64system.h"
 #include "mem/pif.h"
@@ -327,16 +326,9 @@ void cpu_step(r4300i_t* cpu) {
 
 void update_count(int taken) {
     r4300i_t* cpu = &N64CPU;
-
-    uint64_t oldcount = cpu->cp0.count >> 1;
-    uint64_t newcount = (cpu->cp0.count + (taken * CYCLES_PER_INSTR)) >> 1;
-    if (unlikely(oldcount < cpu->cp0.compare && newcount >= cpu->cp0.compare)) {
-        cpu->cp0.cause.ip7 = true;
-        loginfo("Compare interrupt!");
-        r4300i_interrupt_update(cpu);
-    }
+    // Compare interrupts are raised by the scheduler
     cpu->cp0.count += taken;
-
+    cpu->cp0.count &= 0x1FFFFFFFF;
 }
 
 int run_system_check_interrupt() {
@@ -403,61 +395,26 @@ int run_system_and_check(long taken, char* line, long linenum) {
 }
 
 void check_jit_sync_log(FILE* fp) {
-    int cycles = 0;
     long linenum = 0;
-    for (int frame = 0; frame < 0xFFFFFFFF; frame++) {
-        for (n64sys.vi.v_current = 0; n64sys.vi.v_current < NUM_SHORTLINES; n64sys.vi.v_current++) {
-            check_vi_interrupt();
-            check_vsync();
-            while (cycles <= SHORTLINE_CYCLES) {
-                cycles += run_system_check_interrupt();
-                if (cycles > SHORTLINE_CYCLES) {
-                    break;
-                }
-                char *line = NULL;
-                size_t len = 0;
-
-                if (getline(&line, &len, fp) == -1) {
-                    logalways("End of file.");
-                    exit(0);
-                }
-
-                char* tok = strtok(line, " ");
-                tok = strtok(NULL, " ");
-                long steps = strtoul(tok, NULL, 10);
-
-                cycles += run_system_and_check(steps, line, linenum++);
+    while (true) {
+        int taken = run_system_check_interrupt();
+        if (taken == 0) {
+            char *line = NULL;
+            size_t len = 0;
+
+            if (getline(&line, &len, fp) == -1) {
+                logalways("End of file.");
+                exit(0);
             }
-            cycles -= SHORTLINE_CYCLES;
-            ai_step(SHORTLINE_CYCLES);
-        }
-        for (; n64sys.vi.v_current < NUM_SHORTLINES + NUM_LONGLINES; n64sys.vi.v_current++) {
-            check_vi_interrupt();
-            check_vsync();
-            while (cycles <= LONGLINE_CYCLES) {
-                cycles += run_system_check_interrupt();
-                if (cycles > LONGLINE_CYCLES) {
-                    break;
-                }
-                char *line = NULL;
-                size_t len = 0;
 
-                if (getline(&line, &len, fp) == -1) {
-                    logalways("End of file.");
-                    exit(0);
-                }
-
-                char* tok = strtok(line, " ");
-                tok = strtok(NULL, " ");
-                long steps = strtoul(tok, NULL, 10);
+            char* tok = strtok(line, " ");
+            tok = strtok(NULL, " ");
+            long steps = strtoul(tok, NULL, 10);
 
-                cycles += run_system_and_check(steps, line, linenum++);
-            }
-            cycles -= LONGLINE_CYCLES;
-            ai_step(LONGLINE_CYCLES);
+            taken = run_system_and_check(steps, line, linenum++);
         }
-        check_vi_interrupt();
-        check_vsync();
+        // VI halflines, AI samples and compare interrupts all run off the scheduler
+        scheduler_tick(taken);
     }
 }
 
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <time.h>
+#include <cflags.h>
+#include <log.h>
+#include <simd.h>
+#include <system/n64system.h>
+#include <mem/mem_util.h>
+#include <cpu/rsp.h>
+
+#define COP2 0x12
+
+#define VU_OP(funct, vd, vs, vt, e) ((COP2 << 26) | (1 << 25) | ((e) << 21) | ((vt) << 16) | ((vs) << 11) | ((vd) << 6) | (funct))
+#define CFC2(rt, rd) ((COP2 << 26) | (2 << 21) | ((rt) << 16) | ((rd) << 11))
+#define CTC2(rt, rd) ((COP2 << 26) | (6 << 21) | ((rt) << 16) | ((rd) << 11))
+#define J(target) ((2 << 26) | ((target) >> 2))
+#define NOP 0
+
+#define VADD  0x10
+#define VSUB  0x11
+#define VADDC 0x14
+#define VSUBC 0x15
+#define VLT   0x20
+#define VEQ   0x21
+#define VNE   0x22
+#define VGE   0x23
+#define VCL   0x24
+#define VCH   0x25
+#define VMRG  0x27
+#define VMULF 0x00
+#define VMACF 0x08
+
+// Flag-heavy loop in the style of clipping and blending microcode: compares feeding merges, carry chains, and
+// the flags moved in and out through cfc2/ctc2.
+static const u32 flags_program[] = {
+        VU_OP(VSUBC, 4, 1, 2, 0),
+        VU_OP(VSUB, 5, 1, 2, 0),
+        VU_OP(VADDC, 6, 1, 3, 8),
+        VU_OP(VADD, 7, 1, 3, 8),
+        VU_OP(VCH, 8, 1, 2, 0),
+        VU_OP(VCL, 9, 3, 2, 0),
+        CFC2(1, 0),
+        CFC2(2, 1),
+        CFC2(3, 2),
+        VU_OP(VLT, 10, 1, 2, 0),
+        VU_OP(VMRG, 11, 4, 5, 0),
+        VU_OP(VEQ, 12, 6, 7, 0),
+        VU_OP(VNE, 13, 1, 3, 9),
+        VU_OP(VGE, 14, 2, 3, 0),
+        CTC2(1, 0),
+        CTC2(2, 1),
+        CTC2(3, 2),
+        VU_OP(VMRG, 15, 8, 9, 0),
+        J(0),
+        NOP,
+};
+
+// Multiply-accumulate loop with no flag traffic, as a baseline
+static const u32 mac_program[] = {
+        VU_OP(VMULF, 4, 1, 2, 0),
+        VU_OP(VMACF, 5, 1, 3, 0),
+        VU_OP(VMACF, 6, 2, 3, 8),
+        VU_OP(VMACF, 7, 4, 5, 0),
+        VU_OP(VMULF, 8, 6, 7, 0),
+        VU_OP(VMACF, 9, 8, 1, 2),
+        J(0),
+        NOP,
+};
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(cflags_t* flags) {
+    cflags_print_usage(flags,
+                       "[OPTION]...",
+                       "RSP vector unit microbenchmark",
+                       "https://github.com/Dillonb/n64");
+}
+
+void load_program(const u32* program, int length) {
+    for (int i = 0; i < length; i++) {
+        word_to_byte_array((u8*) &N64RSP.sp_imem, i * 4, program[i]);
+        invalidate_rsp_icache(i * 4);
+    }
+}
+
+void seed_registers() {
+    for (int r = 1; r < 4; r++) {
+        for (int e = 0; e < 8; e++) {
+            N64RSP.vu_regs[r].elements[e] = (u16)(0x9E37 * (r * 8 + e + 1));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+
+    int millions = 100;
+    cflags_add_int(flags, 'i', "instructions", &millions, "Millions of RSP instructions to run (default 100)");
+
+    bool mac = false;
+    cflags_add_bool(flags, 'm', "mac", &mac, "Run the multiply-accumulate loop instead of the flag loop");
+
+    bool dynarec = false;
+    cflags_add_bool(flags, 'd', "dynarec", &dynarec, "Run on the RSP dynarec instead of the interpreter");
+
+    const char* simd = NULL;
+    cflags_add_string(flags, 's', "simd", &simd, "Force a SIMD level: scalar, sse2, sse4.1 or avx2 (default: best the CPU supports)");
+
+    cflags_parse(flags, argc, argv);
+
+    if (help || millions < 1) {
+        usage(flags);
+        cflags_free(flags);
+        return help ? 0 : 1;
+    }
+
+    if (simd != NULL) {
+        simd_request_level(simd);
+    }
+    init_n64system(NULL, false, false, UNKNOWN_VIDEO_TYPE, !dynarec);
+
+    if (mac) {
+        load_program(mac_program, sizeof(mac_program) / sizeof(u32));
+    } else {
+        load_program(flags_program, sizeof(flags_program) / sizeof(u32));
+    }
+    seed_registers();
+
+    N64RSP.status.halt = false;
+    N64RSP.pc = 0;
+    N64RSP.next_pc = 1;
+
+    u64 total = (u64)millions * 1000000;
+    u64 executed = 0;
+
+    double start = now_seconds();
+    while (executed < total) {
+        // Run in slices, the way the system loop hands the RSP its share of each CPU block
+        N64RSP.steps = 1000;
+        if (dynarec) {
+            rsp_dynarec_run();
+        } else {
+            rsp_run();
+        }
+        executed += 1000 - N64RSP.steps;
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("Ran %lu RSP instructions of the %s loop on the %s (%s kernels) in %.3f seconds\n",
+           executed, mac ? "multiply-accumulate" : "flag", dynarec ? "dynarec" : "interpreter", simd_level_name(simd_level), elapsed);
+    printf("%.2f ns per instruction, %.1f million instructions per second\n",
+           elapsed * 1e9 / executed, executed / elapsed / 1e6);
+    printf("Final VCO %04X VCC %04X VCE %02X\n", rsp_get_vco(), rsp_get_vcc(), rsp_get_vce());
+
+    cflags_free(flags);
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <time.h>
+#include <cflags.h>
+#include <log.h>
+#include <system/scheduler.h>
+
+// Periods roughly matching what a running game keeps in flight: a VI halfline, an AI sample,
+// a far-off compare interrupt, and a steady trickle of SI/PI DMAs.
+#define VI_PERIOD 5963
+#define AI_PERIOD 2126
+#define PI_PERIOD 900
+#define SI_PERIOD 131072
+
+static u64 events_handled = 0;
+
+void bench_handle_event(scheduler_event_t* event) {
+    events_handled++;
+    switch (event->type) {
+        case SCHEDULER_VI_HALFLINE:
+            scheduler_enqueue_relative(VI_PERIOD, SCHEDULER_VI_HALFLINE);
+            break;
+        case SCHEDULER_AI_SAMPLE:
+            scheduler_enqueue_relative(AI_PERIOD, SCHEDULER_AI_SAMPLE);
+            break;
+        case SCHEDULER_PI_DMA_COMPLETE:
+            scheduler_enqueue_relative(PI_PERIOD, SCHEDULER_PI_DMA_COMPLETE);
+            break;
+        case SCHEDULER_SI_DMA_COMPLETE:
+            scheduler_enqueue_relative(SI_PERIOD, SCHEDULER_SI_DMA_COMPLETE);
+            break;
+        case SCHEDULER_COMPARE_INTERRUPT:
+            scheduler_enqueue_relative(0x200000000, SCHEDULER_COMPARE_INTERRUPT);
+            break;
+        default:
+            break;
+    }
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(cflags_t* flags) {
+    cflags_print_usage(flags,
+                       "[OPTION]...",
+                       "Scheduler event dispatch microbenchmark",
+                       "https://github.com/Dillonb/n64");
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+
+    int frames = 600;
+    cflags_add_int(flags, 'f', "frames", &frames, "Number of emulated 60Hz frames to run (default 600)");
+
+    int step = 1;
+    cflags_add_int(flags, 's', "step", &step, "Cycles per scheduler tick, 1 models the interpreter, larger values model JIT blocks (default 1)");
+
+    int extra = 0;
+    cflags_add_int(flags, 'e', "extra-events", &extra, "Additional far-future events kept pending, to stress the heap (default 0)");
+
+    cflags_parse(flags, argc, argv);
+
+    if (help || step < 1 || frames < 1 || extra < 0) {
+        usage(flags);
+        cflags_free(flags);
+        return help ? 0 : 1;
+    }
+
+    scheduler_init(bench_handle_event);
+    scheduler_enqueue_relative(0, SCHEDULER_VI_HALFLINE);
+    scheduler_enqueue_relative(AI_PERIOD, SCHEDULER_AI_SAMPLE);
+    scheduler_enqueue_relative(PI_PERIOD, SCHEDULER_PI_DMA_COMPLETE);
+    scheduler_enqueue_relative(SI_PERIOD, SCHEDULER_SI_DMA_COMPLETE);
+    scheduler_enqueue_relative(0x200000000, SCHEDULER_COMPARE_INTERRUPT);
+    for (int i = 0; i < extra; i++) {
+        scheduler_enqueue_relative(0x100000000 + i, SCHEDULER_PI_BUS_WRITE_COMPLETE);
+    }
+
+    u64 total_cycles = (u64)frames * (93750000 / 60);
+
+    double start = now_seconds();
+    while (scheduler_ticks < total_cycles) {
+        scheduler_tick(step);
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("Ran %d frames (%lu cycles) in %d cycle steps with %d extra pending events\n", frames, total_cycles, step, extra);
+    printf("Dispatched %lu events in %.3f seconds\n", events_handled, elapsed);
+    printf("%.1f ns per tick, %.1f ns per frame, %.2f million events per second\n",
+           elapsed * 1e9 / (total_cycles / step), elapsed * 1e9 / frames, events_handled / elapsed / 1e6);
+
+    cflags_free(flags);
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cflags.h>
+#include <log.h>
+#include <simd.h>
+#include <mem/n64mem.h>
+#include <mem/mem_util.h>
+#include <rdp/softrdp.h>
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define COLOR_IMAGE_ADDRESS 0x100000
+#define TEXTURE_ADDRESS 0x200000
+
+// Distinct triangles in the stream, replayed until enough have been drawn
+#define NUM_TRIANGLES 256
+// The largest triangle command: edges, shade, texture and Z
+#define MAX_TRIANGLE_WORDS 44
+
+#define CMD_FILL_TRIANGLE          0x08
+#define CMD_TEXTURE_TRIANGLE       0x0A
+#define CMD_SHADE_TRIANGLE         0x0C
+#define CMD_SHADE_TEXTURE_TRIANGLE 0x0E
+#define CMD_SET_SCISSOR            0x2D
+#define CMD_SET_OTHER_MODES        0x2F
+#define CMD_SET_TILE_SIZE          0x32
+#define CMD_LOAD_TILE              0x34
+#define CMD_SET_TILE               0x35
+#define CMD_SET_FILL_COLOR         0x37
+#define CMD_SET_COMBINE            0x3C
+#define CMD_SET_TEXTURE_IMAGE      0x3D
+#define CMD_SET_COLOR_IMAGE        0x3F
+
+typedef struct triangle {
+    u32 words[MAX_TRIANGLE_WORDS];
+    int length;
+} triangle_t;
+
+static softrdp_state_t rdp;
+static triangle_t triangles[NUM_TRIANGLES];
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(cflags_t* flags) {
+    cflags_print_usage(flags,
+                       "[OPTION]...",
+                       "Software RDP triangle microbenchmark",
+                       "https://github.com/Dillonb/n64");
+}
+
+// The RDP takes commands a u64 at a time, with the first of each pair of words on top
+void command(const u32* words, int length) {
+    u64 buffer[MAX_TRIANGLE_WORDS / 2];
+    for (int i = 0; i < length; i += 2) {
+        buffer[i >> 1] = (u64)words[i] << 32 | words[i + 1];
+    }
+    softrdp_enqueue_command(&rdp, length, buffer);
+}
+
+void command2(u32 w0, u32 w1) {
+    u32 words[2] = { w0, w1 };
+    command(words, 2);
+}
+
+u32 s15_16(double value) {
+    return (u32)(s32)(value * 65536.0);
+}
+
+double random_between(double low, double high) {
+    return low + (high - low) * (rand() / (double)RAND_MAX);
+}
+
+// Four attributes per block: the value, its change per pixel and its change along the major edge
+void put_attributes(u32* words, const double* value, const double* dx, const double* de) {
+    const double* sources[3] = { value, dx, de };
+    // Integer halves of the value, dx and de go in words 0, 2 and 8, with their fractions four words later
+    const int offsets[3] = { 0, 2, 8 };
+    for (int i = 0; i < 3; i++) {
+        u32 fixed[4];
+        for (int a = 0; a < 4; a++) {
+            fixed[a] = s15_16(sources[i][a]);
+        }
+        u32* out = &words[offsets[i]];
+        out[0] = (fixed[0] & 0xFFFF0000) | fixed[1] >> 16;
+        out[1] = (fixed[2] & 0xFFFF0000) | fixed[3] >> 16;
+        out[4] = fixed[0] << 16 | (fixed[1] & 0xFFFF);
+        out[5] = fixed[2] << 16 | (fixed[3] & 0xFFFF);
+    }
+}
+
+void make_triangle(triangle_t* triangle, int cmd, bool shade, bool texture) {
+    double x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        x[i] = random_between(0, SCREEN_WIDTH);
+        y[i] = (int)random_between(0, SCREEN_HEIGHT);
+    }
+    // Sort the vertices top to bottom
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2 - i; j++) {
+            if (y[j] > y[j + 1]) {
+                double t = y[j]; y[j] = y[j + 1]; y[j + 1] = t;
+                t = x[j]; x[j] = x[j + 1]; x[j + 1] = t;
+            }
+        }
+    }
+    double dxhdy = y[2] > y[0] ? (x[2] - x[0]) / (y[2] - y[0]) : 0;
+    double dxmdy = y[1] > y[0] ? (x[1] - x[0]) / (y[1] - y[0]) : 0;
+    double dxldy = y[2] > y[1] ? (x[2] - x[1]) / (y[2] - y[1]) : 0;
+    bool right_major = x[0] + dxhdy * (y[1] - y[0]) > x[1];
+
+    u32* w = triangle->words;
+    memset(w, 0, sizeof(triangle->words));
+    w[0] = cmd << 24 | right_major << 23 | ((u32)(y[2] * 4) & 0x3FFF);
+    w[1] = ((u32)(y[1] * 4) & 0x3FFF) << 16 | ((u32)(y[0] * 4) & 0x3FFF);
+    w[2] = s15_16(x[1]);
+    w[3] = s15_16(dxldy);
+    w[4] = s15_16(x[0]);
+    w[5] = s15_16(dxhdy);
+    w[6] = s15_16(x[0]);
+    w[7] = s15_16(dxmdy);
+    triangle->length = 8;
+
+    if (shade) {
+        double value[4], dx[4], de[4];
+        for (int a = 0; a < 4; a++) {
+            value[a] = random_between(0, 255);
+            dx[a] = random_between(-2, 2);
+            de[a] = random_between(-2, 2);
+        }
+        put_attributes(&w[triangle->length], value, dx, de);
+        triangle->length += 16;
+    }
+    if (texture) {
+        // s and t in s10.5, w at 1.0 in s0.15
+        double value[4] = { 0, 0, 0x7FFF / 65536.0, 0 };
+        double dx[4] = { random_between(-32, 32), random_between(-32, 32), 0, 0 };
+        double de[4] = { random_between(-32, 32), random_between(-32, 32), 0, 0 };
+        put_attributes(&w[triangle->length], value, dx, de);
+        triangle->length += 16;
+    }
+}
+
+// A 32x32 RGBA16 texture, loaded into TMEM and set up as tile 0
+void load_texture() {
+    for (int t = 0; t < 32; t++) {
+        for (int s = 0; s < 32; s++) {
+            u16 texel = ((s ^ t) & 8) ? 0xF83F : 0x07C1;
+            memcpy(&rdp.rdram[HALF_ADDRESS(TEXTURE_ADDRESS + (t * 32 + s) * 2)], &texel, sizeof(u16));
+        }
+    }
+    command2(CMD_SET_TEXTURE_IMAGE << 24 | 2 << 19 | 31, TEXTURE_ADDRESS);
+    // Line of 8 u64s, masks of 5 bits so coordinates wrap
+    command2(CMD_SET_TILE << 24 | 2 << 19 | 8 << 9, 5 << 14 | 5 << 4);
+    command2(CMD_LOAD_TILE << 24, (31 * 4) << 12 | 31 * 4);
+    command2(CMD_SET_TILE_SIZE << 24, (31 * 4) << 12 | 31 * 4);
+}
+
+// Combines (0 - 0) * 0 + input, for both cycles, with input being one of the add sources
+void set_combine_passthrough(int input) {
+    u64 c = 15ULL << 52 | 31ULL << 47 | 7ULL << 44 | 7ULL << 41 | 15ULL << 37 | 31ULL << 32
+          | 15ULL << 28 | 15ULL << 24 | 7ULL << 21 | 7ULL << 18 | 7ULL << 12 | 7ULL << 3;
+    c |= (u64)input << 15 | (u64)input << 9 | (u64)input << 6 | (u64)input;
+    command2(CMD_SET_COMBINE << 24 | (u32)(c >> 32), (u32)c);
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+
+    int thousands = 100;
+    cflags_add_int(flags, 't', "triangles", &thousands, "Thousands of triangles to draw (default 100)");
+
+    const char* mode = "shade";
+    cflags_add_string(flags, 'm', "mode", &mode, "What to draw: fill, shade, texture or shade-texture (default shade)");
+
+    int reload = 0;
+    cflags_add_int(flags, 'r', "reload", &reload, "Load the texture again every this many triangles, like a game would each frame (default 0, never)");
+
+    int threads = 0;
+    cflags_add_int(flags, 'j', "threads", &threads, "Draw on this many worker threads, 0 draws on the main thread (default 0)");
+
+    const char* simd = NULL;
+    cflags_add_string(flags, 's', "simd", &simd, "Force a SIMD level: scalar, sse2, sse4.1 or avx2 (default: best the CPU supports)");
+
+    cflags_parse(flags, argc, argv);
+
+    if (help || thousands < 1 || reload < 0) {
+        usage(flags);
+        cflags_free(flags);
+        return help ? 0 : 1;
+    }
+
+    int cmd;
+    bool shade = false;
+    bool texture = false;
+    if (strcmp(mode, "fill") == 0) {
+        cmd = CMD_FILL_TRIANGLE;
+    } else if (strcmp(mode, "shade") == 0) {
+        cmd = CMD_SHADE_TRIANGLE;
+        shade = true;
+    } else if (strcmp(mode, "texture") == 0) {
+        cmd = CMD_TEXTURE_TRIANGLE;
+        texture = true;
+    } else if (strcmp(mode, "shade-texture") == 0) {
+        cmd = CMD_SHADE_TEXTURE_TRIANGLE;
+        shade = true;
+        texture = true;
+    } else {
+        logfatal("Unknown mode '%s', expected fill, shade, texture or shade-texture", mode);
+    }
+
+    if (simd != NULL) {
+        simd_request_level(simd);
+    }
+    simd_init();
+
+    u8* rdram = calloc(1, N64_RDRAM_SIZE);
+    if (rdram == NULL) {
+        logfatal("Failed to allocate RDRAM");
+    }
+    softrdp_init(&rdp, rdram);
+    softrdp_start_workers(&rdp, threads);
+
+    command2(CMD_SET_COLOR_IMAGE << 24 | 2 << 19 | (SCREEN_WIDTH - 1), COLOR_IMAGE_ADDRESS);
+    command2(CMD_SET_SCISSOR << 24, (SCREEN_WIDTH * 4) << 12 | SCREEN_HEIGHT * 4);
+    if (cmd == CMD_FILL_TRIANGLE) {
+        command2(CMD_SET_OTHER_MODES << 24 | 3 << 20, 0);
+        command2(CMD_SET_FILL_COLOR << 24, 0xF801F801);
+    } else {
+        // 1 cycle mode, blender passing the combiner's output through
+        command2(CMD_SET_OTHER_MODES << 24, 0);
+        // The combiner outputs texel 0 when texturing, otherwise the shade color
+        if (texture) {
+            load_texture();
+            set_combine_passthrough(1);
+        } else {
+            set_combine_passthrough(4);
+        }
+    }
+
+    srand(1);
+    for (int i = 0; i < NUM_TRIANGLES; i++) {
+        make_triangle(&triangles[i], cmd, shade, texture);
+    }
+
+    u64 total = (u64)thousands * 1000;
+    double start = now_seconds();
+    for (u64 i = 0; i < total; i++) {
+        if (texture && reload > 0 && i > 0 && i % reload == 0) {
+            load_texture();
+        }
+        const triangle_t* triangle = &triangles[i % NUM_TRIANGLES];
+        command(triangle->words, triangle->length);
+    }
+    softrdp_flush(&rdp);
+    double elapsed = now_seconds() - start;
+
+    printf("Drew %lu %s triangles (%s kernels, %d threads) in %.3f seconds\n", total, mode, simd_level_name(simd_level), threads, elapsed);
+    printf("%.1f thousand triangles per second, %.1f million pixels per second\n",
+           total / elapsed / 1e3, rdp.pixels_drawn / elapsed / 1e6);
+    softrdp_report_overlap(&rdp);
+    softrdp_report_texture_cache(&rdp);
+    softrdp_report_commands(&rdp, 0);
+    printf("Framebuffer CRC %08X\n", crc32(0, &rdram[COLOR_IMAGE_ADDRESS], SCREEN_WIDTH * SCREEN_HEIGHT * 2));
+
+    softrdp_stop_workers(&rdp);
+    free(rdram);
+    cflags_free(flags);
+    return 0;
+}
@@ -0,0 +1,376 @@
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <system/n64system.h>
+#include <mem/mem_util.h>
+#include <cpu/rsp.h>
+#include <cpu/rsp_hle.h>
+#include <cpu/rsp_hle_audio.h>
+
+// Runs audio command lists through the real microcode on the RSP interpreter and through HLE, starting from the same
+// RDRAM, and checks they leave exactly the same RDRAM behind. The microcode isn't ours to ship, so it's passed in as
+// its text and data segments, see testcases/audio/README.md.
+
+// Just to make sure we don't get caught in an infinite loop
+#define MAX_CYCLES 10000000
+
+#define ACMD_SPNOOP     0x00
+#define ACMD_ADPCM      0x01
+#define ACMD_CLEARBUFF  0x02
+#define ACMD_ENVMIXER   0x03
+#define ACMD_LOADBUFF   0x04
+#define ACMD_RESAMPLE   0x05
+#define ACMD_SAVEBUFF   0x06
+#define ACMD_SEGMENT    0x07
+#define ACMD_SETBUFF    0x08
+#define ACMD_SETVOL     0x09
+#define ACMD_DMEMMOVE   0x0A
+#define ACMD_LOADADPCM  0x0B
+#define ACMD_MIXER      0x0C
+#define ACMD_INTERLEAVE 0x0D
+#define ACMD_SETLOOP    0x0F
+
+#define A_INIT 0x01
+#define A_LOOP 0x02
+#define A_LEFT 0x02
+#define A_VOL  0x04
+#define A_AUX  0x08
+
+#define UCODE_ADDRESS      0x100000
+#define UCODE_DATA_ADDRESS 0x110000
+#define COMMANDS_ADDRESS   0x120000
+#define YIELD_ADDRESS      0x130000
+#define INPUT_ADDRESS      0x140000
+#define OUTPUT_ADDRESS     0x150000
+#define STATE_ADDRESS      0x160000
+
+// The ucode goes where the boot microcode puts it, after itself
+#define UCODE_IMEM_ADDRESS 0x080
+
+// Bytes of samples per buffer, and the buffers in DMEM, relative to the start of the ABI's buffers
+#define COUNT 0x100
+#define SAMPLES (COUNT / 2)
+#define DMEM_IN   0x000
+#define DMEM_OUT  0x200
+#define DMEM_AUX1 0x300
+#define DMEM_AUX2 0x400
+#define DMEM_AUX3 0x500
+
+static u32 commands[256];
+static int num_commands;
+
+static u32 ucode_size;
+static u32 ucode_data_size;
+
+static u32 seed = 12345;
+
+static u32 random_u32() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static s16 random_sample() {
+    return (s16)((random_u32() % 60001) - 30000);
+}
+
+static void write_u8(u32 address, u8 value) {
+    n64sys.mem.rdram[BYTE_ADDRESS(address)] = value;
+}
+
+static void write_u16(u32 address, u16 value) {
+    half_to_byte_array(n64sys.mem.rdram, HALF_ADDRESS(address), value);
+}
+
+static void write_u32(u32 address, u32 value) {
+    word_to_byte_array(n64sys.mem.rdram, WORD_ADDRESS(address), value);
+}
+
+static void command(u32 w1, u32 w2) {
+    commands[num_commands++] = w1;
+    commands[num_commands++] = w2;
+}
+
+static void write_samples(u32 address, int samples) {
+    for (int i = 0; i < samples; i++) {
+        write_u16(address + i * 2, random_sample());
+    }
+}
+
+// Loads a file as it would sit in RDRAM, returning its size
+static u32 load_segment(const char* path, u32 address) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        logfatal("Failed to open %s", path);
+    }
+    u8 bytes[SP_DMEM_SIZE];
+    size_t size = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+    if (size == 0 || size % 4 != 0) {
+        logfatal("%s should be a non-empty segment of whole words, it's %zu bytes", path, size);
+    }
+    for (size_t i = 0; i < size; i += 4) {
+        write_u32(address + i, bytes[i] << 24 | bytes[i + 1] << 16 | bytes[i + 2] << 8 | bytes[i + 3]);
+    }
+    return size;
+}
+
+static void build_task(rsp_hle_task_t* task) {
+    memset(task, 0, sizeof(*task));
+    task->type = OSTASK_TYPE_AUDIO;
+    task->ucode = UCODE_ADDRESS;
+    task->ucode_size = ucode_size;
+    task->ucode_data = UCODE_DATA_ADDRESS;
+    task->ucode_data_size = ucode_data_size;
+    task->yield_data_ptr = YIELD_ADDRESS;
+    task->yield_data_size = SP_DMEM_SIZE;
+    task->data_ptr = COMMANDS_ADDRESS;
+    task->data_size = num_commands * 4;
+}
+
+static void run_hle(const rsp_hle_task_t* task) {
+    rsp_hle_rdram = n64sys.mem.rdram;
+    rsp_hle_audio_ucode_t ucode;
+    if (!rsp_hle_audio_identify(task, &ucode)) {
+        logfatal("The microcode doesn't look like the standard audio ABI");
+    }
+    if (!rsp_hle_audio_supported(task)) {
+        logfatal("HLE doesn't support every command in the task");
+    }
+    rsp_hle_audio_run(task, &ucode);
+}
+
+// Does what the boot microcode would, then lets the task run to its break
+static void run_lle(const rsp_hle_task_t* task) {
+    memset(N64RSP.sp_dmem, 0, SP_DMEM_SIZE);
+    const u32* fields = (const u32*)task;
+    for (int i = 0; i < sizeof(rsp_hle_task_t) / sizeof(u32); i++) {
+        word_to_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + i * 4, fields[i]);
+    }
+
+    memset(N64RSP.sp_imem, 0, SP_IMEM_SIZE);
+    for (u32 i = 0; i < task->ucode_size && UCODE_IMEM_ADDRESS + i < SP_IMEM_SIZE; i += 4) {
+        word_to_byte_array(N64RSP.sp_imem, UCODE_IMEM_ADDRESS + i, word_from_byte_array(n64sys.mem.rdram, task->ucode + i));
+    }
+    for (int i = 0; i < SP_IMEM_SIZE / 4; i++) {
+        N64RSP.icache[i].instruction.raw = word_from_byte_array(N64RSP.sp_imem, i * 4);
+        N64RSP.icache[i].handler = cache_rsp_instruction;
+    }
+
+    N64RSP.status.raw = 0;
+    N64RSP.pc = UCODE_IMEM_ADDRESS >> 2;
+    N64RSP.next_pc = N64RSP.pc + 1;
+
+    int cycles = 0;
+    while (!N64RSP.status.halt) {
+        if (cycles >= MAX_CYCLES) {
+            logfatal("Task ran too long and was killed! Possible infinite loop?");
+        }
+        cycles++;
+        rsp_step();
+    }
+}
+
+// Runs the commands built up so far as one task both ways
+static bool run_task(const char* name) {
+    for (int i = 0; i < num_commands; i++) {
+        write_u32(COMMANDS_ADDRESS + i * 4, commands[i]);
+    }
+    rsp_hle_task_t task;
+    build_task(&task);
+    num_commands = 0;
+
+    static u8 before[N64_RDRAM_SIZE];
+    static u8 hle[N64_RDRAM_SIZE];
+    memcpy(before, n64sys.mem.rdram, N64_RDRAM_SIZE);
+    run_hle(&task);
+    memcpy(hle, n64sys.mem.rdram, N64_RDRAM_SIZE);
+    memcpy(n64sys.mem.rdram, before, N64_RDRAM_SIZE);
+    run_lle(&task);
+
+    if (memcmp(hle, n64sys.mem.rdram, N64_RDRAM_SIZE) == 0) {
+        printf("[%s] PASSED\n", name);
+        return false;
+    }
+    printf(COLOR_RED "[%s] FAILED\n" COLOR_END, name);
+    int shown = 0;
+    for (u32 address = 0; address < N64_RDRAM_SIZE && shown < 16; address++) {
+        u32 index = BYTE_ADDRESS(address);
+        if (hle[index] != n64sys.mem.rdram[index]) {
+            printf("0x%08X: HLE 0x%02X, RSP 0x%02X\n", address, hle[index], n64sys.mem.rdram[index]);
+            shown++;
+        }
+    }
+    return true;
+}
+
+// Saves one of the ABI's buffers to RDRAM
+static void save_buffer(u16 dmem, u32 count, u32 address) {
+    command(ACMD_SETBUFF << 24, dmem << 16 | count);
+    command(ACMD_SAVEBUFF << 24, address);
+}
+
+static void load_buffer(u16 dmem, u32 count, u32 address) {
+    command(ACMD_SETBUFF << 24 | dmem, count);
+    command(ACMD_LOADBUFF << 24, address);
+}
+
+// Decodes two tasks' worth of frames with two predictors, the second carrying on from the state the first saved,
+// then a third from the loop point
+static bool test_adpcm() {
+    const int frames = COUNT / 32;
+    bool failed = false;
+    for (int i = 0; i < 2 * 16; i++) {
+        // Keeps the prediction from saturating every sample, while still getting there sometimes
+        write_u16(INPUT_ADDRESS + i * 2, (s16)(random_u32() % 0x1800) - 0xC00);
+    }
+    for (int i = 0; i < 16; i++) {
+        write_u16(STATE_ADDRESS + 0x100 + i * 2, random_sample());
+    }
+
+    for (int t = 0; t < 3; t++) {
+        u32 frames_address = INPUT_ADDRESS + 0x100 + t * 0x100;
+        for (int f = 0; f < frames; f++) {
+            // A header with any scale and either predictor, then 16 samples of 4 bits
+            write_u8(frames_address + f * 9, (random_u32() % 16) << 4 | (random_u32() % 2));
+            for (int i = 1; i < 9; i++) {
+                write_u8(frames_address + f * 9 + i, random_u32());
+            }
+        }
+
+        command(ACMD_LOADADPCM << 24 | 2 * 16 * 2, INPUT_ADDRESS);
+        load_buffer(DMEM_IN, frames * 9, frames_address);
+        command(ACMD_SETBUFF << 24 | DMEM_IN, DMEM_OUT << 16 | COUNT);
+        if (t == 2) {
+            command(ACMD_SETLOOP << 24, STATE_ADDRESS + 0x100);
+            command(ACMD_ADPCM << 24 | A_LOOP << 16, STATE_ADDRESS);
+        } else {
+            command(ACMD_ADPCM << 24 | (t == 0 ? A_INIT : 0) << 16, STATE_ADDRESS);
+        }
+        // The last frame of the previous run comes out first
+        save_buffer(DMEM_OUT, COUNT + 32, OUTPUT_ADDRESS);
+
+        static const char* names[] = { "ADPCM init", "ADPCM resumed", "ADPCM loop" };
+        failed |= run_task(names[t]);
+    }
+    return failed;
+}
+
+// Resamples down and then up, each carrying on from where the last left off
+static bool test_resample() {
+    static const u16 pitches[] = { 0x5A3C, 0x8000, 0xB717 };
+    static const char* names[] = { "RESAMPLE init", "RESAMPLE unity", "RESAMPLE up" };
+    // The filter reads the four samples before the input, which the command fills in
+    const u16 in = DMEM_IN + 0x10;
+    bool failed = false;
+
+    for (int t = 0; t < 3; t++) {
+        // Enough input for the fastest pitch
+        write_samples(INPUT_ADDRESS, 2 * SAMPLES);
+        load_buffer(in, 2 * COUNT, INPUT_ADDRESS);
+        command(ACMD_SETBUFF << 24 | in, DMEM_AUX2 << 16 | COUNT);
+        command(ACMD_RESAMPLE << 24 | (t == 0 ? A_INIT : 0) << 16 | pitches[t], STATE_ADDRESS);
+        save_buffer(DMEM_AUX2, COUNT, OUTPUT_ADDRESS);
+        failed |= run_task(names[t]);
+    }
+    return failed;
+}
+
+// Ramps the left volume up and the right one down over two tasks, the second picking everything up from the save area
+// rather than from volumes set since, then mixes without the aux outputs
+static bool test_envmixer() {
+    static const u16 outputs[4] = { 0x200, 0x300, 0x400, 0x500 };
+    static const char* names[] = { "ENVMIXER init", "ENVMIXER resumed", "ENVMIXER dry only" };
+    bool failed = false;
+
+    for (int t = 0; t < 3; t++) {
+        if (t == 0) {
+            command(ACMD_SETVOL << 24 | A_AUX << 16 | 0x5A00, 0x2300);
+            command(ACMD_SETVOL << 24 | (A_LEFT | A_VOL) << 16 | 0x2000, 0);
+            command(ACMD_SETVOL << 24 | A_VOL << 16 | 0x7000, 0);
+            command(ACMD_SETVOL << 24 | A_LEFT << 16 | 0x6000, 0x11000);
+            command(ACMD_SETVOL << 24 | 0x1000, 0xE800);
+        } else {
+            command(ACMD_SETVOL << 24 | A_AUX << 16 | 0x1111, 0x2222);
+            command(ACMD_SETVOL << 24 | A_LEFT << 16 | 0x3333, 0x4444);
+            command(ACMD_SETVOL << 24 | 0x5555, 0x6666);
+        }
+
+        write_samples(INPUT_ADDRESS, SAMPLES);
+        load_buffer(DMEM_IN, COUNT, INPUT_ADDRESS);
+        for (int i = 0; i < 4; i++) {
+            command(ACMD_CLEARBUFF << 24 | outputs[i], COUNT);
+        }
+        command(ACMD_SETBUFF << 24 | A_AUX << 16 | outputs[1], outputs[2] << 16 | outputs[3]);
+        command(ACMD_SETBUFF << 24 | DMEM_IN, outputs[0] << 16 | COUNT);
+        u8 flags = (t == 0 ? A_INIT : 0) | (t == 2 ? 0 : A_AUX);
+        command(ACMD_ENVMIXER << 24 | flags << 16, STATE_ADDRESS);
+        for (int i = 0; i < 4; i++) {
+            save_buffer(outputs[i], COUNT, OUTPUT_ADDRESS + i * COUNT);
+        }
+        failed |= run_task(names[t]);
+    }
+    return failed;
+}
+
+// Mixes with gains that saturate, cut, invert and do nothing, then interleaves and moves the result around
+static bool test_mixer() {
+    static const s16 gains[] = { 0x7FFF, 0x4000, (s16)0x8000, (s16)0xC000, 0 };
+    bool failed = false;
+
+    write_samples(INPUT_ADDRESS, 2 * SAMPLES);
+    load_buffer(DMEM_OUT, COUNT, INPUT_ADDRESS);
+    load_buffer(DMEM_AUX1, COUNT, INPUT_ADDRESS + COUNT);
+    for (size_t i = 0; i < sizeof(gains) / sizeof(gains[0]); i++) {
+        write_samples(INPUT_ADDRESS + 2 * COUNT + i * COUNT, SAMPLES);
+        load_buffer(DMEM_IN, COUNT, INPUT_ADDRESS + 2 * COUNT + i * COUNT);
+        command(ACMD_SETBUFF << 24, COUNT);
+        command(ACMD_MIXER << 24 | (u16)gains[i], DMEM_IN << 16 | (i % 2 ? DMEM_AUX1 : DMEM_OUT));
+    }
+    save_buffer(DMEM_OUT, COUNT, OUTPUT_ADDRESS);
+    save_buffer(DMEM_AUX1, COUNT, OUTPUT_ADDRESS + COUNT);
+    failed |= run_task("MIXER");
+
+    load_buffer(DMEM_OUT, COUNT, INPUT_ADDRESS);
+    load_buffer(DMEM_AUX1, COUNT, INPUT_ADDRESS + COUNT);
+    command(ACMD_SETBUFF << 24, DMEM_AUX2 << 16 | COUNT);
+    command(ACMD_INTERLEAVE << 24, DMEM_OUT << 16 | DMEM_AUX1);
+    command(ACMD_DMEMMOVE << 24 | DMEM_AUX2, DMEM_IN << 16 | 2 * COUNT);
+    save_buffer(DMEM_IN, 2 * COUNT, OUTPUT_ADDRESS + 2 * COUNT);
+    failed |= run_task("INTERLEAVE and DMEMMOVE");
+    return failed;
+}
+
+// Addresses everything through segments instead of directly
+static bool test_segments() {
+    command(ACMD_SEGMENT << 24, 3 << 24 | INPUT_ADDRESS);
+    command(ACMD_SEGMENT << 24, 5 << 24 | OUTPUT_ADDRESS);
+    write_samples(INPUT_ADDRESS + 0x40, SAMPLES);
+    load_buffer(DMEM_IN, COUNT, 3 << 24 | 0x40);
+    command(ACMD_SETBUFF << 24, COUNT);
+    command(ACMD_MIXER << 24 | 0x6000, DMEM_IN << 16 | DMEM_AUX3);
+    save_buffer(DMEM_AUX3, COUNT, 5 << 24 | 0x80);
+    command(ACMD_SPNOOP << 24, 0);
+    return run_task("SEGMENT");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        logfatal("Usage: %s <audio microcode text> <audio microcode data>", argv[0]);
+    }
+    init_n64system(NULL, false, false, UNKNOWN_VIDEO_TYPE, false);
+
+    ucode_size = load_segment(argv[1], UCODE_ADDRESS);
+    ucode_data_size = load_segment(argv[2], UCODE_DATA_ADDRESS);
+
+    bool failed = false;
+    failed |= test_adpcm();
+    failed |= test_resample();
+    failed |= test_envmixer();
+    failed |= test_mixer();
+    failed |= test_segments();
+
+    if (failed) {
+        logfatal("Tests failed!");
+    }
+    printf("Passed!\n");
+}
@@ -0,0 +1,446 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <system/n64system.h>
+#include <mem/mem_util.h>
+#include <cpu/rsp.h>
+#include <cpu/rsp_hle.h>
+#include <cpu/rsp_hle_gfx.h>
+#include <rdp/rdp.h>
+
+// Runs a display list through the real F3DEX2 microcode on the RSP interpreter and through HLE, and diffs the RDP
+// commands each sends. HLE sets triangles up in floating point rather than the microcode's fixed point and reciprocals,
+// so triangle coefficients only have to come within a tolerance of the microcode's. Everything else has to match
+// exactly. The microcode isn't ours to ship, so it's passed in as its text and data segments, see
+// testcases/gfx/README.md.
+
+// Just to make sure we don't get caught in an infinite loop
+#define MAX_CYCLES 50000000
+
+#define UCODE_ADDRESS        0x100000
+#define UCODE_DATA_ADDRESS   0x110000
+#define DL_ADDRESS           0x120000
+#define MATRIX_ADDRESS       0x130000
+#define VIEWPORT_ADDRESS     0x131000
+#define VERTEX_ADDRESS       0x140000
+#define STACK_ADDRESS        0x150000
+#define YIELD_ADDRESS        0x151000
+#define FIFO_ADDRESS         0x160000
+#define FIFO_SIZE            0x10000
+#define COLOR_IMAGE_ADDRESS  0x200000
+#define DEPTH_IMAGE_ADDRESS  0x280000
+
+// The ucode goes where the boot microcode puts it, after itself
+#define UCODE_IMEM_ADDRESS 0x080
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define NUM_VERTICES 32
+
+// F3DEX2 geometry mode
+#define G_ZBUFFER        0x00000001
+#define G_SHADE          0x00000004
+#define G_CULL_BACK      0x00000400
+#define G_SHADING_SMOOTH 0x00200000
+
+#define G_MTX_NOPUSH     0x00
+#define G_MTX_LOAD       0x02
+#define G_MTX_PROJECTION 0x04
+
+#define MAX_COMMAND_WORDS 0x10000
+#define MAX_COMMANDS 0x2000
+
+typedef struct command_stream {
+    u32 words[MAX_COMMAND_WORDS];
+    int num_words;
+    int starts[MAX_COMMANDS];
+    int num_commands;
+} command_stream_t;
+
+// How far HLE's triangle coefficients may be from the microcode's, in s15.16
+typedef struct tolerance {
+    const char* name;
+    s32 limit;
+    s32 worst;
+} tolerance_t;
+
+static tolerance_t tolerances[] = {
+        { "y",                     1,       0 }, // s11.2
+        { "edge x",                0x8000,  0 },
+        { "edge slope",            0x400,   0 },
+        { "shade",                 0x10000, 0 },
+        { "shade gradient",        0x1000,  0 },
+        { "texture",               0x20000, 0 },
+        { "texture gradient",      0x2000,  0 },
+        { "depth",                 0x20000, 0 },
+        { "depth gradient",        0x2000,  0 },
+};
+enum { TOL_Y, TOL_EDGE_X, TOL_EDGE_SLOPE, TOL_SHADE, TOL_SHADE_GRADIENT, TOL_TEXTURE, TOL_TEXTURE_GRADIENT, TOL_DEPTH, TOL_DEPTH_GRADIENT };
+
+static command_stream_t streams[2];
+static command_stream_t* recording;
+
+static u32 dl[0x1000];
+static int dl_words;
+
+static u32 ucode_size;
+static u32 ucode_data_size;
+
+static u32 seed = 12345;
+
+static u32 random_u32() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static s32 random_range(s32 low, s32 high) {
+    return low + (s32)(random_u32() % (u32)(high - low + 1));
+}
+
+static void write_u16(u32 address, u16 value) {
+    half_to_byte_array(n64sys.mem.rdram, HALF_ADDRESS(address), value);
+}
+
+static void write_u32(u32 address, u32 value) {
+    word_to_byte_array(n64sys.mem.rdram, WORD_ADDRESS(address), value);
+}
+
+static void command(u32 w0, u32 w1) {
+    dl[dl_words++] = w0;
+    dl[dl_words++] = w1;
+}
+
+static void record_command(int length_words, const u32* words) {
+    if (recording->num_words + length_words > MAX_COMMAND_WORDS || recording->num_commands == MAX_COMMANDS) {
+        logfatal("Too many RDP commands to record");
+    }
+    recording->starts[recording->num_commands++] = recording->num_words;
+    memcpy(&recording->words[recording->num_words], words, length_words * sizeof(u32));
+    recording->num_words += length_words;
+}
+
+// Loads a file as it would sit in RDRAM, returning its size
+static u32 load_segment(const char* path, u32 address) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        logfatal("Failed to open %s", path);
+    }
+    // The text is bigger than IMEM, the rest is overlays the microcode loads itself
+    static u8 bytes[0x4000];
+    size_t size = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+    if (size == 0 || size % 4 != 0) {
+        logfatal("%s should be a non-empty segment of whole words, it's %zu bytes", path, size);
+    }
+    for (size_t i = 0; i < size; i += 4) {
+        write_u32(address + i, bytes[i] << 24 | bytes[i + 1] << 16 | bytes[i + 2] << 8 | bytes[i + 3]);
+    }
+    return size;
+}
+
+// s15.16, with the integer halves of all 16 elements followed by the fractional halves
+static void write_matrix(u32 address, float m[4][4]) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            s32 fixed = (s32)(m[i][j] * 65536.0f);
+            write_u16(address + (i * 4 + j) * 2, fixed >> 16);
+            write_u16(address + 32 + (i * 4 + j) * 2, fixed);
+        }
+    }
+}
+
+// What guPerspective() builds, and the w scale it hands back for G_MW_PERSPNORM
+static u16 write_perspective(u32 address, float fovy, float aspect, float near, float far) {
+    float m[4][4];
+    memset(m, 0, sizeof(m));
+    float f = 1.0f / tanf(fovy * (float)M_PI / 360.0f);
+    m[0][0] = f / aspect;
+    m[1][1] = f;
+    m[2][2] = (near + far) / (near - far);
+    m[2][3] = -1.0f;
+    m[3][2] = 2.0f * near * far / (near - far);
+    write_matrix(address, m);
+    return near + far <= 2.0f ? 0xFFFF : (u16)(2.0f * 65536.0f / (near + far));
+}
+
+static void write_modelview(u32 address, float angle, float distance) {
+    float m[4][4];
+    memset(m, 0, sizeof(m));
+    m[0][0] = cosf(angle);
+    m[0][2] = -sinf(angle);
+    m[1][1] = 1.0f;
+    m[2][0] = sinf(angle);
+    m[2][2] = cosf(angle);
+    m[3][2] = -distance;
+    m[3][3] = 1.0f;
+    write_matrix(address, m);
+}
+
+static void write_vertices() {
+    for (int i = 0; i < NUM_VERTICES; i++) {
+        u32 v = VERTEX_ADDRESS + i * 16;
+        write_u16(v + 0, random_range(-100, 100));
+        write_u16(v + 2, random_range(-100, 100));
+        write_u16(v + 4, random_range(-100, 100));
+        write_u16(v + 6, 0);
+        write_u16(v + 8, random_range(-0x400, 0x400));
+        write_u16(v + 10, random_range(-0x400, 0x400));
+        write_u32(v + 12, random_u32() << 8 | random_range(0x40, 0xFF));
+    }
+}
+
+static void triangles() {
+    for (int i = 0; i + 5 < NUM_VERTICES; i += 6) {
+        // G_TRI2 for two, and G_TRI1 for one more out of the same vertices
+        command(0x06000000 | (i * 2) << 16 | ((i + 1) * 2) << 8 | (i + 2) * 2, ((i + 3) * 2) << 16 | ((i + 4) * 2) << 8 | (i + 5) * 2);
+        command(0x05000000 | (i * 2) << 16 | ((i + 2) * 2) << 8 | (i + 4) * 2, 0);
+    }
+}
+
+static void build_display_list() {
+    write_u16(VIEWPORT_ADDRESS + 0, SCREEN_WIDTH * 2);
+    write_u16(VIEWPORT_ADDRESS + 2, SCREEN_HEIGHT * 2);
+    write_u16(VIEWPORT_ADDRESS + 4, 0x1FF);
+    write_u16(VIEWPORT_ADDRESS + 6, 0);
+    write_u16(VIEWPORT_ADDRESS + 8, SCREEN_WIDTH * 2);
+    write_u16(VIEWPORT_ADDRESS + 10, SCREEN_HEIGHT * 2);
+    write_u16(VIEWPORT_ADDRESS + 12, 0x1FF);
+    write_u16(VIEWPORT_ADDRESS + 14, 0);
+    u16 perspnorm = write_perspective(MATRIX_ADDRESS, 60.0f, 4.0f / 3.0f, 10.0f, 1000.0f);
+    write_modelview(MATRIX_ADDRESS + 0x40, 0.3f, 400.0f);
+    write_vertices();
+
+    // Segment 6 points at the vertices, the rest is addressed directly
+    command(0xDB060018, VERTEX_ADDRESS);
+    command(0xE7000000, 0);
+    command(0xFF10013F, COLOR_IMAGE_ADDRESS);
+    command(0xFE000000, DEPTH_IMAGE_ADDRESS);
+    command(0xED000000, (SCREEN_WIDTH * 4) << 12 | SCREEN_HEIGHT * 4);
+    command(0xDC080008, VIEWPORT_ADDRESS);
+    command(0xDB0E0000, perspnorm);
+    command(0xDA380000 | ((G_MTX_PROJECTION | G_MTX_LOAD | G_MTX_NOPUSH) ^ 1), MATRIX_ADDRESS);
+    command(0xDA380000 | ((G_MTX_LOAD | G_MTX_NOPUSH) ^ 1), MATRIX_ADDRESS + 0x40);
+    // HLE starts with no other modes set and the microcode with its own, so start from the same ones. Then one cycle,
+    // perspective correct texturing and a Z buffered render mode.
+    command(0xEF000000, 0);
+    command(0xE3000A01, 0x00000000);
+    command(0xE3000C00, 0x00080000);
+    command(0xE200001C, 0x00552078);
+
+    // Smooth shaded and Z buffered, with and without texturing, then flat shaded without culling
+    command(0xD9000000, G_ZBUFFER | G_SHADE | G_SHADING_SMOOTH | G_CULL_BACK);
+    command(0x01000000 | NUM_VERTICES << 12 | NUM_VERTICES << 1, 0x06000000);
+    triangles();
+    command(0xD7000002, 0x80008000);
+    triangles();
+    command(0xD7000000, 0xFFFFFFFF);
+    command(0xD9000000, G_ZBUFFER | G_SHADE);
+    triangles();
+
+    // A texture rectangle passes straight through
+    command(0xE4000000 | (200 * 4) << 12 | 100 * 4, (100 * 4) << 12 | 50 * 4);
+    command(0xE1000000, 0x00400080);
+    command(0xF1000000, 0x04000400);
+    command(0xE9000000, 0);
+    command(0xDF000000, 0);
+
+    for (int i = 0; i < dl_words; i++) {
+        write_u32(DL_ADDRESS + i * 4, dl[i]);
+    }
+}
+
+static void build_task(rsp_hle_task_t* task) {
+    memset(task, 0, sizeof(*task));
+    task->type = OSTASK_TYPE_GFX;
+    task->ucode = UCODE_ADDRESS;
+    task->ucode_size = ucode_size;
+    task->ucode_data = UCODE_DATA_ADDRESS;
+    task->ucode_data_size = ucode_data_size;
+    task->dram_stack = STACK_ADDRESS;
+    task->dram_stack_size = 0x400;
+    task->output_buff = FIFO_ADDRESS;
+    task->output_buff_size = FIFO_ADDRESS + FIFO_SIZE;
+    task->data_ptr = DL_ADDRESS;
+    task->data_size = dl_words * 4;
+    task->yield_data_ptr = YIELD_ADDRESS;
+    task->yield_data_size = 0xC00;
+}
+
+static void run_hle(const rsp_hle_task_t* task) {
+    rsp_hle_rdram = n64sys.mem.rdram;
+    rsp_hle_gfx_ucode_t ucode;
+    if (!rsp_hle_gfx_identify(task, &ucode)) {
+        logfatal("The microcode isn't one HLE knows");
+    }
+    if (!rsp_hle_gfx_supported(task, &ucode) || !rsp_hle_gfx_run(task, &ucode)) {
+        logfatal("HLE didn't run the whole display list");
+    }
+}
+
+// Does what the boot microcode would, then lets the task run to its break
+static void run_lle(const rsp_hle_task_t* task) {
+    memset(N64RSP.sp_dmem, 0, SP_DMEM_SIZE);
+    const u32* fields = (const u32*)task;
+    for (int i = 0; i < sizeof(rsp_hle_task_t) / sizeof(u32); i++) {
+        word_to_byte_array(N64RSP.sp_dmem, OSTASK_ADDRESS + i * 4, fields[i]);
+    }
+
+    memset(N64RSP.sp_imem, 0, SP_IMEM_SIZE);
+    for (u32 i = 0; i < task->ucode_size && UCODE_IMEM_ADDRESS + i < SP_IMEM_SIZE; i += 4) {
+        word_to_byte_array(N64RSP.sp_imem, UCODE_IMEM_ADDRESS + i, word_from_byte_array(n64sys.mem.rdram, task->ucode + i));
+    }
+    for (int i = 0; i < SP_IMEM_SIZE / 4; i++) {
+        N64RSP.icache[i].instruction.raw = word_from_byte_array(N64RSP.sp_imem, i * 4);
+        N64RSP.icache[i].handler = cache_rsp_instruction;
+    }
+
+    N64RSP.status.raw = 0;
+    N64RSP.pc = UCODE_IMEM_ADDRESS >> 2;
+    N64RSP.next_pc = N64RSP.pc + 1;
+
+    int cycles = 0;
+    while (!N64RSP.status.halt) {
+        if (cycles >= MAX_CYCLES) {
+            logfatal("Task ran too long and was killed! Possible infinite loop?");
+        }
+        cycles++;
+        rsp_step();
+    }
+}
+
+static bool check(int tolerance, s32 hle, s32 lle) {
+    s64 difference = llabs((s64)hle - lle);
+    tolerance_t* t = &tolerances[tolerance];
+    if (difference > t->worst) {
+        t->worst = difference > 0x7FFFFFFF ? 0x7FFFFFFF : (s32)difference;
+    }
+    return difference <= t->limit;
+}
+
+static s32 unpack(u32 high, u32 low, bool upper) {
+    return upper ? (s32)((high & 0xFFFF0000) | (low >> 16)) : (s32)((high << 16) | (low & 0xFFFF));
+}
+
+// The shade and texture blocks hold four attributes each: starts, dx, de and dy, integer halves then fractional halves
+static bool check_attributes(const u32* hle, const u32* lle, int attributes, int value_tolerance, int gradient_tolerance) {
+    static const int integer[4] = { 0, 2, 8, 10 };
+    bool ok = true;
+    for (int kind = 0; kind < 4; kind++) {
+        for (int a = 0; a < attributes; a++) {
+            int word = integer[kind] + a / 2;
+            bool upper = a % 2 == 0;
+            ok &= check(kind == 0 ? value_tolerance : gradient_tolerance,
+                        unpack(hle[word], hle[word + 4], upper), unpack(lle[word], lle[word + 4], upper));
+        }
+    }
+    return ok;
+}
+
+static bool check_triangle(const u32* hle, const u32* lle) {
+    u8 command = (hle[0] >> 24) & 0x3F;
+    bool ok = (hle[0] & 0xFFFFC000) == (lle[0] & 0xFFFFC000);
+    ok &= check(TOL_Y, (s32)(hle[0] << 18) >> 18, (s32)(lle[0] << 18) >> 18);
+    ok &= check(TOL_Y, (s32)(hle[1] << 2) >> 18, (s32)(lle[1] << 2) >> 18);
+    ok &= check(TOL_Y, (s32)(hle[1] << 18) >> 18, (s32)(lle[1] << 18) >> 18);
+    for (int i = 2; i < 8; i++) {
+        ok &= check(i % 2 == 0 ? TOL_EDGE_X : TOL_EDGE_SLOPE, hle[i], lle[i]);
+    }
+    int offset = 8;
+    if (command & 0x04) {
+        ok &= check_attributes(&hle[offset], &lle[offset], 4, TOL_SHADE, TOL_SHADE_GRADIENT);
+        offset += 16;
+    }
+    if (command & 0x02) {
+        // s, t and w, the fourth is unused
+        ok &= check_attributes(&hle[offset], &lle[offset], 3, TOL_TEXTURE, TOL_TEXTURE_GRADIENT);
+        offset += 16;
+    }
+    if (command & 0x01) {
+        ok &= check(TOL_DEPTH, hle[offset], lle[offset]);
+        for (int i = 1; i < 4; i++) {
+            ok &= check(TOL_DEPTH_GRADIENT, hle[offset + i], lle[offset + i]);
+        }
+    }
+    return ok;
+}
+
+static void print_command(const char* who, const command_stream_t* stream, int index) {
+    int start = stream->starts[index];
+    int end = index + 1 < stream->num_commands ? stream->starts[index + 1] : stream->num_words;
+    printf("%s:", who);
+    for (int i = start; i < end; i++) {
+        printf(" %08X", stream->words[i]);
+    }
+    printf("\n");
+}
+
+static bool compare_streams(const command_stream_t* hle, const command_stream_t* lle) {
+    bool failed = false;
+    int triangles = 0;
+    if (hle->num_commands != lle->num_commands) {
+        printf(COLOR_RED "HLE sent %d RDP commands, the microcode %d\n" COLOR_END, hle->num_commands, lle->num_commands);
+        failed = true;
+    }
+    int commands = hle->num_commands < lle->num_commands ? hle->num_commands : lle->num_commands;
+    for (int i = 0; i < commands; i++) {
+        const u32* h = &hle->words[hle->starts[i]];
+        const u32* l = &lle->words[lle->starts[i]];
+        u8 command = (h[0] >> 24) & 0x3F;
+        int length = (i + 1 < hle->num_commands ? hle->starts[i + 1] : hle->num_words) - hle->starts[i];
+        bool ok;
+        if (command != ((l[0] >> 24) & 0x3F)) {
+            ok = false;
+        } else if (command >= 0x08 && command <= 0x0F) {
+            ok = check_triangle(h, l);
+            triangles++;
+        } else {
+            ok = memcmp(h, l, length * sizeof(u32)) == 0;
+        }
+        if (!ok) {
+            printf(COLOR_RED "RDP command %d differs\n" COLOR_END, i);
+            print_command("HLE", hle, i);
+            print_command("RSP", lle, i);
+            failed = true;
+            // Everything after a missing or extra command would differ too
+            if (command != ((l[0] >> 24) & 0x3F)) {
+                break;
+            }
+        }
+    }
+
+    printf("%d commands, %d of them triangles. Furthest HLE got from the microcode:\n", commands, triangles);
+    for (size_t i = 0; i < sizeof(tolerances) / sizeof(tolerances[0]); i++) {
+        printf("  %-18s 0x%08X (allowed 0x%08X)\n", tolerances[i].name, tolerances[i].worst, tolerances[i].limit);
+    }
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        logfatal("Usage: %s <F3DEX2 text> <F3DEX2 data>", argv[0]);
+    }
+    init_n64system(NULL, false, false, UNKNOWN_VIDEO_TYPE, false);
+
+    ucode_size = load_segment(argv[1], UCODE_ADDRESS);
+    ucode_data_size = load_segment(argv[2], UCODE_DATA_ADDRESS);
+    build_display_list();
+
+    rsp_hle_task_t task;
+    build_task(&task);
+    rdp_set_command_observer(record_command);
+
+    static u8 before[N64_RDRAM_SIZE];
+    memcpy(before, n64sys.mem.rdram, N64_RDRAM_SIZE);
+    recording = &streams[0];
+    run_hle(&task);
+    memcpy(n64sys.mem.rdram, before, N64_RDRAM_SIZE);
+    recording = &streams[1];
+    run_lle(&task);
+    rdp_set_command_observer(NULL);
+
+    if (compare_streams(&streams[0], &streams[1])) {
+        logfatal("Tests failed!");
+    }
+    printf("Passed!\n");
+}
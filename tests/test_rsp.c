@@ -10,6 +10,8 @@
 #include <cpu/rsp.h>
 #include <mem/mem_util.h>
 #include <cpu/n64_rsp_bus.h>
+#include <cpu/dynarec/rsp_dynarec.h>
+#include <simd.h>
 
 // Just to make sure we don't get caught in an infinite loop
 #define MAX_CYCLES 100000
@@ -41,12 +43,59 @@ void load_rsp_dmem(u32* input, int input_size) {
     }
 }
 
-bool run_test(u32* input, int input_size, u32* output, int output_size) {
-    load_rsp_dmem(input, input_size / 4);
+// Everything a testcase can leave behind for the next one to start from
+typedef struct rsp_test_state {
+    u32 gpr[32];
+    vu_reg_t vu_regs[32];
+    __typeof__(N64RSP.vcc) vcc;
+    __typeof__(N64RSP.vco) vco;
+    vu_reg_t vce;
+    __typeof__(N64RSP.acc) acc;
+    s16 divin;
+    bool divin_loaded;
+    s16 divout;
+} rsp_test_state_t;
+
+void save_state(rsp_test_state_t* state) {
+    memcpy(state->gpr, N64RSP.gpr, sizeof(state->gpr));
+    memcpy(state->vu_regs, N64RSP.vu_regs, sizeof(state->vu_regs));
+    state->vcc = N64RSP.vcc;
+    state->vco = N64RSP.vco;
+    state->vce = N64RSP.vce;
+    state->acc = N64RSP.acc;
+    state->divin = N64RSP.divin;
+    state->divin_loaded = N64RSP.divin_loaded;
+    state->divout = N64RSP.divout;
+}
 
-    N64RSP.status.halt = false;
-    N64RSP.pc = 0;
+void restore_state(const rsp_test_state_t* state) {
+    memcpy(N64RSP.gpr, state->gpr, sizeof(state->gpr));
+    memcpy(N64RSP.vu_regs, state->vu_regs, sizeof(state->vu_regs));
+    N64RSP.vcc = state->vcc;
+    N64RSP.vco = state->vco;
+    N64RSP.vce = state->vce;
+    N64RSP.acc = state->acc;
+    N64RSP.divin = state->divin;
+    N64RSP.divin_loaded = state->divin_loaded;
+    N64RSP.divout = state->divout;
+}
+
+// Vector instruction handlers are picked for the current SIMD level when an instruction is cached or a block is compiled,
+// so both caches have to be thrown away whenever the level changes.
+void use_simd_level(simd_level_t level) {
+    simd_request_level(simd_level_name(level));
+    simd_init();
+
+    for (int i = 0; i < SP_IMEM_SIZE / 4; i++) {
+        N64RSP.icache[i].handler = cache_rsp_instruction;
+    }
 
+    rsp_dynarec_t* old = N64RSP.dynarec;
+    N64RSP.dynarec = rsp_dynarec_init(old->codecache, old->codecache_size);
+    free(old);
+}
+
+void run_interpreter() {
     int cycles = 0;
 
     while (!N64RSP.status.halt) {
@@ -57,6 +106,30 @@ bool run_test(u32* input, int input_size, u32* output, int output_size) {
         cycles++;
         rsp_step();
     }
+}
+
+void run_dynarec() {
+    // Runs until the break instruction zeroes the steps, or they run out
+    N64RSP.steps = MAX_CYCLES;
+    rsp_dynarec_run();
+
+    if (!N64RSP.status.halt) {
+        logfatal("Test ran too long and was killed! Possible infinite loop?");
+    }
+}
+
+bool run_test(u32* input, int input_size, u32* output, int output_size, bool dynarec) {
+    load_rsp_dmem(input, input_size / 4);
+
+    N64RSP.status.halt = false;
+    N64RSP.pc = 0;
+    N64RSP.next_pc = 1;
+
+    if (dynarec) {
+        run_dynarec();
+    } else {
+        run_interpreter();
+    }
 
     bool failed = false;
     printf("\n\n================= Expected =================    ================== Actual ==================\n");
@@ -155,15 +228,26 @@ int main(int argc, char** argv) {
         u8 output[output_size];
         fread(output, 1, output_size, output_data_handle);
 
-        bool subtest_failed = run_test((u32 *) input, input_size, (u32 *) output, output_size);
+        // Both the interpreter and the dynarec have to match the golden, at every SIMD level the host can run.
+        // Each of them starts from what the previous subtest left behind.
+        rsp_test_state_t state;
+        save_state(&state);
+        for (int level = SIMD_LEVEL_SCALAR; level <= (int)simd_host_level() && !failed; level++) {
+            use_simd_level(level);
+            for (int dynarec = 0; dynarec <= 1 && !failed; dynarec++) {
+                const char* mode = dynarec ? "dynarec" : "interpreter";
+                restore_state(&state);
+                bool subtest_failed = run_test((u32 *) input, input_size, (u32 *) output, output_size, dynarec);
+
+                if (subtest_failed) {
+                    printf("[%s %s %s %s] FAILED\n", test_name, subtest_name, mode, simd_level_name(level));
+                } else {
+                    printf("[%s %s %s %s] PASSED\n", test_name, subtest_name, mode, simd_level_name(level));
+                }
 
-        if (subtest_failed) {
-            printf("[%s %s] FAILED\n", test_name, subtest_name);
-        } else {
-            printf("[%s %s] PASSED\n", test_name, subtest_name);
+                failed |= subtest_failed;
+            }
         }
-
-        failed |= subtest_failed;
         if (failed) {
             break;
         }
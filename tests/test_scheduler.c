@@ -0,0 +1,68 @@
+#include <log.h>
+#include <system/scheduler.h>
+
+#define ASSERT_INT_EQUALS(message, expected, actual) do { if ((expected) != (actual)) { logfatal("assert failed! [%s] expected %ld != actual %ld", message, (long)(expected), (long)(actual)); } } while(0)
+
+#define MAX_FIRED 64
+static scheduler_event_t fired[MAX_FIRED];
+static int num_fired = 0;
+
+void record_event(scheduler_event_t* event) {
+    if (num_fired == MAX_FIRED) {
+        logfatal("Too many events fired");
+    }
+    fired[num_fired++] = *event;
+}
+
+int main(int argc, char** argv) {
+    scheduler_init(record_event);
+    ASSERT_INT_EQUALS("empty scheduler has no next event", UINT64_MAX, scheduler_next_event_time());
+
+    // Enqueued out of order, including one earlier than the current head
+    scheduler_enqueue_absolute(300, SCHEDULER_PI_DMA_COMPLETE);
+    scheduler_enqueue_absolute(100, SCHEDULER_SI_DMA_COMPLETE);
+    scheduler_enqueue_absolute(200, SCHEDULER_VI_HALFLINE);
+    scheduler_enqueue_absolute(50, SCHEDULER_AI_SAMPLE);
+    ASSERT_INT_EQUALS("next event is the earliest", 50, scheduler_next_event_time());
+
+    scheduler_tick(49);
+    ASSERT_INT_EQUALS("nothing due yet", 0, num_fired);
+
+    // A single large tick fires every event that came due, in order
+    scheduler_tick(251);
+    ASSERT_INT_EQUALS("all due events fired", 4, num_fired);
+    ASSERT_INT_EQUALS("first", SCHEDULER_AI_SAMPLE, fired[0].type);
+    ASSERT_INT_EQUALS("second", SCHEDULER_SI_DMA_COMPLETE, fired[1].type);
+    ASSERT_INT_EQUALS("third", SCHEDULER_VI_HALFLINE, fired[2].type);
+    ASSERT_INT_EQUALS("fourth", SCHEDULER_PI_DMA_COMPLETE, fired[3].type);
+
+    // Events due at the same time fire in the order they were enqueued
+    num_fired = 0;
+    scheduler_enqueue_relative(10, SCHEDULER_COMPARE_INTERRUPT);
+    scheduler_enqueue_relative(10, SCHEDULER_SI_DMA_COMPLETE);
+    scheduler_enqueue_relative(10, SCHEDULER_AI_SAMPLE);
+    scheduler_tick(10);
+    ASSERT_INT_EQUALS("simultaneous events", 3, num_fired);
+    ASSERT_INT_EQUALS("simultaneous first", SCHEDULER_COMPARE_INTERRUPT, fired[0].type);
+    ASSERT_INT_EQUALS("simultaneous second", SCHEDULER_SI_DMA_COMPLETE, fired[1].type);
+    ASSERT_INT_EQUALS("simultaneous third", SCHEDULER_AI_SAMPLE, fired[2].type);
+
+    // No fixed capacity
+    num_fired = 0;
+    for (int i = 0; i < 40; i++) {
+        scheduler_enqueue_relative(1000 - i, SCHEDULER_PI_BUS_WRITE_COMPLETE);
+    }
+    scheduler_enqueue_relative(500, SCHEDULER_VI_HALFLINE);
+    ASSERT_INT_EQUALS("removed event reports remaining cycles", 500, scheduler_remove_event(SCHEDULER_VI_HALFLINE));
+    ASSERT_INT_EQUALS("removing a missing event", 0, scheduler_remove_event(SCHEDULER_VI_HALFLINE));
+    ASSERT_INT_EQUALS("removal picks the earliest", 961, scheduler_remove_event(SCHEDULER_PI_BUS_WRITE_COMPLETE));
+    scheduler_tick(1000);
+    ASSERT_INT_EQUALS("all remaining events fired", 39, num_fired);
+    for (int i = 1; i < num_fired; i++) {
+        ASSERT_INT_EQUALS("fired in time order", true, fired[i - 1].time <= fired[i].time);
+    }
+
+    scheduler_reset();
+    ASSERT_INT_EQUALS("reset clears time", 0, scheduler_ticks);
+    ASSERT_INT_EQUALS("reset clears events", UINT64_MAX, scheduler_next_event_time());
+}
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <simd.h>
+#include <mem/n64mem.h>
+#include <mem/mem_util.h>
+#include <rdp/softrdp.h>
+
+// Draws fixed scenes through the software RDP and checks what lands in RDRAM against known CRCs, with every kernel tier
+// the host supports, on the main thread and on workers. Every tier and worker count has to draw exactly the same thing.
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define IMAGE_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT * 2)
+#define COLOR_IMAGE_ADDRESS  0x100000
+#define SECOND_IMAGE_ADDRESS 0x140000
+#define DEPTH_IMAGE_ADDRESS  0x180000
+#define TEXTURE_ADDRESS      0x200000
+// Everything the scenes draw to, checked as one
+#define CHECKED_START COLOR_IMAGE_ADDRESS
+#define CHECKED_END   (DEPTH_IMAGE_ADDRESS + IMAGE_SIZE)
+
+#define MAX_COMMAND_WORDS 44
+
+#define CMD_FILL_TRIANGLE          0x08
+#define CMD_TEXTURE_TRIANGLE       0x0A
+#define CMD_SHADE_TRIANGLE         0x0C
+#define CMD_SHADE_ZBUFFER_TRIANGLE 0x0D
+#define CMD_SHADE_TEXTURE_TRIANGLE 0x0E
+#define CMD_TEXTURE_RECTANGLE      0x24
+#define CMD_SYNC_LOAD              0x26
+#define CMD_SYNC_PIPE              0x27
+#define CMD_SYNC_TILE              0x28
+#define CMD_SET_SCISSOR            0x2D
+#define CMD_SET_PRIM_DEPTH         0x2E
+#define CMD_SET_OTHER_MODES        0x2F
+#define CMD_SET_TILE_SIZE          0x32
+#define CMD_LOAD_TILE              0x34
+#define CMD_SET_TILE               0x35
+#define CMD_FILL_RECTANGLE         0x36
+#define CMD_SET_FILL_COLOR         0x37
+#define CMD_SET_PRIM_COLOR         0x3A
+#define CMD_SET_COMBINE            0x3C
+#define CMD_SET_TEXTURE_IMAGE      0x3D
+#define CMD_SET_Z_IMAGE            0x3E
+#define CMD_SET_COLOR_IMAGE        0x3F
+
+// Other modes
+#define CYCLE_COPY      (2 << 20)
+#define CYCLE_FILL      (3 << 20)
+#define Z_COMPARE       (1 << 4)
+#define Z_UPDATE        (1 << 5)
+#define Z_SOURCE_PRIM   (1 << 2)
+#define Z_MODE_OPAQUE   (0 << 10)
+#define Z_MODE_DECAL    (3 << 10)
+
+typedef struct scene {
+    const char* name;
+    void (*draw)();
+    u32 crc;
+} scene_t;
+
+static softrdp_state_t rdp;
+static u8* rdram;
+// While set, state commands are sent twice with syncs in between, all of which should be dropped
+static bool redundant = false;
+static u64 redundant_commands;
+
+// The RDP takes commands a u64 at a time, with the first of each pair of words on top
+static void command(const u32* words, int length) {
+    u64 buffer[MAX_COMMAND_WORDS / 2];
+    for (int i = 0; i < length; i += 2) {
+        buffer[i >> 1] = (u64)words[i] << 32 | words[i + 1];
+    }
+    softrdp_enqueue_command(&rdp, length, buffer);
+}
+
+static void command2(u32 w0, u32 w1) {
+    u32 words[2] = { w0, w1 };
+    command(words, 2);
+}
+
+static void state_command(u32 w0, u32 w1) {
+    command2(w0, w1);
+    if (redundant) {
+        command2(CMD_SYNC_PIPE << 24, 0);
+        command2(w0, w1);
+        command2(CMD_SYNC_TILE << 24, 0);
+        command2(CMD_SYNC_LOAD << 24, 0);
+        redundant_commands += 4;
+    }
+}
+
+static u32 s15_16(double value) {
+    return (u32)(s32)(value * 65536.0);
+}
+
+// Four attributes per block: the value, its change per pixel and its change along the major edge
+static void put_attributes(u32* words, const double* value, const double* dx, const double* de) {
+    const double* sources[3] = { value, dx, de };
+    // Integer halves of the value, dx and de go in words 0, 2 and 8, with their fractions four words later
+    const int offsets[3] = { 0, 2, 8 };
+    memset(words, 0, 16 * sizeof(u32));
+    for (int i = 0; i < 3; i++) {
+        u32 fixed[4];
+        for (int a = 0; a < 4; a++) {
+            fixed[a] = s15_16(sources[i][a]);
+        }
+        u32* out = &words[offsets[i]];
+        out[0] = (fixed[0] & 0xFFFF0000) | fixed[1] >> 16;
+        out[1] = (fixed[2] & 0xFFFF0000) | fixed[3] >> 16;
+        out[4] = fixed[0] << 16 | (fixed[1] & 0xFFFF);
+        out[5] = fixed[2] << 16 | (fixed[3] & 0xFFFF);
+    }
+}
+
+// Edges with y in scanlines and x in pixels, followed by whatever attribute blocks the command takes
+static void triangle(int cmd, double yh, double ym, double yl, double xh, double dxhdy, double xm, double dxmdy, double xl, double dxldy,
+                     const u32* attributes, int attribute_words) {
+    u32 w[MAX_COMMAND_WORDS];
+    w[0] = cmd << 24 | ((u32)(yl * 4) & 0x3FFF);
+    w[1] = ((u32)(ym * 4) & 0x3FFF) << 16 | ((u32)(yh * 4) & 0x3FFF);
+    w[2] = s15_16(xl);
+    w[3] = s15_16(dxldy);
+    w[4] = s15_16(xh);
+    w[5] = s15_16(dxhdy);
+    w[6] = s15_16(xm);
+    w[7] = s15_16(dxmdy);
+    if (attribute_words > 0) {
+        memcpy(&w[8], attributes, attribute_words * sizeof(u32));
+    }
+    command(w, 8 + attribute_words);
+}
+
+// (sub_a - sub_b) * mul + add, the same for both cycles
+static void set_combine(int rgb_sub_a, int rgb_sub_b, int rgb_mul, int rgb_add, int alpha_sub_a, int alpha_sub_b, int alpha_mul, int alpha_add) {
+    u64 c = (u64)rgb_sub_a << 52 | (u64)rgb_mul << 47 | (u64)alpha_sub_a << 44 | (u64)alpha_mul << 41
+          | (u64)rgb_sub_a << 37 | (u64)rgb_mul << 32 | (u64)rgb_sub_b << 28 | (u64)rgb_sub_b << 24
+          | (u64)alpha_sub_a << 21 | (u64)alpha_mul << 18 | (u64)rgb_add << 15 | (u64)alpha_sub_b << 12
+          | (u64)alpha_add << 9 | (u64)rgb_add << 6 | (u64)alpha_sub_b << 3 | (u64)alpha_add;
+    state_command(CMD_SET_COMBINE << 24 | (u32)(c >> 32), (u32)c);
+}
+
+// Combines (0 - 0) * 0 + input, with input being one of the add sources
+static void set_combine_passthrough(int input) {
+    set_combine(15, 15, 31, input, 7, 7, 7, input);
+}
+
+static void fill_screen(u32 address, u32 color) {
+    state_command(CMD_SET_COLOR_IMAGE << 24 | 2 << 19 | (SCREEN_WIDTH - 1), address);
+    state_command(CMD_SET_OTHER_MODES << 24 | CYCLE_FILL, 0);
+    state_command(CMD_SET_FILL_COLOR << 24, color);
+    command2(CMD_FILL_RECTANGLE << 24 | ((SCREEN_WIDTH - 1) * 4) << 12 | (SCREEN_HEIGHT - 1) * 4, 0);
+}
+
+static void begin_scene() {
+    state_command(CMD_SET_SCISSOR << 24, (SCREEN_WIDTH * 4) << 12 | SCREEN_HEIGHT * 4);
+    fill_screen(COLOR_IMAGE_ADDRESS, 0x00010001);
+}
+
+// A 16x16 RGBA16 checker, loaded into TMEM and set up as tile 0
+static void load_checker() {
+    for (int t = 0; t < 16; t++) {
+        for (int s = 0; s < 16; s++) {
+            u16 texel = ((s ^ t) & 4) ? 0xF83F : 0x07C1;
+            memcpy(&rdram[HALF_ADDRESS(TEXTURE_ADDRESS + (t * 16 + s) * 2)], &texel, sizeof(u16));
+        }
+    }
+    state_command(CMD_SET_TEXTURE_IMAGE << 24 | 2 << 19 | 15, TEXTURE_ADDRESS);
+    state_command(CMD_SET_TILE << 24 | 2 << 19 | 4 << 9, 7 << 24);
+    command2(CMD_LOAD_TILE << 24, 7 << 24 | (15 * 4) << 12 | 15 * 4);
+    state_command(CMD_SET_TILE << 24 | 2 << 19 | 4 << 9, 4 << 14 | 4 << 4);
+    state_command(CMD_SET_TILE_SIZE << 24, (15 * 4) << 12 | 15 * 4);
+}
+
+static void shade_attributes(u32* words) {
+    const double value[4] = { 255, 0, 0, 255 };
+    const double dx[4] = { -2.5, 2.5, 0.7, 0 };
+    const double de[4] = { 0, 0, 3.1, 0 };
+    put_attributes(words, value, dx, de);
+}
+
+// s and t in s10.5, stepping by step every pixel
+static void texture_attributes(u32* words, double step) {
+    const double value[4] = { 0, 0, 0, 0 };
+    const double dx[4] = { step, 0, 0, 0 };
+    const double de[4] = { 0, step, 0, 0 };
+    put_attributes(words, value, dx, de);
+}
+
+static void draw_fill() {
+    begin_scene();
+    state_command(CMD_SET_FILL_COLOR << 24, 0xF801F801);
+    triangle(CMD_FILL_TRIANGLE, 10, 50, 50, 20, 0, 20, 2.0, 100, 0, NULL, 0);
+    state_command(CMD_SET_FILL_COLOR << 24, 0x07C107C1);
+    triangle(CMD_FILL_TRIANGLE, 60.25, 140.5, 200.75, 150.5, -0.75, 150.5, 1.25, 250.5, -3.4, NULL, 0);
+    // Odd edges, so partial words at both ends
+    state_command(CMD_SET_FILL_COLOR << 24, 0x003F003F);
+    command2(CMD_FILL_RECTANGLE << 24 | (301 * 4) << 12 | 230 * 4, (203 * 4) << 12 | 121 * 4);
+}
+
+static void draw_shade() {
+    begin_scene();
+    state_command(CMD_SET_OTHER_MODES << 24, 0);
+    set_combine_passthrough(4);
+    u32 attributes[16];
+    shade_attributes(attributes);
+    triangle(CMD_SHADE_TRIANGLE, 60, 200, 200, 10, 0, 10, 1.3, 300, 0, attributes, 16);
+}
+
+static void draw_texture() {
+    begin_scene();
+    load_checker();
+    state_command(CMD_SET_OTHER_MODES << 24, 0);
+    set_combine_passthrough(1);
+    u32 attributes[16];
+    texture_attributes(attributes, 16);
+    triangle(CMD_TEXTURE_TRIANGLE, 150, 230, 230, 150, 0, 300, 0, 300, 0, attributes, 16);
+}
+
+static void draw_shade_texture() {
+    begin_scene();
+    load_checker();
+    state_command(CMD_SET_OTHER_MODES << 24, 0);
+    // Texel 0 times shade
+    set_combine(1, 15, 4, 7, 1, 7, 4, 7);
+    u32 attributes[32];
+    shade_attributes(&attributes[0]);
+    texture_attributes(&attributes[16], 24);
+    triangle(CMD_SHADE_TEXTURE_TRIANGLE, 20, 220, 220, 30, 0.2, 30, 1.2, 270, -0.3, attributes, 32);
+}
+
+static void draw_rectangle() {
+    begin_scene();
+    state_command(CMD_SET_OTHER_MODES << 24, 0);
+    state_command(CMD_SET_PRIM_COLOR << 24, 0x10203040);
+    set_combine_passthrough(3);
+    command2(CMD_FILL_RECTANGLE << 24 | (40 * 4) << 12 | 40 * 4, (30 * 4) << 12 | 30 * 4);
+    command2(CMD_FILL_RECTANGLE << 24 | (317 * 4 + 2) << 12 | 201 * 4, (101 * 4 + 1) << 12 | 77 * 4);
+}
+
+// Copy mode blits of a 64x32 texture at assorted x and s offsets
+static void draw_copy() {
+    begin_scene();
+    for (int i = 0; i < 64 * 32; i++) {
+        u16 texel = (u16)(i * 2654435761u >> 7);
+        memcpy(&rdram[HALF_ADDRESS(TEXTURE_ADDRESS + i * 2)], &texel, sizeof(u16));
+    }
+    state_command(CMD_SET_TEXTURE_IMAGE << 24 | 2 << 19 | 63, TEXTURE_ADDRESS);
+    state_command(CMD_SET_TILE << 24 | 2 << 19 | 16 << 9, 1 << 24);
+    command2(CMD_LOAD_TILE << 24, 1 << 24 | (63 * 4) << 12 | 31 * 4);
+    state_command(CMD_SET_OTHER_MODES << 24 | CYCLE_COPY, 0);
+    for (u32 k = 0; k < 12; k++) {
+        u32 xh = 3 + k * 23, yh = 100 + (k % 3) * 41, s = k % 5, t = k % 2;
+        u32 xl = xh + 10 + k * 4, yl = yh + 30;
+        u32 words[4] = { CMD_TEXTURE_RECTANGLE << 24 | (xl * 4) << 12 | yl * 4, 1 << 24 | (xh * 4) << 12 | yh * 4,
+                         (s * 32) << 16 | t * 32, 0x1000 << 16 | 0x400 };
+        command(words, 4);
+    }
+}
+
+// Draws into one color image, then textures from it while drawing into another, then goes back to the first
+static void draw_resolve() {
+    draw_shade();
+    fill_screen(SECOND_IMAGE_ADDRESS, 0x00400040);
+    state_command(CMD_SET_OTHER_MODES << 24, 0);
+    set_combine_passthrough(1);
+    state_command(CMD_SET_TEXTURE_IMAGE << 24 | 2 << 19 | (SCREEN_WIDTH - 1), COLOR_IMAGE_ADDRESS);
+    state_command(CMD_SET_TILE << 24 | 2 << 19 | 4 << 9, 7 << 24);
+    command2(CMD_LOAD_TILE << 24 | (30 * 4) << 12 | 120 * 4, 7 << 24 | (45 * 4) << 12 | 135 * 4);
+    state_command(CMD_SET_TILE << 24 | 2 << 19 | 4 << 9, 4 << 14 | 4 << 4);
+    state_command(CMD_SET_TILE_SIZE << 24, (15 * 4) << 12 | 15 * 4);
+    u32 attributes[16];
+    texture_attributes(attributes, 32);
+    triangle(CMD_TEXTURE_TRIANGLE, 20, 52, 52, 250, 0, 282, 0, 282, 0, attributes, 16);
+
+    state_command(CMD_SET_COLOR_IMAGE << 24 | 2 << 19 | (SCREEN_WIDTH - 1), COLOR_IMAGE_ADDRESS);
+    state_command(CMD_SET_TEXTURE_IMAGE << 24 | 2 << 19 | (SCREEN_WIDTH - 1), SECOND_IMAGE_ADDRESS);
+    command2(CMD_LOAD_TILE << 24 | (250 * 4) << 12 | 20 * 4, 7 << 24 | (265 * 4) << 12 | 35 * 4);
+    triangle(CMD_TEXTURE_TRIANGLE, 180, 230, 230, 10, 0, 60, 0, 60, 0, attributes, 16);
+}
+
+// One of a set of overlapping triangles at assorted depths
+static void depth_triangle(int k, double red) {
+    u32 attributes[20];
+    const double value[4] = { red, 255 - 40 * k, 128, 255 };
+    const double dx[4] = { 0.3, 0, 0, 0 };
+    const double de[4] = { 0, 0.5, 0, 0 };
+    put_attributes(attributes, value, dx, de);
+    attributes[16] = s15_16(k % 2 ? 300 + k * 700 : 30000 - k * 2000);
+    attributes[17] = s15_16(k * 37.5);
+    attributes[18] = s15_16(k * 11.25 - 20);
+    attributes[19] = s15_16(3.5);
+    triangle(CMD_SHADE_ZBUFFER_TRIANGLE, 30 + k * 17, 170 + k * 9, 170 + k * 9, 15 + k * 31, 0.2, 15 + k * 31, 1.1, 140 + k * 27, 0, attributes, 20);
+}
+
+// The overlapping triangles, then the same ones again and one at the primitive's depth across all of them, both in
+// z_mode
+static void draw_depth(u32 z_mode) {
+    begin_scene();
+    fill_screen(DEPTH_IMAGE_ADDRESS, 0xFFFCFFFC);
+    state_command(CMD_SET_COLOR_IMAGE << 24 | 2 << 19 | (SCREEN_WIDTH - 1), COLOR_IMAGE_ADDRESS);
+    state_command(CMD_SET_Z_IMAGE << 24, DEPTH_IMAGE_ADDRESS);
+    state_command(CMD_SET_OTHER_MODES << 24, Z_MODE_OPAQUE | Z_UPDATE | Z_COMPARE);
+    set_combine_passthrough(4);
+    for (int k = 0; k < 6; k++) {
+        depth_triangle(k, 40 * k);
+    }
+    state_command(CMD_SET_OTHER_MODES << 24, z_mode | Z_UPDATE | Z_COMPARE);
+    for (int k = 1; k < 6; k += 2) {
+        depth_triangle(k, 255);
+    }
+    state_command(CMD_SET_PRIM_DEPTH << 24, 5000 << 16 | 24);
+    state_command(CMD_SET_OTHER_MODES << 24, z_mode | Z_UPDATE | Z_COMPARE | Z_SOURCE_PRIM);
+    u32 attributes[16];
+    const double value[4] = { 0, 0, 255, 255 };
+    const double zero[4] = { 0, 0, 0, 0 };
+    put_attributes(attributes, value, zero, zero);
+    triangle(CMD_SHADE_TRIANGLE, 100, 200, 200, 3, 0, 3, 0.5, 317, 0, attributes, 16);
+}
+
+static void draw_depth_opaque() {
+    draw_depth(Z_MODE_OPAQUE);
+}
+
+static void draw_depth_decal() {
+    draw_depth(Z_MODE_DECAL);
+}
+
+// The shade scene again with every state command repeated, which has to draw the same thing
+static void draw_redundant() {
+    redundant = true;
+    redundant_commands = 0;
+    draw_shade();
+    redundant = false;
+    if (rdp.commands_dropped != redundant_commands) {
+        logfatal("Expected %lu redundant commands to be dropped, but %lu were", redundant_commands, rdp.commands_dropped);
+    }
+}
+
+static scene_t scenes[] = {
+        { "fill",           draw_fill,          0xFDE203DC },
+        { "shade",          draw_shade,         0x0C5759B3 },
+        { "texture",        draw_texture,       0x09AAC209 },
+        { "shade texture",  draw_shade_texture, 0xD03E8B0A },
+        { "rectangle",      draw_rectangle,     0x7943B1E6 },
+        { "copy",           draw_copy,          0xCD1561F3 },
+        { "resolve",        draw_resolve,       0x0E4BE689 },
+        { "opaque depth",   draw_depth_opaque,  0xFA0E1CAD },
+        { "decal depth",    draw_depth_decal,   0x4D9556E2 },
+        { "redundant",      draw_redundant,     0x0C5759B3 },
+};
+
+static const int worker_counts[] = { 0, 1, 3 };
+
+#define NUM_SCENES ((int)(sizeof(scenes) / sizeof(scenes[0])))
+#define NUM_WORKER_COUNTS ((int)(sizeof(worker_counts) / sizeof(worker_counts[0])))
+
+int main(int argc, char** argv) {
+    rdram = malloc(N64_RDRAM_SIZE);
+    if (rdram == NULL) {
+        logfatal("Failed to allocate RDRAM");
+    }
+
+    for (int level = SIMD_LEVEL_SCALAR; level <= (int)simd_host_level(); level++) {
+        simd_request_level(simd_level_name(level));
+        simd_init();
+        for (int w = 0; w < NUM_WORKER_COUNTS; w++) {
+            for (int s = 0; s < NUM_SCENES; s++) {
+                memset(rdram, 0, N64_RDRAM_SIZE);
+                softrdp_init(&rdp, rdram);
+                softrdp_start_workers(&rdp, worker_counts[w]);
+                scenes[s].draw();
+                softrdp_flush(&rdp);
+                softrdp_stop_workers(&rdp);
+
+                u32 crc = crc32(0, &rdram[CHECKED_START], CHECKED_END - CHECKED_START);
+                if (crc != scenes[s].crc) {
+                    logfatal("The %s scene drew CRC %08X with %s kernels and %d workers, expected %08X",
+                             scenes[s].name, crc, simd_level_name(simd_level), worker_counts[w], scenes[s].crc);
+                }
+            }
+        }
+    }
+    free(rdram);
+    printf("Passed!\n");
+}
@@ -0,0 +1,121 @@
+// The software RDP's depth test is all statics, so it's built in here to be tested directly
+#include <rdp/softrdp.cpp>
+
+#define ASSERT_INT_EQUALS(message, expected, actual) do { if ((expected) != (actual)) { logfatal("assert failed! [%s] expected %d != actual %d", message, (int)(expected), (int)(actual)); } } while(0)
+
+static uint32_t seed = 12345;
+
+static uint32_t random_u32() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Every depth each exponent can hold comes back out as it went in, with its exponent, mantissa and dz where they belong
+static void test_compression() {
+    for (int exponent = 0; exponent < 8; exponent++) {
+        for (uint32_t mantissa = 0; mantissa < 0x800; mantissa++) {
+            const uint32_t z = z_base_table[exponent] + (mantissa << z_shift_table[exponent]);
+            if (z > Z_MAX) {
+                break;
+            }
+            for (uint8_t dz = 0; dz < 16; dz++) {
+                const uint16_t memory = z_compress(z, dz);
+                ASSERT_INT_EQUALS("exponent", exponent, memory >> 13);
+                ASSERT_INT_EQUALS("mantissa", mantissa, (memory >> 2) & 0x7FF);
+                ASSERT_INT_EQUALS("dz", dz >> 2, memory & 3);
+                ASSERT_INT_EQUALS("round trip", z, z_decompress(memory));
+            }
+            // Anything between two steps of the mantissa goes to the one below it
+            const uint32_t between = z + (1 << z_shift_table[exponent]) - 1;
+            if (between <= Z_MAX) {
+                ASSERT_INT_EQUALS("rounded down", z, z_decompress(z_compress(between, 0)));
+            }
+        }
+    }
+    ASSERT_INT_EQUALS("largest depth", Z_MAX, z_decompress(z_compress(Z_MAX, 0)));
+}
+
+static void test_compare() {
+    const uint16_t memory = z_compress(0x20000, 0);
+    const uint16_t empty = z_compress(Z_MAX, 0);
+
+    // Without coverage, opaque, interpenetrating and transparent all pass what's in front and nothing else
+    for (uint8_t z_mode = 0; z_mode < Z_MODE_DECAL; z_mode++) {
+        ASSERT_INT_EQUALS("in front", true, depth_compare(z_mode, 0x1FFFF, 0, memory));
+        ASSERT_INT_EQUALS("equal", false, depth_compare(z_mode, 0x20000, 0, memory));
+        ASSERT_INT_EQUALS("behind", false, depth_compare(z_mode, 0x20020, 0, memory));
+        ASSERT_INT_EQUALS("empty Z buffer", true, depth_compare(z_mode, Z_MAX, 0, empty));
+    }
+
+    // Decal passes within eight times the wider dz, the pixel's or the Z buffer's, on either side
+    ASSERT_INT_EQUALS("decal equal", true, depth_compare(Z_MODE_DECAL, 0x20000, 0, memory));
+    ASSERT_INT_EQUALS("decal in front, in range", true, depth_compare(Z_MODE_DECAL, 0x20000 - 8, 0, memory));
+    ASSERT_INT_EQUALS("decal in front, out of range", false, depth_compare(Z_MODE_DECAL, 0x20000 - 9, 0, memory));
+    ASSERT_INT_EQUALS("decal behind, in range", true, depth_compare(Z_MODE_DECAL, 0x20000 + 8, 0, memory));
+    ASSERT_INT_EQUALS("decal behind, out of range", false, depth_compare(Z_MODE_DECAL, 0x20000 + 9, 0, memory));
+    ASSERT_INT_EQUALS("decal with the pixel's dz", true, depth_compare(Z_MODE_DECAL, 0x20000 + 32, 2, memory));
+    ASSERT_INT_EQUALS("decal with the Z buffer's dz", true, depth_compare(Z_MODE_DECAL, 0x20000 + 128, 0, z_compress(0x20000, 4)));
+    ASSERT_INT_EQUALS("decal with the Z buffer's dz, out of range", false, depth_compare(Z_MODE_DECAL, 0x20000 + 129, 0, z_compress(0x20000, 4)));
+    ASSERT_INT_EQUALS("decal on an empty Z buffer", false, depth_compare(Z_MODE_DECAL, Z_MAX, 15, empty));
+}
+
+// Runs every kernel the host has on the same random chunks, and checks they all agree with the scalar ones
+static void test_kernels() {
+    static softrdp_state_t rdp;
+    static span_buffer_t expected;
+    static span_buffer_t actual;
+    primitive_t prim;
+    memset(&prim, 0, sizeof(prim));
+
+    for (int round = 0; round < 4096; round++) {
+        rdp.other_modes.z_mode = round & 3;
+        rdp.other_modes.z_compare_en = (round & 4) != 0;
+        rdp.other_modes.z_source_sel = (round & 8) != 0;
+        rdp.primitive_z = random_u32();
+        prim.dz = random_u32() % 16;
+
+        uint16_t memory[SPAN_CHUNK];
+        for (int i = 0; i < SPAN_CHUNK; i++) {
+            // Mostly near the same depth, so the decal range matters, with the ends of the range mixed in
+            const uint32_t r = random_u32();
+            expected.z[i] = (int32_t)((0x1F000 + (r & 0x3FFF)) << 13);
+            memory[i] = z_compress(0x1F000 + (random_u32() & 0x3FFF), random_u32() % 16);
+            if ((r >> 16) % 16 == 0) {
+                expected.z[i] = (int32_t)(random_u32() << 8);
+            }
+            if ((r >> 20) % 16 == 0) {
+                memory[i] = z_compress(Z_MAX, 0);
+            }
+        }
+        memcpy(actual.z, expected.z, sizeof(expected.z));
+
+        depth_test_scalar(&rdp, &prim, memory, SPAN_CHUNK, &expected);
+#ifdef N64_USE_SIMD
+        if (simd_host_level() >= SIMD_LEVEL_AVX2) {
+            depth_test_avx2(&rdp, &prim, memory, SPAN_CHUNK, &actual);
+            for (int i = 0; i < SPAN_CHUNK; i++) {
+                ASSERT_INT_EQUALS("AVX2 depth test mask", expected.draw[i], actual.draw[i]);
+                ASSERT_INT_EQUALS("AVX2 depth test depth", expected.depth[i], actual.depth[i]);
+            }
+        }
+        if (simd_host_level() >= SIMD_LEVEL_SSE41) {
+            uint16_t expected_memory[SPAN_CHUNK];
+            uint16_t actual_memory[SPAN_CHUNK];
+            memcpy(expected_memory, memory, sizeof(memory));
+            memcpy(actual_memory, memory, sizeof(memory));
+            depth_update_scalar(&expected, SPAN_CHUNK, expected_memory);
+            depth_update_sse(&expected, SPAN_CHUNK, actual_memory);
+            for (int i = 0; i < SPAN_CHUNK; i++) {
+                ASSERT_INT_EQUALS("SSE4.1 depth update", expected_memory[i], actual_memory[i]);
+            }
+        }
+#endif
+    }
+}
+
+int main(int argc, char** argv) {
+    test_compression();
+    test_compare();
+    test_kernels();
+    printf("Passed!\n");
+}
@@ -0,0 +1,131 @@
+#include <string.h>
+#include <system/n64system.h>
+#include <cpu/rsp.h>
+#include <cpu/rsp_vector_instructions.h>
+#include <simd.h>
+
+#define ROUNDS 100000
+
+typedef struct multiply_instruction {
+    const char* name;
+    rspinstr_handler_t simd;
+    rspinstr_handler_t scalar;
+} multiply_instruction_t;
+
+#define MULTIPLY_INSTRUCTION(NAME) { #NAME, NAME, NAME##_scalar }
+
+static const multiply_instruction_t instructions[] = {
+        MULTIPLY_INSTRUCTION(rsp_vec_vmacf),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmacu),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmadh),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmadl),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmadm),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmadn),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmudh),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmudl),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmudm),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmudn),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmulf),
+        MULTIPLY_INSTRUCTION(rsp_vec_vmulu),
+};
+
+static u32 seed = 12345;
+
+static u16 random_u16() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+// Mostly random, with the values the clamps and carries care about mixed in
+static u16 random_element() {
+    static const u16 edges[] = { 0x0000, 0x0001, 0x7FFF, 0x8000, 0x8001, 0xFFFF };
+    u16 r = random_u16();
+    if (r % 4 == 0) {
+        return edges[random_u16() % (sizeof(edges) / sizeof(edges[0]))];
+    }
+    return random_u16();
+}
+
+static void randomize(vu_reg_t* reg) {
+    for (int i = 0; i < 8; i++) {
+        reg->elements[i] = random_element();
+    }
+}
+
+static bool compare(const char* instruction, const char* what, const vu_reg_t* expected, const vu_reg_t* actual) {
+    if (memcmp(expected->elements, actual->elements, sizeof(expected->elements)) == 0) {
+        return false;
+    }
+    printf(COLOR_RED "[FAILED] %s %s\n" COLOR_END, instruction, what);
+    printf("Expected: ");
+    for (int i = 0; i < 8; i++) {
+        printf("%04X ", expected->elements[i]);
+    }
+    printf("\nActual:   ");
+    for (int i = 0; i < 8; i++) {
+        printf("%04X ", actual->elements[i]);
+    }
+    printf("\n");
+    return true;
+}
+
+// Runs the SIMD multiply-accumulate kernels and the per-lane ones on the same random registers, accumulators and
+// element selections, and checks they leave the same vd and accumulator behind.
+int main(int argc, char** argv) {
+    init_n64system(NULL, false, false, UNKNOWN_VIDEO_TYPE, false);
+
+    if (simd_host_level() < SIMD_LEVEL_SSE41) {
+        printf("SSE4.1 isn't available, nothing to compare against the scalar kernels\n");
+        return 0;
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < sizeof(instructions) / sizeof(instructions[0]) && !failed; i++) {
+        const multiply_instruction_t* instruction = &instructions[i];
+        for (int round = 0; round < ROUNDS && !failed; round++) {
+            mips_instruction_t instr;
+            instr.raw = 0;
+            instr.cp2_vec.vs = 1;
+            // vd the same as vt every so often, since the kernels read vte before writing vd
+            instr.cp2_vec.vt = 2;
+            instr.cp2_vec.vd = round % 8 == 0 ? 2 : 3;
+            instr.cp2_vec.e  = random_u16() % 16;
+
+            vu_reg_t vs, vt, acc_h, acc_m, acc_l;
+            randomize(&vs);
+            randomize(&vt);
+            randomize(&acc_h);
+            randomize(&acc_m);
+            randomize(&acc_l);
+
+            vu_reg_t expected[4];
+            N64RSP.vu_regs[1] = vs;
+            N64RSP.vu_regs[2] = vt;
+            N64RSP.acc.h = acc_h;
+            N64RSP.acc.m = acc_m;
+            N64RSP.acc.l = acc_l;
+            instruction->scalar(instr);
+            expected[0] = N64RSP.vu_regs[instr.cp2_vec.vd];
+            expected[1] = N64RSP.acc.h;
+            expected[2] = N64RSP.acc.m;
+            expected[3] = N64RSP.acc.l;
+
+            N64RSP.vu_regs[1] = vs;
+            N64RSP.vu_regs[2] = vt;
+            N64RSP.acc.h = acc_h;
+            N64RSP.acc.m = acc_m;
+            N64RSP.acc.l = acc_l;
+            instruction->simd(instr);
+
+            failed |= compare(instruction->name, "vd", &expected[0], &N64RSP.vu_regs[instr.cp2_vec.vd]);
+            failed |= compare(instruction->name, "acc.h", &expected[1], &N64RSP.acc.h);
+            failed |= compare(instruction->name, "acc.m", &expected[2], &N64RSP.acc.m);
+            failed |= compare(instruction->name, "acc.l", &expected[3], &N64RSP.acc.l);
+        }
+    }
+
+    if (failed) {
+        logfatal("Tests failed!");
+    }
+    printf("Passed!\n");
+}